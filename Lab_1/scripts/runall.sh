@@ -10,14 +10,12 @@
 
 ########## ---------------  Lab1 ---------------- ################
 
-../src/sim ../traces/bzip2.otr.gz > ../results/Lab1.bzip2.res 
-../src/sim ../traces/gcc.otr.gz > ../results/Lab1.gcc.res 
-../src/sim ../traces/libq.otr.gz > ../results/Lab1.libq.res 
-../src/sim ../traces/mcf.otr.gz > ../results/Lab1.mcf.res
-
-######### ------- Generate Report -------- ##################
-
-./genreport.ecelinsrv7 > report.txt
+# The report tool runs sim on all four traces at once, keeps each one's output
+# in ../results/Lab1.<trace>.res, and builds the report from them as
+# genreport.ecelinsrv7 does
+mkdir -p ../results
+../src/report -results ../results -o report.txt -json report.json \
+    ../traces/libq.otr.gz ../traces/bzip2.otr.gz ../traces/mcf.otr.gz ../traces/gcc.otr.gz
 
 ######### ------- Goodbye -------- ##################
 
@@ -0,0 +1,502 @@
+// bbv.cpp
+// Implements basic block vectors and the choice of simpoints from them.
+
+#include "bbv.h"
+#include <algorithm>
+#include <atomic>
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+/**
+ * [Internal] The state of one k-means clustering.
+ */
+typedef struct KMeansStruct
+{
+    /** The number of clusters. */
+    int k;
+    /** The centroid of each cluster, BBV_DIMS values apiece. */
+    std::vector<double> centers;
+    /** The cluster of each interval. */
+    std::vector<int> assign;
+    /** The sum of the squared distances of the intervals to their centroids. */
+    double sse;
+} KMeans;
+
+/** [Internal] What one chunk of intervals adds to the next centroids. */
+typedef struct LloydPartialStruct
+{
+    /** The sum of the vectors in each cluster. */
+    std::vector<double> sums;
+    /** The number of intervals in each cluster. */
+    std::vector<uint64_t> counts;
+    /** The sum of the squared distances to the nearest centroids. */
+    double sse;
+    /** Whether any interval changed cluster. */
+    bool changed;
+} LloydPartial;
+
+/** [Internal] One Lloyd step, shared by the threads running it. */
+typedef struct LloydStepStruct
+{
+    /** The intervals' vectors. */
+    const double *points;
+    /** The number of intervals. */
+    size_t n;
+    /** The clustering being improved. */
+    KMeans *km;
+    /** What each chunk of BBV_CHUNK_POINTS intervals adds. */
+    std::vector<LloydPartial> partials;
+    /** The next chunk to take. */
+    std::atomic<size_t> next_chunk;
+} LloydStep;
+
+/**
+ * [Internal] Mix the bits of a number, as the last step of splitmix64.
+ *
+ * @param x the number
+ * @return the mixed bits
+ */
+static inline uint64_t bbv_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * [Internal] Get a random number, advancing a splitmix64 state.
+ *
+ * @param state the state
+ * @return a number from 0 up to but not including 1
+ */
+static inline double bbv_random(uint64_t *state)
+{
+    *state += 0x9e3779b97f4a7c15ull;
+    return (double)(bbv_mix(*state) >> 11) / (double)(1ull << 53);
+}
+
+/**
+ * [Internal] Get the squared distance between two vectors.
+ *
+ * @param a one vector of BBV_DIMS values
+ * @param b the other
+ * @return the squared distance
+ */
+static inline double bbv_dist2(const double *a, const double *b)
+{
+    double sum = 0;
+    for (int j = 0; j < BBV_DIMS; j++)
+    {
+        double d = a[j] - b[j];
+        sum += d * d;
+    }
+    return sum;
+}
+
+/**
+ * Make basic block vectors empty.
+ *
+ * @param b the vectors
+ * @param interval the number of instructions in each interval
+ */
+void bbv_init(Bbv *b, uint64_t interval)
+{
+    b->interval = interval;
+    b->num_blocks = 0;
+    b->vectors.clear();
+    b->lengths.clear();
+    b->block_pc = UINT64_MAX;
+    b->block_len = 0;
+    b->interval_len = 0;
+    memset(b->current, 0, sizeof(b->current));
+    b->block_index.clear();
+    b->directions.clear();
+}
+
+/**
+ * [Internal] End the current interval, normalizing its vector.
+ *
+ * @param b the vectors
+ */
+static void bbv_end_interval(Bbv *b)
+{
+    for (int j = 0; j < BBV_DIMS; j++)
+    {
+        b->vectors.push_back(b->current[j] / (double)b->interval_len);
+    }
+    b->lengths.push_back(b->interval_len);
+    memset(b->current, 0, sizeof(b->current));
+    b->interval_len = 0;
+}
+
+/**
+ * [Internal] Add the instructions of the current basic block in the current
+ * interval to its vector, and end the interval if it is full.
+ *
+ * @param b the vectors
+ */
+void bbv_flush(Bbv *b)
+{
+    if (b->block_len > 0)
+    {
+        // A block's direction is drawn from a hash of its address the first
+        // time it is seen, uniformly from -1 to 1 in each dimension.
+        std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> found =
+            b->block_index.insert(std::make_pair(b->block_pc,
+                                                 (uint32_t)b->num_blocks));
+        if (found.second)
+        {
+            uint64_t state = b->block_pc;
+            for (int j = 0; j < BBV_DIMS; j++)
+            {
+                b->directions.push_back((float)(2 * bbv_random(&state) - 1));
+            }
+            b->num_blocks++;
+        }
+
+        const float *direction = &b->directions[found.first->second * BBV_DIMS];
+        for (int j = 0; j < BBV_DIMS; j++)
+        {
+            b->current[j] += (double)b->block_len * direction[j];
+        }
+        b->block_len = 0;
+    }
+
+    if (b->interval_len == b->interval)
+    {
+        bbv_end_interval(b);
+    }
+}
+
+/**
+ * End the last interval, however short.
+ *
+ * @param b the vectors
+ */
+void bbv_finish(Bbv *b)
+{
+    bbv_flush(b);
+    if (b->interval_len > 0)
+    {
+        bbv_end_interval(b);
+    }
+}
+
+/**
+ * [Internal] Assign chunks of intervals to their nearest centroids until
+ * there are none left, the body of each thread of bbv_lloyd_step().
+ *
+ * @param step the step
+ */
+static void bbv_lloyd_chunks(LloydStep *step)
+{
+    KMeans *km = step->km;
+    size_t c;
+    while ((c = step->next_chunk++) < step->partials.size())
+    {
+        LloydPartial *partial = &step->partials[c];
+        partial->sums.assign(km->k * BBV_DIMS, 0);
+        partial->counts.assign(km->k, 0);
+        partial->sse = 0;
+        partial->changed = false;
+
+        size_t end = std::min(step->n, (c + 1) * BBV_CHUNK_POINTS);
+        for (size_t i = c * BBV_CHUNK_POINTS; i < end; i++)
+        {
+            const double *point = &step->points[i * BBV_DIMS];
+            int best = 0;
+            double best_dist = bbv_dist2(point, &km->centers[0]);
+            for (int cluster = 1; cluster < km->k; cluster++)
+            {
+                double dist = bbv_dist2(point, &km->centers[cluster * BBV_DIMS]);
+                if (dist < best_dist)
+                {
+                    best = cluster;
+                    best_dist = dist;
+                }
+            }
+
+            partial->changed |= km->assign[i] != best;
+            km->assign[i] = best;
+            partial->counts[best]++;
+            partial->sse += best_dist;
+            for (int j = 0; j < BBV_DIMS; j++)
+            {
+                partial->sums[best * BBV_DIMS + j] += point[j];
+            }
+        }
+    }
+}
+
+/**
+ * [Internal] Run one Lloyd iteration: assign each interval to its nearest
+ * centroid, then move each centroid to the mean of its intervals.
+ *
+ * The intervals are assigned in chunks of BBV_CHUNK_POINTS, on up to
+ * num_threads threads, and the chunks' sums added up in order, so the result
+ * doesn't depend on the number of threads.
+ *
+ * @param points the intervals' vectors
+ * @param n the number of intervals
+ * @param km the clustering; sse is set to that of the assignment
+ * @param num_threads the number of threads to run on
+ * @return whether any interval changed cluster
+ */
+static bool bbv_lloyd_step(const double *points, size_t n, KMeans *km,
+                           unsigned int num_threads)
+{
+    LloydStep step;
+    step.points = points;
+    step.n = n;
+    step.km = km;
+    step.partials.resize((n + BBV_CHUNK_POINTS - 1) / BBV_CHUNK_POINTS);
+    step.next_chunk = 0;
+
+    size_t threads = std::min((size_t)num_threads, step.partials.size());
+    if (threads <= 1)
+    {
+        bbv_lloyd_chunks(&step);
+    }
+    else
+    {
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.push_back(std::thread(bbv_lloyd_chunks, &step));
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    std::vector<double> sums(km->k * BBV_DIMS, 0);
+    std::vector<uint64_t> counts(km->k, 0);
+    bool changed = false;
+    km->sse = 0;
+    for (const LloydPartial &partial : step.partials)
+    {
+        for (size_t j = 0; j < sums.size(); j++)
+        {
+            sums[j] += partial.sums[j];
+        }
+        for (int cluster = 0; cluster < km->k; cluster++)
+        {
+            counts[cluster] += partial.counts[cluster];
+        }
+        km->sse += partial.sse;
+        changed |= partial.changed;
+    }
+
+    // A cluster left empty keeps its centroid.
+    for (int cluster = 0; cluster < km->k; cluster++)
+    {
+        if (counts[cluster] == 0)
+        {
+            continue;
+        }
+        for (int j = 0; j < BBV_DIMS; j++)
+        {
+            km->centers[cluster * BBV_DIMS + j] =
+                sums[cluster * BBV_DIMS + j] / (double)counts[cluster];
+        }
+    }
+    return changed;
+}
+
+/**
+ * [Internal] Cluster intervals by k-means, starting from centroids picked by
+ * k-means++.
+ *
+ * @param points the intervals' vectors
+ * @param n the number of intervals, at least k
+ * @param k the number of clusters
+ * @param seed the seed of the random choice of starting centroids
+ * @param num_threads the number of threads to run on
+ * @param km set to the clustering
+ */
+static void bbv_kmeans(const double *points, size_t n, int k, uint64_t seed,
+                       unsigned int num_threads, KMeans *km)
+{
+    km->k = k;
+    km->centers.clear();
+    km->assign.assign(n, -1);
+
+    // Each centroid after the first is an interval picked with probability
+    // proportional to its squared distance from the nearest one so far.
+    uint64_t state = seed;
+    size_t first = std::min((size_t)(bbv_random(&state) * n), n - 1);
+    km->centers.insert(km->centers.end(), &points[first * BBV_DIMS],
+                       &points[(first + 1) * BBV_DIMS]);
+    std::vector<double> nearest(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        nearest[i] = bbv_dist2(&points[i * BBV_DIMS], &km->centers[0]);
+    }
+    for (int cluster = 1; cluster < k; cluster++)
+    {
+        double total = 0;
+        for (double dist : nearest)
+        {
+            total += dist;
+        }
+        double target = bbv_random(&state) * total;
+        size_t pick = 0;
+        while (pick + 1 < n && (target -= nearest[pick]) >= 0)
+        {
+            pick++;
+        }
+
+        const double *center = &points[pick * BBV_DIMS];
+        km->centers.insert(km->centers.end(), center, center + BBV_DIMS);
+        for (size_t i = 0; i < n; i++)
+        {
+            nearest[i] = std::min(nearest[i],
+                                  bbv_dist2(&points[i * BBV_DIMS], center));
+        }
+    }
+
+    for (int iter = 0; iter < BBV_MAX_ITERS; iter++)
+    {
+        if (!bbv_lloyd_step(points, n, km, num_threads))
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * [Internal] Score a clustering by the Bayesian Information Criterion, as
+ * X-means does (Pelleg and Moore, "X-means: Extending K-means with Efficient
+ * Estimation of the Number of Clusters"): the log-likelihood of the
+ * intervals under spherical Gaussians at the centroids, less a penalty for
+ * the number of parameters.
+ *
+ * @param km the clustering
+ * @param n the number of intervals
+ * @return the score; higher is better
+ */
+static double bbv_bic(const KMeans *km, size_t n)
+{
+    std::vector<uint64_t> counts(km->k, 0);
+    for (int cluster : km->assign)
+    {
+        counts[cluster]++;
+    }
+
+    double r = (double)n;
+    double variance = n > (size_t)km->k ? km->sse / (r - km->k) : 0;
+    variance = std::max(variance, 1e-12);
+    double likelihood = 0;
+    for (uint64_t count : counts)
+    {
+        if (count == 0)
+        {
+            continue;
+        }
+        double rn = (double)count;
+        likelihood += -rn / 2 * log(2 * M_PI) -
+                      rn * BBV_DIMS / 2 * log(variance) - (rn - km->k) / 2 +
+                      rn * log(rn) - rn * log(r);
+    }
+    double params = (km->k - 1) + BBV_DIMS * km->k + 1;
+    return likelihood - params / 2 * log(r);
+}
+
+/**
+ * Cluster the intervals and pick a simpoint from each cluster.
+ *
+ * @param b the finished vectors
+ * @param first_rec the index in the trace of the first interval's first
+ *                  record
+ * @param max_k the largest number of clusters to try
+ * @param num_threads the number of threads to run k-means on
+ * @param sp set to the simpoints
+ * @param bics set to the BIC of the best clustering for each k from 1
+ */
+void bbv_pick_simpoints(const Bbv *b, uint64_t first_rec, int max_k,
+                        unsigned int num_threads, SimPoints *sp,
+                        std::vector<double> *bics)
+{
+    size_t n = b->lengths.size();
+    sp->interval = b->interval;
+    sp->num_insts = 0;
+    sp->points.clear();
+    bics->clear();
+    for (uint64_t length : b->lengths)
+    {
+        sp->num_insts += length;
+    }
+    if (n == 0)
+    {
+        return;
+    }
+
+    // Keep the best of several runs for each k.
+    max_k = (int)std::min((size_t)max_k, n);
+    std::vector<KMeans> best(max_k);
+    for (int k = 1; k <= max_k; k++)
+    {
+        KMeans *kept = &best[k - 1];
+        for (int s = 0; s < BBV_NUM_SEEDS; s++)
+        {
+            KMeans km;
+            bbv_kmeans(b->vectors.data(), n, k,
+                       (uint64_t)k * BBV_NUM_SEEDS + s, num_threads, &km);
+            if (s == 0 || km.sse < kept->sse)
+            {
+                *kept = km;
+            }
+        }
+        bics->push_back(bbv_bic(kept, n));
+    }
+
+    // Take the fewest clusters scoring most of the way to the best.
+    double lo = *std::min_element(bics->begin(), bics->end());
+    double hi = *std::max_element(bics->begin(), bics->end());
+    int k = 1;
+    while (k < max_k && (*bics)[k - 1] < lo + BBV_BIC_THRESHOLD * (hi - lo))
+    {
+        k++;
+    }
+    const KMeans *km = &best[k - 1];
+
+    // Each cluster is stood for by its interval nearest the centroid.
+    std::vector<size_t> nearest(k, n);
+    std::vector<double> nearest_dist(k, 0);
+    std::vector<uint64_t> insts(k, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        int cluster = km->assign[i];
+        double dist = bbv_dist2(&b->vectors[i * BBV_DIMS],
+                                &km->centers[cluster * BBV_DIMS]);
+        if (nearest[cluster] == n || dist < nearest_dist[cluster])
+        {
+            nearest[cluster] = i;
+            nearest_dist[cluster] = dist;
+        }
+        insts[cluster] += b->lengths[i];
+    }
+    for (int cluster = 0; cluster < k; cluster++)
+    {
+        if (nearest[cluster] == n)
+        {
+            continue;
+        }
+        SimPoint point;
+        point.start = first_rec + nearest[cluster] * b->interval;
+        point.length = b->lengths[nearest[cluster]];
+        point.weight = (double)insts[cluster] / (double)sp->num_insts;
+        point.cluster = 0;
+        sp->points.push_back(point);
+    }
+
+    std::sort(sp->points.begin(), sp->points.end(),
+              [](const SimPoint &x, const SimPoint &y)
+              { return x.start < y.start; });
+    for (size_t i = 0; i < sp->points.size(); i++)
+    {
+        sp->points[i].cluster = (uint32_t)i;
+    }
+}
@@ -0,0 +1,152 @@
+// bbv.h
+// Declares the collection of basic block vectors from a trace, and the
+// choice of simpoints from them by k-means clustering, after SimPoint
+// (Sherwood et al., "Automatically Characterizing Large Scale Program
+// Behavior").
+//
+// The trace is cut into intervals of a fixed number of instructions, and the
+// instruction stream into basic blocks, each ending at a conditional branch
+// and named by the address of its first instruction. An interval's basic
+// block vector counts the instructions it executed in each basic block,
+// divided by its length. Intervals with similar vectors run the same code in
+// the same proportions, and so tend to perform alike.
+//
+// Rather than keeping a count per block, each block is given a fixed random
+// direction in BBV_DIMS dimensions, and an interval's vector is the sum of
+// its blocks' directions times their instruction counts: a random projection,
+// which preserves distances between intervals well enough to cluster them,
+// in constant space per interval.
+//
+// The projected vectors are clustered by k-means for each k up to a limit,
+// and the smallest k scoring close to the best Bayesian Information
+// Criterion is kept. Each cluster's simpoint is the interval nearest its
+// centroid, weighted by the share of instructions in the cluster.
+
+#ifndef _BBV_H_
+#define _BBV_H_
+
+#include "simpoints.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+/** The number of dimensions basic block vectors are projected down to. */
+#define BBV_DIMS 15
+
+/** The default number of instructions in an interval. */
+#define BBV_DEFAULT_INTERVAL 100000
+
+/** The default largest number of clusters tried. */
+#define BBV_DEFAULT_MAX_K 10
+
+/** The most clusters that may be tried. */
+#define BBV_MAX_K 100
+
+/** The number of k-means runs from different starting centroids per k. */
+#define BBV_NUM_SEEDS 5
+
+/** The most Lloyd iterations a k-means run takes. */
+#define BBV_MAX_ITERS 100
+
+/**
+ * The fraction of the way from the worst to the best BIC that the chosen
+ * number of clusters must score.
+ */
+#define BBV_BIC_THRESHOLD 0.9
+
+/** The number of intervals a thread assigns at a time in a Lloyd step. */
+#define BBV_CHUNK_POINTS 256
+
+/** Projected basic block vectors of the intervals of a trace. */
+typedef struct BbvStruct
+{
+    /** The number of instructions in each interval but perhaps the last. */
+    uint64_t interval;
+    /** The number of distinct basic blocks seen. */
+    size_t num_blocks;
+    /** The normalized vector of each interval, BBV_DIMS values apiece. */
+    std::vector<double> vectors;
+    /** The number of instructions in each interval. */
+    std::vector<uint64_t> lengths;
+    /**
+     * [Internal] The address of the current block's first instruction, or
+     * UINT64_MAX between blocks.
+     */
+    uint64_t block_pc;
+    /** [Internal] The instructions of the current block in this interval. */
+    uint64_t block_len;
+    /** [Internal] The number of instructions in the current interval. */
+    uint64_t interval_len;
+    /** [Internal] The current interval's vector, not yet normalized. */
+    double current[BBV_DIMS];
+    /** [Internal] The index of each block's direction in directions. */
+    std::unordered_map<uint64_t, uint32_t> block_index;
+    /** [Internal] The random direction of each block. */
+    std::vector<float> directions;
+} Bbv;
+
+/**
+ * Make basic block vectors empty.
+ *
+ * @param b the vectors
+ * @param interval the number of instructions in each interval
+ */
+void bbv_init(Bbv *b, uint64_t interval);
+
+/**
+ * [Internal] Add the instructions of the current basic block in the current
+ * interval to its vector, and end the interval if it is full.
+ *
+ * @param b the vectors
+ */
+void bbv_flush(Bbv *b);
+
+/**
+ * Add an instruction to basic block vectors.
+ *
+ * @param b the vectors
+ * @param pc the address of the instruction
+ * @param is_branch whether it is a conditional branch, ending its block
+ */
+static inline void bbv_add(Bbv *b, uint64_t pc, bool is_branch)
+{
+    if (b->block_pc == UINT64_MAX)
+    {
+        b->block_pc = pc;
+    }
+    b->block_len++;
+    b->interval_len++;
+    if (is_branch || b->interval_len == b->interval)
+    {
+        bbv_flush(b);
+        if (is_branch)
+        {
+            b->block_pc = UINT64_MAX;
+        }
+    }
+}
+
+/**
+ * End the last interval, however short.
+ *
+ * @param b the vectors
+ */
+void bbv_finish(Bbv *b);
+
+/**
+ * Cluster the intervals and pick a simpoint from each cluster.
+ *
+ * @param b the finished vectors
+ * @param first_rec the index in the trace of the first interval's first
+ *                  record
+ * @param max_k the largest number of clusters to try
+ * @param num_threads the number of threads to run k-means on
+ * @param sp set to the simpoints
+ * @param bics set to the BIC of the best clustering for each k from 1
+ */
+void bbv_pick_simpoints(const Bbv *b, uint64_t first_rec, int max_k,
+                        unsigned int num_threads, SimPoints *sp,
+                        std::vector<double> *bics);
+
+#endif
@@ -0,0 +1,133 @@
+// codefootprint.cpp
+// Implements the exact count of the code a trace touches.
+
+#include "codefootprint.h"
+#include <algorithm>
+#include <string.h>
+
+/**
+ * Make a footprint empty.
+ *
+ * @param cf the footprint
+ */
+void code_footprint_init(CodeFootprint *cf)
+{
+    cf->num_inst = 0;
+    cf->num_lines = 0;
+    cf->num_pages = 0;
+    cf->huge_pages.clear();
+    cf->growth.clear();
+    cf->next_point = CODE_FOOTPRINT_FIRST_POINT;
+    cf->last_line = 0;
+    cf->last_huge_page = 0;
+    cf->last_huge_index = 0;
+    cf->huge_index.clear();
+}
+
+/**
+ * [Internal] Add an instruction in a line other than the last one's.
+ *
+ * @param cf the footprint
+ * @param pc the address of the instruction
+ */
+void code_footprint_touch(CodeFootprint *cf, uint64_t pc)
+{
+    // Code runs in a few huge pages, so the last one is usually the one.
+    uint64_t huge_page = pc >> CODE_HUGE_PAGE_BITS;
+    if (huge_page + 1 != cf->last_huge_page)
+    {
+        std::pair<std::unordered_map<uint64_t, size_t>::iterator, bool> found =
+            cf->huge_index.insert(
+                std::make_pair(huge_page, cf->huge_pages.size()));
+        if (found.second)
+        {
+            CodeHugePage empty;
+            memset(&empty, 0, sizeof(empty));
+            cf->huge_pages.push_back(empty);
+        }
+        cf->last_huge_page = huge_page + 1;
+        cf->last_huge_index = found.first->second;
+    }
+
+    CodeHugePage *hp = &cf->huge_pages[cf->last_huge_index];
+    uint64_t line = (pc & ((1ull << CODE_HUGE_PAGE_BITS) - 1)) >>
+                    CODE_LINE_BITS;
+    uint64_t line_bit = 1ull << (line & 63);
+    if ((hp->lines[line >> 6] & line_bit) != 0)
+    {
+        return;
+    }
+    hp->lines[line >> 6] |= line_bit;
+    cf->num_lines++;
+
+    // A page is new only if one of its lines is.
+    uint64_t page = line >> (CODE_PAGE_BITS - CODE_LINE_BITS);
+    uint64_t page_bit = 1ull << (page & 63);
+    if ((hp->pages[page >> 6] & page_bit) == 0)
+    {
+        hp->pages[page >> 6] |= page_bit;
+        cf->num_pages++;
+    }
+}
+
+/**
+ * [Internal] Note the footprint so far.
+ *
+ * @param cf the footprint
+ */
+static void code_footprint_note(CodeFootprint *cf)
+{
+    CodeFootprintPoint point;
+    point.num_inst = cf->num_inst;
+    point.num_lines = cf->num_lines;
+    point.num_pages = cf->num_pages;
+    point.num_huge_pages = cf->huge_pages.size();
+    cf->growth.push_back(point);
+}
+
+/**
+ * Add a block of records to a footprint.
+ *
+ * @param cf the footprint
+ * @param recs the records
+ * @param n the number of records
+ */
+void code_footprint_add(CodeFootprint *cf, const TraceRec *recs, size_t n)
+{
+    // Take the records up to each point at which the footprint is noted.
+    while (n > 0)
+    {
+        size_t m = (size_t)std::min((uint64_t)n, cf->next_point - cf->num_inst);
+        for (size_t i = 0; i < m; i++)
+        {
+            uint64_t line = recs[i].inst_addr >> CODE_LINE_BITS;
+            if (line + 1 != cf->last_line)
+            {
+                cf->last_line = line + 1;
+                code_footprint_touch(cf, recs[i].inst_addr);
+            }
+        }
+
+        cf->num_inst += m;
+        recs += m;
+        n -= m;
+        if (cf->num_inst == cf->next_point)
+        {
+            code_footprint_note(cf);
+            cf->next_point *= 2;
+        }
+    }
+}
+
+/**
+ * Note the footprint at the end of the trace, if it wasn't noted already.
+ *
+ * @param cf the footprint
+ */
+void code_footprint_finish(CodeFootprint *cf)
+{
+    if (cf->growth.empty() || cf->growth.back().num_inst != cf->num_inst)
+    {
+        code_footprint_note(cf);
+    }
+}
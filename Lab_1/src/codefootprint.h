@@ -0,0 +1,116 @@
+// codefootprint.h
+// Declares an exact count of the code a trace touches at three granularities
+// at once: 64-byte cache lines, 4KB pages and 2MB huge pages, which size the
+// I-cache, the ITLB and a huge-page ITLB. Unlike a FootprintSketch, which
+// estimates the first two in fixed memory, it also keeps how the footprint
+// grew over the trace.
+//
+// Each 2MB page touched gets a bitmap of its lines and one of its 4KB pages,
+// found through a hash table, so the whole footprint takes about 4KB per huge
+// page of code. A record costs one bit test, or nothing if it is in the same
+// line as the one before, as most are.
+//
+// The footprint so far is noted after every power of two instructions from
+// CODE_FOOTPRINT_FIRST_POINT, so the growth curve has a row per doubling
+// whatever the length of the trace.
+
+#ifndef _CODEFOOTPRINT_H_
+#define _CODEFOOTPRINT_H_
+
+#include "trace.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+/** The log2 of the size in bytes of a code line. */
+#define CODE_LINE_BITS 6
+
+/** The log2 of the size in bytes of a code page. */
+#define CODE_PAGE_BITS 12
+
+/** The log2 of the size in bytes of a code huge page. */
+#define CODE_HUGE_PAGE_BITS 21
+
+/** The number of instructions after which the footprint is first noted. */
+#define CODE_FOOTPRINT_FIRST_POINT 1024
+
+/** The lines and pages touched in one huge page. */
+typedef struct CodeHugePageStruct
+{
+    /** A bit for each line, set once touched. */
+    uint64_t lines[1 << (CODE_HUGE_PAGE_BITS - CODE_LINE_BITS - 6)];
+    /** A bit for each page, set once touched. */
+    uint64_t pages[1 << (CODE_HUGE_PAGE_BITS - CODE_PAGE_BITS - 6)];
+} CodeHugePage;
+
+/** The footprint of the first instructions of a trace. */
+typedef struct CodeFootprintPointStruct
+{
+    /** The number of instructions. */
+    uint64_t num_inst;
+    /** The number of distinct lines they touched. */
+    uint64_t num_lines;
+    /** The number of distinct pages. */
+    uint64_t num_pages;
+    /** The number of distinct huge pages. */
+    uint64_t num_huge_pages;
+} CodeFootprintPoint;
+
+/** The code lines, pages and huge pages touched by a trace. */
+typedef struct CodeFootprintStruct
+{
+    /** The number of instructions added. */
+    uint64_t num_inst;
+    /** The number of distinct lines touched. */
+    uint64_t num_lines;
+    /** The number of distinct pages touched. */
+    uint64_t num_pages;
+    /** The bitmaps of each huge page touched, in the order first touched. */
+    std::vector<CodeHugePage> huge_pages;
+    /** The footprint after each power of two instructions, and at the end. */
+    std::vector<CodeFootprintPoint> growth;
+    /** [Internal] The number of instructions at which to note the next point. */
+    uint64_t next_point;
+    /** [Internal] The line of the last instruction, plus one, or 0 for none. */
+    uint64_t last_line;
+    /** [Internal] The huge page last looked up, plus one, or 0 for none. */
+    uint64_t last_huge_page;
+    /** [Internal] The index in huge_pages of that huge page. */
+    size_t last_huge_index;
+    /** [Internal] The index in huge_pages of each huge page touched. */
+    std::unordered_map<uint64_t, size_t> huge_index;
+} CodeFootprint;
+
+/**
+ * Make a footprint empty.
+ *
+ * @param cf the footprint
+ */
+void code_footprint_init(CodeFootprint *cf);
+
+/**
+ * [Internal] Add an instruction in a line other than the last one's.
+ *
+ * @param cf the footprint
+ * @param pc the address of the instruction
+ */
+void code_footprint_touch(CodeFootprint *cf, uint64_t pc);
+
+/**
+ * Add a block of records to a footprint.
+ *
+ * @param cf the footprint
+ * @param recs the records
+ * @param n the number of records
+ */
+void code_footprint_add(CodeFootprint *cf, const TraceRec *recs, size_t n);
+
+/**
+ * Note the footprint at the end of the trace, if it wasn't noted already.
+ *
+ * @param cf the footprint
+ */
+void code_footprint_finish(CodeFootprint *cf);
+
+#endif
@@ -0,0 +1,255 @@
+// hll.cpp
+// Implements a HyperLogLog++ sketch.
+
+#include "hll.h"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+/**
+ * Make a sketch empty and sparse, with the given precision.
+ *
+ * @param h the sketch
+ * @param bits the precision, from HLL_MIN_BITS to HLL_MAX_BITS
+ */
+void hll_init(Hll *h, int bits)
+{
+    h->bits = bits;
+    h->sparse.clear();
+    h->num_sorted = 0;
+    h->compact_at = HLL_MIN_COMPACT;
+    h->registers.clear();
+}
+
+/**
+ * [Internal] Get the register and rank at a sketch's precision of a hash
+ * stored in a sparse list.
+ *
+ * The HLL_SPARSE_BITS - bits index bits that the register doesn't take are
+ * the start of the bits whose leading zeros are counted; only if they are all
+ * zero does the stored rank of the bits after them matter.
+ *
+ * @param h the sketch
+ * @param entry the entry of the sparse list
+ * @param rank set to the rank
+ * @return the register
+ */
+static inline size_t hll_sparse_register(const Hll *h, uint32_t entry,
+                                         uint8_t *rank)
+{
+    uint32_t index = entry >> 6;
+    int extra = HLL_SPARSE_BITS - h->bits;
+    uint32_t low = index & ((1u << extra) - 1);
+    if (low != 0)
+    {
+        *rank = (uint8_t)(__builtin_clz(low) - (32 - extra) + 1);
+    }
+    else
+    {
+        *rank = (uint8_t)(extra + (entry & 63));
+    }
+    return index >> extra;
+}
+
+/**
+ * [Internal] Sort and deduplicate the list of a sparse sketch, making it
+ * dense if the list has outgrown the registers.
+ *
+ * Entries sort by index and then by rank, so of the entries for an index only
+ * the last, with the highest rank, is kept.
+ *
+ * @param h the sketch
+ */
+void hll_compact(Hll *h)
+{
+    std::sort(h->sparse.begin() + h->num_sorted, h->sparse.end());
+    std::inplace_merge(h->sparse.begin(), h->sparse.begin() + h->num_sorted,
+                       h->sparse.end());
+    size_t n = 0;
+    for (size_t i = 0; i < h->sparse.size(); i++)
+    {
+        if (n > 0 && h->sparse[n - 1] >> 6 == h->sparse[i] >> 6)
+        {
+            n--;
+        }
+        h->sparse[n++] = h->sparse[i];
+    }
+    h->sparse.resize(n);
+    h->num_sorted = n;
+
+    // Four bytes an entry against one a register.
+    if (4 * n > ((size_t)1 << h->bits))
+    {
+        hll_make_dense(h);
+        return;
+    }
+    h->compact_at = std::max(2 * n, (size_t)HLL_MIN_COMPACT);
+}
+
+/**
+ * Make a sketch dense, if it isn't already.
+ *
+ * @param h the sketch
+ */
+void hll_make_dense(Hll *h)
+{
+    if (!h->registers.empty())
+    {
+        return;
+    }
+    h->registers.assign((size_t)1 << h->bits, 0);
+    for (uint32_t entry : h->sparse)
+    {
+        uint8_t rank;
+        size_t index = hll_sparse_register(h, entry, &rank);
+        h->registers[index] = std::max(h->registers[index], rank);
+    }
+    std::vector<uint32_t>().swap(h->sparse);
+    h->num_sorted = 0;
+}
+
+/**
+ * Add every value in one sketch to another.
+ *
+ * Prints an error message if the sketches have different precisions.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ * @return 0 on success, or -1 if the sketches can't be merged
+ */
+int hll_merge(Hll *dst, const Hll *src)
+{
+    if (dst->bits != src->bits)
+    {
+        fprintf(stderr, "Error: Can't merge sketches of precision %d and %d\n",
+                dst->bits, src->bits);
+        return -1;
+    }
+
+    if (src->registers.empty())
+    {
+        if (dst->registers.empty())
+        {
+            dst->sparse.insert(dst->sparse.end(), src->sparse.begin(),
+                               src->sparse.end());
+            hll_compact(dst);
+            return 0;
+        }
+        for (uint32_t entry : src->sparse)
+        {
+            uint8_t rank;
+            size_t index = hll_sparse_register(dst, entry, &rank);
+            dst->registers[index] = std::max(dst->registers[index], rank);
+        }
+        return 0;
+    }
+
+    hll_make_dense(dst);
+    for (size_t i = 0; i < dst->registers.size(); i++)
+    {
+        dst->registers[i] = std::max(dst->registers[i], src->registers[i]);
+    }
+    return 0;
+}
+
+/**
+ * [Internal] Ertl's sigma function, the correction for empty registers.
+ *
+ * @param x the fraction of registers that are empty
+ * @return sigma(x)
+ */
+static double hll_sigma(double x)
+{
+    if (x == 1)
+    {
+        return INFINITY;
+    }
+    double y = 1;
+    double z = x;
+    double z_prev;
+    do
+    {
+        x *= x;
+        z_prev = z;
+        z += x * y;
+        y += y;
+    } while (z != z_prev);
+    return z;
+}
+
+/**
+ * [Internal] Ertl's tau function, the correction for full registers.
+ *
+ * @param x the fraction of registers that aren't full
+ * @return tau(x)
+ */
+static double hll_tau(double x)
+{
+    if (x == 0 || x == 1)
+    {
+        return 0;
+    }
+    double y = 1;
+    double z = 1 - x;
+    double z_prev;
+    do
+    {
+        x = sqrt(x);
+        z_prev = z;
+        y *= 0.5;
+        z -= (1 - x) * (1 - x) * y;
+    } while (z != z_prev);
+    return z / 3;
+}
+
+/**
+ * Estimate the number of distinct values in a sketch.
+ *
+ * A sparse sketch is estimated by linear counting over its 2^HLL_SPARSE_BITS
+ * possible indexes, which is all but exact for the counts it can hold. A
+ * dense one is estimated from the histogram of its registers by Ertl's
+ * improved estimator.
+ *
+ * @param h the sketch
+ * @return the estimate
+ */
+double hll_estimate(Hll *h)
+{
+    if (h->registers.empty())
+    {
+        hll_compact(h);
+    }
+    if (h->registers.empty())
+    {
+        double m = (double)(1u << HLL_SPARSE_BITS);
+        return m * log(m / (m - (double)h->sparse.size()));
+    }
+
+    int q = 64 - h->bits;
+    uint64_t counts[66] = {0};
+    for (uint8_t rank : h->registers)
+    {
+        counts[rank]++;
+    }
+
+    double m = (double)h->registers.size();
+    double z = m * hll_tau(1 - counts[q + 1] / m);
+    for (int k = q; k >= 1; k--)
+    {
+        z = 0.5 * (z + counts[k]);
+    }
+    z += m * hll_sigma(counts[0] / m);
+    return 0.5 / log(2.0) * m * m / z;
+}
+
+/**
+ * Get the relative standard error of a sketch's estimate.
+ *
+ * @param h the sketch
+ * @return the standard error, as a fraction of the estimate
+ */
+double hll_std_error(const Hll *h)
+{
+    int bits = h->registers.empty() ? HLL_SPARSE_BITS : h->bits;
+    return 1.04 / sqrt((double)((uint64_t)1 << bits));
+}
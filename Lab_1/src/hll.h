@@ -0,0 +1,164 @@
+// hll.h
+// Declares a HyperLogLog++ sketch, which estimates the number of distinct
+// values added to it in a fixed amount of memory, however many there are.
+//
+// A sketch of precision p has 2^p one-byte registers; the top p bits of each
+// value's 64-bit hash pick a register, which keeps the longest run of leading
+// zeros seen in the remaining bits. As in HyperLogLog++ (Heule et al.,
+// "HyperLogLog in Practice"), a sketch starts out sparse, as a sorted list of
+// hashes cut down to HLL_SPARSE_BITS index bits, which counts small sets far
+// more precisely, and only becomes dense once the list would outgrow the
+// registers. Dense sketches are estimated with Ertl's improved estimator
+// ("New cardinality estimation algorithms for HyperLogLog sketches", 2017),
+// which needs no empirical bias tables and is unbiased over the whole range.
+//
+// Two sketches of the same precision merge into a sketch of the union of
+// their values, so parts of a trace can be sketched separately and combined.
+
+#ifndef _HLL_H_
+#define _HLL_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/** The smallest precision of a sketch. */
+#define HLL_MIN_BITS 4
+
+/** The largest precision of a sketch. */
+#define HLL_MAX_BITS 18
+
+/** The number of index bits of the hashes in a sparse sketch. */
+#define HLL_SPARSE_BITS 25
+
+/** The length to which the list of a sparse sketch may grow at first. */
+#define HLL_MIN_COMPACT 1024
+
+/** A HyperLogLog++ sketch. */
+typedef struct HllStruct
+{
+    /** The precision of the sketch: it has 2^bits registers once dense. */
+    int bits;
+    /**
+     * [Internal] While sparse, the hashes added, each as its top
+     * HLL_SPARSE_BITS bits followed by 6 bits of rank. The first num_sorted
+     * are sorted, with one per index; the rest are as added.
+     */
+    std::vector<uint32_t> sparse;
+    /** [Internal] The number of entries at the front of sparse in order. */
+    size_t num_sorted;
+    /** [Internal] The length of sparse at which to compact it next. */
+    size_t compact_at;
+    /** [Internal] Once dense, the 2^bits registers; until then, empty. */
+    std::vector<uint8_t> registers;
+} Hll;
+
+/**
+ * Scramble a value so that every bit of the result depends on every bit of
+ * the value (the finalizer of MurmurHash3).
+ *
+ * @param x the value
+ * @return the hash of the value
+ */
+static inline uint64_t hll_hash(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * Make a sketch empty and sparse, with the given precision.
+ *
+ * @param h the sketch
+ * @param bits the precision, from HLL_MIN_BITS to HLL_MAX_BITS
+ */
+void hll_init(Hll *h, int bits);
+
+/**
+ * [Internal] Sort and deduplicate the list of a sparse sketch, making it
+ * dense if the list has outgrown the registers.
+ *
+ * @param h the sketch
+ */
+void hll_compact(Hll *h);
+
+/**
+ * Add a value, given by its hash, to a sketch.
+ *
+ * @param h the sketch
+ * @param hash the hash of the value, from hll_hash()
+ */
+static inline void hll_add_hash(Hll *h, uint64_t hash)
+{
+    if (!h->registers.empty())
+    {
+        size_t index = hash >> (64 - h->bits);
+        uint64_t rest = (hash << h->bits) | (1ull << (h->bits - 1));
+        uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+        if (rank > h->registers[index])
+        {
+            h->registers[index] = rank;
+        }
+        return;
+    }
+
+    uint32_t index = (uint32_t)(hash >> (64 - HLL_SPARSE_BITS));
+    uint64_t rest = (hash << HLL_SPARSE_BITS) |
+                    (1ull << (HLL_SPARSE_BITS - 1));
+    h->sparse.push_back(index << 6 | (uint32_t)(__builtin_clzll(rest) + 1));
+    if (h->sparse.size() >= h->compact_at)
+    {
+        hll_compact(h);
+    }
+}
+
+/**
+ * Add a value to a sketch.
+ *
+ * @param h the sketch
+ * @param x the value
+ */
+static inline void hll_add(Hll *h, uint64_t x)
+{
+    hll_add_hash(h, hll_hash(x));
+}
+
+/**
+ * Make a sketch dense, if it isn't already.
+ *
+ * @param h the sketch
+ */
+void hll_make_dense(Hll *h);
+
+/**
+ * Add every value in one sketch to another.
+ *
+ * Prints an error message if the sketches have different precisions.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ * @return 0 on success, or -1 if the sketches can't be merged
+ */
+int hll_merge(Hll *dst, const Hll *src);
+
+/**
+ * Estimate the number of distinct values in a sketch.
+ *
+ * @param h the sketch
+ * @return the estimate
+ */
+double hll_estimate(Hll *h);
+
+/**
+ * Get the relative standard error of a sketch's estimate.
+ *
+ * @param h the sketch
+ * @return the standard error, as a fraction of the estimate
+ */
+double hll_std_error(const Hll *h);
+
+#endif
@@ -0,0 +1,395 @@
+// hotpcs.cpp
+// Implements a Space-Saving tracker of the most executed instructions.
+
+#include "hotpcs.h"
+#include <algorithm>
+
+/** [Internal] The number of bits of a hash table index. */
+#define HOT_PCS_TABLE_BITS __builtin_ctz(HOT_PCS_TABLE_SIZE)
+
+HotPcsStruct::HotPcsStruct()
+    : num_recs(0), min_bucket(HOT_PCS_NONE), free_buckets(HOT_PCS_NONE),
+      table(HOT_PCS_TABLE_SIZE, HOT_PCS_NONE)
+{
+    counters.reserve(HOT_PCS_COUNTERS);
+    buckets.reserve(HOT_PCS_COUNTERS);
+}
+
+/**
+ * [Internal] Get the hash table slot an address belongs in.
+ *
+ * @param pc the address
+ * @return the slot
+ */
+static inline size_t hot_pcs_home(uint64_t pc)
+{
+    return (size_t)((pc * 0x9e3779b97f4a7c15ull) >> (64 - HOT_PCS_TABLE_BITS));
+}
+
+/**
+ * [Internal] Find the hash table slot of an address, or the empty slot where
+ * it would go.
+ *
+ * @param h the tracker
+ * @param pc the address
+ * @return the slot
+ */
+static size_t hot_pcs_find(const HotPcs *h, uint64_t pc)
+{
+    size_t slot = hot_pcs_home(pc);
+    while (h->table[slot] != HOT_PCS_NONE &&
+           h->counters[h->table[slot]].pc != pc)
+    {
+        slot = (slot + 1) % HOT_PCS_TABLE_SIZE;
+    }
+    return slot;
+}
+
+/**
+ * [Internal] Remove an address from the hash table, moving back any entries
+ * after it that would otherwise no longer be found (there are no tombstones).
+ *
+ * @param h the tracker
+ * @param pc the address, which must be in the table
+ */
+static void hot_pcs_unmap(HotPcs *h, uint64_t pc)
+{
+    size_t hole = hot_pcs_find(h, pc);
+    h->table[hole] = HOT_PCS_NONE;
+    for (size_t slot = (hole + 1) % HOT_PCS_TABLE_SIZE;
+         h->table[slot] != HOT_PCS_NONE;
+         slot = (slot + 1) % HOT_PCS_TABLE_SIZE)
+    {
+        // An entry can fill the hole if its home isn't between the hole and
+        // its slot, going around the table.
+        size_t home = hot_pcs_home(h->counters[h->table[slot]].pc);
+        if ((slot - home) % HOT_PCS_TABLE_SIZE >=
+            (slot - hole) % HOT_PCS_TABLE_SIZE)
+        {
+            h->table[hole] = h->table[slot];
+            h->table[slot] = HOT_PCS_NONE;
+            hole = slot;
+        }
+    }
+}
+
+/**
+ * [Internal] Add an empty bucket to the list of buckets.
+ *
+ * @param h the tracker
+ * @param count the count of the bucket
+ * @param prev the bucket to put it after, or HOT_PCS_NONE to put it first
+ * @return the bucket
+ */
+static uint32_t hot_pcs_new_bucket(HotPcs *h, uint64_t count, uint32_t prev)
+{
+    uint32_t b = h->free_buckets;
+    if (b != HOT_PCS_NONE)
+    {
+        h->free_buckets = h->buckets[b].next;
+    }
+    else
+    {
+        b = (uint32_t)h->buckets.size();
+        h->buckets.push_back(HotPcsBucket());
+    }
+
+    HotPcsBucket *bucket = &h->buckets[b];
+    bucket->count = count;
+    bucket->first = HOT_PCS_NONE;
+    bucket->prev = prev;
+    bucket->next = prev != HOT_PCS_NONE ? h->buckets[prev].next : h->min_bucket;
+    if (bucket->next != HOT_PCS_NONE)
+    {
+        h->buckets[bucket->next].prev = b;
+    }
+    if (prev != HOT_PCS_NONE)
+    {
+        h->buckets[prev].next = b;
+    }
+    else
+    {
+        h->min_bucket = b;
+    }
+    return b;
+}
+
+/**
+ * [Internal] Put a counter in a bucket.
+ *
+ * @param h the tracker
+ * @param c the counter, in no bucket
+ * @param b the bucket
+ */
+static void hot_pcs_attach(HotPcs *h, uint32_t c, uint32_t b)
+{
+    HotPcsCounter *counter = &h->counters[c];
+    counter->bucket = b;
+    counter->prev = HOT_PCS_NONE;
+    counter->next = h->buckets[b].first;
+    if (counter->next != HOT_PCS_NONE)
+    {
+        h->counters[counter->next].prev = c;
+    }
+    h->buckets[b].first = c;
+}
+
+/**
+ * [Internal] Take a counter out of its bucket, freeing the bucket if that
+ * leaves it empty.
+ *
+ * @param h the tracker
+ * @param c the counter
+ */
+static void hot_pcs_detach(HotPcs *h, uint32_t c)
+{
+    HotPcsCounter *counter = &h->counters[c];
+    uint32_t b = counter->bucket;
+    HotPcsBucket *bucket = &h->buckets[b];
+    if (counter->prev != HOT_PCS_NONE)
+    {
+        h->counters[counter->prev].next = counter->next;
+    }
+    else
+    {
+        bucket->first = counter->next;
+    }
+    if (counter->next != HOT_PCS_NONE)
+    {
+        h->counters[counter->next].prev = counter->prev;
+    }
+    if (bucket->first != HOT_PCS_NONE)
+    {
+        return;
+    }
+
+    if (bucket->prev != HOT_PCS_NONE)
+    {
+        h->buckets[bucket->prev].next = bucket->next;
+    }
+    else
+    {
+        h->min_bucket = bucket->next;
+    }
+    if (bucket->next != HOT_PCS_NONE)
+    {
+        h->buckets[bucket->next].prev = bucket->prev;
+    }
+    bucket->next = h->free_buckets;
+    h->free_buckets = b;
+}
+
+/**
+ * [Internal] Add one to a counter's count, moving it to the next bucket up.
+ *
+ * @param h the tracker
+ * @param c the counter
+ */
+static void hot_pcs_increment(HotPcs *h, uint32_t c)
+{
+    uint32_t b = h->counters[c].bucket;
+    uint64_t count = h->buckets[b].count + 1;
+    uint32_t next = h->buckets[b].next;
+    if (next != HOT_PCS_NONE && h->buckets[next].count == count)
+    {
+        hot_pcs_detach(h, c);
+        hot_pcs_attach(h, c, next);
+        return;
+    }
+
+    // A counter alone in its bucket can take the bucket along.
+    const HotPcsCounter *counter = &h->counters[c];
+    if (counter->prev == HOT_PCS_NONE && counter->next == HOT_PCS_NONE)
+    {
+        h->buckets[b].count = count;
+        return;
+    }
+    next = hot_pcs_new_bucket(h, count, b);
+    hot_pcs_detach(h, c);
+    hot_pcs_attach(h, c, next);
+}
+
+/**
+ * Count an execution of an instruction.
+ *
+ * @param h the tracker
+ * @param pc the address of the instruction
+ * @param optype its op type
+ */
+void hot_pcs_add(HotPcs *h, uint64_t pc, uint8_t optype)
+{
+    h->num_recs++;
+    size_t slot = hot_pcs_find(h, pc);
+    if (h->table[slot] != HOT_PCS_NONE)
+    {
+        hot_pcs_increment(h, h->table[slot]);
+        return;
+    }
+
+    if (h->counters.size() < HOT_PCS_COUNTERS)
+    {
+        uint32_t c = (uint32_t)h->counters.size();
+        HotPcsCounter counter = {pc, 0, optype, 0, 0, 0};
+        h->counters.push_back(counter);
+        uint32_t b = h->min_bucket;
+        if (b == HOT_PCS_NONE || h->buckets[b].count != 1)
+        {
+            b = hot_pcs_new_bucket(h, 1, HOT_PCS_NONE);
+        }
+        hot_pcs_attach(h, c, b);
+        h->table[slot] = c;
+        return;
+    }
+
+    // Take over a counter with the lowest count.
+    uint32_t c = h->buckets[h->min_bucket].first;
+    HotPcsCounter *counter = &h->counters[c];
+    hot_pcs_unmap(h, counter->pc);
+    counter->pc = pc;
+    counter->error = h->buckets[h->min_bucket].count;
+    counter->optype = optype;
+    h->table[hot_pcs_find(h, pc)] = c;
+    hot_pcs_increment(h, c);
+}
+
+/**
+ * [Internal] Order instructions from most to least executed, with ties
+ * broken by address.
+ */
+static bool hot_pc_hotter(const HotPc &a, const HotPc &b)
+{
+    return a.count != b.count ? a.count > b.count : a.pc < b.pc;
+}
+
+/**
+ * [Internal] Order instructions by address.
+ */
+static bool hot_pc_lower(const HotPc &a, const HotPc &b)
+{
+    return a.pc < b.pc;
+}
+
+/**
+ * [Internal] Get every counter of a tracker.
+ *
+ * @param h the tracker
+ * @return the counters' instructions, in no particular order
+ */
+static std::vector<HotPc> hot_pcs_all(const HotPcs *h)
+{
+    std::vector<HotPc> all;
+    all.reserve(h->counters.size());
+    for (const HotPcsCounter &counter : h->counters)
+    {
+        HotPc pc = {counter.pc, h->buckets[counter.bucket].count,
+                    counter.error, counter.optype};
+        all.push_back(pc);
+    }
+    return all;
+}
+
+/**
+ * Add the counts of one tracker to another, as if the other had seen its
+ * records too.
+ *
+ * @param dst the tracker to add to
+ * @param src the tracker to add
+ */
+void hot_pcs_merge(HotPcs *dst, const HotPcs *src)
+{
+    std::vector<HotPc> a = hot_pcs_all(dst);
+    std::vector<HotPc> b = hot_pcs_all(src);
+    std::sort(a.begin(), a.end(), hot_pc_lower);
+    std::sort(b.begin(), b.end(), hot_pc_lower);
+    uint64_t a_missing = hot_pcs_max_error(dst);
+    uint64_t b_missing = hot_pcs_max_error(src);
+
+    // Walk both lists by address, adding up the counts of each.
+    std::vector<HotPc> merged;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() || j < b.size())
+    {
+        HotPc pc;
+        if (j == b.size() || (i < a.size() && a[i].pc < b[j].pc))
+        {
+            pc = a[i++];
+            pc.count += b_missing;
+            pc.error += b_missing;
+        }
+        else if (i == a.size() || b[j].pc < a[i].pc)
+        {
+            pc = b[j++];
+            pc.count += a_missing;
+            pc.error += a_missing;
+        }
+        else
+        {
+            pc = a[i++];
+            pc.count += b[j].count;
+            pc.error += b[j].error;
+            j++;
+        }
+        merged.push_back(pc);
+    }
+    std::sort(merged.begin(), merged.end(), hot_pc_hotter);
+    if (merged.size() > HOT_PCS_COUNTERS)
+    {
+        merged.resize(HOT_PCS_COUNTERS);
+    }
+
+    // Rebuild the tracker from the lowest count up.
+    uint64_t num_recs = dst->num_recs + src->num_recs;
+    *dst = HotPcs();
+    dst->num_recs = num_recs;
+    uint32_t last = HOT_PCS_NONE;
+    for (size_t k = merged.size(); k-- > 0;)
+    {
+        const HotPc &pc = merged[k];
+        uint32_t c = (uint32_t)dst->counters.size();
+        HotPcsCounter counter = {pc.pc, pc.error, pc.optype, 0, 0, 0};
+        dst->counters.push_back(counter);
+        if (last == HOT_PCS_NONE || dst->buckets[last].count != pc.count)
+        {
+            last = hot_pcs_new_bucket(dst, pc.count, last);
+        }
+        hot_pcs_attach(dst, c, last);
+        dst->table[hot_pcs_find(dst, pc.pc)] = c;
+    }
+}
+
+/**
+ * Get the most executed instructions, from most to least executed, with
+ * ties broken by address.
+ *
+ * @param h the tracker
+ * @param k the largest number of instructions to get
+ * @return the instructions, at most k of them
+ */
+std::vector<HotPc> hot_pcs_top(const HotPcs *h, size_t k)
+{
+    std::vector<HotPc> all = hot_pcs_all(h);
+    if (k > all.size())
+    {
+        k = all.size();
+    }
+    std::partial_sort(all.begin(), all.begin() + k, all.end(), hot_pc_hotter);
+    all.resize(k);
+    return all;
+}
+
+/**
+ * Get the most by which any address's count can be too high, or by which an
+ * address without a counter can have been executed.
+ *
+ * @param h the tracker
+ * @return the lowest count if every counter is in use, or else 0
+ */
+uint64_t hot_pcs_max_error(const HotPcs *h)
+{
+    if (h->counters.size() < HOT_PCS_COUNTERS)
+    {
+        return 0;
+    }
+    return h->buckets[h->min_bucket].count;
+}
@@ -0,0 +1,133 @@
+// hotpcs.h
+// Declares a fixed-size tracker of the most executed instruction addresses
+// in a trace, using the Space-Saving algorithm (Metwally et al., "Efficient
+// Computation of Frequent and Top-k Elements in Data Streams").
+//
+// The tracker has HOT_PCS_COUNTERS counters. An address that has a counter
+// has it incremented; one that doesn't takes over the counter with the
+// lowest count, keeping that count as the new address's possible error. Each
+// count is then at most its error too high, and every address executed more
+// than N / HOT_PCS_COUNTERS times out of N is sure to have a counter.
+//
+// Counters are grouped into buckets of equal count, kept in order of count
+// (the "Stream-Summary" structure), and found by address through a hash
+// table, so that each record takes constant time.
+
+#ifndef _HOTPCS_H_
+#define _HOTPCS_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/** The number of counters in a HotPcs. */
+#define HOT_PCS_COUNTERS 4096
+
+/** The number of slots in a HotPcs's hash table; a power of two. */
+#define HOT_PCS_TABLE_SIZE (4 * HOT_PCS_COUNTERS)
+
+/** The index of no counter or bucket. */
+#define HOT_PCS_NONE 0xffffffffu
+
+/** An instruction address and how often it was executed. */
+typedef struct HotPcStruct
+{
+    /** The address. */
+    uint64_t pc;
+    /** The number of times it was executed, at most error too high. */
+    uint64_t count;
+    /** The most by which count may be too high. */
+    uint64_t error;
+    /** The op type of the instruction. */
+    uint8_t optype;
+} HotPc;
+
+/** [Internal] A counter of a HotPcs. */
+typedef struct HotPcsCounterStruct
+{
+    /** The address counted. */
+    uint64_t pc;
+    /** The most by which the bucket's count may be too high for it. */
+    uint64_t error;
+    /** The op type of the instruction. */
+    uint8_t optype;
+    /** The bucket holding the counter. */
+    uint32_t bucket;
+    /** The previous and next counters in the bucket, or HOT_PCS_NONE. */
+    uint32_t prev, next;
+} HotPcsCounter;
+
+/** [Internal] A bucket of the counters of a HotPcs with the same count. */
+typedef struct HotPcsBucketStruct
+{
+    /** The count of every counter in the bucket. */
+    uint64_t count;
+    /** The first counter in the bucket. */
+    uint32_t first;
+    /** The buckets with the next lower and higher counts, or HOT_PCS_NONE. */
+    uint32_t prev, next;
+} HotPcsBucket;
+
+/** A tracker of the most executed instruction addresses. */
+typedef struct HotPcsStruct
+{
+    /** The number of records counted. */
+    uint64_t num_recs;
+    /** [Internal] The counters in use. */
+    std::vector<HotPcsCounter> counters;
+    /** [Internal] The buckets, in use or free. */
+    std::vector<HotPcsBucket> buckets;
+    /** [Internal] The bucket with the lowest count, or HOT_PCS_NONE. */
+    uint32_t min_bucket;
+    /** [Internal] A list of free buckets, linked through next. */
+    uint32_t free_buckets;
+    /** [Internal] The counter of each address, by hash, or HOT_PCS_NONE. */
+    std::vector<uint32_t> table;
+
+    HotPcsStruct();
+} HotPcs;
+
+/**
+ * Count an execution of an instruction.
+ *
+ * @param h the tracker
+ * @param pc the address of the instruction
+ * @param optype its op type
+ */
+void hot_pcs_add(HotPcs *h, uint64_t pc, uint8_t optype);
+
+/**
+ * Add the counts of one tracker to another, as if the other had seen its
+ * records too.
+ *
+ * An address missing from a full tracker may have been executed as many
+ * times as that tracker's lowest count, so it is given that count, and that
+ * much more error. Of the combined counts, the HOT_PCS_COUNTERS highest are
+ * kept. The result depends on the order of merging only in which addresses
+ * are kept when more than HOT_PCS_COUNTERS were seen.
+ *
+ * @param dst the tracker to add to
+ * @param src the tracker to add
+ */
+void hot_pcs_merge(HotPcs *dst, const HotPcs *src);
+
+/**
+ * Get the most executed instructions, from most to least executed, with
+ * ties broken by address.
+ *
+ * @param h the tracker
+ * @param k the largest number of instructions to get
+ * @return the instructions, at most k of them
+ */
+std::vector<HotPc> hot_pcs_top(const HotPcs *h, size_t k);
+
+/**
+ * Get the most by which any address's count can be too high, or by which an
+ * address without a counter can have been executed.
+ *
+ * @param h the tracker
+ * @return the lowest count if every counter is in use, or else 0
+ */
+uint64_t hot_pcs_max_error(const HotPcs *h);
+
+#endif
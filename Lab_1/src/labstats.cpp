@@ -0,0 +1,104 @@
+// labstats.cpp
+// Implements mergeable Lab 1 statistics of part of a trace.
+
+#include "labstats.h"
+#include <string.h>
+
+/**
+ * Make a footprint sketch empty.
+ *
+ * @param f the sketch
+ * @param bits the precision of each of its HyperLogLogs
+ */
+void footprint_sketch_init(FootprintSketch *f, int bits)
+{
+    hll_init(&f->pcs, bits);
+    hll_init(&f->lines, bits);
+    hll_init(&f->pages, bits);
+}
+
+/**
+ * Add every address in one footprint sketch to another of the same
+ * precision.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ */
+void footprint_sketch_merge(FootprintSketch *dst, const FootprintSketch *src)
+{
+    hll_merge(&dst->pcs, &src->pcs);
+    hll_merge(&dst->lines, &src->lines);
+    hll_merge(&dst->pages, &src->pages);
+}
+
+/**
+ * Make statistics empty.
+ *
+ * @param s the statistics
+ * @param sketch_bits the precision of the footprint sketches to keep, or 0 to
+ *                    keep the distinct addresses exactly
+ */
+void lab_stats_init(LabStats *s, int sketch_bits)
+{
+    memset(&s->totals, 0, sizeof(s->totals));
+    pc_sketch_clear(&s->pcs);
+    footprint_sketch_init(&s->footprint, sketch_bits != 0 ? sketch_bits
+                                                          : HLL_MIN_BITS);
+    s->sketch_bits = sketch_bits;
+    memset(s->recent_pcs, 0, sizeof(s->recent_pcs));
+}
+
+/**
+ * Add a block of consecutive trace records to statistics.
+ *
+ * @param s the statistics
+ * @param recs the records
+ * @param n the number of records
+ * @return the number of records with a valid op type; if fewer than n, the
+ *         trace is invalid
+ */
+size_t lab_stats_add_block(LabStats *s, const TraceRec *recs, size_t n)
+{
+    size_t num_valid = count_trace_block(recs, n, s->totals.op_counts,
+                                         &s->totals.cycles);
+    s->totals.num_recs += n;
+
+    if (s->sketch_bits != 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            footprint_sketch_add(&s->footprint, recs[i].inst_addr);
+        }
+        return num_valid;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t pc = recs[i].inst_addr;
+        uint64_t *recent =
+            &s->recent_pcs[(pc ^ (pc >> 10)) % LAB_STATS_RECENT_PCS];
+        if (*recent != pc + 1)
+        {
+            *recent = pc + 1;
+            pc_sketch_add(&s->pcs, pc);
+        }
+    }
+    return num_valid;
+}
+
+/**
+ * Add the statistics of some records to those of others.
+ *
+ * @param dst the statistics to add to
+ * @param src the statistics to add, kept the same way as dst's
+ */
+void lab_stats_merge(LabStats *dst, const LabStats *src)
+{
+    stat_totals_add(&dst->totals, &src->totals);
+    if (dst->sketch_bits != 0)
+    {
+        footprint_sketch_merge(&dst->footprint, &src->footprint);
+        return;
+    }
+    pc_sketch_merge(&dst->pcs, &src->pcs);
+}
@@ -0,0 +1,120 @@
+// labstats.h
+// Declares the Lab 1 statistics of part of a trace, gathered without the
+// global variables so that parts of a trace can be analyzed on separate
+// threads, and merged afterwards into the statistics of the parts combined.
+//
+// Every statistic is associative: op type counts and cycles add up, and sets
+// and sketches of addresses merge into their union. Merging gives the same
+// result however the trace was divided and in whatever order the parts are
+// merged.
+
+#ifndef _LABSTATS_H_
+#define _LABSTATS_H_
+
+#include "hll.h"
+#include "pcsketch.h"
+#include "statindex.h"
+#include "trace.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The log2 of the size in bytes of the code lines a FootprintSketch counts. */
+#define FOOTPRINT_LINE_BITS 6
+
+/** The log2 of the size in bytes of the code pages a FootprintSketch counts. */
+#define FOOTPRINT_PAGE_BITS 12
+
+/** The number of slots in LabStats's table of recently seen addresses. */
+#define LAB_STATS_RECENT_PCS 1024
+
+/**
+ * Sketches of the distinct instruction addresses in part of a trace, and of
+ * the distinct lines and pages they fall in.
+ */
+typedef struct FootprintSketchStruct
+{
+    /** The distinct instruction addresses. */
+    Hll pcs;
+    /** The distinct code lines. */
+    Hll lines;
+    /** The distinct code pages. */
+    Hll pages;
+} FootprintSketch;
+
+/** The statistics of part of a trace. */
+typedef struct LabStatsStruct
+{
+    /** The number of records, their op type counts and cycle total. */
+    StatTotals totals;
+    /** The distinct instruction addresses, exactly, unless sketch_bits. */
+    PcSketch pcs;
+    /** With sketch_bits, sketches of the footprint instead of pcs. */
+    FootprintSketch footprint;
+    /** The precision of the footprint sketches, or 0 to count exactly. */
+    int sketch_bits;
+    /**
+     * [Internal] A direct-mapped table of addresses recently added to pcs,
+     * plus one so that zero means empty, which spares most records the list.
+     */
+    uint64_t recent_pcs[LAB_STATS_RECENT_PCS];
+} LabStats;
+
+/**
+ * Make a footprint sketch empty.
+ *
+ * @param f the sketch
+ * @param bits the precision of each of its HyperLogLogs
+ */
+void footprint_sketch_init(FootprintSketch *f, int bits);
+
+/**
+ * Add an instruction address to a footprint sketch.
+ *
+ * @param f the sketch
+ * @param pc the address
+ */
+static inline void footprint_sketch_add(FootprintSketch *f, uint64_t pc)
+{
+    hll_add(&f->pcs, pc);
+    hll_add(&f->lines, pc >> FOOTPRINT_LINE_BITS);
+    hll_add(&f->pages, pc >> FOOTPRINT_PAGE_BITS);
+}
+
+/**
+ * Add every address in one footprint sketch to another of the same
+ * precision.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ */
+void footprint_sketch_merge(FootprintSketch *dst, const FootprintSketch *src);
+
+/**
+ * Make statistics empty.
+ *
+ * @param s the statistics
+ * @param sketch_bits the precision of the footprint sketches to keep, or 0 to
+ *                    keep the distinct addresses exactly
+ */
+void lab_stats_init(LabStats *s, int sketch_bits);
+
+/**
+ * Add a block of consecutive trace records to statistics.
+ *
+ * @param s the statistics
+ * @param recs the records
+ * @param n the number of records
+ * @return the number of records with a valid op type; if fewer than n, the
+ *         trace is invalid
+ */
+size_t lab_stats_add_block(LabStats *s, const TraceRec *recs, size_t n);
+
+/**
+ * Add the statistics of some records to those of others.
+ *
+ * @param dst the statistics to add to
+ * @param src the statistics to add, kept the same way as dst's
+ */
+void lab_stats_merge(LabStats *dst, const LabStats *src);
+
+#endif
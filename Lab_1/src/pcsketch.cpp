@@ -0,0 +1,99 @@
+// pcsketch.cpp
+// Implements a mergeable record of distinct instruction addresses.
+
+#include "pcsketch.h"
+#include <algorithm>
+
+/**
+ * [Internal] Sort and deduplicate the list of an exact sketch.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_compact(PcSketch *s)
+{
+    std::sort(s->pcs.begin() + s->num_sorted, s->pcs.end());
+    std::inplace_merge(s->pcs.begin(), s->pcs.begin() + s->num_sorted,
+                       s->pcs.end());
+    s->pcs.erase(std::unique(s->pcs.begin(), s->pcs.end()), s->pcs.end());
+    s->num_sorted = s->pcs.size();
+    s->compact_at = std::max(2 * s->pcs.size(), (size_t)PC_SKETCH_MIN_COMPACT);
+}
+
+/**
+ * Turn a sketch into a HyperLogLog, if it isn't one already.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_make_hll(PcSketch *s)
+{
+    if (!s->hll.registers.empty())
+    {
+        return;
+    }
+    hll_init(&s->hll, PC_SKETCH_HLL_BITS);
+    hll_make_dense(&s->hll);
+    for (uint64_t pc : s->pcs)
+    {
+        hll_add(&s->hll, pc);
+    }
+    std::vector<uint64_t>().swap(s->pcs);
+    s->num_sorted = 0;
+}
+
+/**
+ * Add every address in one sketch to another.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ */
+void pc_sketch_merge(PcSketch *dst, const PcSketch *src)
+{
+    if (src->hll.registers.empty())
+    {
+        for (uint64_t pc : src->pcs)
+        {
+            pc_sketch_add(dst, pc);
+        }
+        return;
+    }
+
+    pc_sketch_make_hll(dst);
+    hll_merge(&dst->hll, &src->hll);
+}
+
+/**
+ * Count the distinct addresses in a sketch.
+ *
+ * A HyperLogLog's estimate has a standard error of about 1.04 / sqrt(m) for
+ * m registers, under 1% here.
+ *
+ * @param s the sketch
+ * @param exact set to whether the count is exact rather than estimated
+ * @return the number of distinct addresses
+ */
+uint64_t pc_sketch_count(PcSketch *s, bool *exact)
+{
+    if (s->hll.registers.empty())
+    {
+        pc_sketch_compact(s);
+        *exact = true;
+        return s->pcs.size();
+    }
+
+    double estimate = hll_estimate(&s->hll);
+    *exact = false;
+    return (uint64_t)(estimate + 0.5);
+}
+
+/**
+ * Empty a sketch, making it exact again.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_clear(PcSketch *s)
+{
+    s->pcs.clear();
+    s->num_sorted = 0;
+    s->compact_at = PC_SKETCH_MIN_COMPACT;
+    hll_init(&s->hll, PC_SKETCH_HLL_BITS);
+}
@@ -0,0 +1,113 @@
+// pcsketch.h
+// Declares a mergeable record of the distinct instruction addresses in part
+// of a trace.
+//
+// A sketch starts out exact, as a list of addresses that is sorted and
+// deduplicated whenever it has doubled in length. Sketches of different
+// parts of a trace can be merged into one for the parts combined. A sketch
+// can also be turned into a HyperLogLog (see hll.h), which takes a fixed
+// amount of memory however many addresses it holds but only estimates how
+// many there are.
+
+#ifndef _PCSKETCH_H_
+#define _PCSKETCH_H_
+
+#include "hll.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/** The number of index bits of a PcSketch's HyperLogLog. */
+#define PC_SKETCH_HLL_BITS 14
+
+/** The number of registers, one byte each, of a PcSketch's HyperLogLog. */
+#define PC_SKETCH_HLL_SIZE (1 << PC_SKETCH_HLL_BITS)
+
+/** The length to which the list of an exact sketch may grow at first. */
+#define PC_SKETCH_MIN_COMPACT 4096
+
+/** The distinct instruction addresses seen in part of a trace. */
+typedef struct PcSketchStruct
+{
+    /**
+     * [Internal] The addresses seen, if the sketch is exact. The first
+     * num_sorted are sorted and distinct; the rest are as added.
+     */
+    std::vector<uint64_t> pcs;
+    /** [Internal] The number of addresses at the front of pcs in order. */
+    size_t num_sorted;
+    /** [Internal] The length of pcs at which to compact it next. */
+    size_t compact_at;
+    /**
+     * [Internal] The HyperLogLog, dense with PC_SKETCH_HLL_SIZE registers,
+     * or with no registers if the sketch is exact.
+     */
+    Hll hll;
+
+    PcSketchStruct() : num_sorted(0), compact_at(PC_SKETCH_MIN_COMPACT)
+    {
+        hll_init(&hll, PC_SKETCH_HLL_BITS);
+    }
+} PcSketch;
+
+/**
+ * [Internal] Sort and deduplicate the list of an exact sketch.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_compact(PcSketch *s);
+
+/**
+ * Add an instruction address to a sketch.
+ *
+ * @param s the sketch
+ * @param pc the address
+ */
+static inline void pc_sketch_add(PcSketch *s, uint64_t pc)
+{
+    if (!s->hll.registers.empty())
+    {
+        hll_add(&s->hll, pc);
+        return;
+    }
+    s->pcs.push_back(pc);
+    if (s->pcs.size() >= s->compact_at)
+    {
+        pc_sketch_compact(s);
+    }
+}
+
+/**
+ * Turn a sketch into a HyperLogLog, if it isn't one already.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_make_hll(PcSketch *s);
+
+/**
+ * Add every address in one sketch to another.
+ *
+ * If either sketch is a HyperLogLog, dst becomes one too.
+ *
+ * @param dst the sketch to add to
+ * @param src the sketch to add
+ */
+void pc_sketch_merge(PcSketch *dst, const PcSketch *src);
+
+/**
+ * Count the distinct addresses in a sketch.
+ *
+ * @param s the sketch
+ * @param exact set to whether the count is exact rather than estimated
+ * @return the number of distinct addresses
+ */
+uint64_t pc_sketch_count(PcSketch *s, bool *exact);
+
+/**
+ * Empty a sketch, making it exact again.
+ *
+ * @param s the sketch
+ */
+void pc_sketch_clear(PcSketch *s);
+
+#endif
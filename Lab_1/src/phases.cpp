@@ -0,0 +1,222 @@
+// phases.cpp
+// Implements the time series of the Lab 1 statistics of a trace.
+
+#include "phases.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * [Internal] Tell whether a conditional branch was taken from the address of
+ * the instruction after it.
+ *
+ * @param pc the address of the branch
+ * @param next_pc the address of the next instruction executed
+ * @return whether the branch was taken
+ */
+static inline bool phase_branch_taken(uint64_t pc, uint64_t next_pc)
+{
+    return next_pc <= pc || next_pc - pc > PHASE_MAX_INST_BYTES;
+}
+
+/**
+ * Make a phase time series empty.
+ *
+ * @param ps the series
+ * @param first_rec the index in the trace of the first record to be added
+ * @param interval the number of instructions in each interval
+ */
+void phase_series_init(PhaseSeries *ps, uint64_t first_rec,
+                       uint64_t interval)
+{
+    ps->first_rec = first_rec;
+    ps->interval = interval;
+    ps->num_inst.clear();
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        ps->op_counts[op].clear();
+    }
+    ps->cycles.clear();
+    ps->new_pcs.clear();
+    ps->branches_taken.clear();
+    ps->last_unique_pcs = 0;
+    ps->taken = 0;
+    ps->pending_branch = UINT64_MAX;
+    ps->pending_in_last_row = false;
+}
+
+/**
+ * Count the taken branches in the next block of records. The block must not
+ * go past the end of the current interval.
+ *
+ * @param ps the series
+ * @param recs the records
+ * @param n the number of records
+ */
+void phase_series_add(PhaseSeries *ps, const TraceRec *recs, size_t n)
+{
+    if (n == 0)
+    {
+        return;
+    }
+
+    // A branch ending the last block goes the way this block starts.
+    if (ps->pending_branch != UINT64_MAX &&
+        phase_branch_taken(ps->pending_branch, recs[0].inst_addr))
+    {
+        if (ps->pending_in_last_row)
+        {
+            ps->branches_taken.back()++;
+        }
+        else
+        {
+            ps->taken++;
+        }
+    }
+
+    uint32_t taken = 0;
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        taken += recs[i].optype == OP_CBR &&
+                 phase_branch_taken(recs[i].inst_addr, recs[i + 1].inst_addr);
+    }
+    ps->taken += taken;
+
+    ps->pending_branch = recs[n - 1].optype == OP_CBR ? recs[n - 1].inst_addr
+                                                      : UINT64_MAX;
+    ps->pending_in_last_row = false;
+}
+
+/**
+ * End the current interval, adding its row to the series.
+ *
+ * @param ps the series
+ * @param totals the statistics of the interval's records
+ * @param unique_pcs the number of distinct addresses seen up to the end of
+ *                   the interval
+ */
+void phase_series_end_row(PhaseSeries *ps, const StatTotals *totals,
+                          uint64_t unique_pcs)
+{
+    ps->num_inst.push_back((uint32_t)totals->num_recs);
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        ps->op_counts[op].push_back((uint32_t)totals->op_counts[op]);
+    }
+    ps->cycles.push_back(totals->cycles);
+
+    // An estimated count of distinct addresses may dip.
+    uint64_t new_pcs = 0;
+    if (unique_pcs > ps->last_unique_pcs)
+    {
+        new_pcs = unique_pcs - ps->last_unique_pcs;
+        ps->last_unique_pcs = unique_pcs;
+    }
+    ps->new_pcs.push_back((uint32_t)new_pcs);
+
+    ps->branches_taken.push_back(ps->taken);
+    ps->taken = 0;
+    ps->pending_in_last_row = true;
+}
+
+/**
+ * Write a phase time series to a phases file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param ps the series
+ * @param filename the path of the file to write
+ * @return 0 on success, or -1 on error
+ */
+int phase_series_save(const PhaseSeries *ps, const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't create %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    PhaseFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PHASE_MAGIC, sizeof(header.magic));
+    header.version = PHASE_VERSION;
+    header.num_op_types = NUM_OP_TYPES;
+    header.first_rec = ps->first_rec;
+    header.interval = ps->interval;
+    header.num_rows = ps->num_inst.size();
+
+    size_t n = ps->num_inst.size();
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(ps->num_inst.data(), sizeof(uint32_t), n, f) == n;
+    for (int op = 0; ok && op < NUM_OP_TYPES; op++)
+    {
+        ok = fwrite(ps->op_counts[op].data(), sizeof(uint32_t), n, f) == n;
+    }
+    ok = ok && fwrite(ps->cycles.data(), sizeof(uint64_t), n, f) == n &&
+         fwrite(ps->new_pcs.data(), sizeof(uint32_t), n, f) == n &&
+         fwrite(ps->branches_taken.data(), sizeof(uint32_t), n, f) == n;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "Error: couldn't write %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Write a phase time series to a CSV file, one line per interval, with the
+ * op types as fractions of the interval's instructions, the CPI and the
+ * fraction of conditional branches taken.
+ *
+ * Prints an error message on failure.
+ *
+ * @param ps the series
+ * @param filename the path of the file to write
+ * @return 0 on success, or -1 on error
+ */
+int phase_series_save_csv(const PhaseSeries *ps, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't create %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "first_inst,num_inst,alu,ld,st,cbr,other,cpi,new_pcs,"
+               "taken_rate\n");
+    uint64_t first_inst = ps->first_rec;
+    for (size_t i = 0; i < ps->num_inst.size(); i++)
+    {
+        double num_inst = ps->num_inst[i] != 0 ? (double)ps->num_inst[i] : 1;
+        fprintf(f, "%lu,%u", (unsigned long)first_inst, ps->num_inst[i]);
+        for (int op = 0; op < NUM_OP_TYPES; op++)
+        {
+            fprintf(f, ",%.6f", (double)ps->op_counts[op][i] / num_inst);
+        }
+        fprintf(f, ",%.4f,%u,", (double)ps->cycles[i] / num_inst,
+                ps->new_pcs[i]);
+
+        // An interval without branches has no taken rate.
+        uint32_t branches = ps->op_counts[OP_CBR][i];
+        if (branches != 0)
+        {
+            fprintf(f, "%.6f", (double)ps->branches_taken[i] / branches);
+        }
+        fprintf(f, "\n");
+        first_inst += ps->num_inst[i];
+    }
+
+    if (fclose(f) != 0)
+    {
+        fprintf(stderr, "Error: couldn't write %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
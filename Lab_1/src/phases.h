@@ -0,0 +1,145 @@
+// phases.h
+// Declares a time series of the Lab 1 statistics of a trace, one row per
+// interval of a fixed number of instructions, for seeing how a program's
+// behavior changes over its run.
+//
+// Each row holds the interval's op type counts and cycles, the number of
+// instruction addresses first seen in it, and the number of its conditional
+// branches that were taken. .otr records don't say which way a branch went,
+// so a branch counts as taken if the next instruction isn't within
+// PHASE_MAX_INST_BYTES bytes after it, where its fall-through would be.
+//
+// The series is kept and written column by column. A phases file holds a
+// PhaseFileHeader, then for each of the header's num_rows intervals in order,
+// the columns:
+//
+//   uint32_t num_inst[num_rows];                  instructions
+//   uint32_t op_counts[NUM_OP_TYPES][num_rows];   instructions of each op type
+//   uint64_t cycles[num_rows];                    cycles of the Lab 1 model
+//   uint32_t new_pcs[num_rows];                   addresses first seen
+//   uint32_t branches_taken[num_rows];            conditional branches taken
+//
+// all little-endian. Every interval but perhaps the last has interval
+// instructions.
+
+#ifndef _PHASES_H_
+#define _PHASES_H_
+
+#include "statindex.h"
+#include "trace.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/** The first eight bytes of every phases file. */
+#define PHASE_MAGIC "ECEPHASE"
+
+/** The current version of the phases file format. */
+#define PHASE_VERSION 1
+
+/** The longest an instruction can be, in bytes (as on x86). */
+#define PHASE_MAX_INST_BYTES 15
+
+/** The header at the start of a phases file. */
+typedef struct PhaseFileHeaderStruct
+{
+    /** PHASE_MAGIC, not NUL-terminated. */
+    char magic[8];
+    /** PHASE_VERSION at the time the file was written. */
+    uint32_t version;
+    /** NUM_OP_TYPES, the number of op_counts columns. */
+    uint32_t num_op_types;
+    /** The index in the trace of the first interval's first record. */
+    uint64_t first_rec;
+    /** The number of instructions in each interval but perhaps the last. */
+    uint64_t interval;
+    /** The number of intervals. */
+    uint64_t num_rows;
+} PhaseFileHeader;
+
+/** The Lab 1 statistics of each interval of a trace. */
+typedef struct PhaseSeriesStruct
+{
+    /** The index in the trace of the first interval's first record. */
+    uint64_t first_rec;
+    /** The number of instructions in each interval but perhaps the last. */
+    uint64_t interval;
+    /** The number of instructions in each interval. */
+    std::vector<uint32_t> num_inst;
+    /** The number of instructions of each op type in each interval. */
+    std::vector<uint32_t> op_counts[NUM_OP_TYPES];
+    /** The number of cycles of each interval. */
+    std::vector<uint64_t> cycles;
+    /** The number of addresses first seen in each interval. */
+    std::vector<uint32_t> new_pcs;
+    /** The number of conditional branches taken in each interval. */
+    std::vector<uint32_t> branches_taken;
+    /** [Internal] The number of distinct addresses seen before this row. */
+    uint64_t last_unique_pcs;
+    /** [Internal] The number of branches taken so far in this row. */
+    uint32_t taken;
+    /**
+     * [Internal] The address of the conditional branch ending the last block
+     * added, whose direction the next record tells, or UINT64_MAX.
+     */
+    uint64_t pending_branch;
+    /** [Internal] Whether that branch was in the row last ended. */
+    bool pending_in_last_row;
+} PhaseSeries;
+
+/**
+ * Make a phase time series empty.
+ *
+ * @param ps the series
+ * @param first_rec the index in the trace of the first record to be added
+ * @param interval the number of instructions in each interval
+ */
+void phase_series_init(PhaseSeries *ps, uint64_t first_rec,
+                       uint64_t interval);
+
+/**
+ * Count the taken branches in the next block of records. The block must not
+ * go past the end of the current interval.
+ *
+ * @param ps the series
+ * @param recs the records
+ * @param n the number of records
+ */
+void phase_series_add(PhaseSeries *ps, const TraceRec *recs, size_t n);
+
+/**
+ * End the current interval, adding its row to the series.
+ *
+ * @param ps the series
+ * @param totals the statistics of the interval's records
+ * @param unique_pcs the number of distinct addresses seen up to the end of
+ *                   the interval
+ */
+void phase_series_end_row(PhaseSeries *ps, const StatTotals *totals,
+                          uint64_t unique_pcs);
+
+/**
+ * Write a phase time series to a phases file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param ps the series
+ * @param filename the path of the file to write
+ * @return 0 on success, or -1 on error
+ */
+int phase_series_save(const PhaseSeries *ps, const char *filename);
+
+/**
+ * Write a phase time series to a CSV file, one line per interval, with the
+ * op types as fractions of the interval's instructions, the CPI and the
+ * fraction of conditional branches taken.
+ *
+ * Prints an error message on failure.
+ *
+ * @param ps the series
+ * @param filename the path of the file to write
+ * @return 0 on success, or -1 on error
+ */
+int phase_series_save_csv(const PhaseSeries *ps, const char *filename);
+
+#endif
@@ -0,0 +1,704 @@
+// report.cpp
+// Runs the Lab 1 analyzer, sim, on several CPU traces for ECE 4100/6100 at
+// once, one per thread, and prints the Lab 1 report table that
+// scripts/genreport.ecelinsrv7 builds from the results, with the same
+// approximate score, and optionally the statistics as JSON.
+//
+// Each trace is analyzed by running sim on it, so the statistics are those
+// of the student code built into sim, just as when sim is run by hand. The
+// output of each run can be kept as the .res file scripts/runall.sh has
+// always written.
+
+#include "trace.h"
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/** The most threads -threads may ask for. */
+#define MAX_THREADS 256
+
+/**
+ * The number of statistics sim prints for a trace and the grader checks, in
+ * the order printed: instructions, cycles, CPI, unique PCs, the count of each
+ * op type and the percentage of each op type.
+ */
+#define REPORT_NUM_VALUES (4 + 2 * NUM_OP_TYPES)
+
+/** The number of course traces the grader knows the statistics of. */
+#define REPORT_NUM_REFERENCES 4
+
+/** The names sim prints the statistics under, after "LAB1_". */
+static const char *value_names[REPORT_NUM_VALUES] = {
+    "NUM_INST", "NUM_CYCLES", "CPI", "UNIQUE_PC",
+    "NUM_ALU_OP", "NUM_LD_OP", "NUM_ST_OP", "NUM_CBR_OP", "NUM_OTHER_OP",
+    "PERC_ALU_OP", "PERC_LD_OP", "PERC_ST_OP", "PERC_CBR_OP", "PERC_OTHER_OP"};
+
+/** The settings of the report. */
+typedef struct ReportParamsStruct
+{
+    /** The path of sim. */
+    std::string sim_path;
+    /** The directory to keep sim's output for each trace in, or NULL. */
+    const char *results_dir;
+    /** The path of the text report, or NULL for stdout. */
+    const char *report_filename;
+    /** The path of the JSON report, or NULL for none. */
+    const char *json_filename;
+    /** The number of traces to analyze at once. */
+    unsigned int num_threads;
+} ReportParams;
+
+/** A trace to analyze, and its statistics once analyzed. */
+typedef struct ReportTraceStruct
+{
+    /** The path of the trace file. */
+    const char *filename;
+    /** The name of the trace: its file name up to the first dot. */
+    std::string name;
+    /** Whether it was analyzed without error. */
+    bool ok;
+    /** The statistics sim printed, in the order of REPORT_NUM_VALUES. */
+    double values[REPORT_NUM_VALUES];
+} ReportTrace;
+
+/** The traces being analyzed, shared by the threads of analyze_all(). */
+typedef struct ReportPoolStruct
+{
+    /** The settings of the report. */
+    const ReportParams *params;
+    /** The traces. */
+    std::vector<ReportTrace> *traces;
+    /** The next trace for a thread to take. */
+    std::atomic<size_t> next_trace;
+} ReportPool;
+
+/** The statistics the grader expects of a course trace. */
+typedef struct ReferenceStruct
+{
+    /** The name of the trace. */
+    const char *name;
+    /** Its statistics, in the order of REPORT_NUM_VALUES. */
+    double values[REPORT_NUM_VALUES];
+} Reference;
+
+/** The statistics the grader expects, as built into genreport.ecelinsrv7. */
+static const Reference references[REPORT_NUM_REFERENCES] = {
+    {"libq", {10000000, 15454546, 1.545, 9, 3636363, 1818182, 1818182, 909091,
+              1818182, 36.364, 18.182, 18.182, 9.091, 18.182}},
+    {"bzip2", {10000000, 18227596, 1.823, 764, 917623, 4975348, 1159778,
+               1046235, 1901016, 9.176, 49.753, 11.598, 10.462, 19.010}},
+    {"mcf", {10000000, 18964224, 1.896, 524, 1653889, 4736164, 1128012,
+             1550024, 931911, 16.539, 47.362, 11.280, 15.500, 9.319}},
+    {"gcc", {10000000, 18536679, 1.854, 820, 1251981, 4165105, 2441200, 965187,
+             1176527, 12.520, 41.651, 24.412, 9.652, 11.765}},
+};
+
+int parse_args(int argc, char *argv[], std::vector<ReportTrace> *traces,
+               ReportParams *params);
+int run_sim(const char *sim_path, const char *trace_filename,
+            std::string *output);
+int parse_sim_output(ReportTrace *t, const std::string &output);
+int analyze_trace(const ReportParams *params, ReportTrace *t);
+void analyze_all(const ReportParams *params, std::vector<ReportTrace> *traces);
+bool report_score(const std::vector<ReportTrace> &traces, double *score);
+int write_report(const std::vector<ReportTrace> &traces,
+                 const char *filename);
+int write_json(const std::vector<ReportTrace> &traces, const char *filename);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    // Parse the command-line arguments.
+    std::vector<ReportTrace> traces;
+    ReportParams params;
+    int status = parse_args(argc, argv, &traces, &params);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    // Analyze every trace, several at once.
+    analyze_all(&params, &traces);
+    for (const ReportTrace &t : traces)
+    {
+        if (!t.ok)
+        {
+            return 1;
+        }
+    }
+
+    // Write the report.
+    if (write_report(traces, params.report_filename) != 0)
+    {
+        return 1;
+    }
+    if (params.json_filename != NULL &&
+        write_json(traces, params.json_filename) != 0)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], std::vector<ReportTrace> *traces,
+               ReportParams *params)
+{
+    params->results_dir = NULL;
+    params->report_filename = NULL;
+    params->json_filename = NULL;
+    params->num_threads = 0;
+
+    // By default, sim is the one built beside this program.
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    self[len > 0 ? len : 0] = '\0';
+    char *slash = strrchr(self, '/');
+    params->sim_path = slash != NULL
+                           ? std::string(self, slash + 1 - self) + "sim"
+                           : "./sim";
+
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            // Parse options.
+            if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            else if (strcmp(argv[i], "-o") == 0 ||
+                     strcmp(argv[i], "-json") == 0 ||
+                     strcmp(argv[i], "-results") == 0 ||
+                     strcmp(argv[i], "-sim") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                if (strcmp(argv[i], "-o") == 0)
+                {
+                    params->report_filename = argv[i + 1];
+                }
+                else if (strcmp(argv[i], "-json") == 0)
+                {
+                    params->json_filename = argv[i + 1];
+                }
+                else if (strcmp(argv[i], "-results") == 0)
+                {
+                    params->results_dir = argv[i + 1];
+                }
+                else
+                {
+                    params->sim_path = argv[i + 1];
+                }
+                i++;
+            }
+            else if (strcmp(argv[i], "-threads") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                char *end;
+                errno = 0;
+                long value = strtol(argv[i + 1], &end, 10);
+                if (argv[i + 1][0] == '\0' || *end != '\0' || errno != 0 ||
+                    value < 0 || value > MAX_THREADS)
+                {
+                    fprintf(stderr, "Error: argument to %s must be a number "
+                                    "from 0 to %d\n",
+                            argv[i], MAX_THREADS);
+                    return 2;
+                }
+                params->num_threads = (unsigned int)value;
+                i++;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else
+        {
+            ReportTrace t;
+            t.filename = argv[i];
+            const char *base = strrchr(argv[i], '/');
+            t.name = base != NULL ? base + 1 : argv[i];
+            t.name = t.name.substr(0, t.name.find('.'));
+            t.ok = false;
+            memset(t.values, 0, sizeof(t.values));
+            traces->push_back(t);
+        }
+    }
+
+    if (traces->empty())
+    {
+        fprintf(stderr, "Error: no trace file specified\n");
+        return 2;
+    }
+
+    // By default, analyze every trace at once, if there are cores enough.
+    if (params->num_threads == 0)
+    {
+        params->num_threads = std::thread::hardware_concurrency();
+        if (params->num_threads == 0)
+        {
+            params->num_threads = 1;
+        }
+    }
+    if (params->num_threads > traces->size())
+    {
+        params->num_threads = (unsigned int)traces->size();
+    }
+
+    return 0;
+}
+
+/**
+ * Run sim on a trace and collect what it prints. What it prints to stderr is
+ * passed through.
+ *
+ * @param sim_path the path of sim
+ * @param trace_filename the path of the trace file
+ * @param output set to what sim printed to stdout
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int run_sim(const char *sim_path, const char *trace_filename,
+            std::string *output)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "Error: couldn't create a pipe (%s)\n",
+                strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "Error: couldn't start %s (%s)\n", sim_path,
+                strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(sim_path, sim_path, trace_filename, (char *)NULL);
+        fprintf(stderr, "Error: couldn't run %s (%s)\n", sim_path,
+                strerror(errno));
+        _exit(127);
+    }
+
+    close(fds[1]);
+    char buf[4096];
+    ssize_t got;
+    output->clear();
+    while ((got = read(fds[0], buf, sizeof(buf))) > 0 ||
+           (got < 0 && errno == EINTR))
+    {
+        output->append(buf, got > 0 ? (size_t)got : 0);
+    }
+    close(fds[0]);
+
+    int wstatus;
+    if (waitpid(pid, &wstatus, 0) != pid || !WIFEXITED(wstatus) ||
+        WEXITSTATUS(wstatus) != 0)
+    {
+        fprintf(stderr, "Error: %s failed on %s\n", sim_path, trace_filename);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read the statistics of a trace from what sim printed for it, as the grader
+ * reads them.
+ *
+ * @param t the trace; its values are filled in
+ * @param output what sim printed to stdout
+ * @return 0 on success, or -1 if a statistic is missing (already reported)
+ */
+int parse_sim_output(ReportTrace *t, const std::string &output)
+{
+    // Each statistic is on a line "LAB1_<name> <padding> : <value>".
+    std::string text = "\n" + output;
+    for (int i = 0; i < REPORT_NUM_VALUES; i++)
+    {
+        std::string key = std::string("\nLAB1_") + value_names[i];
+        size_t pos = text.find(key + " ");
+        if (pos == std::string::npos)
+        {
+            pos = text.find(key + "\t");
+        }
+        size_t colon = pos != std::string::npos ? text.find(':', pos)
+                                                : std::string::npos;
+        const char *value = colon != std::string::npos
+                                ? text.c_str() + colon + 1
+                                : NULL;
+        char *end = NULL;
+        if (value != NULL)
+        {
+            t->values[i] = strtod(value, &end);
+        }
+        if (value == NULL || end == value)
+        {
+            fprintf(stderr, "Error: sim printed no LAB1_%s for %s\n",
+                    value_names[i], t->filename);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Analyze a trace by running sim on it, keeping its output as
+ * "<results_dir>/Lab1.<name>.res" if asked to.
+ *
+ * @param params the settings of the report
+ * @param t the trace; its statistics are filled in
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int analyze_trace(const ReportParams *params, ReportTrace *t)
+{
+    std::string output;
+    if (run_sim(params->sim_path.c_str(), t->filename, &output) != 0 ||
+        parse_sim_output(t, output) != 0)
+    {
+        return -1;
+    }
+
+    if (params->results_dir != NULL)
+    {
+        std::string res_filename = std::string(params->results_dir) +
+                                   "/Lab1." + t->name + ".res";
+        FILE *f = fopen(res_filename.c_str(), "w");
+        if (f == NULL)
+        {
+            fprintf(stderr, "Error: couldn't create %s (%s)\n",
+                    res_filename.c_str(), strerror(errno));
+            return -1;
+        }
+        bool ok = fwrite(output.data(), 1, output.size(), f) == output.size();
+        ok = (fclose(f) == 0) && ok;
+        if (!ok)
+        {
+            fprintf(stderr, "Error: couldn't write %s (%s)\n",
+                    res_filename.c_str(), strerror(errno));
+            return -1;
+        }
+    }
+
+    t->ok = true;
+    return 0;
+}
+
+/**
+ * [Internal] Analyze traces until there are none left, the body of each
+ * thread of analyze_all().
+ *
+ * @param pool the traces
+ */
+static void analyze_traces(ReportPool *pool)
+{
+    size_t i;
+    while ((i = pool->next_trace++) < pool->traces->size())
+    {
+        analyze_trace(pool->params, &(*pool->traces)[i]);
+    }
+}
+
+/**
+ * Analyze traces on a pool of threads, each taking the next trace not yet
+ * taken until there are none left.
+ *
+ * @param params the settings of the report
+ * @param traces the traces; ok is set on each one analyzed without error
+ */
+void analyze_all(const ReportParams *params, std::vector<ReportTrace> *traces)
+{
+    ReportPool pool;
+    pool.params = params;
+    pool.traces = traces;
+    pool.next_trace = 0;
+
+    // Anything still buffered would otherwise be printed by every sim too.
+    fflush(stdout);
+    fflush(stderr);
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < params->num_threads; t++)
+    {
+        workers.push_back(std::thread(analyze_traces, &pool));
+    }
+    analyze_traces(&pool);
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+/**
+ * [Internal] Tell whether statistics are all within 1% of those expected.
+ *
+ * @param values the statistics
+ * @param expected the statistics expected
+ * @param first the index of the first statistic to check
+ * @param end the index after the last statistic to check
+ * @return whether they are
+ */
+static bool values_match(const double *values, const double *expected,
+                         int first, int end)
+{
+    for (int i = first; i < end; i++)
+    {
+        if (!(values[i] <= 1.01 * expected[i] &&
+              values[i] >= 0.99 * expected[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Work out the approximate Lab 1 score the grader would give, if the traces
+ * include the four course traces it knows.
+ *
+ * As genreport.ecelinsrv7 does, each course trace is worth 0.5 points if its
+ * instructions, cycles and CPI are right, 0.5 if its unique PCs are, and 0.25
+ * if its op type counts and percentages are, each to within 1%.
+ *
+ * @param traces the traces analyzed
+ * @param score set to the score out of 5
+ * @return whether every course trace was among the traces
+ */
+bool report_score(const std::vector<ReportTrace> &traces, double *score)
+{
+    *score = 0;
+    for (const Reference &ref : references)
+    {
+        const ReportTrace *found = NULL;
+        for (const ReportTrace &t : traces)
+        {
+            if (t.name == ref.name)
+            {
+                found = &t;
+                break;
+            }
+        }
+        if (found == NULL)
+        {
+            return false;
+        }
+
+        *score += values_match(found->values, ref.values, 0, 3) ? 0.5 : 0;
+        *score += values_match(found->values, ref.values, 3, 4) ? 0.5 : 0;
+        *score += values_match(found->values, ref.values, 4,
+                               REPORT_NUM_VALUES)
+                      ? 0.25
+                      : 0;
+    }
+    return true;
+}
+
+/**
+ * Write the report table of the traces, laid out as genreport.ecelinsrv7
+ * lays it out, with the approximate score if the four course traces are
+ * among them.
+ *
+ * Prints an error message on failure.
+ *
+ * @param traces the traces analyzed
+ * @param filename the path of the file to write, or NULL for stdout
+ * @return 0 on success, or -1 on error
+ */
+int write_report(const std::vector<ReportTrace> &traces, const char *filename)
+{
+    FILE *f = filename != NULL ? fopen(filename, "w") : stdout;
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't create %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    // The first column is a character narrower than the rest.
+    const char *op_names[NUM_OP_TYPES] = {"ALU", "LD", "ST", "CBR", "OTHER"};
+    fprintf(f, "\nStat");
+    for (const ReportTrace &t : traces)
+    {
+        fprintf(f, "\t\t%s", t.name.c_str());
+    }
+    fprintf(f, "\n");
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        fprintf(f, "PERC_%s_OP\t", op_names[op]);
+        for (size_t i = 0; i < traces.size(); i++)
+        {
+            fprintf(f, i == 0 ? "%5.3f\t\t" : "%6.3f\t\t",
+                    traces[i].values[4 + NUM_OP_TYPES + op]);
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "CPI\t\t");
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        fprintf(f, i == 0 ? "%5.3f\t\t" : "%6.3f\t\t", traces[i].values[2]);
+    }
+    fprintf(f, "\nUNIQUE_PC\t");
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        fprintf(f, i == 0 ? "%5lu" : "\t\t%6lu",
+                (unsigned long)traces[i].values[3]);
+    }
+    fprintf(f, "\t\n");
+
+    double score;
+    if (report_score(traces, &score))
+    {
+        fprintf(f, "Your approximate score for Lab 1 out of 5 points is: %f\n",
+                score);
+    }
+    fprintf(f, "\n");
+
+    if (filename != NULL && fclose(f) != 0)
+    {
+        fprintf(stderr, "Error: couldn't write %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * [Internal] Write a string as a JSON string literal.
+ *
+ * @param f the file to write to
+ * @param s the string
+ */
+static void json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s != '\0'; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            fprintf(f, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(f, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * Write the statistics of the traces as JSON: an object with a "traces"
+ * array, one object per trace, and the approximate "score" if the four
+ * course traces are among them.
+ *
+ * Prints an error message on failure.
+ *
+ * @param traces the traces analyzed
+ * @param filename the path of the file to write
+ * @return 0 on success, or -1 on error
+ */
+int write_json(const std::vector<ReportTrace> &traces, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't create %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    const char *op_names[NUM_OP_TYPES] = {"alu", "ld", "st", "cbr", "other"};
+    fprintf(f, "{\n  \"traces\": [");
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        const ReportTrace &t = traces[i];
+        fprintf(f, i == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ");
+        json_string(f, t.name.c_str());
+        fprintf(f, ", \"file\": ");
+        json_string(f, t.filename);
+        fprintf(f, ",\n     \"num_inst\": %lu, \"num_cycles\": %lu, "
+                   "\"cpi\": %.3f, \"unique_pc\": %lu,\n     \"op_counts\": {",
+                (unsigned long)t.values[0], (unsigned long)t.values[1],
+                t.values[2], (unsigned long)t.values[3]);
+        for (int op = 0; op < NUM_OP_TYPES; op++)
+        {
+            fprintf(f, "%s\"%s\": %lu", op == 0 ? "" : ", ", op_names[op],
+                    (unsigned long)t.values[4 + op]);
+        }
+        fprintf(f, "},\n     \"op_percents\": {");
+        for (int op = 0; op < NUM_OP_TYPES; op++)
+        {
+            fprintf(f, "%s\"%s\": %.3f", op == 0 ? "" : ", ", op_names[op],
+                    t.values[4 + NUM_OP_TYPES + op]);
+        }
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n  ]");
+
+    double score;
+    if (report_score(traces, &score))
+    {
+        fprintf(f, ",\n  \"score\": %.6f", score);
+    }
+    fprintf(f, "\n}\n");
+
+    if (fclose(f) != 0)
+    {
+        fprintf(stderr, "Error: couldn't write %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file>...\n\n", program_name);
+    fprintf(stderr, "Runs sim on several CPU traces at once and prints the Lab 1 report table\n");
+    fprintf(stderr, "of them\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -o <file>           Write the report to <file> instead of the screen\n");
+    fprintf(stderr, "    -json <file>        Also write the statistics to <file> as JSON\n");
+    fprintf(stderr, "    -results <dir>      Keep the output of sim for each trace in\n");
+    fprintf(stderr, "                        <dir>/Lab1.<trace>.res\n");
+    fprintf(stderr, "    -sim <path>         Run the sim at <path> (default: the one beside\n");
+    fprintf(stderr, "                        this program)\n");
+    fprintf(stderr, "    -threads <num>      Analyze at most <num> traces at once, or one per\n");
+    fprintf(stderr, "                        core if 0 (default 0)\n");
+}
@@ -6,11 +6,28 @@
 // Reads and analyzes a CPU trace file for ECE 4100/6100.
 // Author: Rishov Sarkar
 
+#include "bbv.h"
+#include "codefootprint.h"
+#include "hotpcs.h"
+#include "labstats.h"
+#include "phases.h"
+#include "simpoints.h"
+#include "stackdist.h"
+#include "statindex.h"
 #include "trace.h"
+#include "tracefmt.h"
+#include "tracereader.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <map>
+#include <mutex>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
 
 /** Total number of instructions executed. Updated in this file. */
 extern uint64_t stat_num_inst;
@@ -37,101 +54,1292 @@ extern uint64_t stat_num_cycle;
  */
 extern uint64_t stat_unique_pc;
 
-int read_trace(int fd);
-void print_stats();
+/** Whether student code tracks unique PCs exactly. Cleared by -sketch. */
+extern bool track_unique_pcs;
+
+/** The cycles taken by an instruction of each op type. From student code. */
+extern uint64_t op_cycles[NUM_OP_TYPES];
+
+/** The most threads -threads may ask for. */
+#define MAX_THREADS 256
+
+/** The most line sizes or associativities -mrc or -assoc may list. */
+#define MAX_MRC_CONFIGS 8
+
+/** The smallest and largest I-cache sizes in KB given a miss ratio. */
+#define MRC_MIN_CACHE_KB 1
+#define MRC_MAX_CACHE_KB 2048
+
+/** The options given on the command line. */
+typedef struct SimArgsStruct
+{
+    /** The path of the trace file. */
+    char *trace_filename;
+    /** The number of records to skip (-skip). */
+    uint64_t trace_skip;
+    /** The largest number of records to analyze, or 0 for all (-window). */
+    uint64_t trace_window;
+    /** Whether to use an up-to-date statistics index (not -noindex). */
+    bool use_index;
+    /** Whether a scan of the whole trace writes its index (-index). */
+    bool write_index;
+    /** The precision of the footprint sketches, or 0 for none (-sketch). */
+    int sketch_bits;
+    /** The number of threads to analyze on (-threads). */
+    unsigned int num_threads;
+    /** The number of most executed instructions to list (-hotpcs). */
+    size_t num_hot_pcs;
+    /** Whether to count code lines and pages touched exactly (-footprint). */
+    bool code_footprint;
+    /** The I-cache line sizes to give miss ratios for, if any (-mrc). */
+    std::vector<long> mrc_line_sizes;
+    /** The associativities to give them for, 0 meaning full (-assoc). */
+    std::vector<long> mrc_assocs;
+    /** If not NULL, the simpoints file to write instead (-simpoints). */
+    char *simpoints_filename;
+    /** The largest number of simpoints to pick (-maxk). */
+    long simpoint_max_k;
+    /** If not NULL, the phases file to write (-phases). */
+    char *phases_filename;
+    /** If not NULL, the phases CSV file to write (-phasecsv). */
+    char *phases_csv_filename;
+    /** The number of instructions in each simpoint or phase (-interval). */
+    uint64_t interval;
+} SimArgs;
+
+/**
+ * What a scan gathers besides the statistics, each only if asked for on the
+ * command line.
+ */
+typedef struct ScanExtrasStruct
+{
+    /** With -sketch, sketches of the footprint; otherwise NULL. */
+    FootprintSketch *footprint;
+    /** With -hotpcs, the most executed instructions; otherwise NULL. */
+    HotPcs *hot_pcs;
+    /** With -mrc, a stack distance profile for each line size; else NULL. */
+    std::vector<StackDist> *icache;
+    /** With -phases or -phasecsv, the time series; otherwise NULL. */
+    PhaseSeries *phases;
+    /** With -footprint, the code lines and pages touched; otherwise NULL. */
+    CodeFootprint *code;
+} ScanExtras;
+
+/** A scan of a trace shared by the threads of read_parallel(). */
+typedef struct ParallelScanStruct
+{
+    /** The path of the trace file. */
+    const char *trace_filename;
+    /** The index of the first record to analyze. */
+    uint64_t first_rec;
+    /** The index of the record after the last one to analyze. */
+    uint64_t end_rec;
+    /** The number of chunks the records are divided into. */
+    uint64_t num_chunks;
+    /** The next chunk for a thread to take. */
+    std::atomic<uint64_t> next_chunk;
+    /** Set once any thread has run into an error. */
+    std::atomic<bool> failed;
+    /** If not NULL, the index to put each chunk in. */
+    StatIndexWriter *writer;
+    /** If not NULL, the tracker to merge each chunk's hot PCs into. */
+    HotPcs *hot_pcs;
+    /** Held while merging hot PCs. */
+    std::mutex hot_lock;
+    /** The next chunk whose hot PCs are to be merged. */
+    uint64_t hot_next;
+    /** The hot PCs of chunks finished ahead of hot_next, by chunk. */
+    std::map<uint64_t, HotPcs *> hot_pending;
+} ParallelScan;
+
+int parse_args(int argc, char *argv[], SimArgs *args);
+int parse_count(const char *option, const char *arg, uint64_t *count);
+int parse_int(const char *option, const char *arg, long min, long max,
+              long *value);
+int parse_int_list(const char *option, const char *arg, long min, long max,
+                   std::vector<long> *values);
+int read_trace(TraceReader *trace, StatIndexWriter *writer, PcSketch *pcs,
+               const ScanExtras *extras);
+int read_whole(const char *trace_filename, uint64_t trace_skip,
+               uint64_t trace_window, StatIndexWriter *writer,
+               const ScanExtras *extras);
+int read_parallel(const char *trace_filename, uint64_t trace_skip,
+                  uint64_t trace_window, unsigned int num_threads,
+                  StatIndexWriter *writer, const ScanExtras *extras);
+int read_range(const char *trace_filename, uint64_t first, uint64_t count,
+               PcSketch *pcs);
+int find_simpoints(const SimArgs *args);
+int read_indexed(StatIndex *index, const char *trace_filename,
+                 uint64_t trace_skip, uint64_t trace_window);
+void print_stats(FootprintSketch *footprint);
+void print_hot_pcs(const HotPcs *hot_pcs, size_t k);
+void print_icache_mrc(const StackDist *sd, const std::vector<long> &assocs);
+void print_code_footprint(const CodeFootprint *cf);
+void print_usage(char *program_name);
 
 int main(int argc, char *argv[])
 {
     int status;
 
-    if (argc != 2)
+    // Parse the command-line arguments.
+    SimArgs args;
+    status = parse_args(argc, argv, &args);
+    if (status != 0)
     {
-        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
-        return 2;
+        return status;
     }
+    const char *trace_filename = args.trace_filename;
+    uint64_t trace_skip = args.trace_skip;
+    uint64_t trace_window = args.trace_window;
 
-    // Open the trace file using gunzip.
-    // Uses the traditional pipe/fork/exec method.
-    printf("Opening trace file with gunzip: %s\n", argv[1]);
+    // With -simpoints, the trace is only cut into intervals and clustered.
+    if (args.simpoints_filename != NULL)
+    {
+        return find_simpoints(&args) == 0 ? 0 : 1;
+    }
 
-    int pipefd[2];
-    status = pipe(pipefd);
-    if (status != 0)
+    // With -sketch, footprints are estimated in fixed memory during a scan.
+    // An index holds exact counts, so it is neither used nor written.
+    FootprintSketch footprint;
+    HotPcs hot_pcs;
+    std::vector<StackDist> icache;
+    PhaseSeries phases;
+    CodeFootprint code;
+    ScanExtras extras = {NULL, NULL, NULL, NULL, NULL};
+    bool use_index = args.use_index;
+    if (args.sketch_bits != 0)
     {
-        perror("Couldn't create pipe");
-        return 1;
+        footprint_sketch_init(&footprint, args.sketch_bits);
+        extras.footprint = &footprint;
+        track_unique_pcs = false;
+        use_index = false;
     }
+    if (args.num_hot_pcs != 0)
+    {
+        extras.hot_pcs = &hot_pcs;
+    }
+    if (!args.mrc_line_sizes.empty())
+    {
+        icache.resize(args.mrc_line_sizes.size());
+        for (size_t i = 0; i < icache.size(); i++)
+        {
+            stack_dist_init(&icache[i],
+                            __builtin_ctzl(args.mrc_line_sizes[i]));
+        }
+        extras.icache = &icache;
 
-    pid_t pid = fork();
-    if (pid == -1)
+        // Stack distances depend on every access before, so they can't be
+        // found for chunks apart.
+        if (args.num_threads != 1)
+        {
+            fprintf(stderr, "Note: -mrc analyzes the trace on one thread\n");
+            args.num_threads = 1;
+        }
+    }
+    if (args.phases_filename != NULL || args.phases_csv_filename != NULL)
     {
-        perror("Couldn't fork");
-        return 1;
+        phase_series_init(&phases, trace_skip, args.interval);
+        extras.phases = &phases;
+
+        // Addresses are new to an interval only if no interval before had
+        // them, so intervals must be analyzed in order.
+        if (args.num_threads != 1)
+        {
+            fprintf(stderr, "Note: -phases analyzes the trace on one thread\n");
+            args.num_threads = 1;
+        }
     }
+    if (args.code_footprint)
+    {
+        code_footprint_init(&code);
+        extras.code = &code;
 
-    if (pid == 0)
+        // So must they be for the footprint's growth.
+        if (args.num_threads != 1)
+        {
+            fprintf(stderr, "Note: -footprint analyzes the trace on one thread\n");
+            args.num_threads = 1;
+        }
+    }
+
+    printf("Opening trace file: %s\n", trace_filename);
+    if (trace_skip > 0)
     {
-        // Child process: exec gunzip.
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[0]);
-        close(pipefd[1]);
-        execlp("gunzip", "gunzip", "-c", argv[1], NULL);
-        perror("Couldn't exec gunzip");
-        fprintf(stderr, "Is gunzip installed?\n");
-        return 127;
+        printf("Starting at instruction %lu\n", (unsigned long)trace_skip);
     }
 
-    // Parent process: read the trace file.
-    int trace_fd = pipefd[0];
-    close(pipefd[1]);
-    status = read_trace(trace_fd);
-    close(trace_fd);
-    if (status != 0)
+    // If the trace has an up-to-date statistics index, answer from that,
+    // reading only the records in partly covered chunks at either end. The
+    // index doesn't keep each instruction, so -hotpcs, -mrc, -phases and
+    // -footprint need a scan.
+    StatIndex *index = use_index && extras.hot_pcs == NULL &&
+                               extras.icache == NULL &&
+                               extras.phases == NULL && extras.code == NULL
+                           ? stat_index_load(trace_filename, sizeof(TraceRec))
+                           : NULL;
+    if (index != NULL)
     {
-        return 1;
+        printf("Using statistics index: %s%s\n", trace_filename,
+               STAT_INDEX_SUFFIX);
+        status = read_indexed(index, trace_filename, trace_skip,
+                              trace_window);
+        stat_index_free(index);
+        if (status != 0)
+        {
+            return 1;
+        }
+        print_stats(NULL);
+        return 0;
     }
 
-    // Wait for the child process to finish.
-    waitpid(pid, &status, 0);
-    status = WEXITSTATUS(status);
-    if (status == 127)
+    // Otherwise, scan the trace, on several threads if asked to and the
+    // trace can be divided up. With -index, a scan of the whole trace also
+    // builds its index for next time.
+    StatIndexWriter *writer = NULL;
+    if (use_index && args.write_index && trace_skip == 0 && trace_window == 0)
+    {
+        writer = stat_index_writer_open(trace_filename, sizeof(TraceRec));
+    }
+    status = 1;
+    if (args.num_threads != 1)
+    {
+        status = read_parallel(trace_filename, trace_skip, trace_window,
+                               args.num_threads, writer, &extras);
+    }
+    if (status == 1)
+    {
+        status = read_whole(trace_filename, trace_skip, trace_window, writer,
+                            &extras);
+    }
+    if (status != 0)
     {
+        stat_index_writer_discard(writer);
         return 1;
     }
+    if (writer != NULL)
+    {
+        // Not being able to write the index is no reason to fail.
+        stat_index_writer_close(writer, stat_unique_pc);
+    }
 
     // Print statistics.
-    print_stats();
+    print_stats(extras.footprint);
+    if (extras.hot_pcs != NULL)
+    {
+        print_hot_pcs(extras.hot_pcs, args.num_hot_pcs);
+    }
+    for (const StackDist &sd : icache)
+    {
+        print_icache_mrc(&sd, args.mrc_assocs);
+    }
+    if (extras.code != NULL)
+    {
+        code_footprint_finish(extras.code);
+        print_code_footprint(extras.code);
+    }
+    if (args.phases_filename != NULL)
+    {
+        if (phase_series_save(&phases, args.phases_filename) != 0)
+        {
+            return 1;
+        }
+        printf("Wrote phases file: %s\n", args.phases_filename);
+    }
+    if (args.phases_csv_filename != NULL)
+    {
+        if (phase_series_save_csv(&phases, args.phases_csv_filename) != 0)
+        {
+            return 1;
+        }
+        printf("Wrote phases CSV file: %s\n", args.phases_csv_filename);
+    }
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], SimArgs *args)
+{
+    args->trace_filename = NULL;
+    args->trace_skip = 0;
+    args->trace_window = 0;
+    args->use_index = true;
+    args->write_index = false;
+    args->sketch_bits = 0;
+    args->num_threads = 1;
+    args->num_hot_pcs = 0;
+    args->code_footprint = false;
+    args->mrc_line_sizes.clear();
+    args->mrc_assocs.clear();
+    args->simpoints_filename = NULL;
+    args->simpoint_max_k = 0;
+    args->phases_filename = NULL;
+    args->phases_csv_filename = NULL;
+    args->interval = 0;
+
+    if (argc < 2)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            // Parse options.
+            if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            else if (strcmp(argv[i], "-skip") == 0 ||
+                     strcmp(argv[i], "-window") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                uint64_t *count = argv[i][1] == 's' ? &args->trace_skip
+                                                    : &args->trace_window;
+                if (parse_count(argv[i], argv[i + 1], count) != 0)
+                {
+                    return 2;
+                }
+                i++;
+            }
+            else if (strcmp(argv[i], "-noindex") == 0)
+            {
+                args->use_index = false;
+            }
+            else if (strcmp(argv[i], "-index") == 0)
+            {
+                args->write_index = true;
+            }
+            else if (strcmp(argv[i], "-footprint") == 0)
+            {
+                args->code_footprint = true;
+            }
+            else if (strcmp(argv[i], "-simpoints") == 0 ||
+                     strcmp(argv[i], "-phases") == 0 ||
+                     strcmp(argv[i], "-phasecsv") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                if (strcmp(argv[i], "-simpoints") == 0)
+                {
+                    args->simpoints_filename = argv[i + 1];
+                }
+                else if (strcmp(argv[i], "-phases") == 0)
+                {
+                    args->phases_filename = argv[i + 1];
+                }
+                else
+                {
+                    args->phases_csv_filename = argv[i + 1];
+                }
+                i++;
+            }
+            else if (strcmp(argv[i], "-interval") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                if (parse_count(argv[i], argv[i + 1],
+                                &args->interval) != 0)
+                {
+                    return 2;
+                }
+                if (args->interval == 0 || args->interval > UINT32_MAX)
+                {
+                    fprintf(stderr, "Error: -interval must be from 1 to %lu\n",
+                            (unsigned long)UINT32_MAX);
+                    return 2;
+                }
+                i++;
+            }
+            else if (strcmp(argv[i], "-sketch") == 0 ||
+                     strcmp(argv[i], "-threads") == 0 ||
+                     strcmp(argv[i], "-hotpcs") == 0 ||
+                     strcmp(argv[i], "-maxk") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                long value;
+                if (strcmp(argv[i], "-sketch") == 0)
+                {
+                    if (parse_int(argv[i], argv[i + 1], HLL_MIN_BITS,
+                                  HLL_MAX_BITS, &value) != 0)
+                    {
+                        return 2;
+                    }
+                    args->sketch_bits = (int)value;
+                }
+                else if (strcmp(argv[i], "-threads") == 0)
+                {
+                    if (parse_int(argv[i], argv[i + 1], 0, MAX_THREADS,
+                                  &value) != 0)
+                    {
+                        return 2;
+                    }
+                    args->num_threads = value != 0
+                                            ? (unsigned int)value
+                                            : std::thread::hardware_concurrency();
+                    if (args->num_threads == 0)
+                    {
+                        args->num_threads = 1;
+                    }
+                }
+                else if (strcmp(argv[i], "-hotpcs") == 0)
+                {
+                    if (parse_int(argv[i], argv[i + 1], 1, HOT_PCS_COUNTERS,
+                                  &value) != 0)
+                    {
+                        return 2;
+                    }
+                    args->num_hot_pcs = (size_t)value;
+                }
+                else
+                {
+                    if (parse_int(argv[i], argv[i + 1], 1, BBV_MAX_K,
+                                  &value) != 0)
+                    {
+                        return 2;
+                    }
+                    args->simpoint_max_k = value;
+                }
+                i++;
+            }
+            else if (strcmp(argv[i], "-mrc") == 0 ||
+                     strcmp(argv[i], "-assoc") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                bool mrc = strcmp(argv[i], "-mrc") == 0;
+                std::vector<long> *values = mrc ? &args->mrc_line_sizes
+                                                : &args->mrc_assocs;
+                if (parse_int_list(argv[i], argv[i + 1], mrc ? 4 : 0,
+                                   mrc ? 4096 : 64, values) != 0)
+                {
+                    return 2;
+                }
+                for (long value : *values)
+                {
+                    if ((value & (value - 1)) != 0)
+                    {
+                        fprintf(stderr, "Error: %s takes powers of two\n",
+                                argv[i]);
+                        return 2;
+                    }
+                }
+                i++;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else
+        {
+            if (args->trace_filename != NULL)
+            {
+                fprintf(stderr, "Error: only one trace file may be specified\n");
+                return 2;
+            }
+
+            args->trace_filename = argv[i];
+        }
+    }
+
+    if (!args->mrc_assocs.empty() && args->mrc_line_sizes.empty())
+    {
+        fprintf(stderr, "Error: -assoc needs -mrc\n");
+        return 2;
+    }
+    bool phases = args->phases_filename != NULL ||
+                  args->phases_csv_filename != NULL;
+    if (args->simpoint_max_k != 0 && args->simpoints_filename == NULL)
+    {
+        fprintf(stderr, "Error: -maxk needs -simpoints\n");
+        return 2;
+    }
+    if (args->interval != 0 && args->simpoints_filename == NULL && !phases)
+    {
+        fprintf(stderr, "Error: -interval needs -simpoints or -phases\n");
+        return 2;
+    }
+    if (args->interval == 0)
+    {
+        args->interval = BBV_DEFAULT_INTERVAL;
+    }
+    if (args->simpoint_max_k == 0)
+    {
+        args->simpoint_max_k = BBV_DEFAULT_MAX_K;
+    }
+
+    if (args->mrc_assocs.empty())
+    {
+        // Fully associative, then direct-mapped up to 8 ways.
+        long assocs[] = {0, 1, 2, 4, 8};
+        args->mrc_assocs.assign(assocs, assocs + 5);
+    }
+
+    if (args->trace_filename == NULL)
+    {
+        fprintf(stderr, "Error: no trace file specified\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse a non-negative instruction count given to an option.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param count set to the count
+ * @return 0 on success, or 2 if arg is not a valid count
+ */
+int parse_count(const char *option, const char *arg, uint64_t *count)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number of instructions\n",
+                option);
+        return 2;
+    }
+
+    *count = value;
     return 0;
 }
 
-int read_trace(int fd)
+/**
+ * Parse an integer given to an option.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param min the smallest value allowed
+ * @param max the largest value allowed
+ * @param value set to the integer
+ * @return 0 on success, or 2 if arg is not an integer from min to max
+ */
+int parse_int(const char *option, const char *arg, long min, long max,
+              long *value)
 {
-    TraceRec trace_record;
+    char *end;
+    errno = 0;
+    *value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || *value < min ||
+        *value > max)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number from %ld to "
+                        "%ld\n",
+                option, min, max);
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * Parse a comma-separated list of integers given to an option.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param min the smallest value allowed
+ * @param max the largest value allowed
+ * @param values set to the integers, at most MAX_MRC_CONFIGS of them
+ * @return 0 on success, or 2 if arg is not such a list
+ */
+int parse_int_list(const char *option, const char *arg, long min, long max,
+                   std::vector<long> *values)
+{
+    values->clear();
+    const char *start = arg;
     while (true)
     {
-        ssize_t bytes_read = read(fd, &trace_record, sizeof(trace_record));
-        if (bytes_read == 0)
+        const char *comma = strchr(start, ',');
+        std::string item = comma != NULL ? std::string(start, comma - start)
+                                         : std::string(start);
+        long value;
+        if (parse_int(option, item.c_str(), min, max, &value) != 0)
+        {
+            return 2;
+        }
+        if (values->size() == MAX_MRC_CONFIGS)
+        {
+            fprintf(stderr, "Error: %s takes at most %d values\n", option,
+                    MAX_MRC_CONFIGS);
+            return 2;
+        }
+        values->push_back(value);
+        if (comma == NULL)
         {
             return 0;
         }
-        if (bytes_read == -1)
+        start = comma + 1;
+    }
+}
+
+/**
+ * Add a block of records to what a scan gathers besides the statistics.
+ *
+ * @param extras what to add the records to
+ * @param recs the records
+ * @param n the number of records
+ */
+static void scan_extras_add(const ScanExtras *extras, const TraceRec *recs,
+                            size_t n)
+{
+    if (extras->footprint != NULL)
+    {
+        for (size_t i = 0; i < n; i++)
         {
-            perror("Couldn't read from pipe");
-            return -1;
+            footprint_sketch_add(extras->footprint, recs[i].inst_addr);
+        }
+    }
+    if (extras->hot_pcs != NULL)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            hot_pcs_add(extras->hot_pcs, recs[i].inst_addr, recs[i].optype);
         }
-        if (bytes_read != sizeof(trace_record) || trace_record.optype >= NUM_OP_TYPES)
+    }
+    if (extras->icache != NULL)
+    {
+        for (StackDist &sd : *extras->icache)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                stack_dist_add(&sd, recs[i].inst_addr);
+            }
+        }
+    }
+    if (extras->phases != NULL)
+    {
+        phase_series_add(extras->phases, recs, n);
+    }
+    if (extras->code != NULL)
+    {
+        code_footprint_add(extras->code, recs, n);
+    }
+}
+
+/**
+ * Get the statistics gathered since the last call.
+ *
+ * @param last the totals as of the last call; updated to the current ones
+ * @param totals set to the difference
+ */
+static void take_totals(StatTotals *last, StatTotals *totals)
+{
+    StatTotals now;
+    now.num_recs = stat_num_inst;
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        now.op_counts[op] = stat_optype_dyn[op];
+        totals->op_counts[op] = now.op_counts[op] - last->op_counts[op];
+    }
+    now.cycles = stat_num_cycle;
+    totals->num_recs = now.num_recs - last->num_recs;
+    totals->cycles = now.cycles - last->cycles;
+    *last = now;
+}
+
+/**
+ * End a phase interval with the statistics gathered since the last one.
+ *
+ * @param phases the time series
+ * @param last the totals as of the last interval's end; updated
+ * @param footprint if not NULL, the sketches to estimate the number of
+ *                  distinct addresses from, because they aren't tracked
+ *                  exactly
+ */
+static void end_phase(PhaseSeries *phases, StatTotals *last,
+                      FootprintSketch *footprint)
+{
+    StatTotals totals;
+    take_totals(last, &totals);
+    uint64_t unique_pcs = footprint != NULL
+                              ? (uint64_t)(hll_estimate(&footprint->pcs) + 0.5)
+                              : stat_unique_pc;
+    phase_series_end_row(phases, &totals, unique_pcs);
+}
+
+/**
+ * Analyze every record the reader has left.
+ *
+ * @param trace the trace reader
+ * @param writer if not NULL, the index to add each chunk of records to
+ * @param pcs if not NULL, the sketch to add each record's address to; must
+ *            not be NULL if writer isn't
+ * @param extras if not NULL, what else to gather from the records
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int read_trace(TraceReader *trace, StatIndexWriter *writer, PcSketch *pcs,
+               const ScanExtras *extras)
+{
+    StatTotals last;
+    StatTotals chunk;
+    take_totals(&last, &chunk);
+    uint64_t chunk_left = STAT_INDEX_CHUNK_RECS;
+    PhaseSeries *phases = extras != NULL ? extras->phases : NULL;
+    StatTotals phase_last = last;
+    uint64_t phase_left = phases != NULL ? phases->interval : UINT64_MAX;
+
+    // Walk the trace one buffer-sized block at a time, analyzing records in
+    // place in the reader's buffer. Blocks are cut short at the end of each
+    // index chunk and each phase interval.
+    TraceSpan<TraceRec> block;
+    while ((block = trace_next_span<TraceRec>(
+                trace, std::min(chunk_left, phase_left)))
+               .size() > 0)
+    {
+        // Update statistics.
+        if (analyze_trace_block(block.data, block.count) != block.count)
         {
             fprintf(stderr, "Error: Invalid trace file\n");
             return -1;
         }
+        stat_num_inst += block.count;
 
-        // Update statistics.
-        stat_num_inst++;
-        analyze_trace_record(&trace_record);
+        if (pcs != NULL)
+        {
+            for (const TraceRec &trace_record : block)
+            {
+                pc_sketch_add(pcs, trace_record.inst_addr);
+            }
+        }
+        if (extras != NULL)
+        {
+            scan_extras_add(extras, block.data, block.count);
+        }
+
+        if (writer != NULL && (chunk_left -= block.count) == 0)
+        {
+            take_totals(&last, &chunk);
+            stat_index_writer_add(writer, &chunk, pcs);
+            pc_sketch_clear(pcs);
+            chunk_left = STAT_INDEX_CHUNK_RECS;
+        }
+        if (phases != NULL && (phase_left -= block.count) == 0)
+        {
+            end_phase(phases, &phase_last, extras->footprint);
+            phase_left = phases->interval;
+        }
+    }
+
+    // trace_next_span() has already reported any error.
+    if (trace->error)
+    {
+        return -1;
+    }
+    if (writer != NULL && chunk_left < STAT_INDEX_CHUNK_RECS)
+    {
+        take_totals(&last, &chunk);
+        stat_index_writer_add(writer, &chunk, pcs);
+    }
+    if (phases != NULL && phase_left < phases->interval)
+    {
+        end_phase(phases, &phase_last, extras->footprint);
+    }
+    return 0;
+}
+
+/**
+ * Analyze a range of a trace on this thread, with the reader decompressing
+ * or decoding it on a background thread.
+ *
+ * @param trace_filename the path of the trace file
+ * @param trace_skip the index of the first record to analyze
+ * @param trace_window the number of records to analyze, or 0 for all of them
+ *                     up to the end of the trace
+ * @param writer if not NULL, the index to add each chunk of records to
+ * @param extras what else to gather from the records
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int read_whole(const char *trace_filename, uint64_t trace_skip,
+               uint64_t trace_window, StatIndexWriter *writer,
+               const ScanExtras *extras)
+{
+    TraceReader *trace = trace_open_range(trace_filename, sizeof(TraceRec),
+                                          TRACE_OPEN_ASYNC, trace_skip,
+                                          trace_window);
+    if (trace == NULL)
+    {
+        return -1;
+    }
+
+    PcSketch pcs;
+    int status = read_trace(trace, writer, writer != NULL ? &pcs : NULL,
+                            extras);
+    trace_close(trace);
+    return status;
+}
+
+/**
+ * [Internal] Merge the hot PCs of a chunk into those of a parallel scan,
+ * once those of every chunk before it have been.
+ *
+ * Merging isn't exact once more addresses are seen than there are counters,
+ * so chunks are merged in order to give the same result however many threads
+ * there are. A chunk finished early waits in hot_pending.
+ *
+ * @param scan the scan
+ * @param chunk_no the number of the chunk
+ * @param chunk the chunk's hot PCs, taken over and freed
+ */
+static void scan_merge_hot_pcs(ParallelScan *scan, uint64_t chunk_no,
+                               HotPcs *chunk)
+{
+    std::lock_guard<std::mutex> guard(scan->hot_lock);
+    scan->hot_pending[chunk_no] = chunk;
+    std::map<uint64_t, HotPcs *>::iterator it;
+    while ((it = scan->hot_pending.find(scan->hot_next)) !=
+           scan->hot_pending.end())
+    {
+        hot_pcs_merge(scan->hot_pcs, it->second);
+        delete it->second;
+        scan->hot_pending.erase(it);
+        scan->hot_next++;
+    }
+}
+
+/**
+ * [Internal] Analyze chunks of a trace until there are none left, the body
+ * of each thread of read_parallel().
+ *
+ * Each chunk is read with its own reader, decompressed or decoded on this
+ * thread, into statistics of its own, which are then merged into the
+ * thread's and, for an index, put in it.
+ *
+ * @param scan the scan the thread is part of
+ * @param stats the thread's statistics
+ */
+static void scan_chunks(ParallelScan *scan, LabStats *stats)
+{
+    LabStats chunk;
+    uint64_t i;
+    while (!scan->failed && (i = scan->next_chunk++) < scan->num_chunks)
+    {
+        uint64_t first = scan->first_rec + i * STAT_INDEX_CHUNK_RECS;
+        uint64_t count = scan->end_rec - first < STAT_INDEX_CHUNK_RECS
+                             ? scan->end_rec - first
+                             : STAT_INDEX_CHUNK_RECS;
+        TraceReader *trace = trace_open_range(scan->trace_filename,
+                                              sizeof(TraceRec), 0, first,
+                                              count);
+        if (trace == NULL)
+        {
+            scan->failed = true;
+            return;
+        }
+
+        lab_stats_init(&chunk, stats->sketch_bits);
+        HotPcs *hot_pcs = scan->hot_pcs != NULL ? new HotPcs() : NULL;
+        TraceSpan<TraceRec> block;
+        while ((block = trace_next_span<TraceRec>(trace)).size() > 0)
+        {
+            if (lab_stats_add_block(&chunk, block.data, block.count) !=
+                block.count)
+            {
+                if (!scan->failed.exchange(true))
+                {
+                    fprintf(stderr, "Error: Invalid trace file\n");
+                }
+                break;
+            }
+            if (hot_pcs != NULL)
+            {
+                for (const TraceRec &trace_record : block)
+                {
+                    hot_pcs_add(hot_pcs, trace_record.inst_addr,
+                                trace_record.optype);
+                }
+            }
+        }
+        bool ok = !trace->error && !scan->failed;
+        trace_close(trace);
+        if (!ok)
+        {
+            delete hot_pcs;
+            scan->failed = true;
+            return;
+        }
+        if (hot_pcs != NULL)
+        {
+            scan_merge_hot_pcs(scan, i, hot_pcs);
+        }
+
+        // Merge before the index may turn the chunk's list into a sketch.
+        lab_stats_merge(stats, &chunk);
+        if (scan->writer != NULL)
+        {
+            stat_index_writer_put(scan->writer, i, &chunk.totals,
+                                  &chunk.pcs);
+        }
+    }
+}
+
+/**
+ * Analyze a range of a trace on several threads.
+ *
+ * The range is divided into chunks of STAT_INDEX_CHUNK_RECS records, which
+ * the threads take in turn, each reading its own. Their statistics are merged
+ * at the end, which gives the same results however many threads there are.
+ * This needs the number of records in the trace up front, which packed traces
+ * and gzip traces with an index have; for others, nothing is done.
+ *
+ * @param trace_filename the path of the trace file
+ * @param trace_skip the index of the first record to analyze
+ * @param trace_window the number of records to analyze, or 0 for all of them
+ *                     up to the end of the trace
+ * @param num_threads the number of threads to analyze on
+ * @param writer if not NULL, the index to put each chunk in; trace_skip must
+ *               be 0
+ * @param extras what else to gather from the records; with a footprint,
+ *               that is estimated instead of counting unique PCs exactly
+ * @return 0 on success, 1 if the trace can't be divided up (in which case
+ *         nothing has been done), or -1 on error (already reported)
+ */
+int read_parallel(const char *trace_filename, uint64_t trace_skip,
+                  uint64_t trace_window, unsigned int num_threads,
+                  StatIndexWriter *writer, const ScanExtras *extras)
+{
+    // Threads count with count_trace_block(), which student code need not
+    // have.
+    uint64_t no_counts[NUM_OP_TYPES] = {0};
+    uint64_t no_cycles = 0;
+    if (count_trace_block(NULL, 0, no_counts, &no_cycles) ==
+        TRACE_BLOCK_UNSUPPORTED)
+    {
+        fprintf(stderr, "Note: studentwork.cpp has no count_trace_block(); "
+                        "analyzing the trace on one thread\n");
+        return 1;
+    }
+
+    TraceReader *probe = trace_open(trace_filename, sizeof(TraceRec), 0);
+    if (probe == NULL)
+    {
+        return -1;
+    }
+    uint64_t total = probe->total_recs;
+    trace_close(probe);
+    if (total == 0)
+    {
+        fprintf(stderr, "Note: %s has no index; analyzing it on one thread "
+                        "(build one with tools/traceindex)\n",
+                trace_filename);
+        return 1;
+    }
+    if (trace_skip >= total)
+    {
+        // Let the scan on one thread report it.
+        return 1;
+    }
+
+    ParallelScan scan;
+    scan.trace_filename = trace_filename;
+    scan.first_rec = trace_skip;
+    scan.end_rec = trace_window == 0 || trace_window > total - trace_skip
+                       ? total
+                       : trace_skip + trace_window;
+    scan.num_chunks = (scan.end_rec - scan.first_rec + STAT_INDEX_CHUNK_RECS - 1) /
+                      STAT_INDEX_CHUNK_RECS;
+    scan.next_chunk = 0;
+    scan.failed = false;
+    scan.writer = writer;
+    scan.hot_pcs = extras->hot_pcs;
+    scan.hot_next = 0;
+    if (num_threads > scan.num_chunks)
+    {
+        num_threads = (unsigned int)scan.num_chunks;
+    }
+
+    FootprintSketch *footprint = extras->footprint;
+    int sketch_bits = footprint != NULL ? footprint->pcs.bits : 0;
+    std::vector<LabStats> stats(num_threads);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < num_threads; t++)
+    {
+        lab_stats_init(&stats[t], sketch_bits);
+        threads.push_back(std::thread(scan_chunks, &scan, &stats[t]));
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    for (std::map<uint64_t, HotPcs *>::value_type &pending : scan.hot_pending)
+    {
+        delete pending.second;
+    }
+    if (scan.failed)
+    {
+        return -1;
+    }
+
+    for (unsigned int t = 1; t < num_threads; t++)
+    {
+        lab_stats_merge(&stats[0], &stats[t]);
+    }
+    const LabStats *sum = &stats[0];
+    stat_num_inst += sum->totals.num_recs;
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        stat_optype_dyn[op] += sum->totals.op_counts[op];
+    }
+    stat_num_cycle += sum->totals.cycles;
+    if (footprint != NULL)
+    {
+        footprint_sketch_merge(footprint, &sum->footprint);
+    }
+    else
+    {
+        // Student code keeps its unique PCs in globals, so the threads can't
+        // run it; say so rather than pass the simulator's count off as its.
+        bool exact;
+        stat_unique_pc = pc_sketch_count(&stats[0].pcs, &exact);
+        fprintf(stderr, "Note: LAB1_UNIQUE_PC is counted by the simulator on "
+                        "%u threads, not by analyze_trace_record(); run "
+                        "without -threads to check your own count\n",
+                num_threads);
+    }
+    return 0;
+}
+
+/**
+ * Analyze a range of records of a trace.
+ *
+ * @param trace_filename the path of the trace file
+ * @param first the index of the first record to analyze
+ * @param count the number of records to analyze
+ * @param pcs the sketch to add each record's address to
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int read_range(const char *trace_filename, uint64_t first, uint64_t count,
+               PcSketch *pcs)
+{
+    if (count == 0)
+    {
+        return 0;
+    }
+
+    TraceReader *trace = trace_open_range(trace_filename, sizeof(TraceRec),
+                                          TRACE_OPEN_ASYNC, first, count);
+    if (trace == NULL)
+    {
+        return -1;
+    }
+    int status = read_trace(trace, NULL, pcs, NULL);
+    trace_close(trace);
+    return status;
+}
+
+/**
+ * Cut a range of a trace into intervals, cluster their basic block vectors,
+ * and write the simpoints picked to a file, printing a summary.
+ *
+ * The trace may be a .ptr trace for Labs 2 and 3, whose simpoints are the
+ * ones those labs can use; only the address and op type of each record are
+ * read, which are at the same offsets in both layouts.
+ *
+ * @param args the options given on the command line
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int find_simpoints(const SimArgs *args)
+{
+    size_t rec_size = strstr(args->trace_filename, ".ptr") != NULL
+                          ? sizeof(PtrRec)
+                          : sizeof(TraceRec);
+    printf("Opening trace file: %s\n", args->trace_filename);
+    TraceReader *trace = trace_open_range(args->trace_filename, rec_size,
+                                          TRACE_OPEN_ASYNC, args->trace_skip,
+                                          args->trace_window);
+    if (trace == NULL)
+    {
+        return -1;
+    }
+
+    Bbv bbv;
+    bbv_init(&bbv, args->interval);
+    TraceBlock block;
+    while ((block = trace_next_block(trace, (size_t)-1)).count > 0)
+    {
+        const uint8_t *rec = (const uint8_t *)block.recs;
+        for (size_t i = 0; i < block.count; i++, rec += rec_size)
+        {
+            uint64_t pc;
+            memcpy(&pc, rec, sizeof(pc));
+            bbv_add(&bbv, pc, rec[TRACE_OP_TYPE_OFFSET] == OP_CBR);
+        }
+    }
+    bool failed = trace->error;
+    trace_close(trace);
+    if (failed)
+    {
+        return -1;
+    }
+    bbv_finish(&bbv);
+    if (bbv.lengths.empty())
+    {
+        fprintf(stderr, "Error: No instructions found in trace file\n");
+        return -1;
+    }
+
+    SimPoints sp;
+    std::vector<double> bics;
+    bbv_pick_simpoints(&bbv, args->trace_skip, (int)args->simpoint_max_k,
+                       args->num_threads, &sp, &bics);
+
+    printf("\n");
+    printf("LAB1_NUM_INST           \t : %10lu\n", (unsigned long)sp.num_insts);
+    printf("LAB1_INTERVALS          \t : %10lu\n",
+           (unsigned long)bbv.lengths.size());
+    printf("LAB1_BASIC_BLOCKS       \t : %10lu\n", (unsigned long)bbv.num_blocks);
+    printf("LAB1_SIMPOINTS          \t : %10lu\n",
+           (unsigned long)sp.points.size());
+    printf("\n");
+
+    printf("(Bayesian Information Criterion of the best clustering into k "
+           "clusters)\n");
+    printf("%4s  %14s\n", "K", "BIC");
+    for (size_t k = 1; k <= bics.size(); k++)
+    {
+        printf("%4lu  %14.1f%s\n", (unsigned long)k, bics[k - 1],
+               k == sp.points.size() ? "  <" : "");
+    }
+    printf("\n");
+
+    printf("%8s  %14s  %12s  %8s\n", "CLUSTER", "FIRST RECORD", "RECORDS",
+           "WEIGHT");
+    for (const SimPoint &point : sp.points)
+    {
+        printf("%8u  %14lu  %12lu  %8.4f\n", point.cluster,
+               (unsigned long)point.start, (unsigned long)point.length,
+               point.weight);
     }
+    printf("\n");
+
+    if (simpoints_save(args->simpoints_filename, args->trace_filename,
+                       &sp) != 0)
+    {
+        return -1;
+    }
+    printf("Wrote simpoints file: %s\n", args->simpoints_filename);
+    return 0;
 }
 
-void print_stats()
+/**
+ * Gather the statistics of a range of a trace from its index.
+ *
+ * Chunks wholly inside the range are taken from the index; the records of
+ * chunks only partly inside it are read from the trace. Distinct addresses
+ * are counted by merging the chunks' sketches, which is exact unless one of
+ * them had to be stored as a HyperLogLog.
+ *
+ * @param index the index of the trace
+ * @param trace_filename the path of the trace file
+ * @param trace_skip the index of the first record in the range
+ * @param trace_window the number of records in the range, or 0 for all of
+ *                     them up to the end of the trace
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int read_indexed(StatIndex *index, const char *trace_filename,
+                 uint64_t trace_skip, uint64_t trace_window)
+{
+    const StatIndexHeader *header = index->header;
+    uint64_t total = header->totals.num_recs;
+    if (trace_skip > 0 && trace_skip >= total)
+    {
+        fprintf(stderr, "Error: %s: can't start at record %lu; the trace is "
+                        "shorter than that\n",
+                trace_filename, (unsigned long)trace_skip);
+        return -1;
+    }
+
+    uint64_t end = trace_window == 0 || trace_window > total - trace_skip
+                       ? total
+                       : trace_skip + trace_window;
+    uint64_t chunk_recs = header->chunk_recs;
+    uint64_t first_chunk = (trace_skip + chunk_recs - 1) / chunk_recs;
+    uint64_t end_chunk = end == total ? header->num_chunks : end / chunk_recs;
+
+    PcSketch pcs;
+    StatTotals sum;
+    memset(&sum, 0, sizeof(sum));
+    if (first_chunk >= end_chunk)
+    {
+        if (read_range(trace_filename, trace_skip, end - trace_skip, &pcs) != 0)
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        uint64_t chunks_start = first_chunk * chunk_recs;
+        uint64_t chunks_end = end_chunk == header->num_chunks
+                                  ? total
+                                  : end_chunk * chunk_recs;
+        if (read_range(trace_filename, trace_skip, chunks_start - trace_skip,
+                       &pcs) != 0 ||
+            read_range(trace_filename, chunks_end, end - chunks_end,
+                       &pcs) != 0)
+        {
+            return -1;
+        }
+        bool whole = trace_skip == 0 && end == total;
+        stat_index_sum(index, first_chunk, end_chunk, &sum,
+                       whole ? NULL : &pcs);
+    }
+
+    stat_num_inst += sum.num_recs;
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        stat_optype_dyn[op] += sum.op_counts[op];
+    }
+    stat_num_cycle += sum.cycles;
+
+    if (trace_skip == 0 && end == total)
+    {
+        stat_unique_pc = header->unique_pcs;
+        return 0;
+    }
+    bool exact;
+    stat_unique_pc = pc_sketch_count(&pcs, &exact);
+    if (!exact)
+    {
+        fprintf(stderr, "Note: LAB1_UNIQUE_PC is estimated from the index, "
+                        "to within a few percent\n");
+    }
+    return 0;
+}
+
+/**
+ * Print the statistics gathered.
+ *
+ * @param footprint if not NULL, the sketches from which to estimate the
+ *                  number of unique PCs, lines and pages
+ */
+void print_stats(FootprintSketch *footprint)
 {
     if (stat_num_inst == 0)
     {
@@ -148,7 +1356,23 @@ void print_stats()
     printf("LAB1_NUM_CYCLES         \t : %10lu\n", stat_num_cycle);
 
     printf("LAB1_CPI                \t : %6.3f\n", cpi);
-    printf("LAB1_UNIQUE_PC          \t : %10lu\n", stat_unique_pc);
+    if (footprint == NULL)
+    {
+        printf("LAB1_UNIQUE_PC          \t : %10lu\n", stat_unique_pc);
+    }
+    else
+    {
+        // Report twice the standard error, a 95% confidence interval.
+        stat_unique_pc = (uint64_t)(hll_estimate(&footprint->pcs) + 0.5);
+        printf("LAB1_UNIQUE_PC          \t : %10lu (+/- %.2f%%)\n",
+               stat_unique_pc, 200 * hll_std_error(&footprint->pcs));
+        printf("LAB1_UNIQUE_LINES       \t : %10.0f (+/- %.2f%%)\n",
+               hll_estimate(&footprint->lines),
+               200 * hll_std_error(&footprint->lines));
+        printf("LAB1_UNIQUE_PAGES       \t : %10.0f (+/- %.2f%%)\n",
+               hll_estimate(&footprint->pages),
+               200 * hll_std_error(&footprint->pages));
+    }
 
     printf("\n");
 
@@ -166,3 +1390,178 @@ void print_stats()
     printf("LAB1_PERC_CBR_OP        \t : %6.3f\n", 100.0 * (double)(stat_optype_dyn[OP_CBR]) / (double)(stat_num_inst));
     printf("LAB1_PERC_OTHER_OP      \t : %6.3f\n\n", 100.0 * (double)(stat_optype_dyn[OP_OTHER]) / (double)(stat_num_inst));
 }
+
+/**
+ * Print the most executed instructions, with their share of the cycles.
+ *
+ * @param hot_pcs the tracker of the most executed instructions
+ * @param k the largest number of instructions to print
+ */
+void print_hot_pcs(const HotPcs *hot_pcs, size_t k)
+{
+    const char *names[NUM_OP_TYPES] = {"ALU", "LD", "ST", "CBR", "OTHER"};
+    std::vector<HotPc> top = hot_pcs_top(hot_pcs, k);
+    uint64_t max_error = hot_pcs_max_error(hot_pcs);
+
+    printf("LAB1_HOT_PCS            \t : %10lu\n", (unsigned long)top.size());
+    if (max_error == 0)
+    {
+        printf("(exact counts)\n");
+    }
+    else
+    {
+        // Space-Saving never misses an address executed more than its
+        // lowest count, which is at most N / HOT_PCS_COUNTERS.
+        printf("(each count is at most its +/- too high; every instruction "
+               "executed more than %lu times is listed)\n",
+               (unsigned long)max_error);
+    }
+    printf("%4s  %-18s  %-5s  %12s  %12s  %8s\n", "RANK", "PC", "OP",
+           "EXECUTIONS", "+/-", "%CYCLES");
+    for (size_t i = 0; i < top.size(); i++)
+    {
+        const HotPc &pc = top[i];
+        const char *name = pc.optype < NUM_OP_TYPES ? names[pc.optype] : "?";
+        double cycles = pc.optype < NUM_OP_TYPES
+                            ? (double)pc.count * (double)op_cycles[pc.optype]
+                            : 0;
+        printf("%4lu  0x%016lx  %-5s  %12lu  %12lu  %8.3f\n",
+               (unsigned long)(i + 1), (unsigned long)pc.pc, name,
+               (unsigned long)pc.count, (unsigned long)pc.error,
+               stat_num_cycle != 0 ? 100.0 * cycles / (double)stat_num_cycle
+                                   : 0.0);
+    }
+    printf("\n");
+}
+
+/**
+ * Print the miss ratios of LRU instruction caches of one line size, for each
+ * size from MRC_MIN_CACHE_KB to MRC_MAX_CACHE_KB and each associativity.
+ *
+ * @param sd the stack distance profile of the trace's lines
+ * @param assocs the associativities, 0 meaning fully associative
+ */
+void print_icache_mrc(const StackDist *sd, const std::vector<long> &assocs)
+{
+    unsigned long line_size = 1ul << sd->block_bits;
+    char label[48];
+    snprintf(label, sizeof(label), "LAB1_ICACHE_LINES_%luB", line_size);
+    printf("%-24s\t : %10lu\n", label, (unsigned long)sd->num_cold);
+    printf("(%% of fetches missing an LRU I-cache of %lu-byte lines; "
+           "set-associative\n caches are approximated from stack distances)\n",
+           line_size);
+    printf("%8s", "SIZE");
+    for (long assoc : assocs)
+    {
+        if (assoc == 0)
+        {
+            printf("  %8s", "FULL");
+        }
+        else
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "%ld-WAY", assoc);
+            printf("  %8s", name);
+        }
+    }
+    printf("\n");
+
+    for (unsigned long kb = MRC_MIN_CACHE_KB; kb <= MRC_MAX_CACHE_KB; kb *= 2)
+    {
+        uint64_t num_lines = kb * 1024 / line_size;
+        printf("%6luKB", kb);
+        for (long assoc : assocs)
+        {
+            if (num_lines == 0 || (uint64_t)assoc > num_lines)
+            {
+                printf("  %8s", "-");
+                continue;
+            }
+            double misses = stack_dist_misses(sd, num_lines,
+                                              (unsigned int)assoc);
+            printf("  %8.3f", sd->num_accesses != 0
+                                  ? 100.0 * misses / (double)sd->num_accesses
+                                  : 0.0);
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+/**
+ * Print the code lines and pages a trace touched, and how many the first
+ * instructions touched after each doubling.
+ *
+ * @param cf the footprint of the trace
+ */
+void print_code_footprint(const CodeFootprint *cf)
+{
+    printf("LAB1_CODE_LINES_64B     \t : %10lu\n", (unsigned long)cf->num_lines);
+    printf("LAB1_CODE_PAGES_4KB     \t : %10lu\n", (unsigned long)cf->num_pages);
+    printf("LAB1_CODE_PAGES_2MB     \t : %10lu\n",
+           (unsigned long)cf->huge_pages.size());
+    printf("(distinct code lines and pages touched by the first instructions)\n");
+    printf("%14s  %10s  %10s  %10s\n", "INSTRUCTIONS", "LINES_64B",
+           "PAGES_4KB", "PAGES_2MB");
+    for (const CodeFootprintPoint &point : cf->growth)
+    {
+        printf("%14lu  %10lu  %10lu  %10lu\n", (unsigned long)point.num_inst,
+               (unsigned long)point.num_lines, (unsigned long)point.num_pages,
+               (unsigned long)point.num_huge_pages);
+    }
+    printf("\n");
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file>\n\n", program_name);
+    fprintf(stderr, "Analyzes the instruction mix of a CPU trace\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -skip <num>         Start analyzing <num> instructions into the trace\n");
+    fprintf(stderr, "    -window <num>       Analyze at most <num> instructions\n");
+    fprintf(stderr, "    -index              Write a statistics index beside the trace when\n");
+    fprintf(stderr, "                        scanning all of it, for later runs to use\n");
+    fprintf(stderr, "    -noindex            Scan the trace even if it has an up-to-date\n");
+    fprintf(stderr, "                        statistics index, and don't write one\n");
+    fprintf(stderr, "    -threads <num>      Analyze on <num> threads, or one per core if 0, each\n");
+    fprintf(stderr, "                        taking chunks of the trace in turn; needs a\n");
+    fprintf(stderr, "                        packed trace or a gzip trace with an index.\n");
+    fprintf(stderr, "                        Unique PCs are then counted by the simulator,\n");
+    fprintf(stderr, "                        not by analyze_trace_record()\n");
+    fprintf(stderr, "    -sketch <bits>      Estimate unique PCs, and unique 64-byte lines and\n");
+    fprintf(stderr, "                        4KB pages of code, with HyperLogLog++ sketches of\n");
+    fprintf(stderr, "                        2^<bits> registers (%d-%d) instead of exactly\n",
+            HLL_MIN_BITS, HLL_MAX_BITS);
+    fprintf(stderr, "    -hotpcs <num>       Also list the <num> most executed instructions\n");
+    fprintf(stderr, "                        (at most %d), counted in fixed memory with\n",
+            HOT_PCS_COUNTERS);
+    fprintf(stderr, "                        bounded error; needs a scan of the trace\n");
+    fprintf(stderr, "    -mrc <sizes>        Also give I-cache miss ratios for every size from\n");
+    fprintf(stderr, "                        %dKB to %dKB, for each comma-separated line size\n",
+            MRC_MIN_CACHE_KB, MRC_MAX_CACHE_KB);
+    fprintf(stderr, "                        in bytes, from one pass; needs a scan of the trace\n");
+    fprintf(stderr, "                        on one thread\n");
+    fprintf(stderr, "    -assoc <ways>       The comma-separated associativities to give them\n");
+    fprintf(stderr, "                        for, 0 meaning fully associative (default\n");
+    fprintf(stderr, "                        0,1,2,4,8)\n");
+    fprintf(stderr, "    -footprint          Also count the distinct 64-byte lines, 4KB pages\n");
+    fprintf(stderr, "                        and 2MB pages of code exactly, and how they grew\n");
+    fprintf(stderr, "                        over the trace; needs a scan of the trace on one\n");
+    fprintf(stderr, "                        thread\n");
+    fprintf(stderr, "    -simpoints <file>   Instead, cluster intervals of the trace by their\n");
+    fprintf(stderr, "                        basic block vectors and write a simulation window\n");
+    fprintf(stderr, "                        standing for each cluster to <file>, for the\n");
+    fprintf(stderr, "                        -simpoints option of Labs 2 and 3; works on .ptr\n");
+    fprintf(stderr, "                        traces too, and on -threads threads\n");
+    fprintf(stderr, "    -phases <file>      Also write the op mix, cycles, new unique PCs and\n");
+    fprintf(stderr, "                        taken branches of each interval of the trace, in\n");
+    fprintf(stderr, "                        columns, to <file>; needs a scan of the trace on\n");
+    fprintf(stderr, "                        one thread\n");
+    fprintf(stderr, "    -phasecsv <file>    Also write them to <file> as CSV, as fractions and\n");
+    fprintf(stderr, "                        rates\n");
+    fprintf(stderr, "    -interval <num>     The number of instructions in each interval of\n");
+    fprintf(stderr, "                        -simpoints or -phases (default %d)\n",
+            BBV_DEFAULT_INTERVAL);
+    fprintf(stderr, "    -maxk <num>         The most clusters to try (default %d, at most %d)\n",
+            BBV_DEFAULT_MAX_K, BBV_MAX_K);
+}
@@ -0,0 +1,407 @@
+// statindex.cpp
+// Implements an index of precomputed Lab 1 statistics for a trace.
+
+#include "statindex.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * [Internal] The largest number of addresses stored as a list in a chunk's
+ * sketch; beyond this, the list would take more space than the registers.
+ */
+#define STAT_INDEX_MAX_LIST_PCS (PC_SKETCH_HLL_SIZE / sizeof(uint64_t))
+
+/**
+ * [Internal] Get the name of the statistics index file of a trace.
+ *
+ * @param trace_filename the path of the trace file
+ * @return a newly allocated string; free it with free()
+ */
+static char *stat_index_filename(const char *trace_filename)
+{
+    size_t len = strlen(trace_filename) + sizeof(STAT_INDEX_SUFFIX);
+    char *filename = (char *)malloc(len);
+    snprintf(filename, len, "%s%s", trace_filename, STAT_INDEX_SUFFIX);
+    return filename;
+}
+
+/**
+ * [Internal] Fill in the fields of an index header that tell which trace and
+ * which build of the simulator it is for.
+ *
+ * @param trace_filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param header the header to fill in
+ * @return 0 on success, or -1 if the trace or the simulator couldn't be
+ *         looked up
+ */
+static int stat_index_identify(const char *trace_filename, size_t rec_size,
+                               StatIndexHeader *header)
+{
+    struct stat trace_st, analyzer_st;
+    if (stat(trace_filename, &trace_st) != 0 ||
+        stat("/proc/self/exe", &analyzer_st) != 0)
+    {
+        return -1;
+    }
+
+    header->rec_size = (uint32_t)rec_size;
+    header->trace_size = (uint64_t)trace_st.st_size;
+    header->trace_mtime = (int64_t)trace_st.st_mtim.tv_sec * 1000000000 +
+                          trace_st.st_mtim.tv_nsec;
+    header->analyzer_size = (uint64_t)analyzer_st.st_size;
+    header->analyzer_mtime = (int64_t)analyzer_st.st_mtim.tv_sec * 1000000000 +
+                             analyzer_st.st_mtim.tv_nsec;
+    return 0;
+}
+
+/**
+ * [Internal] Check that an index file's chunks fit in it and add up to the
+ * totals in its header.
+ *
+ * @param si the index
+ * @return whether the chunks are consistent
+ */
+static bool stat_index_chunks_ok(const StatIndex *si)
+{
+    const StatIndexHeader *header = si->header;
+    uint64_t table_end = sizeof(*header) +
+                         header->num_chunks * sizeof(StatIndexChunk);
+    if (header->chunk_recs == 0 ||
+        header->num_chunks > si->len / sizeof(StatIndexChunk) ||
+        table_end > si->len)
+    {
+        return false;
+    }
+
+    uint64_t num_recs = 0;
+    for (uint64_t i = 0; i < header->num_chunks; i++)
+    {
+        const StatIndexChunk *chunk = &si->chunks[i];
+        uint64_t sketch_len = chunk->num_pcs == STAT_INDEX_SKETCH_HLL
+                                  ? PC_SKETCH_HLL_SIZE
+                                  : chunk->num_pcs * sizeof(uint64_t);
+        bool full = i + 1 == header->num_chunks
+                        ? chunk->totals.num_recs <= header->chunk_recs
+                        : chunk->totals.num_recs == header->chunk_recs;
+        if (!full || chunk->sketch_offset < table_end ||
+            chunk->sketch_offset > si->len ||
+            sketch_len > si->len - chunk->sketch_offset)
+        {
+            return false;
+        }
+        num_recs += chunk->totals.num_recs;
+    }
+    return num_recs == header->totals.num_recs;
+}
+
+/**
+ * Load the statistics index of a trace, if it has an up-to-date one.
+ *
+ * @param trace_filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @return a pointer to a newly allocated StatIndex, or NULL if there is none
+ */
+StatIndex *stat_index_load(const char *trace_filename, size_t rec_size)
+{
+    char *index_filename = stat_index_filename(trace_filename);
+    int fd = open(index_filename, O_RDONLY);
+    if (fd == -1)
+    {
+        free(index_filename);
+        return NULL;
+    }
+
+    StatIndex *si = (StatIndex *)calloc(1, sizeof(StatIndex));
+    const char *problem = NULL;
+    bool stale = false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(StatIndexHeader))
+    {
+        problem = "not a statistics index";
+    }
+    else
+    {
+        si->len = (size_t)st.st_size;
+        si->data = (uint8_t *)malloc(si->len);
+        si->header = (const StatIndexHeader *)si->data;
+        si->chunks = (const StatIndexChunk *)(si->header + 1);
+        if (pread(fd, si->data, si->len, 0) != (ssize_t)si->len)
+        {
+            problem = "truncated statistics index";
+        }
+    }
+    close(fd);
+
+    StatIndexHeader current;
+    memset(&current, 0, sizeof(current));
+    const StatIndexHeader *header = si->header;
+    if (problem != NULL)
+    {
+        // Already described.
+    }
+    else if (memcmp(header->magic, STAT_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+             header->version != STAT_INDEX_VERSION ||
+             header->rec_size != rec_size)
+    {
+        problem = "not a statistics index, or an unsupported version";
+    }
+    else if (stat_index_identify(trace_filename, rec_size, &current) != 0 ||
+             current.trace_size != header->trace_size ||
+             current.trace_mtime != header->trace_mtime)
+    {
+        problem = "built for a different version of the trace";
+        stale = true;
+    }
+    else if (current.analyzer_size != header->analyzer_size ||
+             current.analyzer_mtime != header->analyzer_mtime)
+    {
+        problem = "built by a different build of the simulator";
+        stale = true;
+    }
+    else if (!stat_index_chunks_ok(si))
+    {
+        problem = "corrupt statistics index";
+    }
+
+    if (problem != NULL)
+    {
+        fprintf(stderr, "%s: %s: %s; ignoring the index\n",
+                stale ? "Note" : "Warning", index_filename, problem);
+        stat_index_free(si);
+        si = NULL;
+    }
+    free(index_filename);
+    return si;
+}
+
+/**
+ * Add up the statistics and address sketches of consecutive chunks.
+ *
+ * @param si the index
+ * @param first_chunk the first chunk to add
+ * @param end_chunk the chunk after the last one to add
+ * @param totals set to the sum of the chunks' statistics
+ * @param pcs if not NULL, the sketch to merge the chunks' addresses into
+ */
+void stat_index_sum(const StatIndex *si, uint64_t first_chunk,
+                    uint64_t end_chunk, StatTotals *totals, PcSketch *pcs)
+{
+    memset(totals, 0, sizeof(*totals));
+    for (uint64_t i = first_chunk; i < end_chunk; i++)
+    {
+        const StatIndexChunk *chunk = &si->chunks[i];
+        stat_totals_add(totals, &chunk->totals);
+
+        if (pcs == NULL)
+        {
+            continue;
+        }
+        const uint8_t *sketch = si->data + chunk->sketch_offset;
+        if (chunk->num_pcs == STAT_INDEX_SKETCH_HLL)
+        {
+            PcSketch chunk_pcs;
+            pc_sketch_make_hll(&chunk_pcs);
+            chunk_pcs.hll.registers.assign(sketch,
+                                           sketch + PC_SKETCH_HLL_SIZE);
+            pc_sketch_merge(pcs, &chunk_pcs);
+            continue;
+        }
+        for (uint32_t j = 0; j < chunk->num_pcs; j++)
+        {
+            uint64_t pc;
+            memcpy(&pc, sketch + j * sizeof(pc), sizeof(pc));
+            pc_sketch_add(pcs, pc);
+        }
+    }
+}
+
+/**
+ * Free all memory associated with an index.
+ *
+ * @param si the index to free (may be NULL)
+ */
+void stat_index_free(StatIndex *si)
+{
+    if (si == NULL)
+    {
+        return;
+    }
+    free(si->data);
+    free(si);
+}
+
+/**
+ * Start building the statistics index of a trace, before scanning it.
+ *
+ * @param trace_filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @return a pointer to a newly allocated StatIndexWriter, or NULL
+ */
+StatIndexWriter *stat_index_writer_open(const char *trace_filename,
+                                        size_t rec_size)
+{
+    StatIndexWriter *w = new StatIndexWriter();
+    if (stat_index_identify(trace_filename, rec_size, &w->header) != 0)
+    {
+        fprintf(stderr, "Note: couldn't look up %s or the simulator; not "
+                        "indexing its statistics\n",
+                trace_filename);
+        delete w;
+        return NULL;
+    }
+
+    w->filename = stat_index_filename(trace_filename);
+    memcpy(w->header.magic, STAT_INDEX_MAGIC, sizeof(w->header.magic));
+    w->header.version = STAT_INDEX_VERSION;
+    w->header.chunk_recs = STAT_INDEX_CHUNK_RECS;
+    return w;
+}
+
+/**
+ * Add the next chunk of the trace to an index being built.
+ *
+ * @param w the index being built
+ * @param totals the statistics of the chunk
+ * @param pcs the distinct addresses in the chunk; may be turned into a
+ *            HyperLogLog
+ */
+void stat_index_writer_add(StatIndexWriter *w, const StatTotals *totals,
+                           PcSketch *pcs)
+{
+    stat_index_writer_put(w, w->chunks.size(), totals, pcs);
+}
+
+/**
+ * Set any chunk of the trace in an index being built.
+ *
+ * Each chunk's sketch is kept apart until the index is written, when they
+ * are laid out in order of their chunks.
+ *
+ * @param w the index being built
+ * @param chunk_no the number of the chunk, counting from 0
+ * @param totals the statistics of the chunk
+ * @param pcs the distinct addresses in the chunk; may be turned into a
+ *            HyperLogLog
+ */
+void stat_index_writer_put(StatIndexWriter *w, uint64_t chunk_no,
+                           const StatTotals *totals, PcSketch *pcs)
+{
+    StatIndexChunk chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.totals = *totals;
+
+    // Copy the sketch out before taking the lock.
+    const uint8_t *sketch;
+    size_t sketch_len;
+    bool exact;
+    uint64_t num_pcs = pc_sketch_count(pcs, &exact);
+    if (exact && num_pcs <= STAT_INDEX_MAX_LIST_PCS)
+    {
+        chunk.num_pcs = (uint32_t)num_pcs;
+        sketch = (const uint8_t *)pcs->pcs.data();
+        sketch_len = num_pcs * sizeof(uint64_t);
+    }
+    else
+    {
+        chunk.num_pcs = STAT_INDEX_SKETCH_HLL;
+        pc_sketch_make_hll(pcs);
+        sketch = pcs->hll.registers.data();
+        sketch_len = pcs->hll.registers.size();
+    }
+
+    std::vector<uint8_t> bytes(sketch, sketch + sketch_len);
+
+    std::lock_guard<std::mutex> guard(w->lock);
+    if (w->chunks.size() <= chunk_no)
+    {
+        w->chunks.resize(chunk_no + 1);
+        w->sketches.resize(chunk_no + 1);
+    }
+    w->chunks[chunk_no] = chunk;
+    w->sketches[chunk_no].swap(bytes);
+}
+
+/**
+ * Finish an index after a complete scan of its trace and write it out.
+ *
+ * @param w the index being built (freed by this call)
+ * @param unique_pcs the number of distinct addresses in the whole trace
+ * @return 0 on success, or -1 if the index couldn't be written (already
+ *         reported)
+ */
+int stat_index_writer_close(StatIndexWriter *w, uint64_t unique_pcs)
+{
+    w->header.unique_pcs = unique_pcs;
+    size_t n = w->chunks.size();
+    w->header.num_chunks = n;
+    uint64_t offset = sizeof(w->header) + n * sizeof(StatIndexChunk);
+    for (size_t i = 0; i < n; i++)
+    {
+        w->chunks[i].sketch_offset = offset;
+        offset += w->sketches[i].size();
+        stat_totals_add(&w->header.totals, &w->chunks[i].totals);
+    }
+
+    size_t name_len = strlen(w->filename);
+    char *tmp_filename = (char *)malloc(name_len + 5);
+    snprintf(tmp_filename, name_len + 5, "%s.tmp", w->filename);
+
+    FILE *f = fopen(tmp_filename, "wb");
+    bool ok = f != NULL;
+    if (!ok)
+    {
+        fprintf(stderr, "Couldn't create %s: ", tmp_filename);
+        perror(NULL);
+    }
+    else
+    {
+        ok = fwrite(&w->header, sizeof(w->header), 1, f) == 1 &&
+             fwrite(w->chunks.data(), sizeof(StatIndexChunk), n, f) == n;
+        for (size_t i = 0; ok && i < n; i++)
+        {
+            ok = fwrite(w->sketches[i].data(), 1, w->sketches[i].size(), f) ==
+                 w->sketches[i].size();
+        }
+        ok = (fclose(f) == 0) && ok;
+        if (!ok)
+        {
+            fprintf(stderr, "Couldn't write %s: ", tmp_filename);
+            perror(NULL);
+        }
+        else if (rename(tmp_filename, w->filename) != 0)
+        {
+            fprintf(stderr, "Couldn't rename %s to %s: ", tmp_filename,
+                    w->filename);
+            perror(NULL);
+            ok = false;
+        }
+        if (!ok)
+        {
+            unlink(tmp_filename);
+        }
+    }
+
+    free(tmp_filename);
+    stat_index_writer_discard(w);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Abandon an index being built, writing nothing.
+ *
+ * @param w the index being built (may be NULL; freed by this call)
+ */
+void stat_index_writer_discard(StatIndexWriter *w)
+{
+    if (w == NULL)
+    {
+        return;
+    }
+    free(w->filename);
+    delete w;
+}
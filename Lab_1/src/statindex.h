@@ -0,0 +1,237 @@
+// statindex.h
+// Declares an index of precomputed Lab 1 statistics for a trace, so the
+// statistics of the whole trace, or of any range of it, can be had without
+// reading it again.
+//
+// The trace is divided into chunks of STAT_INDEX_CHUNK_RECS records. For each
+// chunk, the index holds the number of records, the op type counts and cycle
+// total the analyzer gave them, and a sketch of their distinct instruction
+// addresses (see pcsketch.h). The analyzer writes it beside the trace, when
+// run with -index, as "<trace>.lsi":
+//
+//   StatIndexHeader               magic, version, and what the index covers
+//   StatIndexChunk[num_chunks]    the statistics of each chunk, in order
+//   sketches                      the addresses of each chunk, either as a
+//                                 sorted list of uint64_t or, if that would
+//                                 be longer, as HyperLogLog registers
+//
+// The statistics depend on the analyzer as much as on the trace, so an index
+// is only used by the same build of the simulator that wrote it.
+
+#ifndef _STATINDEX_H_
+#define _STATINDEX_H_
+
+#include "pcsketch.h"
+#include "trace.h"
+#include <inttypes.h>
+#include <mutex>
+#include <stddef.h>
+#include <vector>
+
+/** The first eight bytes of every statistics index file. */
+#define STAT_INDEX_MAGIC "ECESTIDX"
+
+/** The current version of the statistics index format. */
+#define STAT_INDEX_VERSION 1
+
+/** The suffix appended to a trace's file name to name its index. */
+#define STAT_INDEX_SUFFIX ".lsi"
+
+/** The number of records in each chunk but the last. */
+#define STAT_INDEX_CHUNK_RECS (1024 * 1024)
+
+/** The value of StatIndexChunk::num_pcs for a HyperLogLog sketch. */
+#define STAT_INDEX_SKETCH_HLL 0xffffffffu
+
+/** Statistics of some of the records of a trace. */
+typedef struct StatTotalsStruct
+{
+    /** The number of records. */
+    uint64_t num_recs;
+    /** The number of records of each op type. */
+    uint64_t op_counts[NUM_OP_TYPES];
+    /** The number of cycles the analyzer gave the records. */
+    uint64_t cycles;
+} StatTotals;
+
+/**
+ * Add the statistics of some records to those of others.
+ *
+ * @param dst the statistics to add to
+ * @param src the statistics to add
+ */
+static inline void stat_totals_add(StatTotals *dst, const StatTotals *src)
+{
+    dst->num_recs += src->num_recs;
+    for (int op = 0; op < NUM_OP_TYPES; op++)
+    {
+        dst->op_counts[op] += src->op_counts[op];
+    }
+    dst->cycles += src->cycles;
+}
+
+/** The header at the start of a statistics index file. */
+typedef struct StatIndexHeaderStruct
+{
+    /** STAT_INDEX_MAGIC, not NUL-terminated. */
+    char magic[8];
+    /** STAT_INDEX_VERSION. */
+    uint32_t version;
+    /** The size in bytes of one trace record. */
+    uint32_t rec_size;
+    /** The size in bytes of the trace the index was built for. */
+    uint64_t trace_size;
+    /** That trace's modification time, in nanoseconds since the epoch. */
+    int64_t trace_mtime;
+    /** The size in bytes of the simulator that built the index. */
+    uint64_t analyzer_size;
+    /** That simulator's modification time, in nanoseconds. */
+    int64_t analyzer_mtime;
+    /** The number of records in each chunk but the last. */
+    uint64_t chunk_recs;
+    /** The number of chunks. */
+    uint64_t num_chunks;
+    /** The statistics of the whole trace. */
+    StatTotals totals;
+    /** The exact number of distinct instruction addresses in the trace. */
+    uint64_t unique_pcs;
+} StatIndexHeader;
+
+/** The statistics of one chunk of a trace. */
+typedef struct StatIndexChunkStruct
+{
+    /** The statistics of the chunk's records. */
+    StatTotals totals;
+    /** The offset in the index file of the chunk's address sketch. */
+    uint64_t sketch_offset;
+    /**
+     * The number of addresses in the sketch, or STAT_INDEX_SKETCH_HLL if it
+     * holds PC_SKETCH_HLL_SIZE registers instead.
+     */
+    uint32_t num_pcs;
+    /** Unused; 0. */
+    uint32_t reserved;
+} StatIndexChunk;
+
+/** A statistics index loaded from disk. */
+typedef struct StatIndexStruct
+{
+    /** [Internal] The contents of the index file. */
+    uint8_t *data;
+    /** [Internal] The size in bytes of the index file. */
+    size_t len;
+    /** The header of the index. */
+    const StatIndexHeader *header;
+    /** The statistics of each chunk, header->num_chunks of them. */
+    const StatIndexChunk *chunks;
+} StatIndex;
+
+/** A statistics index being built during a scan of a trace. */
+typedef struct StatIndexWriterStruct
+{
+    /** [Internal] The path of the index file to write. */
+    char *filename;
+    /** [Internal] The header so far, describing the trace as first seen. */
+    StatIndexHeader header;
+    /** [Internal] The chunks added so far, in order of their records. */
+    std::vector<StatIndexChunk> chunks;
+    /** [Internal] Their sketches, each laid out as in the file. */
+    std::vector<std::vector<uint8_t>> sketches;
+    /** [Internal] Held while adding a chunk. */
+    std::mutex lock;
+} StatIndexWriter;
+
+/**
+ * Load the statistics index of a trace, if it has an up-to-date one.
+ *
+ * An index whose file is missing is silently ignored. One built for a
+ * different version of the trace or by a different build of the simulator is
+ * ignored with a note, and one that is corrupt with a warning.
+ *
+ * @param trace_filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @return a pointer to a newly allocated StatIndex, or NULL if there is none
+ */
+StatIndex *stat_index_load(const char *trace_filename, size_t rec_size);
+
+/**
+ * Add up the statistics and address sketches of consecutive chunks.
+ *
+ * @param si the index
+ * @param first_chunk the first chunk to add
+ * @param end_chunk the chunk after the last one to add
+ * @param totals set to the sum of the chunks' statistics
+ * @param pcs if not NULL, the sketch to merge the chunks' addresses into
+ */
+void stat_index_sum(const StatIndex *si, uint64_t first_chunk,
+                    uint64_t end_chunk, StatTotals *totals, PcSketch *pcs);
+
+/**
+ * Free all memory associated with an index.
+ *
+ * @param si the index to free (may be NULL)
+ */
+void stat_index_free(StatIndex *si);
+
+/**
+ * Start building the statistics index of a trace, before scanning it.
+ *
+ * Prints a note and returns NULL if the trace or the simulator can't be
+ * looked up, in which case the scan should go ahead without an index.
+ *
+ * @param trace_filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @return a pointer to a newly allocated StatIndexWriter, or NULL
+ */
+StatIndexWriter *stat_index_writer_open(const char *trace_filename,
+                                        size_t rec_size);
+
+/**
+ * Add the next chunk of the trace to an index being built.
+ *
+ * Every chunk but the last must hold STAT_INDEX_CHUNK_RECS records.
+ *
+ * @param w the index being built
+ * @param totals the statistics of the chunk
+ * @param pcs the distinct addresses in the chunk; may be turned into a
+ *            HyperLogLog
+ */
+void stat_index_writer_add(StatIndexWriter *w, const StatTotals *totals,
+                           PcSketch *pcs);
+
+/**
+ * Set any chunk of the trace in an index being built.
+ *
+ * Unlike stat_index_writer_add(), chunks may be put in any order, and from
+ * several threads at once; every chunk up to the last must have been put
+ * before the index is closed.
+ *
+ * @param w the index being built
+ * @param chunk_no the number of the chunk, counting from 0
+ * @param totals the statistics of the chunk
+ * @param pcs the distinct addresses in the chunk; may be turned into a
+ *            HyperLogLog
+ */
+void stat_index_writer_put(StatIndexWriter *w, uint64_t chunk_no,
+                           const StatTotals *totals, PcSketch *pcs);
+
+/**
+ * Finish an index after a complete scan of its trace and write it out, under
+ * a temporary name first so that an interrupted write never leaves a partial
+ * index behind.
+ *
+ * @param w the index being built (freed by this call)
+ * @param unique_pcs the number of distinct addresses in the whole trace
+ * @return 0 on success, or -1 if the index couldn't be written (already
+ *         reported)
+ */
+int stat_index_writer_close(StatIndexWriter *w, uint64_t unique_pcs);
+
+/**
+ * Abandon an index being built, writing nothing.
+ *
+ * @param w the index being built (may be NULL; freed by this call)
+ */
+void stat_index_writer_discard(StatIndexWriter *w);
+
+#endif
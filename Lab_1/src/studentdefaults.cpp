@@ -0,0 +1,71 @@
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! //
+// DO NOT MODIFY OR SUBMIT THIS FILE. //
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! //
+
+// studentdefaults.cpp
+// Defaults for the parts of studentwork.cpp that sim.cpp can use but that
+// students need not write. Each is a weak definition, so a definition of the
+// same name in studentwork.cpp takes its place; only analyze_trace_record()
+// is required.
+
+#include "trace.h"
+
+/**
+ * Whether student code tracks unique PCs exactly. sim.cpp clears this for
+ * its -sketch option; student code that ignores it just keeps tracking them.
+ */
+__attribute__((weak)) bool track_unique_pcs = true;
+
+/**
+ * The cycles taken by an instruction of each op type, as the Lab 1 CPI model
+ * gives them, for sim.cpp's list of hot PCs.
+ */
+__attribute__((weak)) uint64_t op_cycles[NUM_OP_TYPES] = {
+    1, // OP_ALU
+    2, // OP_LD
+    2, // OP_ST
+    3, // OP_CBR
+    1, // OP_OTHER
+};
+
+/**
+ * Updates the same global variables as analyze_trace_record(), for a block of
+ * consecutive trace records at once, by calling analyze_trace_record() on
+ * each record in turn.
+ *
+ * @param recs the trace records to process
+ * @param n the number of records
+ * @return n if every record has a valid op type, or else the number before
+ *         the first one that doesn't, which is not analyzed
+ */
+__attribute__((weak)) size_t analyze_trace_block(const TraceRec *recs,
+                                                 size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        if (recs[i].optype >= NUM_OP_TYPES)
+        {
+            return i;
+        }
+        TraceRec rec = recs[i];
+        analyze_trace_record(&rec);
+    }
+    return n;
+}
+
+/**
+ * Counts nothing: without a count_trace_block() of its own, student code
+ * can't count blocks on several threads at once.
+ *
+ * @param recs the trace records to count
+ * @param n the number of records
+ * @param optype_dyn the number of records of each op type, left as it is
+ * @param num_cycle the number of cycles, left as it is
+ * @return TRACE_BLOCK_UNSUPPORTED
+ */
+__attribute__((weak)) size_t count_trace_block(const TraceRec *recs, size_t n,
+                                               uint64_t optype_dyn[NUM_OP_TYPES],
+                                               uint64_t *num_cycle)
+{
+    return TRACE_BLOCK_UNSUPPORTED;
+}
@@ -9,8 +9,12 @@
 
 #include "trace.h"
 #include <assert.h>
-#include <list>
-#include <iostream>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 // You may include any other standard C or C++ headers you need here,
 // e.g. #include <vector> or #include <algorithm>.
 // Make sure this compiles on the reference machine!
@@ -55,6 +59,235 @@ uint64_t stat_num_cycle = 0;
  */
 uint64_t stat_unique_pc = 0;
 
+// Unique PCs are tracked in an open-addressing hash set laid out like Abseil's
+// SwissTable: slots are grouped 16 at a time, and each slot has a control byte
+// that is either PC_SET_EMPTY or 7 bits of its address's hash. A lookup
+// compares all 16 control bytes of a group at once with SSE2, and only looks
+// at the slots whose byte matched, so most lookups touch one control group
+// and one slot. Addresses are never removed, so there are no tombstones.
+
+/** The number of slots, and control bytes, in a group. */
+#define PC_SET_GROUP 16
+
+/** The control byte of an empty slot. */
+#define PC_SET_EMPTY 0x80
+
+/** The number of groups a PcSet starts out with. */
+#define PC_SET_INITIAL_GROUPS 16
+
+/** A set of instruction addresses. */
+struct PcSet {
+    /** One control byte per slot. */
+    uint8_t *ctrl;
+    /** The addresses, in slots matching ctrl. */
+    uint64_t *slots;
+    /** The number of groups; a power of two. */
+    size_t num_groups;
+    /** The number of addresses that can still be added before growing. */
+    size_t growth_left;
+    /** The number of addresses in the set. */
+    size_t size;
+};
+
+PcSet unique_pcs = {NULL, NULL, 0, 0, 0};
+
+/**
+ * Whether to track unique PCs here at all. sim.cpp clears this when it is
+ * estimating them itself in bounded memory (its -sketch option), so that the
+ * set above doesn't grow with the trace.
+ */
+bool track_unique_pcs = true;
+
+/**
+ * Hashes an instruction address. Addresses are mostly small and close
+ * together, so every bit of the result is made to depend on every bit of the
+ * address: the low bits pick the group, and the top 7 go in the control byte.
+ */
+static inline uint64_t pc_hash(uint64_t pc) {
+    uint64_t h = (pc ^ (pc >> 29)) * 0xbf58476d1ce4e5b9ull;
+    return h ^ (h >> 32);
+}
+
+/** Gets a bit mask of the slots in a group whose control byte is b. */
+static inline unsigned pc_set_match(const uint8_t *group, uint8_t b) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)b)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < PC_SET_GROUP; i++) {
+        mask |= (unsigned)(group[i] == b) << i;
+    }
+    return mask;
+#endif
+}
+
+/** Allocates an empty set with the given number of groups. */
+static void pc_set_alloc(PcSet *set, size_t num_groups) {
+    size_t capacity = num_groups * PC_SET_GROUP;
+    set->ctrl = (uint8_t *)malloc(capacity);
+    memset(set->ctrl, PC_SET_EMPTY, capacity);
+    set->slots = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+    set->num_groups = num_groups;
+    set->growth_left = capacity / 8 * 7 - set->size;
+}
+
+/** Puts an address known not to be in the set into its first free slot. */
+static void pc_set_place(PcSet *set, uint64_t pc, uint64_t h) {
+    size_t mask = set->num_groups - 1;
+    size_t g = (size_t)h & mask;
+    for (size_t step = 1;; step++) {
+        unsigned empty = pc_set_match(set->ctrl + g * PC_SET_GROUP, PC_SET_EMPTY);
+        if (empty != 0) {
+            size_t slot = g * PC_SET_GROUP + __builtin_ctz(empty);
+            set->ctrl[slot] = (uint8_t)(h >> 57);
+            set->slots[slot] = pc;
+            return;
+        }
+        g = (g + step) & mask;
+    }
+}
+
+/** Doubles the number of groups, once the set is 7/8 full. */
+static void pc_set_grow(PcSet *set) {
+    PcSet old = *set;
+    pc_set_alloc(set, old.num_groups == 0 ? PC_SET_INITIAL_GROUPS : old.num_groups * 2);
+    for (size_t i = 0; i < old.num_groups * PC_SET_GROUP; i++) {
+        if (old.ctrl[i] != PC_SET_EMPTY) {
+            pc_set_place(set, old.slots[i], pc_hash(old.slots[i]));
+        }
+    }
+    free(old.ctrl);
+    free(old.slots);
+}
+
+/**
+ * Adds an address to the set. Probes whole groups in triangular order, which
+ * visits every group once before repeating.
+ *
+ * @return true if the address was not in the set before
+ */
+static bool pc_set_insert(PcSet *set, uint64_t pc) {
+    uint64_t h = pc_hash(pc);
+    uint8_t h2 = (uint8_t)(h >> 57);
+    size_t mask = set->num_groups - 1;
+    size_t g = (size_t)h & mask;
+    for (size_t step = 1; set->num_groups > 0; step++) {
+        const uint8_t *group = set->ctrl + g * PC_SET_GROUP;
+        for (unsigned match = pc_set_match(group, h2); match != 0; match &= match - 1) {
+            if (set->slots[g * PC_SET_GROUP + __builtin_ctz(match)] == pc) {
+                return false;
+            }
+        }
+        if (pc_set_match(group, PC_SET_EMPTY) != 0) {
+            break;
+        }
+        g = (g + step) & mask;
+    }
+
+    if (set->growth_left == 0) {
+        pc_set_grow(set);
+    }
+    pc_set_place(set, pc, h);
+    set->growth_left--;
+    set->size++;
+    return true;
+}
+
+// Most instructions in a block repeat one seen shortly before, in the same
+// loop, so the block path checks a small direct-mapped table of recently
+// seen addresses before probing the set. A slot holds an address plus one, so
+// that zero means empty; an instruction can't start at the very last byte of
+// the address space.
+
+/** The number of slots in the table of recently seen addresses. */
+#define RECENT_PCS 1024
+
+/** Addresses recently added to unique_pcs, plus one. */
+uint64_t recent_pcs[RECENT_PCS] = {0};
+
+/**
+ * Cycles taken by an instruction of each op type, indexed by OpType.
+ */
+uint64_t op_cycles[NUM_OP_TYPES] = {
+    1, // OP_ALU
+    2, // OP_LD
+    2, // OP_ST
+    3, // OP_CBR
+    1, // OP_OTHER
+};
+
+// A block of records is analyzed by counting its op types first and adding
+// up the cycles from the counts afterwards. With SSE2, the op types of 16
+// records are gathered into one vector and compared against each type at
+// once, and the matches are counted in 16 private 8-bit lanes per type that
+// are only added into the totals every OP_HIST_FLUSH vectors, before any
+// lane can overflow.
+
+/** The number of records whose op types fill a vector. */
+#define OP_HIST_LANES 16
+
+/** The number of vectors counted in 8-bit lanes between flushes. */
+#define OP_HIST_FLUSH 255
+
+#ifdef __SSE2__
+static_assert(sizeof(TraceRec) == 16 && offsetof(TraceRec, optype) == 8,
+              "gather_op_types() expects 16-byte records");
+
+/**
+ * Gathers the op types of 16 consecutive records, byte 8 of each, into one
+ * vector by interleaving the records' upper halves pairwise, then the pairs
+ * pairwise, and so on.
+ */
+static inline __m128i gather_op_types(const TraceRec *recs) {
+    __m128i pairs[8];
+    for (int i = 0; i < 8; i++) {
+        pairs[i] = _mm_unpackhi_epi8(_mm_loadu_si128((const __m128i *)(recs + 2 * i)),
+                                     _mm_loadu_si128((const __m128i *)(recs + 2 * i + 1)));
+    }
+    __m128i quads[4];
+    for (int i = 0; i < 4; i++) {
+        quads[i] = _mm_unpacklo_epi16(pairs[2 * i], pairs[2 * i + 1]);
+    }
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(quads[0], quads[1]),
+                              _mm_unpacklo_epi32(quads[2], quads[3]));
+}
+#endif
+
+/**
+ * Counts the records of each op type in a block. Records with an invalid op
+ * type are not counted.
+ */
+static void count_op_types(const TraceRec *recs, size_t n, uint64_t counts[NUM_OP_TYPES]) {
+    size_t i = 0;
+#ifdef __SSE2__
+    while (n - i >= OP_HIST_LANES) {
+        __m128i lanes[NUM_OP_TYPES];
+        for (int k = 0; k < NUM_OP_TYPES; k++) {
+            lanes[k] = _mm_setzero_si128();
+        }
+        for (int j = 0; j < OP_HIST_FLUSH && n - i >= OP_HIST_LANES; j++) {
+            __m128i ops = gather_op_types(recs + i);
+            for (int k = 0; k < NUM_OP_TYPES; k++) {
+                // A match is all ones, so subtracting it adds one.
+                lanes[k] = _mm_sub_epi8(lanes[k], _mm_cmpeq_epi8(ops, _mm_set1_epi8((char)k)));
+            }
+            i += OP_HIST_LANES;
+        }
+        for (int k = 0; k < NUM_OP_TYPES; k++) {
+            uint64_t sums[2];
+            _mm_storeu_si128((__m128i *)sums, _mm_sad_epu8(lanes[k], _mm_setzero_si128()));
+            counts[k] += sums[0] + sums[1];
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (recs[i].optype < NUM_OP_TYPES) {
+            counts[recs[i].optype]++;
+        }
+    }
+}
+
 // ------------------------------------------------------------------------- //
 // You must implement the body of the analyze_trace_record() function below. //
 // Do not modify its return type or argument type.                           //
@@ -73,12 +306,9 @@ uint64_t stat_unique_pc = 0;
  * details on the TraceRec type.
  */
 
-std::list<uint64_t> addresses;
-
 void analyze_trace_record(TraceRec *t) {
     assert(t);
 
-    //std::cout << stat_num_inst << std::endl;
     // TODO: Task 1: Quantify the mix of the dynamic instruction stream.
     // Update stat_optype_dyn according to the trace record t.
 
@@ -88,24 +318,64 @@ void analyze_trace_record(TraceRec *t) {
     // the CPI for each category of instructions is provided.
     // Update stat_num_cycle according to the trace record t.
 
-    if (t->optype == OP_ALU) {
-        stat_num_cycle += 1;
-    } else if (t->optype == OP_LD) {
-        stat_num_cycle += 2;
-    } else if (t->optype == OP_ST) {
-        stat_num_cycle += 2;
-    } else if (t->optype == OP_CBR) {
-        stat_num_cycle += 3;
-    } else {
-        stat_num_cycle += 1;
-    }
+    stat_num_cycle += op_cycles[t->optype];
 
     // TODO: Task 3: Estimate the instruction footprint by counting the number
     // of unique PCs in the benchmark trace.
     // Update stat_unique_pc according to the trace record t.
-    addresses.push_back(t->inst_addr);
-    addresses.sort();
-    addresses.unique();
-    stat_unique_pc = addresses.size();
+    if (track_unique_pcs && pc_set_insert(&unique_pcs, t->inst_addr)) {
+        stat_unique_pc = unique_pcs.size;
+    }
     // Make sure you DO NOT update stat_num_inst.
 }
+
+/**
+ * Counts the op types and cycles of a block of trace records. Touches no
+ * global variables, so several threads may count blocks at once.
+ *
+ * @param recs the trace records to count
+ * @param n the number of records
+ * @param optype_dyn the number of records of each op type, added to
+ * @param num_cycle the number of cycles, added to
+ * @return the number of records with a valid op type; any others are left
+ * out of the counts
+ */
+size_t count_trace_block(const TraceRec *recs, size_t n,
+                         uint64_t optype_dyn[NUM_OP_TYPES], uint64_t *num_cycle) {
+    uint64_t counts[NUM_OP_TYPES] = {0};
+    count_op_types(recs, n, counts);
+
+    size_t num_valid = 0;
+    for (int k = 0; k < NUM_OP_TYPES; k++) {
+        optype_dyn[k] += counts[k];
+        *num_cycle += counts[k] * op_cycles[k];
+        num_valid += counts[k];
+    }
+    return num_valid;
+}
+
+/**
+ * Updates the same global variables as analyze_trace_record(), for a block of
+ * consecutive trace records at once.
+ *
+ * @param recs the trace records to process
+ * @param n the number of records
+ * @return the number of records with a valid op type; any others are left
+ * out of the op type counts and the cycle total
+ */
+size_t analyze_trace_block(const TraceRec *recs, size_t n) {
+    size_t num_valid = count_trace_block(recs, n, stat_optype_dyn, &stat_num_cycle);
+
+    if (track_unique_pcs) {
+        for (size_t i = 0; i < n; i++) {
+            uint64_t pc = recs[i].inst_addr;
+            uint64_t *recent = &recent_pcs[(pc ^ (pc >> 10)) % RECENT_PCS];
+            if (*recent != pc + 1) {
+                *recent = pc + 1;
+                pc_set_insert(&unique_pcs, pc);
+            }
+        }
+        stat_unique_pc = unique_pcs.size;
+    }
+    return num_valid;
+}
@@ -6,6 +6,7 @@
 #define _TRACE_H_
 
 #include <inttypes.h>
+#include <stddef.h>
 
 /** The type of operation performed by an instruction in the CPU trace file. */
 typedef enum OpTypeEnum
@@ -50,4 +51,40 @@ typedef struct TraceRecStruct
  */
 void analyze_trace_record(TraceRec *t);
 
+/** Returned by the default count_trace_block(), which counts nothing. */
+#define TRACE_BLOCK_UNSUPPORTED ((size_t)-1)
+
+/**
+ * Updates the same global variables as analyze_trace_record(), for a block of
+ * consecutive trace records at once.
+ *
+ * You may implement this function in studentwork.cpp to analyze records
+ * faster. If you don't, the default in studentdefaults.cpp calls
+ * analyze_trace_record() on each record in turn.
+ *
+ * @param recs the trace records to process
+ * @param n the number of records
+ * @return n if every record has a valid op type, or fewer if not
+ */
+size_t analyze_trace_block(const TraceRec *recs, size_t n);
+
+/**
+ * Counts the op types and cycles of a block of trace records the way
+ * analyze_trace_block() does, but into the given counters instead of the
+ * global variables, so that several threads may count blocks at once.
+ *
+ * You may implement this function in studentwork.cpp for sim's -threads
+ * option. If you don't, the default in studentdefaults.cpp returns
+ * TRACE_BLOCK_UNSUPPORTED, and sim analyzes the trace on one thread.
+ *
+ * @param recs the trace records to count
+ * @param n the number of records
+ * @param optype_dyn the number of records of each op type, added to
+ * @param num_cycle the number of cycles, added to
+ * @return the number of records with a valid op type, or
+ *         TRACE_BLOCK_UNSUPPORTED
+ */
+size_t count_trace_block(const TraceRec *recs, size_t n,
+                         uint64_t optype_dyn[NUM_OP_TYPES], uint64_t *num_cycle);
+
 #endif
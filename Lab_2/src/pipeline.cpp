@@ -11,7 +11,6 @@
 #include "pipeline.h"
 #include <cstdlib>
 #include <stdio.h>
-#include <unistd.h>
 #include <iostream>
 
 /**
@@ -25,29 +24,11 @@
  */
 void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
 {
-    TraceRec *trace_rec = &fetch_op->trace_rec;
-    uint8_t *trace_rec_buf = (uint8_t *)trace_rec;
-    size_t bytes_read_total = 0;
-    ssize_t bytes_read_last = 0;
-    size_t bytes_left = sizeof(*trace_rec);
-
-    // Read a total of sizeof(TraceRec) bytes from the trace file.
-    while (bytes_left > 0)
-    {
-        bytes_read_last = read(p->trace_fd, trace_rec_buf, bytes_left);
-        if (bytes_read_last <= 0)
-        {
-            // EOF or error
-            break;
-        }
-
-        trace_rec_buf += bytes_read_last;
-        bytes_read_total += bytes_read_last;
-        bytes_left -= bytes_read_last;
-    }
+    // Take the next record straight from the trace reader's buffer.
+    const TraceRec *trace_rec = (const TraceRec *)trace_next_rec(p->trace);
 
     // Check for error conditions.
-    if (bytes_left > 0 || trace_rec->op_type >= NUM_OP_TYPES)
+    if (trace_rec == NULL || trace_rec->op_type >= NUM_OP_TYPES)
     {
         fetch_op->valid = false;
         p->halt_op_id = p->last_op_id;
@@ -57,26 +38,21 @@ void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
             p->halt = true;
         }
 
-        if (bytes_read_last == -1)
-        {
-            fprintf(stderr, "\n");
-            perror("Couldn't read from pipe");
-            return;
-        }
-
-        if (bytes_read_total == 0)
+        if (trace_rec == NULL)
         {
-            // No more trace records to read
+            // No more trace records to read, or trace_next_rec() has already
+            // reported an error.
             return;
         }
 
-        // Too few bytes read or invalid op_type
+        // Invalid op_type
         fprintf(stderr, "\n");
         fprintf(stderr, "Error: Invalid trace file\n");
         return;
     }
 
     // Got a valid trace record!
+    fetch_op->trace_rec = *trace_rec;
     fetch_op->valid = true;
     fetch_op->stall = false;
     fetch_op->is_mispred_cbr = false;
@@ -88,10 +64,10 @@ void pipe_get_fetch_op(Pipeline *p, PipelineLatch *fetch_op)
  * 
  * You should not need to modify this function.
  * 
- * @param trace_fd the file descriptor from which to read trace records
+ * @param trace the trace file from which to read trace records
  * @return a pointer to a newly allocated pipeline
  */
-Pipeline *pipe_init(int trace_fd)
+Pipeline *pipe_init(TraceReader *trace)
 {
     printf("\n** PIPELINE IS %d WIDE **\n\n", PIPE_WIDTH);
 
@@ -99,7 +75,7 @@ Pipeline *pipe_init(int trace_fd)
     Pipeline *p = (Pipeline *)calloc(1, sizeof(Pipeline));
 
     // Initialize pipeline.
-    p->trace_fd = trace_fd;
+    p->trace = trace;
     p->halt_op_id = (uint64_t)(-1) - 3;
 
     // Allocate and initialize a branch predictor if needed.
@@ -12,6 +12,7 @@
 #define _PIPELINE_H_
 
 #include "trace.h"
+#include "tracereader.h"
 #include "bpred.h"
 #include <inttypes.h>
 
@@ -200,8 +201,8 @@ typedef struct Pipeline
      */
     uint64_t stat_num_cycle;
 
-    /** [Internal] The file descriptor from which to read trace records. */
-    int trace_fd;
+    /** [Internal] The trace file from which to read trace records. */
+    TraceReader *trace;
     /** [Internal] The last op_id assigned. */
     uint64_t last_op_id;
     /** [Internal] The op_id of the last instruction in the trace. */
@@ -215,10 +216,10 @@ typedef struct Pipeline
  * 
  * You should not need to modify this function.
  * 
- * @param trace_fd the file descriptor from which to read trace records
+ * @param trace the trace file from which to read trace records
  * @return a pointer to a newly allocated pipeline
  */
-Pipeline *pipe_init(int trace_fd);
+Pipeline *pipe_init(TraceReader *trace);
 
 /**
  * Simulate one cycle of all stages of a pipeline.
@@ -7,12 +7,13 @@
 // CS 4290/6290.
 
 #include "pipeline.h"
+#include "simpoints.h"
 #include "bpred.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -60,13 +61,41 @@ BPredPolicy BPRED_POLICY = BPRED_PERFECT;
 #define HEARTBEAT_CYCLES 10000
 #define STAT_CYCLES (HEARTBEAT_CYCLES * 50)
 
+/** The counts of a simulation, or of the part of one after its warm-up. */
+typedef struct SimStatsStruct
+{
+    /** The number of instructions retired. */
+    uint64_t num_inst;
+    /** The number of cycles simulated. */
+    uint64_t num_cycle;
+    /** The number of conditional branches predicted. */
+    uint64_t num_branches;
+    /** The number of them mispredicted. */
+    uint64_t num_mispred;
+} SimStats;
+
 Pipeline *pipeline;
 uint64_t last_hbeat_inst = 0;
-
-int parse_args(int argc, char *argv[], char **trace_filename);
-int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid);
+unsigned int last_hbeat_percent = 0;
+
+int parse_args(int argc, char *argv[], char **trace_filename,
+               uint64_t *trace_skip, uint64_t *trace_window,
+               int *trace_flags, char **simpoints_filename,
+               uint64_t *warmup);
+int parse_count(const char *option, const char *arg, uint64_t *count);
+int simulate(const char *trace_filename, uint64_t trace_skip,
+             uint64_t trace_window, int trace_flags, uint64_t warmup,
+             SimStats *warm);
+int simulate_simpoint(const char *trace_filename, const SimPoint *point,
+                      int trace_flags, uint64_t warmup, SimStats *stats);
+int simulate_simpoints(const char *trace_filename,
+                       const char *simpoints_filename, int trace_flags,
+                       uint64_t warmup);
+void take_stats(SimStats *stats);
 int check_heartbeat();
 void print_stats();
+void print_simpoint_stats(const SimPoints *sp,
+                          const std::vector<SimStats> &stats);
 void print_usage(char *program_name);
 
 int main(int argc, char *argv[])
@@ -75,53 +104,51 @@ int main(int argc, char *argv[])
 
     // Parse the command-line arguments.
     char *trace_filename = NULL;
-    status = parse_args(argc, argv, &trace_filename);
+    uint64_t trace_skip = 0;
+    uint64_t trace_window = 0;
+    int trace_flags = 0;
+    char *simpoints_filename = NULL;
+    uint64_t warmup = 0;
+    status = parse_args(argc, argv, &trace_filename, &trace_skip,
+                        &trace_window, &trace_flags, &simpoints_filename,
+                        &warmup);
     if (status != 0)
     {
         return status;
     }
 
-    // Open the trace file using gunzip.
-    int trace_fd;
-    pid_t pid;
-    printf("Opening trace file with gunzip: %s\n", trace_filename);
-    status = open_gunzip_pipe(trace_filename, &trace_fd, &pid);
-    if (status != 0)
+    // With -simpoints, simulate only the windows named in the file, and
+    // estimate the statistics of the whole trace from them.
+    if (simpoints_filename != NULL)
     {
-        return status;
+        return simulate_simpoints(trace_filename, simpoints_filename,
+                                  trace_flags, warmup);
     }
 
-    // Simulate the pipeline.
-    pipeline = pipe_init(trace_fd);
-    status = 0;
-    while (status == 0 && !pipeline->halt)
-    {
-        pipe_cycle(pipeline);
-        status = check_heartbeat();
-    }
-    close(trace_fd);
+    status = simulate(trace_filename, trace_skip, trace_window, trace_flags,
+                      0, NULL);
     if (status != 0)
     {
-        waitpid(pid, NULL, 0);
         return status;
     }
 
-    // Wait for the child process to finish.
-    waitpid(pid, &status, 0);
-    status = WEXITSTATUS(status);
-    if (status == 127)
-    {
-        return 1;
-    }
-
     // Print statistics.
     print_stats();
     return 0;
 }
 
-int parse_args(int argc, char *argv[], char **trace_filename)
+int parse_args(int argc, char *argv[], char **trace_filename,
+               uint64_t *trace_skip, uint64_t *trace_window,
+               int *trace_flags, char **simpoints_filename,
+               uint64_t *warmup)
 {
     *trace_filename = NULL;
+    *trace_skip = 0;
+    *trace_window = 0;
+    *trace_flags = 0;
+    *simpoints_filename = NULL;
+    *warmup = 0;
+    bool has_warmup = false;
 
     if (argc < 2)
     {
@@ -181,6 +208,63 @@ int parse_args(int argc, char *argv[], char **trace_filename)
 
                 BPRED_POLICY = (BPredPolicy)policy;
             }
+            else if (strcmp(argv[i], "-skip") == 0 ||
+                     strcmp(argv[i], "-window") == 0 ||
+                     strcmp(argv[i], "-warmup") == 0)
+            {
+                if (i + 1 >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                    return 2;
+                }
+
+                uint64_t *count = argv[i][1] == 's'   ? trace_skip
+                                  : argv[i][2] == 'i' ? trace_window
+                                                      : warmup;
+                if (parse_count(argv[i], argv[i + 1], count) != 0)
+                {
+                    return 2;
+                }
+                has_warmup |= count == warmup;
+                i++;
+            }
+            else if (strcmp(argv[i], "-simpoints") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -simpoints\n");
+                    return 2;
+                }
+
+                *simpoints_filename = argv[i];
+            }
+            else if (strcmp(argv[i], "-io") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -io\n");
+                    return 2;
+                }
+
+                *trace_flags &= ~(TRACE_OPEN_URING | TRACE_OPEN_DIRECT);
+                if (strcmp(argv[i], "uring") == 0)
+                {
+                    *trace_flags |= TRACE_OPEN_URING;
+                }
+                else if (strcmp(argv[i], "direct") == 0)
+                {
+                    *trace_flags |= TRACE_OPEN_URING | TRACE_OPEN_DIRECT;
+                }
+                else if (strcmp(argv[i], "mmap") != 0)
+                {
+                    fprintf(stderr, "Error: invalid argument for -io\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-shm") == 0)
+            {
+                *trace_flags |= TRACE_OPEN_SHARED;
+            }
             else
             {
                 fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
@@ -204,55 +288,269 @@ int parse_args(int argc, char *argv[], char **trace_filename)
         fprintf(stderr, "Error: no trace file specified\n");
         return 2;
     }
+    if (*simpoints_filename != NULL && (*trace_skip != 0 || *trace_window != 0))
+    {
+        fprintf(stderr, "Error: -simpoints can't be used with -skip or -window\n");
+        return 2;
+    }
+    if (*simpoints_filename == NULL && has_warmup)
+    {
+        fprintf(stderr, "Error: -warmup needs -simpoints\n");
+        return 2;
+    }
 
     return 0;
 }
 
-int open_gunzip_pipe(const char *filename, int *fd, pid_t *pid)
+/**
+ * Parse a non-negative instruction count given to an option.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param count set to the count
+ * @return 0 on success, or 2 if arg is not a valid count
+ */
+int parse_count(const char *option, const char *arg, uint64_t *count)
 {
-    int status;
-    int pipefd[2];
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number of instructions\n",
+                option);
+        return 2;
+    }
+
+    *count = value;
+    return 0;
+}
+
+/**
+ * Simulate a range of a trace, leaving the finished pipeline in pipeline.
+ *
+ * Prints an error message on failure.
+ *
+ * @param trace_filename the path of the trace file
+ * @param trace_skip the index of the first record to simulate
+ * @param trace_window the number of records to simulate, or 0 for all of
+ *                     them up to the end of the trace
+ * @param trace_flags the flags to open the trace with
+ * @param warmup the number of instructions after which to take warm
+ * @param warm if not NULL, set to the counts once warmup instructions have
+ *             retired
+ * @return 0 on success, or 1 on error
+ */
+int simulate(const char *trace_filename, uint64_t trace_skip,
+             uint64_t trace_window, int trace_flags, uint64_t warmup,
+             SimStats *warm)
+{
+    // Open the trace file. Packed traces are mapped into memory (or, with
+    // -io, read ahead with io_uring); gzip traces are decompressed on a
+    // background thread, or with -shm, once into shared memory for every
+    // simulation of the trace. With -skip, the simulation starts that many
+    // instructions into the trace.
+    printf("Opening trace file: %s\n", trace_filename);
+    if (trace_skip > 0)
+    {
+        printf("Starting at instruction %lu\n", (unsigned long)trace_skip);
+    }
+    TraceReader *trace = trace_open_range(trace_filename, sizeof(TraceRec),
+                                          TRACE_OPEN_ASYNC | trace_flags,
+                                          trace_skip, trace_window);
+    if (trace == NULL)
+    {
+        return 1;
+    }
 
-    status = pipe(pipefd);
+    // Simulate the pipeline.
+    pipeline = pipe_init(trace);
+    int status = 0;
+    bool warmed = warm == NULL;
+    while (status == 0 && !pipeline->halt)
+    {
+        if (!warmed && pipeline->stat_retired_inst >= warmup)
+        {
+            take_stats(warm);
+            warmed = true;
+        }
+        pipe_cycle(pipeline);
+        status = check_heartbeat();
+    }
+    bool trace_error = trace->error;
+    trace_close(trace);
     if (status != 0)
     {
-        perror("Couldn't create pipe");
+        return status;
+    }
+    if (trace_error)
+    {
         return 1;
     }
+    if (!warmed)
+    {
+        take_stats(warm);
+    }
+    return 0;
+}
 
-    *pid = fork();
-    if (*pid == -1)
+/**
+ * Simulate one simpoint in a child process, so that it starts from a fresh
+ * pipeline and from any state kept between cycles in static variables.
+ *
+ * The simulation starts up to warmup instructions early, to warm up the
+ * pipeline's state, and only counts the simpoint's own instructions.
+ *
+ * Prints an error message on failure.
+ *
+ * @param trace_filename the path of the trace file
+ * @param point the simpoint
+ * @param trace_flags the flags to open the trace with
+ * @param warmup the number of instructions to simulate before the simpoint
+ * @param stats set to the counts of the simpoint's instructions
+ * @return 0 on success, or 1 on error
+ */
+int simulate_simpoint(const char *trace_filename, const SimPoint *point,
+                      int trace_flags, uint64_t warmup, SimStats *stats)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
     {
-        perror("Couldn't fork");
-        close(pipefd[0]);
-        close(pipefd[1]);
+        fprintf(stderr, "Error: couldn't create a pipe (%s)\n",
+                strerror(errno));
         return 1;
     }
 
-    if (*pid == 0)
+    // Anything still buffered would otherwise be printed by both processes.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0)
     {
-        // Child process: exec gunzip.
-        dup2(pipefd[1], STDOUT_FILENO);
-        close(pipefd[0]);
-        close(pipefd[1]);
-        execlp("gunzip", "gunzip", "-c", filename, NULL);
-        perror("Couldn't exec gunzip");
-        fprintf(stderr, "Is gunzip installed?\n");
-        return 127;
+        fprintf(stderr, "Error: couldn't start a simulation (%s)\n",
+                strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        warmup = warmup < point->start ? warmup : point->start;
+        SimStats warm;
+        int status = simulate(trace_filename, point->start - warmup,
+                              warmup + point->length, trace_flags, warmup,
+                              &warm);
+        if (status == 0)
+        {
+            take_stats(stats);
+            stats->num_inst -= warm.num_inst;
+            stats->num_cycle -= warm.num_cycle;
+            stats->num_branches -= warm.num_branches;
+            stats->num_mispred -= warm.num_mispred;
+            if (write(fds[1], stats, sizeof(*stats)) != sizeof(*stats))
+            {
+                status = 1;
+            }
+        }
+        fflush(stdout);
+        _exit(status);
     }
 
-    // Parent process: return the read end of the pipe.
-    *fd = pipefd[0];
-    close(pipefd[1]);
+    close(fds[1]);
+    ssize_t got = read(fds[0], stats, sizeof(*stats));
+    close(fds[0]);
+    int wstatus;
+    if (waitpid(pid, &wstatus, 0) != pid || !WIFEXITED(wstatus) ||
+        WEXITSTATUS(wstatus) != 0 || got != sizeof(*stats))
+    {
+        fprintf(stderr, "Error: simulation of the simpoint at instruction "
+                        "%lu failed\n",
+                (unsigned long)point->start);
+        return 1;
+    }
     return 0;
 }
 
+/**
+ * Simulate the simpoints of a trace one after another, and print the
+ * statistics of the whole trace estimated from them.
+ *
+ * @param trace_filename the path of the trace file
+ * @param simpoints_filename the path of the simpoints file
+ * @param trace_flags the flags to open the trace with
+ * @param warmup the number of instructions to simulate before each simpoint
+ * @return 0 on success, or 1 on error
+ */
+int simulate_simpoints(const char *trace_filename,
+                       const char *simpoints_filename, int trace_flags,
+                       uint64_t warmup)
+{
+    SimPoints sp;
+    if (simpoints_load(simpoints_filename, &sp) != 0)
+    {
+        return 1;
+    }
+
+    std::vector<SimStats> stats(sp.points.size());
+    for (size_t i = 0; i < sp.points.size(); i++)
+    {
+        const SimPoint &point = sp.points[i];
+        printf("Simulating simpoint %lu of %lu: %lu instructions at "
+               "instruction %lu, weight %.4f\n",
+               (unsigned long)(i + 1), (unsigned long)sp.points.size(),
+               (unsigned long)point.length, (unsigned long)point.start,
+               point.weight);
+        if (simulate_simpoint(trace_filename, &point, trace_flags, warmup,
+                              &stats[i]) != 0)
+        {
+            return 1;
+        }
+        printf("\n\n");
+    }
+
+    print_simpoint_stats(&sp, stats);
+    return 0;
+}
+
+/**
+ * Get the counts of the simulation so far.
+ *
+ * @param stats set to the counts
+ */
+void take_stats(SimStats *stats)
+{
+    stats->num_inst = pipeline->stat_retired_inst;
+    stats->num_cycle = pipeline->stat_num_cycle;
+    stats->num_branches = 0;
+    stats->num_mispred = 0;
+    if (BPRED_POLICY != BPRED_PERFECT)
+    {
+        stats->num_branches = pipeline->b_pred->stat_num_branches;
+        stats->num_mispred = pipeline->b_pred->stat_num_mispred;
+    }
+}
+
 int check_heartbeat()
 {
     if (pipeline->stat_num_cycle % HEARTBEAT_CYCLES == 0)
     {
-        // Print a heartbeat.
-        printf(".");
+        // Print a heartbeat. If the trace length is known up front (packed
+        // traces), show how far through the trace we are instead of a dot.
+        uint64_t total_recs = pipeline->trace->total_recs;
+        if (total_recs > 0)
+        {
+            unsigned int percent =
+                (unsigned int)(100 * pipeline->stat_retired_inst / total_recs);
+            if (percent != last_hbeat_percent)
+            {
+                printf(" %u%%", percent);
+                last_hbeat_percent = percent;
+            }
+        }
+        else
+        {
+            printf(".");
+        }
         fflush(stdout);
 
         // Check for deadlock.
@@ -311,6 +609,51 @@ void print_stats()
     printf("\n");
 }
 
+/**
+ * Print the statistics of a whole trace estimated from its simpoints.
+ *
+ * @param sp the simpoints
+ * @param stats the counts of each simpoint's instructions
+ */
+void print_simpoint_stats(const SimPoints *sp,
+                          const std::vector<SimStats> &stats)
+{
+    // Each simpoint stands for its weight's share of the instructions, at
+    // its own rate of cycles and branches per instruction.
+    double cpi = 0;
+    double branches_per_inst = 0;
+    double mispred_per_inst = 0;
+    uint64_t simulated = 0;
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        double num_inst = stats[i].num_inst != 0 ? (double)stats[i].num_inst : 1;
+        double weight = sp->points[i].weight;
+        cpi += weight * (double)stats[i].num_cycle / num_inst;
+        branches_per_inst += weight * (double)stats[i].num_branches / num_inst;
+        mispred_per_inst += weight * (double)stats[i].num_mispred / num_inst;
+        simulated += stats[i].num_inst;
+    }
+    double num_inst = (double)sp->num_insts;
+
+    printf("(estimated from %lu simpoints, %lu instructions simulated)\n",
+           (unsigned long)stats.size(), (unsigned long)simulated);
+    printf("LAB2_NUM_INST           \t : %10lu\n", (unsigned long)sp->num_insts);
+    printf("LAB2_NUM_CYCLES         \t : %10.0f\n", cpi * num_inst);
+    printf("LAB2_CPI                \t : %10.3f\n", cpi);
+
+    if (BPRED_POLICY != BPRED_PERFECT)
+    {
+        double bpred_mispred_rate = branches_per_inst != 0
+                                        ? 100.0 * mispred_per_inst / branches_per_inst
+                                        : 0.0;
+
+        printf("LAB2_BPRED_BRANCHES     \t : %10.0f\n", branches_per_inst * num_inst);
+        printf("LAB2_BPRED_MISPRED      \t : %10.0f\n", mispred_per_inst * num_inst);
+        printf("LAB2_MISPRED_RATE       \t : %10.3f\n", bpred_mispred_rate);
+    }
+    printf("\n");
+}
+
 void print_usage(char *program_name)
 {
     fprintf(stderr, "Usage: %s [options] <trace file>\n\n", program_name);
@@ -323,4 +666,19 @@ void print_usage(char *program_name)
     fprintf(stderr, "                        default)\n");
     fprintf(stderr, "    -bpredpolicy <num>  Set branch predictor [0: Perfect, 1: Always Taken,\n");
     fprintf(stderr, "                        2: Gshare] (Default: 0)\n");
+    fprintf(stderr, "    -skip <num>         Start simulating <num> instructions into the trace\n");
+    fprintf(stderr, "                        (fast for packed traces and indexed gzip traces)\n");
+    fprintf(stderr, "    -window <num>       Simulate at most <num> instructions\n");
+    fprintf(stderr, "    -io <mode>          How to read uncompressed packed traces [mmap: map\n");
+    fprintf(stderr, "                        into memory, uring: read ahead with io_uring,\n");
+    fprintf(stderr, "                        direct: like uring, bypassing the page cache]\n");
+    fprintf(stderr, "                        (default: mmap)\n");
+    fprintf(stderr, "    -shm                Share the decompressed trace with other simulations\n");
+    fprintf(stderr, "                        of the same trace through shared memory\n");
+    fprintf(stderr, "    -simpoints <file>   Simulate only the windows in <file>, written by the\n");
+    fprintf(stderr, "                        Lab 1 analyzer's -simpoints option, and estimate\n");
+    fprintf(stderr, "                        the statistics of the whole trace from them\n");
+    fprintf(stderr, "    -warmup <num>       With -simpoints, start simulating each window up to\n");
+    fprintf(stderr, "                        <num> instructions early, without counting them\n");
+    fprintf(stderr, "                        (default: 0)\n");
 }
@@ -12,7 +12,6 @@
 #include "pipeline.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 
 /**
  * The width of the pipeline; that is, the maximum number of instructions that
@@ -67,29 +66,12 @@ extern uint32_t LOAD_EXE_CYCLES;
 void pipe_fetch_inst(Pipeline *p, PipelineLatch *fe_latch)
 {
     InstInfo *inst = &fe_latch->inst;
-    TraceRec trace_rec;
-    uint8_t *trace_rec_buf = (uint8_t *)&trace_rec;
-    size_t bytes_read_total = 0;
-    ssize_t bytes_read_last = 0;
-    size_t bytes_left = sizeof(TraceRec);
-
-    // Read a total of sizeof(TraceRec) bytes from the trace file.
-    while (bytes_left > 0)
-    {
-        bytes_read_last = read(p->trace_fd, trace_rec_buf, bytes_left);
-        if (bytes_read_last <= 0)
-        {
-            // EOF or error
-            break;
-        }
 
-        trace_rec_buf += bytes_read_last;
-        bytes_read_total += bytes_read_last;
-        bytes_left -= bytes_read_last;
-    }
+    // Take the next record straight from the trace reader's buffer.
+    const TraceRec *trace_rec = (const TraceRec *)trace_next_rec(p->trace);
 
     // Check for error conditions.
-    if (bytes_left > 0 || trace_rec.op_type >= NUM_OP_TYPES)
+    if (trace_rec == NULL || trace_rec->op_type >= NUM_OP_TYPES)
     {
         fe_latch->valid = false;
         p->halt_inst_num = p->last_inst_num;
@@ -99,20 +81,14 @@ void pipe_fetch_inst(Pipeline *p, PipelineLatch *fe_latch)
             p->halt = true;
         }
 
-        if (bytes_read_last == -1)
-        {
-            fprintf(stderr, "\n");
-            perror("Couldn't read from pipe");
-            return;
-        }
-
-        if (bytes_read_total == 0)
+        if (trace_rec == NULL)
         {
-            // No more trace records to read
+            // No more trace records to read, or trace_next_rec() has already
+            // reported an error.
             return;
         }
 
-        // Too few bytes read or invalid op_type
+        // Invalid op_type
         fprintf(stderr, "\n");
         fprintf(stderr, "Error: Invalid trace file\n");
         return;
@@ -122,11 +98,11 @@ void pipe_fetch_inst(Pipeline *p, PipelineLatch *fe_latch)
     fe_latch->valid = true;
     fe_latch->stall = false;
     inst->inst_num = ++p->last_inst_num;
-    inst->op_type = (OpType)trace_rec.op_type;
+    inst->op_type = (OpType)trace_rec->op_type;
 
-    inst->dest_reg = trace_rec.dest_needed ? trace_rec.dest_reg : -1;
-    inst->src1_reg = trace_rec.src1_needed ? trace_rec.src1_reg : -1;
-    inst->src2_reg = trace_rec.src2_needed ? trace_rec.src2_reg : -1;
+    inst->dest_reg = trace_rec->dest_needed ? trace_rec->dest_reg : -1;
+    inst->src1_reg = trace_rec->src1_needed ? trace_rec->src1_reg : -1;
+    inst->src2_reg = trace_rec->src2_needed ? trace_rec->src2_reg : -1;
 
     inst->dr_tag = -1;
     inst->src1_tag = -1;
@@ -141,10 +117,10 @@ void pipe_fetch_inst(Pipeline *p, PipelineLatch *fe_latch)
  * 
  * You should not need to modify this function.
  * 
- * @param trace_fd the file descriptor from which to read trace records
+ * @param trace the trace file from which to read trace records
  * @return a pointer to a newly allocated pipeline
  */
-Pipeline *pipe_init(int trace_fd)
+Pipeline *pipe_init(TraceReader *trace)
 {
     printf("\n** PIPELINE IS %d WIDE **\n\n", PIPE_WIDTH);
 
@@ -155,7 +131,7 @@ Pipeline *pipe_init(int trace_fd)
     p->rat = rat_init();
     p->rob = rob_init();
     p->exeq = exeq_init();
-    p->trace_fd = trace_fd;
+    p->trace = trace;
     p->halt_inst_num = (uint64_t)(-1) - 3;
 
     for (unsigned int i = 0; i < PIPE_WIDTH; i++)
@@ -12,6 +12,7 @@
 #define _PIPELINE_H_
 
 #include "trace.h"
+#include "tracereader.h"
 #include "rat.h"
 #include "rob.h"
 #include "exeq.h"
@@ -169,8 +170,8 @@ typedef struct Pipeline
      */
     uint64_t stat_num_cycle;
 
-    /** [Internal] The file descriptor from which to read trace records. */
-    int trace_fd;
+    /** [Internal] The trace file from which to read trace records. */
+    TraceReader *trace;
     /** [Internal] The last inst_num assigned. */
     uint64_t last_inst_num;
     /** [Internal] The inst_num of the last instruction in the trace. */
@@ -184,10 +185,10 @@ typedef struct Pipeline
  * 
  * You should not modify this function.
  * 
- * @param trace_fd the file descriptor from which to read trace records
+ * @param trace the trace file from which to read trace records
  * @return a pointer to a newly allocated pipeline
  */
-Pipeline *pipe_init(int trace_fd);
+Pipeline *pipe_init(TraceReader *trace);
 
 /**
  * Simulate one cycle of all stages of a pipeline.
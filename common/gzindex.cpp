@@ -0,0 +1,394 @@
+// gzindex.cpp
+// Implements a random-access index for gzip-compressed trace files.
+
+#include "gzindex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ * [Internal] Get the name of the index file of a gzip-compressed file.
+ *
+ * @param gz_filename the path of the gzip-compressed file
+ * @return a newly allocated string; free it with free()
+ */
+static char *gzi_filename(const char *gz_filename)
+{
+    size_t len = strlen(gz_filename) + sizeof(GZ_INDEX_SUFFIX);
+    char *filename = (char *)malloc(len);
+    snprintf(filename, len, "%s%s", gz_filename, GZ_INDEX_SUFFIX);
+    return filename;
+}
+
+/**
+ * [Internal] Write an index file, under a temporary name first so that an
+ * interrupted build never leaves a partial index behind.
+ *
+ * @param index_filename the path of the index file to write
+ * @param header the header of the index
+ * @param points the checkpoints, with window_offset relative to the end of
+ *               the checkpoint table
+ * @param windows the compressed inflate history of each checkpoint
+ * @param windows_len the total size in bytes of windows
+ * @return 0 on success, or -1 on error
+ */
+static int gzi_write(const char *index_filename, const GzIndexHeader *header,
+                     GzIndexPoint *points, const uint8_t *windows,
+                     size_t windows_len)
+{
+    size_t name_len = strlen(index_filename);
+    char *tmp_filename = (char *)malloc(name_len + 5);
+    snprintf(tmp_filename, name_len + 5, "%s.tmp", index_filename);
+
+    FILE *f = fopen(tmp_filename, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Couldn't create %s: ", tmp_filename);
+        perror(NULL);
+        free(tmp_filename);
+        return -1;
+    }
+
+    size_t n = header->num_points;
+    for (size_t i = 0; i < n; i++)
+    {
+        points[i].window_offset += sizeof(*header) + n * sizeof(*points);
+    }
+    bool ok = fwrite(header, sizeof(*header), 1, f) == 1 &&
+              fwrite(points, sizeof(*points), n, f) == n &&
+              fwrite(windows, 1, windows_len, f) == windows_len;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "Couldn't write %s: ", tmp_filename);
+        perror(NULL);
+    }
+    else if (rename(tmp_filename, index_filename) != 0)
+    {
+        fprintf(stderr, "Couldn't rename %s to %s: ", tmp_filename,
+                index_filename);
+        perror(NULL);
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        unlink(tmp_filename);
+    }
+    free(tmp_filename);
+    return ok ? 0 : -1;
+}
+
+/**
+ * Build an index of a gzip-compressed file and write it to index_filename.
+ *
+ * @param gz_filename the path of the gzip-compressed file
+ * @param index_filename the path of the index file to write
+ * @param span the distance in decompressed bytes between checkpoints
+ * @return the number of checkpoints written, or -1 on error
+ */
+int gzi_build(const char *gz_filename, const char *index_filename,
+              uint64_t span)
+{
+    if (span < GZ_INDEX_WINDOW_SIZE)
+    {
+        span = GZ_INDEX_WINDOW_SIZE;
+    }
+
+    int fd = open(gz_filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Couldn't open trace file %s: ", gz_filename);
+        perror(NULL);
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK)
+    {
+        fprintf(stderr, "Error: couldn't initialize zlib for %s\n", gz_filename);
+        close(fd);
+        return -1;
+    }
+
+    uint8_t *in_buf = (uint8_t *)malloc(GZ_IN_BUF_SIZE);
+    // Output goes round a window-sized ring, so the history preceding each
+    // checkpoint is always at hand.
+    uint8_t *window = (uint8_t *)malloc(GZ_INDEX_WINDOW_SIZE);
+    // Windows are compressed as they're taken; they shrink a lot, since
+    // the traces are very repetitive.
+    uint8_t *unrolled = (uint8_t *)malloc(GZ_INDEX_WINDOW_SIZE);
+    GzIndexPoint *points = NULL;
+    uint8_t *windows = NULL;
+    size_t windows_len = 0;
+    size_t windows_cap = 0;
+    size_t num_points = 0;
+    size_t max_points = 0;
+
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t last_out = 0;
+    bool in_eof = false;
+    const char *problem = NULL;
+    int ret = Z_OK;
+
+    strm.avail_out = 0;
+    while (problem == NULL)
+    {
+        if (strm.avail_in == 0 && !in_eof)
+        {
+            ssize_t bytes_read;
+            do
+            {
+                bytes_read = read(fd, in_buf, GZ_IN_BUF_SIZE);
+            } while (bytes_read == -1 && errno == EINTR);
+            if (bytes_read == -1)
+            {
+                problem = strerror(errno);
+                break;
+            }
+            strm.next_in = in_buf;
+            strm.avail_in = (uInt)bytes_read;
+            in_eof = bytes_read == 0;
+        }
+
+        if (ret == Z_STREAM_END)
+        {
+            // Either another gzip member follows, or the file is over. Like
+            // gzs_read(), stop at anything that isn't a gzip header.
+            if (strm.avail_in == 0 || strm.next_in[0] != 0x1f)
+            {
+                break;
+            }
+            inflateReset(&strm);
+        }
+
+        if (strm.avail_out == 0)
+        {
+            strm.next_out = window;
+            strm.avail_out = GZ_INDEX_WINDOW_SIZE;
+        }
+
+        uInt avail_in = strm.avail_in;
+        uInt avail_out = strm.avail_out;
+        // Z_BLOCK stops at each deflate block boundary, where a checkpoint
+        // can be made.
+        ret = inflate(&strm, Z_BLOCK);
+        total_in += avail_in - strm.avail_in;
+        total_out += avail_out - strm.avail_out;
+
+        if (ret == Z_BUF_ERROR && strm.avail_in == 0 && in_eof)
+        {
+            problem = "truncated gzip stream (unexpected end of file)";
+        }
+        else if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+        {
+            problem = strm.msg ? strm.msg : zError(ret);
+        }
+        else if ((strm.data_type & 128) && !(strm.data_type & 64) &&
+                 total_out - last_out >= span)
+        {
+            // At the end of a block that isn't the member's last one.
+            if (num_points == max_points)
+            {
+                max_points = max_points ? 2 * max_points : 64;
+                points = (GzIndexPoint *)realloc(points, max_points * sizeof(GzIndexPoint));
+            }
+            uLong bound = compressBound(GZ_INDEX_WINDOW_SIZE);
+            if (windows_len + bound > windows_cap)
+            {
+                windows_cap = 2 * (windows_len + bound);
+                windows = (uint8_t *)realloc(windows, windows_cap);
+            }
+
+            // Unroll the ring so the window reads oldest byte first.
+            size_t tail = strm.avail_out;
+            memcpy(unrolled, window + GZ_INDEX_WINDOW_SIZE - tail, tail);
+            memcpy(unrolled + tail, window, GZ_INDEX_WINDOW_SIZE - tail);
+
+            uLongf window_len = bound;
+            compress(windows + windows_len, &window_len, unrolled,
+                     GZ_INDEX_WINDOW_SIZE);
+
+            GzIndexPoint *point = &points[num_points];
+            point->out = total_out;
+            point->in = total_in;
+            point->window_offset = windows_len;
+            point->window_len = (uint32_t)window_len;
+            point->bits = strm.data_type & 7;
+
+            windows_len += window_len;
+            num_points++;
+            last_out = total_out;
+        }
+    }
+
+    inflateEnd(&strm);
+    close(fd);
+    free(in_buf);
+    free(window);
+    free(unrolled);
+
+    int status = -1;
+    if (problem != NULL)
+    {
+        fprintf(stderr, "Error: %s: %s after %lu decompressed bytes\n",
+                gz_filename, problem, (unsigned long)total_out);
+    }
+    else
+    {
+        GzIndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, GZ_INDEX_MAGIC, sizeof(header.magic));
+        header.version = GZ_INDEX_VERSION;
+        header.num_points = (uint32_t)num_points;
+        header.gz_size = (uint64_t)st.st_size;
+        header.total_out = total_out;
+        if (gzi_write(index_filename, &header, points, windows,
+                      windows_len) == 0)
+        {
+            status = (int)num_points;
+        }
+    }
+
+    free(points);
+    free(windows);
+    return status;
+}
+
+/**
+ * Load the index of a gzip-compressed file, if it has an up-to-date one.
+ *
+ * @param gz_filename the path of the gzip-compressed file
+ * @return a pointer to a newly allocated GzIndex, or NULL if there is none
+ */
+GzIndex *gzi_load(const char *gz_filename)
+{
+    char *index_filename = gzi_filename(gz_filename);
+    int fd = open(index_filename, O_RDONLY);
+    if (fd == -1)
+    {
+        free(index_filename);
+        return NULL;
+    }
+
+    GzIndex *gzi = (GzIndex *)calloc(1, sizeof(GzIndex));
+    gzi->fd = fd;
+
+    const char *problem = NULL;
+    struct stat st;
+    GzIndexHeader *header = &gzi->header;
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header) ||
+        memcmp(header->magic, GZ_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != GZ_INDEX_VERSION)
+    {
+        problem = "not a gzip index, or an unsupported version";
+    }
+    else if (stat(gz_filename, &st) != 0 ||
+             (uint64_t)st.st_size != header->gz_size)
+    {
+        problem = "built for a different version of the trace";
+    }
+    else
+    {
+        size_t len = header->num_points * sizeof(GzIndexPoint);
+        gzi->points = (GzIndexPoint *)malloc(len);
+        if (pread(fd, gzi->points, len, sizeof(*header)) != (ssize_t)len)
+        {
+            problem = "truncated gzip index";
+        }
+    }
+
+    if (problem != NULL)
+    {
+        fprintf(stderr, "Warning: %s: %s; ignoring the index\n",
+                index_filename, problem);
+        gzi_free(gzi);
+        gzi = NULL;
+    }
+    free(index_filename);
+    return gzi;
+}
+
+/**
+ * Move a stream to the last checkpoint at or before a decompressed offset.
+ *
+ * @param gzi the index of the stream's file
+ * @param gz the stream to move
+ * @param offset the decompressed offset wanted
+ * @return the decompressed offset the stream was moved to, or (uint64_t)-1
+ *         on error (already reported)
+ */
+uint64_t gzi_seek(GzIndex *gzi, GzStream *gz, uint64_t offset)
+{
+    // Find the first checkpoint past offset; the one before it is the one.
+    size_t lo = 0;
+    size_t hi = gzi->header.num_points;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (gzi->points[mid].out <= offset)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo == 0)
+    {
+        // The offset comes before the first checkpoint.
+        return 0;
+    }
+
+    const GzIndexPoint *point = &gzi->points[lo - 1];
+    uint8_t *packed = (uint8_t *)malloc(point->window_len);
+    uint8_t *window = (uint8_t *)malloc(GZ_INDEX_WINDOW_SIZE);
+    uLongf window_len = GZ_INDEX_WINDOW_SIZE;
+    if (pread(gzi->fd, packed, point->window_len, (off_t)point->window_offset) !=
+            (ssize_t)point->window_len ||
+        uncompress(window, &window_len, packed, point->window_len) != Z_OK ||
+        window_len != GZ_INDEX_WINDOW_SIZE)
+    {
+        fprintf(stderr, "Error: %s%s: truncated or corrupt gzip index\n",
+                gz->filename, GZ_INDEX_SUFFIX);
+        free(packed);
+        free(window);
+        return (uint64_t)-1;
+    }
+
+    int status = gzs_seek(gz, point->in, point->bits, point->out, window,
+                          GZ_INDEX_WINDOW_SIZE);
+    free(packed);
+    free(window);
+    return status == 0 ? point->out : (uint64_t)-1;
+}
+
+/**
+ * Free all memory associated with an index.
+ *
+ * @param gzi the index to free (may be NULL)
+ */
+void gzi_free(GzIndex *gzi)
+{
+    if (gzi == NULL)
+    {
+        return;
+    }
+
+    close(gzi->fd);
+    free(gzi->points);
+    free(gzi);
+}
@@ -0,0 +1,129 @@
+// gzindex.h
+// Declares a random-access index for gzip-compressed trace files, so a
+// simulation can start deep inside a trace without inflating everything
+// before it.
+//
+// Deflate data can't be decoded from an arbitrary byte, but it can be from
+// the start of any deflate block given the 32 KiB of output preceding it.
+// The index records such checkpoints every few MB of output, and is stored
+// beside the trace as "<trace>.gzi":
+//
+//   GzIndexHeader                 magic, version, and what the index covers
+//   GzIndexPoint[num_points]      the checkpoints, in increasing order
+//   windows                       the output preceding each checkpoint, each
+//                                 compressed with zlib on its own
+
+#ifndef _GZINDEX_H_
+#define _GZINDEX_H_
+
+#include "gzstream.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The first eight bytes of every gzip index file. */
+#define GZ_INDEX_MAGIC "ECEGZIDX"
+
+/** The current version of the gzip index format. */
+#define GZ_INDEX_VERSION 1
+
+/** The suffix appended to a trace's file name to name its index. */
+#define GZ_INDEX_SUFFIX ".gzi"
+
+/** The size in bytes of the inflate history stored with each checkpoint. */
+#define GZ_INDEX_WINDOW_SIZE 32768
+
+/** The default distance in decompressed bytes between checkpoints. */
+#define GZ_INDEX_DEFAULT_SPAN (4 * 1024 * 1024)
+
+/** The header at the start of a gzip index file. */
+typedef struct GzIndexHeaderStruct
+{
+    /** GZ_INDEX_MAGIC, not NUL-terminated. */
+    char magic[8];
+    /** GZ_INDEX_VERSION. */
+    uint32_t version;
+    /** The number of checkpoints in the index. */
+    uint32_t num_points;
+    /** The size in bytes of the compressed file the index was built for. */
+    uint64_t gz_size;
+    /** The total decompressed size of that file. */
+    uint64_t total_out;
+} GzIndexHeader;
+
+/** A point in a gzip file where inflating can resume. */
+typedef struct GzIndexPointStruct
+{
+    /** The decompressed offset of the point. */
+    uint64_t out;
+    /**
+     * The compressed offset of the first byte wholly after the point. If
+     * bits is not 0, the point lies that many bits before this byte.
+     */
+    uint64_t in;
+    /** The offset in the index file of the point's compressed window. */
+    uint64_t window_offset;
+    /** The size in bytes of the point's compressed window. */
+    uint32_t window_len;
+    /** The number of bits of the byte at in - 1 that follow the point. */
+    uint32_t bits;
+} GzIndexPoint;
+
+/** A gzip index loaded from disk. */
+typedef struct GzIndexStruct
+{
+    /** [Internal] The file descriptor of the index, for reading windows. */
+    int fd;
+    /** The header of the index. */
+    GzIndexHeader header;
+    /** The checkpoints, header.num_points of them. */
+    GzIndexPoint *points;
+} GzIndex;
+
+/**
+ * Build an index of a gzip-compressed file and write it to index_filename.
+ *
+ * Prints an error message and returns -1 if the file can't be read or is
+ * not a valid gzip file, or if the index can't be written.
+ *
+ * @param gz_filename the path of the gzip-compressed file
+ * @param index_filename the path of the index file to write
+ * @param span the distance in decompressed bytes between checkpoints
+ * @return the number of checkpoints written, or -1 on error
+ */
+int gzi_build(const char *gz_filename, const char *index_filename,
+              uint64_t span);
+
+/**
+ * Load the index of a gzip-compressed file, if it has an up-to-date one.
+ *
+ * An index whose file is missing is silently ignored. One that does not
+ * match the compressed file (for example, because the trace was replaced
+ * after indexing) is ignored with a warning.
+ *
+ * @param gz_filename the path of the gzip-compressed file
+ * @return a pointer to a newly allocated GzIndex, or NULL if there is none
+ */
+GzIndex *gzi_load(const char *gz_filename);
+
+/**
+ * Move a stream to the last checkpoint at or before a decompressed offset.
+ *
+ * The stream must not have been read from yet. The caller reads and discards
+ * the bytes between the checkpoint and the offset it wants.
+ *
+ * @param gzi the index of the stream's file
+ * @param gz the stream to move
+ * @param offset the decompressed offset wanted
+ * @return the decompressed offset the stream was moved to, or (uint64_t)-1
+ *         on error (already reported)
+ */
+uint64_t gzi_seek(GzIndex *gzi, GzStream *gz, uint64_t offset);
+
+/**
+ * Free all memory associated with an index.
+ *
+ * @param gzi the index to free (may be NULL)
+ */
+void gzi_free(GzIndex *gzi);
+
+#endif
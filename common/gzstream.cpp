@@ -0,0 +1,300 @@
+// gzstream.cpp
+// Implements a streaming gzip decoder used to read compressed trace files
+// in-process.
+
+#include "gzstream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** [Internal] The size in bytes of the trailer at the end of a gzip member. */
+#define GZ_TRAILER_SIZE 8
+
+/**
+ * [Internal] The largest number of bytes handed to a single inflate() call;
+ * zlib counts available output in a 32-bit unsigned int.
+ */
+#define GZ_MAX_CHUNK (1u << 30)
+
+/**
+ * [Internal] Refill the compressed input buffer from the file.
+ *
+ * @param gz the stream to refill
+ * @return 0 on success (including reaching the end of the file), or -1 if
+ *         the file could not be read
+ */
+static int gzs_refill(GzStream *gz)
+{
+    ssize_t bytes_read;
+    do
+    {
+        bytes_read = read(gz->fd, gz->in_buf, GZ_IN_BUF_SIZE);
+    } while (bytes_read == -1 && errno == EINTR);
+
+    if (bytes_read == -1)
+    {
+        fprintf(stderr, "\n");
+        perror("Couldn't read from trace file");
+        return -1;
+    }
+
+    gz->strm.next_in = gz->in_buf;
+    gz->strm.avail_in = (uInt)bytes_read;
+    if (bytes_read == 0)
+    {
+        gz->in_eof = true;
+    }
+    return 0;
+}
+
+/**
+ * [Internal] Mark the stream as failed and report why.
+ *
+ * @param gz the stream that failed
+ * @param reason a short description of the failure
+ * @return -1, for convenience
+ */
+static ssize_t gzs_fail(GzStream *gz, const char *reason)
+{
+    gz->error = true;
+    gz->done = true;
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Error: %s: %s after %lu decompressed bytes\n",
+            gz->filename, reason, (unsigned long)gz->total_out);
+    return -1;
+}
+
+/**
+ * Open a gzip-compressed file for streaming decompression.
+ *
+ * @param filename the path of the gzip-compressed file
+ * @return a pointer to a newly allocated GzStream, or NULL on error
+ */
+GzStream *gzs_open(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Couldn't open trace file %s: ", filename);
+        perror(NULL);
+        return NULL;
+    }
+
+    GzStream *gz = (GzStream *)calloc(1, sizeof(GzStream));
+    gz->fd = fd;
+    gz->filename = filename;
+    gz->in_buf = (uint8_t *)malloc(GZ_IN_BUF_SIZE);
+
+    // 16 + MAX_WBITS: accept only the gzip wrapper and verify its CRC.
+    if (inflateInit2(&gz->strm, 16 + MAX_WBITS) != Z_OK)
+    {
+        fprintf(stderr, "Error: couldn't initialize zlib for %s\n", filename);
+        close(fd);
+        free(gz->in_buf);
+        free(gz);
+        return NULL;
+    }
+
+    return gz;
+}
+
+/**
+ * Decompress up to len bytes from the stream into buf.
+ *
+ * @param gz the stream to read from
+ * @param buf the buffer to decompress into
+ * @param len the maximum number of bytes to decompress
+ * @return the number of bytes decompressed, 0 at the end of the stream, or -1
+ *         on error
+ */
+ssize_t gzs_read(GzStream *gz, void *buf, size_t len)
+{
+    if (gz->error)
+    {
+        return -1;
+    }
+
+    uint8_t *out = (uint8_t *)buf;
+    size_t bytes_left = len;
+
+    while (bytes_left > 0 && !gz->done)
+    {
+        if (gz->strm.avail_in == 0 && !gz->in_eof)
+        {
+            if (gzs_refill(gz) != 0)
+            {
+                gz->error = true;
+                gz->done = true;
+                return -1;
+            }
+        }
+
+        if (gz->trailer_left > 0)
+        {
+            // A member inflated raw ends with a trailer inflate didn't read.
+            uInt skip = gz->strm.avail_in < gz->trailer_left
+                            ? gz->strm.avail_in
+                            : gz->trailer_left;
+            gz->strm.next_in += skip;
+            gz->strm.avail_in -= skip;
+            gz->trailer_left -= skip;
+            if (gz->trailer_left > 0)
+            {
+                if (gz->in_eof)
+                {
+                    return gzs_fail(gz, "truncated gzip stream (unexpected end of file)");
+                }
+                continue;
+            }
+        }
+
+        if (gz->member_end)
+        {
+            // Either another gzip member follows, or the stream is over.
+            if (gz->strm.avail_in == 0)
+            {
+                gz->done = true;
+                break;
+            }
+            if (gz->strm.next_in[0] != 0x1f)
+            {
+                fprintf(stderr, "\n");
+                fprintf(stderr, "Warning: %s: trailing garbage ignored\n",
+                        gz->filename);
+                gz->done = true;
+                break;
+            }
+            if (gz->raw)
+            {
+                inflateReset2(&gz->strm, 16 + MAX_WBITS);
+                gz->raw = false;
+            }
+            else
+            {
+                inflateReset(&gz->strm);
+            }
+            gz->member_end = false;
+        }
+
+        uInt chunk = bytes_left > GZ_MAX_CHUNK ? GZ_MAX_CHUNK : (uInt)bytes_left;
+        gz->strm.next_out = out;
+        gz->strm.avail_out = chunk;
+
+        int ret = inflate(&gz->strm, Z_NO_FLUSH);
+
+        size_t produced = chunk - gz->strm.avail_out;
+        out += produced;
+        bytes_left -= produced;
+        gz->total_out += produced;
+
+        if (ret == Z_STREAM_END)
+        {
+            gz->member_end = true;
+            if (gz->raw)
+            {
+                gz->trailer_left = GZ_TRAILER_SIZE;
+            }
+        }
+        else if (ret == Z_BUF_ERROR)
+        {
+            // No progress was possible: the input ran out mid-member.
+            if (gz->strm.avail_in == 0 && gz->in_eof)
+            {
+                return gzs_fail(gz, "truncated gzip stream (unexpected end of file)");
+            }
+        }
+        else if (ret != Z_OK)
+        {
+            char reason[256];
+            snprintf(reason, sizeof(reason), "corrupt gzip stream (%s)",
+                     gz->strm.msg ? gz->strm.msg : zError(ret));
+            return gzs_fail(gz, reason);
+        }
+    }
+
+    return (ssize_t)(len - bytes_left);
+}
+
+/**
+ * Move the stream to a point in the middle of a gzip member where inflating
+ * can resume.
+ *
+ * @param gz the stream to move
+ * @param in the compressed offset of the first byte wholly after the point
+ * @param bits the number of bits of the byte at in - 1 that follow the point
+ * @param out the decompressed offset of the point
+ * @param window the GZ_INDEX_WINDOW_SIZE bytes of output preceding the point
+ * @param window_len the number of bytes in window
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int gzs_seek(GzStream *gz, uint64_t in, int bits, uint64_t out,
+             const uint8_t *window, size_t window_len)
+{
+    // The point is mid-member, so there is no gzip header to parse: inflate
+    // raw deflate data, primed with the bits of the byte it starts in.
+    uint64_t pos = bits ? in - 1 : in;
+    if (lseek(gz->fd, (off_t)pos, SEEK_SET) == -1)
+    {
+        fprintf(stderr, "Couldn't seek in trace file %s: ", gz->filename);
+        perror(NULL);
+        return -1;
+    }
+
+    if (inflateReset2(&gz->strm, -MAX_WBITS) != Z_OK)
+    {
+        fprintf(stderr, "Error: couldn't reset zlib for %s\n", gz->filename);
+        return -1;
+    }
+    gz->raw = true;
+    gz->strm.avail_in = 0;
+    gz->in_eof = false;
+
+    int ret = Z_OK;
+    if (bits)
+    {
+        if (gzs_refill(gz) != 0)
+        {
+            return -1;
+        }
+        if (gz->strm.avail_in == 0)
+        {
+            return gzs_fail(gz, "gzip index points past the end of the file");
+        }
+        ret = inflatePrime(&gz->strm, bits, gz->strm.next_in[0] >> (8 - bits));
+        gz->strm.next_in++;
+        gz->strm.avail_in--;
+    }
+    if (ret == Z_OK)
+    {
+        ret = inflateSetDictionary(&gz->strm, window, (uInt)window_len);
+    }
+    if (ret != Z_OK)
+    {
+        fprintf(stderr, "Error: couldn't resume inflating %s at a checkpoint\n",
+                gz->filename);
+        return -1;
+    }
+
+    gz->total_out = out;
+    return 0;
+}
+
+/**
+ * Close the file and free all memory associated with the stream.
+ *
+ * @param gz the stream to close (may be NULL)
+ */
+void gzs_close(GzStream *gz)
+{
+    if (gz == NULL)
+    {
+        return;
+    }
+
+    inflateEnd(&gz->strm);
+    close(gz->fd);
+    free(gz->in_buf);
+    free(gz);
+}
@@ -0,0 +1,105 @@
+// gzstream.h
+// Declares a streaming gzip decoder used to read compressed trace files
+// in-process, without forking a gunzip child and reading it through a pipe.
+
+#ifndef _GZSTREAM_H_
+#define _GZSTREAM_H_
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+/**
+ * [Internal] The size in bytes of the buffer holding compressed input read
+ * from the trace file.
+ */
+#define GZ_IN_BUF_SIZE (256 * 1024)
+
+/**
+ * A gzip-compressed file being decompressed on the fly.
+ *
+ * Decompressed bytes are inflated directly into the buffer passed to
+ * gzs_read(), so the only copy made is the one zlib makes while decoding.
+ * Files made of several concatenated gzip members (as produced by, e.g.,
+ * "cat a.gz b.gz") are decoded as a single stream, just like gunzip does.
+ */
+typedef struct GzStreamStruct
+{
+    /** [Internal] The file descriptor of the compressed file. */
+    int fd;
+    /** [Internal] The name of the compressed file, for error messages. */
+    const char *filename;
+    /** [Internal] The zlib inflate state. */
+    z_stream strm;
+    /** [Internal] Buffer holding compressed bytes not yet inflated. */
+    uint8_t *in_buf;
+    /** [Internal] Whether the compressed file has been read to the end. */
+    bool in_eof;
+    /** [Internal] Whether the current gzip member has been fully inflated. */
+    bool member_end;
+    /** [Internal] Whether the whole stream has ended, cleanly or not. */
+    bool done;
+    /** [Internal] Whether an error has been reported on this stream. */
+    bool error;
+    /**
+     * [Internal] Whether the current member is being inflated without its
+     * gzip wrapper, after gzs_seek() moved into the middle of it.
+     */
+    bool raw;
+    /** [Internal] Bytes of the current member's trailer left to skip. */
+    unsigned int trailer_left;
+    /** The total number of decompressed bytes returned so far. */
+    uint64_t total_out;
+} GzStream;
+
+/**
+ * Open a gzip-compressed file for streaming decompression.
+ *
+ * Prints an error message and returns NULL if the file cannot be opened.
+ *
+ * @param filename the path of the gzip-compressed file
+ * @return a pointer to a newly allocated GzStream, or NULL on error
+ */
+GzStream *gzs_open(const char *filename);
+
+/**
+ * Decompress up to len bytes from the stream into buf.
+ *
+ * Fewer than len bytes are returned only when the end of the stream is
+ * reached. Truncated and corrupt files are reported on stderr and cause -1
+ * to be returned; every later call also returns -1.
+ *
+ * @param gz the stream to read from
+ * @param buf the buffer to decompress into
+ * @param len the maximum number of bytes to decompress
+ * @return the number of bytes decompressed, 0 at the end of the stream, or -1
+ *         on error
+ */
+ssize_t gzs_read(GzStream *gz, void *buf, size_t len);
+
+/**
+ * Move the stream to a point in the middle of a gzip member where inflating
+ * can resume, as recorded by a gzip index (see gzindex.h).
+ *
+ * The stream must not have been read from yet. The rest of the member is
+ * decoded without checking its CRC; later members are checked as usual.
+ *
+ * @param gz the stream to move
+ * @param in the compressed offset of the first byte wholly after the point
+ * @param bits the number of bits of the byte at in - 1 that follow the point
+ * @param out the decompressed offset of the point
+ * @param window the GZ_INDEX_WINDOW_SIZE bytes of output preceding the point
+ * @param window_len the number of bytes in window
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int gzs_seek(GzStream *gz, uint64_t in, int bits, uint64_t out,
+             const uint8_t *window, size_t window_len);
+
+/**
+ * Close the file and free all memory associated with the stream.
+ *
+ * @param gz the stream to close (may be NULL)
+ */
+void gzs_close(GzStream *gz);
+
+#endif
@@ -0,0 +1,126 @@
+// simpoints.cpp
+// Implements reading and writing simpoints files.
+
+#include "simpoints.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * Write a simpoints file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param filename the path of the file to write
+ * @param trace_filename the path of the trace, noted in a comment
+ * @param sp the simpoints
+ * @return 0 on success, or -1 on error
+ */
+int simpoints_save(const char *filename, const char *trace_filename,
+                   const SimPoints *sp)
+{
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't create %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "# Simpoints of %s\n", trace_filename);
+    fprintf(f, "interval %lu\n", (unsigned long)sp->interval);
+    fprintf(f, "instructions %lu\n", (unsigned long)sp->num_insts);
+    fprintf(f, "# point <first record> <records> <weight> <cluster>\n");
+    for (const SimPoint &point : sp->points)
+    {
+        fprintf(f, "point %lu %lu %.8f %u\n", (unsigned long)point.start,
+                (unsigned long)point.length, point.weight, point.cluster);
+    }
+
+    if (fclose(f) != 0)
+    {
+        fprintf(stderr, "Error: couldn't write %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Read a simpoints file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param filename the path of the file to read
+ * @param sp set to the simpoints
+ * @return 0 on success, or -1 on error
+ */
+int simpoints_load(const char *filename, SimPoints *sp)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error: couldn't open %s (%s)\n", filename,
+                strerror(errno));
+        return -1;
+    }
+
+    sp->interval = 0;
+    sp->num_insts = 0;
+    sp->points.clear();
+    char line[256];
+    int line_no = 0;
+    bool bad = false;
+    double total_weight = 0;
+    while (!bad && fgets(line, sizeof(line), f) != NULL)
+    {
+        line_no++;
+        unsigned long a;
+        unsigned long b;
+        unsigned int cluster;
+        double weight;
+        char end;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        else if (sscanf(line, "interval %lu %c", &a, &end) == 1)
+        {
+            sp->interval = a;
+        }
+        else if (sscanf(line, "instructions %lu %c", &a, &end) == 1)
+        {
+            sp->num_insts = a;
+        }
+        else if (sscanf(line, "point %lu %lu %lf %u %c", &a, &b, &weight,
+                        &cluster, &end) == 4 &&
+                 b > 0 && weight >= 0 && weight <= 1 &&
+                 (sp->points.empty() || a >= sp->points.back().start))
+        {
+            SimPoint point = {a, b, weight, cluster};
+            sp->points.push_back(point);
+            total_weight += weight;
+        }
+        else
+        {
+            bad = true;
+        }
+    }
+    fclose(f);
+
+    if (bad)
+    {
+        fprintf(stderr, "Error: %s:%d is not a valid simpoints line\n",
+                filename, line_no);
+        return -1;
+    }
+    if (sp->interval == 0 || sp->num_insts == 0 || sp->points.empty() ||
+        fabs(total_weight - 1) > 1e-3)
+    {
+        fprintf(stderr, "Error: %s is not a complete simpoints file\n",
+                filename);
+        return -1;
+    }
+    return 0;
+}
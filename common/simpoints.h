@@ -0,0 +1,74 @@
+// simpoints.h
+// Declares the simpoints file, which names the few windows of a trace whose
+// simulation stands in for that of the whole trace, each with the fraction
+// of the trace it represents (Sherwood et al., "Automatically Characterizing
+// Large Scale Program Behavior").
+//
+// The file is written by the Lab 1 analyzer with -simpoints, and read by the
+// Lab 2 and Lab 3 simulators with -simpoints. It is plain text:
+//
+//   # any comment
+//   interval <instructions per interval>
+//   instructions <instructions in the part of the trace analyzed>
+//   point <first record> <number of records> <weight> <cluster>
+//   ...
+//
+// with one point line per simpoint, in increasing order of first record. The
+// weights add up to 1.
+
+#ifndef _SIMPOINTS_H_
+#define _SIMPOINTS_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <vector>
+
+/** One simulation window standing in for part of a trace. */
+typedef struct SimPointStruct
+{
+    /** The index in the trace of the window's first record. */
+    uint64_t start;
+    /** The number of records in the window. */
+    uint64_t length;
+    /** The fraction of the trace's instructions the window stands for. */
+    double weight;
+    /** The cluster of intervals the window was picked from. */
+    uint32_t cluster;
+} SimPoint;
+
+/** The simpoints of a trace. */
+typedef struct SimPointsStruct
+{
+    /** The number of instructions in each interval, and in most windows. */
+    uint64_t interval;
+    /** The number of instructions the simpoints stand for in total. */
+    uint64_t num_insts;
+    /** The simpoints, in increasing order of start. */
+    std::vector<SimPoint> points;
+} SimPoints;
+
+/**
+ * Write a simpoints file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param filename the path of the file to write
+ * @param trace_filename the path of the trace, noted in a comment
+ * @param sp the simpoints
+ * @return 0 on success, or -1 on error
+ */
+int simpoints_save(const char *filename, const char *trace_filename,
+                   const SimPoints *sp);
+
+/**
+ * Read a simpoints file.
+ *
+ * Prints an error message on failure.
+ *
+ * @param filename the path of the file to read
+ * @param sp set to the simpoints
+ * @return 0 on success, or -1 on error
+ */
+int simpoints_load(const char *filename, SimPoints *sp);
+
+#endif
@@ -0,0 +1,108 @@
+// spscring.h
+// Declares a lock-free single-producer/single-consumer ring of fixed slots,
+// used to hand decompressed trace buffers from a background thread to the
+// simulator without taking a lock.
+
+#ifndef _SPSCRING_H_
+#define _SPSCRING_H_
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+ * [Internal] The size in bytes of a cache line, used to keep the producer's
+ * and consumer's indices from sharing one.
+ */
+#define SPSC_CACHE_LINE 64
+
+/**
+ * A bounded single-producer/single-consumer ring of N slots of type T.
+ *
+ * Slots are filled and drained in place: the producer gets the next free slot
+ * with back(), fills it, and publishes it with push(); the consumer reads the
+ * oldest published slot with front() and hands it back with pop(). A slot
+ * returned by front() stays owned by the consumer until pop(), so its
+ * contents may be read in place for as long as needed.
+ *
+ * Only one thread may call back()/push() and only one thread may call
+ * front()/pop(). Neither side ever blocks or takes a lock; both return NULL
+ * when they would have to wait, and waiting is left to the caller.
+ *
+ * N must be a power of two.
+ */
+template <typename T, size_t N>
+class SpscRing
+{
+private:
+    /** [Internal] The slots themselves. */
+    T slots[N];
+
+    /** [Internal] The number of slots ever published; written by producer. */
+    std::atomic<size_t> head;
+    char pad_head[SPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+    /** [Internal] The number of slots ever released; written by consumer. */
+    std::atomic<size_t> tail;
+    char pad_tail[SPSC_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+public:
+    SpscRing() : slots(), head(0), tail(0)
+    {
+        static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+    }
+
+    /**
+     * Get a slot by index, for setting up per-slot storage before the ring
+     * is shared between threads.
+     *
+     * @param i the index of the slot, less than N
+     * @return the slot
+     */
+    T &slot(size_t i) { return slots[i]; }
+
+    /**
+     * [Producer] Get the next free slot to fill.
+     *
+     * @return the slot, or NULL if the ring is full
+     */
+    T *back()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N)
+        {
+            return NULL;
+        }
+        return &slots[h & (N - 1)];
+    }
+
+    /** [Producer] Publish the slot most recently returned by back(). */
+    void push()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+    /**
+     * [Consumer] Get the oldest published slot.
+     *
+     * @return the slot, or NULL if the ring is empty
+     */
+    T *front()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (head.load(std::memory_order_acquire) == t)
+        {
+            return NULL;
+        }
+        return &slots[t & (N - 1)];
+    }
+
+    /** [Consumer] Release the slot most recently returned by front(). */
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+};
+
+#endif
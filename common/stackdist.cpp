@@ -0,0 +1,222 @@
+// stackdist.cpp
+// Implements an LRU stack distance profiler.
+
+#include "stackdist.h"
+#include <algorithm>
+#include <math.h>
+#include <utility>
+
+/**
+ * Make a profile empty.
+ *
+ * @param sd the profile
+ * @param block_bits the log2 of the size in bytes of a block
+ */
+void stack_dist_init(StackDist *sd, int block_bits)
+{
+    sd->block_bits = block_bits;
+    sd->num_accesses = 0;
+    sd->num_cold = 0;
+    sd->hist.assign(1, 0);
+    sd->last_block = 0;
+    sd->last_time.clear();
+    sd->tree.assign(STACK_DIST_MIN_SLOTS + 1, 0);
+    sd->now = 1;
+}
+
+/**
+ * [Internal] Add to the count at a time in a Fenwick tree.
+ *
+ * @param tree the tree
+ * @param t the time, from 1
+ * @param delta what to add
+ */
+static inline void stack_dist_tree_add(std::vector<uint32_t> &tree, size_t t,
+                                       uint32_t delta)
+{
+    for (; t < tree.size(); t += t & -t)
+    {
+        tree[t] += delta;
+    }
+}
+
+/**
+ * [Internal] Sum the counts up to a time in a Fenwick tree.
+ *
+ * @param tree the tree
+ * @param t the time, from 1
+ * @return the sum of the counts at times 1 to t
+ */
+static inline uint64_t stack_dist_tree_sum(const std::vector<uint32_t> &tree,
+                                           size_t t)
+{
+    uint64_t sum = 0;
+    for (; t > 0; t -= t & -t)
+    {
+        sum += tree[t];
+    }
+    return sum;
+}
+
+/**
+ * [Internal] Renumber the last accesses of a profile's blocks to the times
+ * 1 to N, keeping their order, in a tree with room for several times that.
+ *
+ * @param sd the profile
+ */
+static void stack_dist_renumber(StackDist *sd)
+{
+    std::vector<std::pair<uint32_t, uint64_t>> live;
+    live.reserve(sd->last_time.size());
+    for (const std::pair<const uint64_t, uint32_t> &entry : sd->last_time)
+    {
+        live.push_back(std::make_pair(entry.second, entry.first));
+    }
+    std::sort(live.begin(), live.end());
+
+    size_t slots = std::max(4 * live.size(), (size_t)STACK_DIST_MIN_SLOTS);
+    sd->tree.assign(slots + 1, 0);
+    for (size_t i = 0; i < live.size(); i++)
+    {
+        sd->last_time[live[i].second] = (uint32_t)(i + 1);
+        sd->tree[i + 1] = 1;
+    }
+
+    // Build the tree bottom-up in linear time.
+    for (size_t t = 1; t < sd->tree.size(); t++)
+    {
+        size_t parent = t + (t & -t);
+        if (parent < sd->tree.size())
+        {
+            sd->tree[parent] += sd->tree[t];
+        }
+    }
+    sd->now = (uint32_t)(live.size() + 1);
+}
+
+/**
+ * [Internal] Profile an access to a block other than the last one accessed.
+ *
+ * @param sd the profile
+ * @param block the block
+ * @return the stack distance of the access, or STACK_DIST_COLD
+ */
+uint64_t stack_dist_access(StackDist *sd, uint64_t block)
+{
+    if (sd->now >= sd->tree.size())
+    {
+        stack_dist_renumber(sd);
+    }
+
+    uint64_t distance = STACK_DIST_COLD;
+    std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> found =
+        sd->last_time.insert(std::make_pair(block, sd->now));
+    if (found.second)
+    {
+        sd->num_cold++;
+    }
+    else
+    {
+        // Every block has one mark, at its last access; those after this
+        // block's are the distinct blocks accessed since.
+        uint32_t last = found.first->second;
+        distance = sd->last_time.size() - stack_dist_tree_sum(sd->tree, last);
+        stack_dist_tree_add(sd->tree, last, (uint32_t)-1);
+        found.first->second = sd->now;
+        if (distance >= sd->hist.size())
+        {
+            sd->hist.resize(distance + 1, 0);
+        }
+        sd->hist[distance]++;
+    }
+    stack_dist_tree_add(sd->tree, sd->now, 1);
+    sd->now++;
+    return distance;
+}
+
+/**
+ * Forget a block, as if it had never been accessed, so that it no longer
+ * counts towards the distances of other blocks.
+ *
+ * @param sd the profile
+ * @param block the block, an address shifted right by block_bits
+ */
+void stack_dist_remove(StackDist *sd, uint64_t block)
+{
+    std::unordered_map<uint64_t, uint32_t>::iterator found =
+        sd->last_time.find(block);
+    if (found == sd->last_time.end())
+    {
+        return;
+    }
+    stack_dist_tree_add(sd->tree, found->second, (uint32_t)-1);
+    sd->last_time.erase(found);
+    if (sd->last_block == block + 1)
+    {
+        sd->last_block = 0;
+    }
+}
+
+/**
+ * [Internal] Get the probability that fewer than assoc of distance blocks
+ * spread evenly over num_sets sets fall in a given set.
+ *
+ * @param distance the number of blocks
+ * @param num_sets the number of sets
+ * @param assoc the associativity
+ * @return the probability that an access at that distance hits
+ */
+static double stack_dist_hit_chance(uint64_t distance, uint64_t num_sets,
+                                    unsigned int assoc)
+{
+    if (distance < assoc)
+    {
+        return 1;
+    }
+
+    // Sum the binomial terms P(k of them in the set) for k < assoc.
+    double p = 1.0 / (double)num_sets;
+    double term = exp((double)distance * log1p(-p));
+    double sum = term;
+    for (unsigned int k = 0; k + 1 < assoc; k++)
+    {
+        term *= (double)(distance - k) / (double)(k + 1) * p / (1 - p);
+        sum += term;
+    }
+    return std::min(sum, 1.0);
+}
+
+/**
+ * Estimate the number of accesses an LRU cache of the profile's block size
+ * would miss.
+ *
+ * @param sd the profile
+ * @param num_blocks the number of blocks the cache holds
+ * @param assoc the associativity of the cache, or 0 if fully associative;
+ *              must divide num_blocks
+ * @return the number of misses, exact if the cache is fully associative
+ */
+double stack_dist_misses(const StackDist *sd, uint64_t num_blocks,
+                         unsigned int assoc)
+{
+    uint64_t num_sets = assoc != 0 ? num_blocks / assoc : 1;
+    double misses = (double)sd->num_cold;
+    for (uint64_t d = 0; d < sd->hist.size(); d++)
+    {
+        if (sd->hist[d] == 0)
+        {
+            continue;
+        }
+        if (num_sets == 1)
+        {
+            if (d >= num_blocks)
+            {
+                misses += (double)sd->hist[d];
+            }
+            continue;
+        }
+        misses += (double)sd->hist[d] *
+                  (1 - stack_dist_hit_chance(d, num_sets, assoc));
+    }
+    return misses;
+}
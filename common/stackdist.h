@@ -0,0 +1,117 @@
+// stackdist.h
+// Declares an LRU stack distance profiler, from which the miss ratios of
+// caches of every size can be read after a single pass over their accesses
+// (Mattson et al., "Evaluation Techniques for Storage Hierarchies").
+//
+// The stack distance of an access is the number of distinct blocks accessed
+// since the last access to the same block. A fully associative LRU cache of
+// C blocks hits exactly the accesses with a distance below C, so a histogram
+// of distances gives its miss ratio for every C at once. A set-associative
+// cache is approximated by assuming the blocks in between are spread evenly
+// over the sets, so that an access hits if fewer than its associativity of
+// them fell in its set (Smith, "A Comparative Study of Set Associative
+// Memory Mapping Algorithms and Their Use for Cache and Main Memory").
+//
+// Distances are counted with a Fenwick tree over time that marks the last
+// access to each block, so each access takes O(log N) time in the number of
+// distinct blocks N. The tree is renumbered to the live marks whenever time
+// runs past its end.
+
+#ifndef _STACKDIST_H_
+#define _STACKDIST_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <unordered_map>
+#include <vector>
+
+/** The distance of a first access to a block, which any cache misses. */
+#define STACK_DIST_COLD UINT64_MAX
+
+/** The fewest time slots the Fenwick tree of a StackDist is given. */
+#define STACK_DIST_MIN_SLOTS (1 << 16)
+
+/** An LRU stack distance profile of accesses to blocks of memory. */
+typedef struct StackDistStruct
+{
+    /** The log2 of the size in bytes of a block. */
+    int block_bits;
+    /** The number of accesses. */
+    uint64_t num_accesses;
+    /** The number of first accesses to a block, which is the blocks' count. */
+    uint64_t num_cold;
+    /** The number of other accesses with each distance. */
+    std::vector<uint64_t> hist;
+    /** [Internal] The block of the last access, plus one, or 0 for none. */
+    uint64_t last_block;
+    /** [Internal] The time of the last access to each block. */
+    std::unordered_map<uint64_t, uint32_t> last_time;
+    /** [Internal] A Fenwick tree counting last accesses by time, from 1. */
+    std::vector<uint32_t> tree;
+    /** [Internal] The time of the next access. */
+    uint32_t now;
+} StackDist;
+
+/**
+ * Make a profile empty.
+ *
+ * @param sd the profile
+ * @param block_bits the log2 of the size in bytes of a block
+ */
+void stack_dist_init(StackDist *sd, int block_bits);
+
+/**
+ * [Internal] Profile an access to a block other than the last one accessed.
+ *
+ * @param sd the profile
+ * @param block the block
+ * @return the stack distance of the access, or STACK_DIST_COLD
+ */
+uint64_t stack_dist_access(StackDist *sd, uint64_t block);
+
+/**
+ * Profile an access to memory.
+ *
+ * Consecutive accesses to the same block, as most instruction fetches are,
+ * take the fast path.
+ *
+ * @param sd the profile
+ * @param addr the address accessed
+ * @return the stack distance of the access, or STACK_DIST_COLD
+ */
+static inline uint64_t stack_dist_add(StackDist *sd, uint64_t addr)
+{
+    uint64_t block = addr >> sd->block_bits;
+    sd->num_accesses++;
+    if (block + 1 == sd->last_block)
+    {
+        sd->hist[0]++;
+        return 0;
+    }
+    sd->last_block = block + 1;
+    return stack_dist_access(sd, block);
+}
+
+/**
+ * Forget a block, as if it had never been accessed, so that it no longer
+ * counts towards the distances of other blocks.
+ *
+ * @param sd the profile
+ * @param block the block, an address shifted right by block_bits
+ */
+void stack_dist_remove(StackDist *sd, uint64_t block);
+
+/**
+ * Estimate the number of accesses an LRU cache of the profile's block size
+ * would miss.
+ *
+ * @param sd the profile
+ * @param num_blocks the number of blocks the cache holds
+ * @param assoc the associativity of the cache, or 0 if fully associative;
+ *              must divide num_blocks
+ * @return the number of misses, exact if the cache is fully associative
+ */
+double stack_dist_misses(const StackDist *sd, uint64_t num_blocks,
+                         unsigned int assoc);
+
+#endif
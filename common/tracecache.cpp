@@ -0,0 +1,356 @@
+// tracecache.cpp
+// Implements the cache of decoded traces in POSIX shared memory.
+
+#include "tracecache.h"
+#include "tracefmt.h"
+#include "tracereader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * [Internal] The number of times to look for a segment before giving up,
+ * when others keep removing it or it never gets started.
+ */
+#define TRACE_CACHE_MAX_TRIES 1000
+
+/**
+ * [Internal] Hash the contents of a file.
+ *
+ * This is a multiply-xorshift over 8-byte words: not cryptographic, but
+ * quick next to decompressing the file, and any change to the file changes
+ * the hash.
+ *
+ * @param filename the path of the file
+ * @param hash set to the hash
+ * @return 0 on success, or -1 if the file couldn't be read
+ */
+static int trace_cache_hash(const char *filename, uint64_t *hash)
+{
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+
+    size_t len = (size_t)st.st_size;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ len;
+    if (len > 0)
+    {
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+
+        const uint8_t *data = (const uint8_t *)map;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+        {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            h = (h ^ word) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        uint64_t tail = 0;
+        memcpy(&tail, data + i, len - i);
+        h = (h ^ tail) * 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 29;
+        munmap(map, len);
+    }
+
+    close(fd);
+    *hash = h;
+    return 0;
+}
+
+/**
+ * [Internal] Make room for a segment of at least len bytes, growing its
+ * mapping to match.
+ *
+ * The space is allocated up front so that running out of shared memory is
+ * an error here rather than a SIGBUS on a later write.
+ *
+ * @param fd the file descriptor of the segment
+ * @param map the current mapping of the segment, or NULL
+ * @param map_len the length of the current mapping; updated
+ * @param len the size needed
+ * @return the new mapping, or NULL with errno set on error, in which case
+ *         the current mapping is unmapped
+ */
+static uint8_t *trace_cache_grow(int fd, uint8_t *map, size_t *map_len,
+                                 size_t len)
+{
+    int err = posix_fallocate(fd, 0, (off_t)len);
+    void *new_map = MAP_FAILED;
+    if (err == 0)
+    {
+        new_map = map == NULL
+                      ? mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                      : mremap(map, *map_len, len, MREMAP_MAYMOVE);
+        err = errno;
+    }
+    if (new_map == MAP_FAILED)
+    {
+        if (map != NULL)
+        {
+            munmap(map, *map_len);
+        }
+        errno = err;
+        return NULL;
+    }
+    *map_len = len;
+    return (uint8_t *)new_map;
+}
+
+/**
+ * [Internal] Decode a trace into a new segment, as a raw packed trace.
+ *
+ * The header, and its magic number last of all, is only written once every
+ * record is in place, so a segment with a valid header is complete.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param fd the file descriptor of the empty segment
+ * @param error set to whether the trace itself couldn't be read
+ * @return 0 on success, or -1 on error (already reported)
+ */
+static int trace_cache_build(const char *filename, size_t rec_size, int fd,
+                             bool *error)
+{
+    TraceReader *src = trace_open(filename, rec_size, TRACE_OPEN_ASYNC);
+    if (src == NULL)
+    {
+        *error = true;
+        return -1;
+    }
+
+    uint64_t cap = src->total_recs > 0 ? src->total_recs * rec_size
+                                       : TRACE_CACHE_INITIAL_SIZE;
+    size_t map_len = 0;
+    uint8_t *map = trace_cache_grow(fd, NULL, &map_len,
+                                    TRACE_PACK_DATA_OFFSET + cap);
+    TracePackHeader header;
+    memset(&header, 0, sizeof(header));
+    uint64_t len = 0;
+
+    TraceBlock block;
+    while (map != NULL && (block = trace_next_block(src, (size_t)-1)).count > 0)
+    {
+        size_t bytes = block.count * rec_size;
+        if (TRACE_PACK_DATA_OFFSET + len + bytes > map_len)
+        {
+            map = trace_cache_grow(fd, map, &map_len, map_len * 2 + bytes);
+            if (map == NULL)
+            {
+                break;
+            }
+        }
+
+        const uint8_t *rec = (const uint8_t *)block.recs;
+        for (size_t i = 0; i < block.count; i++, rec += rec_size)
+        {
+            uint8_t op_type = rec[TRACE_OP_TYPE_OFFSET];
+            if (op_type < TRACE_PACK_MAX_OP_TYPES)
+            {
+                header.op_type_counts[op_type]++;
+            }
+        }
+        memcpy(map + TRACE_PACK_DATA_OFFSET + len, block.recs, bytes);
+        len += bytes;
+    }
+
+    if (map == NULL)
+    {
+        fprintf(stderr, "Note: couldn't allocate shared memory for %s (%s); "
+                        "decoding it privately\n",
+                filename, strerror(errno));
+        trace_close(src);
+        return -1;
+    }
+    *error = src->error;
+    trace_close(src);
+    if (*error)
+    {
+        munmap(map, map_len);
+        return -1;
+    }
+
+    header.version = TRACE_PACK_VERSION;
+    header.layout = rec_size == sizeof(OtrRec)   ? TRACE_LAYOUT_OTR
+                    : rec_size == sizeof(PtrRec) ? TRACE_LAYOUT_PTR
+                                                 : 0;
+    header.rec_size = (uint32_t)rec_size;
+    header.encoding = TRACE_ENC_RAW;
+    header.data_offset = TRACE_PACK_DATA_OFFSET;
+    header.num_recs = len / rec_size;
+    memcpy(map, &header, sizeof(header));
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(map, TRACE_PACK_MAGIC, sizeof(header.magic));
+
+    munmap(map, map_len);
+    if (ftruncate(fd, (off_t)(TRACE_PACK_DATA_OFFSET + len)) != 0)
+    {
+        fprintf(stderr, "Note: couldn't resize shared memory for %s (%s); "
+                        "decoding it privately\n",
+                filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * [Internal] Check how far along a segment is.
+ *
+ * @param fd the file descriptor of the segment
+ * @return 1 if it holds a complete trace, 0 if it hasn't been started, or -1
+ *         if it was started but never finished
+ */
+static int trace_cache_state(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        return 0;
+    }
+
+    char magic[sizeof(((TracePackHeader *)0)->magic)];
+    if (pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+        memcmp(magic, TRACE_PACK_MAGIC, sizeof(magic)) == 0)
+    {
+        return 1;
+    }
+    return -1;
+}
+
+/**
+ * Get the shared decoded copy of a trace, decoding the trace into a new
+ * segment if no other process has yet, or waiting for the process that is.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param error set to whether the trace itself couldn't be read; already
+ *              reported on stderr
+ * @return a pointer to a newly allocated TraceCache, or NULL
+ */
+TraceCache *trace_cache_open(const char *filename, size_t rec_size,
+                             bool *error)
+{
+    *error = false;
+    uint64_t hash;
+    if (trace_cache_hash(filename, &hash) != 0)
+    {
+        // Opening the trace reports the problem.
+        return NULL;
+    }
+
+    TraceCache *cache = (TraceCache *)calloc(1, sizeof(TraceCache));
+    snprintf(cache->name, sizeof(cache->name), "%s%016llx-%u",
+             TRACE_CACHE_PREFIX, (unsigned long long)hash,
+             (unsigned int)rec_size);
+
+    int unstarted = 0;
+    int tries = 0;
+    for (; tries < TRACE_CACHE_MAX_TRIES; tries++)
+    {
+        int fd = shm_open(cache->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd != -1)
+        {
+            // This process builds the segment, holding an exclusive lock
+            // until it is complete so others wait for it.
+            flock(fd, LOCK_EX);
+            if (trace_cache_build(filename, rec_size, fd, error) != 0)
+            {
+                shm_unlink(cache->name);
+                close(fd);
+                break;
+            }
+            flock(fd, LOCK_SH);
+            cache->fd = fd;
+            return cache;
+        }
+        if (errno != EEXIST)
+        {
+            fprintf(stderr, "Note: couldn't create shared memory for %s (%s); "
+                            "decoding it privately\n",
+                    filename, strerror(errno));
+            break;
+        }
+
+        fd = shm_open(cache->name, O_RDONLY, 0);
+        if (fd == -1)
+        {
+            // Removed since; try to create it again.
+            continue;
+        }
+
+        // Blocks until the builder, if any, has finished.
+        flock(fd, LOCK_SH);
+        int state = trace_cache_state(fd);
+        if (state == 1)
+        {
+            cache->fd = fd;
+            return cache;
+        }
+
+        // The builder either hasn't taken its lock yet or has died. Give it
+        // a moment before deciding which.
+        if (state == 0 && ++unstarted < TRACE_CACHE_MAX_TRIES / 10)
+        {
+            flock(fd, LOCK_UN);
+            close(fd);
+            usleep(1000);
+            continue;
+        }
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+        {
+            shm_unlink(cache->name);
+        }
+        close(fd);
+        unstarted = 0;
+    }
+
+    if (tries == TRACE_CACHE_MAX_TRIES)
+    {
+        fprintf(stderr, "Note: gave up waiting for shared memory for %s; "
+                        "decoding it privately\n",
+                filename);
+    }
+    free(cache);
+    return NULL;
+}
+
+/**
+ * Let go of a shared-memory trace segment, removing it if no other process
+ * still holds it.
+ *
+ * @param cache the hold on the segment (may be NULL; freed by this call)
+ */
+void trace_cache_close(TraceCache *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    // Only possible once every other holder's shared lock is gone.
+    if (flock(cache->fd, LOCK_EX | LOCK_NB) == 0)
+    {
+        shm_unlink(cache->name);
+    }
+    close(cache->fd);
+    free(cache);
+}
@@ -0,0 +1,65 @@
+// tracecache.h
+// Declares a cache of decoded traces in POSIX shared memory, so simulations
+// run side by side on the same trace decompress it once between them rather
+// than once each.
+//
+// The first process to open a trace decodes it into a shared-memory segment
+// laid out as a raw packed trace (see tracefmt.h); the others wait for it and
+// then map the same pages read-only. The segment is named after a hash of
+// the trace file's contents, so a trace that has changed never picks up a
+// stale copy. Every process using a segment holds a shared flock() on it,
+// which the kernel drops even if the process crashes; the last one to close
+// the segment finds no other holders and removes it.
+
+#ifndef _TRACECACHE_H_
+#define _TRACECACHE_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The prefix of the names of shared-memory trace segments. */
+#define TRACE_CACHE_PREFIX "/ece6100-trace-"
+
+/**
+ * The initial size in bytes of a segment being built for a trace of unknown
+ * length. Segments grow by doubling from there.
+ */
+#define TRACE_CACHE_INITIAL_SIZE (64 * 1024 * 1024)
+
+/** A process's hold on a shared-memory trace segment. */
+typedef struct TraceCacheStruct
+{
+    /** The file descriptor of the segment, holding a shared lock on it. */
+    int fd;
+    /** [Internal] The name of the segment. */
+    char name[64];
+} TraceCache;
+
+/**
+ * Get the shared decoded copy of a trace, decoding the trace into a new
+ * segment if no other process has yet, or waiting for the process that is.
+ *
+ * If shared memory can't be used (for example, because /dev/shm is full), a
+ * note is printed and NULL is returned with error left false, and the caller
+ * should read the trace on its own instead.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param error set to whether the trace itself couldn't be read; already
+ *              reported on stderr
+ * @return a pointer to a newly allocated TraceCache, or NULL
+ */
+TraceCache *trace_cache_open(const char *filename, size_t rec_size,
+                             bool *error);
+
+/**
+ * Let go of a shared-memory trace segment, removing it if no other process
+ * still holds it.
+ *
+ * Mappings of the segment stay valid after this call.
+ *
+ * @param cache the hold on the segment (may be NULL; freed by this call)
+ */
+void trace_cache_close(TraceCache *cache);
+
+#endif
@@ -0,0 +1,308 @@
+// tracecompact.cpp
+// Implements the compact encoding of .ptr trace records.
+
+#include "tracecompact.h"
+#include "varint.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** [Internal] The value of an unused register field in the course traces. */
+#define TRACE_COMPACT_NO_REG 255
+
+/**
+ * [Internal] Check that a register field can be stored in 5 bits.
+ *
+ * @param needed the record's *_needed field
+ * @param reg the record's register field
+ * @return true if the pair can be encoded
+ */
+static inline bool reg_encodable(uint8_t needed, uint8_t reg)
+{
+    return needed ? reg < 32 : reg == TRACE_COMPACT_NO_REG;
+}
+
+/**
+ * Encode up to TRACE_COMPACT_BLOCK_RECS records as one compact block.
+ *
+ * @param recs the records to encode
+ * @param count the number of records, at most TRACE_COMPACT_BLOCK_RECS
+ * @param out the buffer to write the block to, with room for
+ *            TRACE_COMPACT_MAX_BLOCK_SIZE bytes
+ * @param bad_rec set to the index of the offending record on failure
+ * @return the size of the block in bytes, or 0 if a record can't be encoded
+ */
+size_t trace_compact_encode(const PtrRec *recs, size_t count, uint8_t *out,
+                            size_t *bad_rec)
+{
+    uint8_t *ops = out + TRACE_COMPACT_BLOCK_HEADER;
+    uint8_t *flags = ops + count;
+    uint8_t *regs = flags + count;
+    uint8_t *deltas = regs + 2 * count;
+
+    uint64_t prev_pc = 0;
+    uint64_t prev_mem = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const PtrRec *r = &recs[i];
+        bool is_mem = r->mem_read || r->mem_write;
+        bool is_cbr = r->op_type == TRACE_COMPACT_OP_CBR;
+
+        if (r->op_type >= TRACE_NUM_OP_TYPES ||
+            (r->dest_needed | r->src1_needed | r->src2_needed | r->cc_read |
+             r->cc_write | r->mem_read | r->mem_write | r->br_dir) > 1 ||
+            !reg_encodable(r->dest_needed, r->dest_reg) ||
+            !reg_encodable(r->src1_needed, r->src1_reg) ||
+            !reg_encodable(r->src2_needed, r->src2_reg) ||
+            (!is_mem && r->mem_addr != 0) ||
+            (!is_cbr && (r->br_dir != 0 || r->br_target != 0)))
+        {
+            *bad_rec = i;
+            return 0;
+        }
+
+        ops[i] = r->op_type;
+        flags[i] = (r->dest_needed ? TRACE_COMPACT_F_DEST_NEEDED : 0) |
+                   (r->src1_needed ? TRACE_COMPACT_F_SRC1_NEEDED : 0) |
+                   (r->src2_needed ? TRACE_COMPACT_F_SRC2_NEEDED : 0) |
+                   (r->cc_read ? TRACE_COMPACT_F_CC_READ : 0) |
+                   (r->cc_write ? TRACE_COMPACT_F_CC_WRITE : 0) |
+                   (r->mem_read ? TRACE_COMPACT_F_MEM_READ : 0) |
+                   (r->mem_write ? TRACE_COMPACT_F_MEM_WRITE : 0) |
+                   (r->br_dir ? TRACE_COMPACT_F_BR_DIR : 0);
+
+        uint16_t reg_bits = (r->dest_needed ? r->dest_reg : 0) |
+                            (r->src1_needed ? r->src1_reg : 0) << 5 |
+                            (r->src2_needed ? r->src2_reg : 0) << 10;
+        regs[2 * i] = (uint8_t)reg_bits;
+        regs[2 * i + 1] = (uint8_t)(reg_bits >> 8);
+
+        deltas = varint_put(deltas, zigzag_encode((int64_t)(r->inst_addr - prev_pc)));
+        prev_pc = r->inst_addr;
+        if (is_mem)
+        {
+            deltas = varint_put(deltas, zigzag_encode((int64_t)(r->mem_addr - prev_mem)));
+            prev_mem = r->mem_addr;
+        }
+        if (is_cbr)
+        {
+            deltas = varint_put(deltas, zigzag_encode((int64_t)(r->br_target - r->inst_addr)));
+        }
+    }
+
+    uint32_t header[2] = {(uint32_t)count, (uint32_t)(deltas - out)};
+    memcpy(out, header, sizeof(header));
+    return deltas - out;
+}
+
+/**
+ * [Internal] Expand the fixed-width columns of records [start, end) one
+ * record at a time.
+ */
+static void decode_fixed_scalar(const uint8_t *ops, const uint8_t *flags,
+                                const uint8_t *regs, PtrRec *out,
+                                size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++)
+    {
+        PtrRec *r = &out[i];
+        uint8_t f = flags[i];
+        uint16_t reg_bits = regs[2 * i] | regs[2 * i + 1] << 8;
+
+        r->op_type = ops[i];
+        r->dest_needed = (f & TRACE_COMPACT_F_DEST_NEEDED) != 0;
+        r->src1_needed = (f & TRACE_COMPACT_F_SRC1_NEEDED) != 0;
+        r->src2_needed = (f & TRACE_COMPACT_F_SRC2_NEEDED) != 0;
+        r->cc_read = (f & TRACE_COMPACT_F_CC_READ) != 0;
+        r->cc_write = (f & TRACE_COMPACT_F_CC_WRITE) != 0;
+        r->mem_read = (f & TRACE_COMPACT_F_MEM_READ) != 0;
+        r->mem_write = (f & TRACE_COMPACT_F_MEM_WRITE) != 0;
+        r->br_dir = (f & TRACE_COMPACT_F_BR_DIR) != 0;
+        r->dest_reg = r->dest_needed ? (reg_bits & 31) : TRACE_COMPACT_NO_REG;
+        r->src1_reg = r->src1_needed ? (reg_bits >> 5 & 31) : TRACE_COMPACT_NO_REG;
+        r->src2_reg = r->src2_needed ? (reg_bits >> 10 & 31) : TRACE_COMPACT_NO_REG;
+    }
+}
+
+#ifdef __SSE2__
+/**
+ * [Internal] Expand the fixed-width columns of 16 records starting at
+ * out[0] with SSE2.
+ *
+ * Each field is first computed for all 16 records at once, one vector per
+ * field with one byte lane per record. A 16x16 byte transpose then turns the
+ * field vectors into one vector per record, laid out like bytes 8-23 of a
+ * PtrRec, with mem_write, mem_read and br_dir following cc_write.
+ */
+static void decode_fixed_sse2(const uint8_t *ops, const uint8_t *flags,
+                              const uint8_t *regs, PtrRec *out)
+{
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i ones = _mm_set1_epi8(-1);
+    const __m128i five_bits = _mm_set1_epi16(31);
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i f = _mm_loadu_si128((const __m128i *)flags);
+    __m128i bit[8];
+    for (int k = 0; k < 8; k++)
+    {
+        // 0 or 1 per record for flag bit k.
+        bit[k] = _mm_min_epu8(_mm_and_si128(f, _mm_set1_epi8((char)(1 << k))), one);
+    }
+
+    __m128i regs_lo = _mm_loadu_si128((const __m128i *)regs);
+    __m128i regs_hi = _mm_loadu_si128((const __m128i *)(regs + 16));
+    __m128i dest = _mm_packus_epi16(_mm_and_si128(regs_lo, five_bits),
+                                    _mm_and_si128(regs_hi, five_bits));
+    __m128i src1 = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(regs_lo, 5), five_bits),
+                                    _mm_and_si128(_mm_srli_epi16(regs_hi, 5), five_bits));
+    __m128i src2 = _mm_packus_epi16(_mm_and_si128(_mm_srli_epi16(regs_lo, 10), five_bits),
+                                    _mm_and_si128(_mm_srli_epi16(regs_hi, 10), five_bits));
+
+    // Unused registers read back as 255.
+    dest = _mm_or_si128(dest, _mm_andnot_si128(_mm_cmpeq_epi8(bit[0], one), ones));
+    src1 = _mm_or_si128(src1, _mm_andnot_si128(_mm_cmpeq_epi8(bit[1], one), ones));
+    src2 = _mm_or_si128(src2, _mm_andnot_si128(_mm_cmpeq_epi8(bit[2], one), ones));
+
+    // Field rows, in PtrRec order from op_type onward.
+    __m128i row[12] = {
+        _mm_loadu_si128((const __m128i *)ops), // op_type
+        dest, bit[0],                          // dest_reg, dest_needed
+        src1, src2, bit[1], bit[2],            // src1/2_reg, src1/2_needed
+        bit[3], bit[4],                        // cc_read, cc_write
+        bit[6], bit[5], bit[7]                 // mem_write, mem_read, br_dir
+    };
+
+    // Transpose: bytes, then 16-bit pairs, then 32-bit quads, then halves.
+    __m128i b[12];
+    for (int k = 0; k < 6; k++)
+    {
+        b[2 * k] = _mm_unpacklo_epi8(row[2 * k], row[2 * k + 1]);
+        b[2 * k + 1] = _mm_unpackhi_epi8(row[2 * k], row[2 * k + 1]);
+    }
+
+    __m128i c[12];
+    for (int k = 0; k < 3; k++)
+    {
+        // Records 0-3, 4-7, 8-11 and 12-15 of fields 4k..4k+3.
+        c[4 * k + 0] = _mm_unpacklo_epi16(b[4 * k], b[4 * k + 2]);
+        c[4 * k + 1] = _mm_unpackhi_epi16(b[4 * k], b[4 * k + 2]);
+        c[4 * k + 2] = _mm_unpacklo_epi16(b[4 * k + 1], b[4 * k + 3]);
+        c[4 * k + 3] = _mm_unpackhi_epi16(b[4 * k + 1], b[4 * k + 3]);
+    }
+
+    const __m128i keep9 = _mm_set_epi8(0, 0, 0, 0, 0, 0, 0, -1,
+                                       -1, -1, -1, -1, -1, -1, -1, -1);
+    for (int q = 0; q < 4; q++)
+    {
+        // Records 4q..4q+3: fields 0-7 in d, fields 8-11 in e.
+        __m128i d_lo = _mm_unpacklo_epi32(c[q], c[4 + q]);
+        __m128i d_hi = _mm_unpackhi_epi32(c[q], c[4 + q]);
+        __m128i e_lo = _mm_unpacklo_epi32(c[8 + q], zero);
+        __m128i e_hi = _mm_unpackhi_epi32(c[8 + q], zero);
+
+        __m128i rec[4] = {
+            _mm_unpacklo_epi64(d_lo, e_lo), _mm_unpackhi_epi64(d_lo, e_lo),
+            _mm_unpacklo_epi64(d_hi, e_hi), _mm_unpackhi_epi64(d_hi, e_hi)};
+
+        for (int j = 0; j < 4; j++)
+        {
+            uint8_t *r = (uint8_t *)&out[4 * q + j];
+            // op_type..cc_write, then zeroed padding up to mem_addr.
+            _mm_storeu_si128((__m128i *)(r + 8), _mm_and_si128(rec[j], keep9));
+            // mem_write, mem_read, br_dir, then zeroed padding.
+            _mm_storel_epi64((__m128i *)(r + 32), _mm_srli_si128(rec[j], 9));
+        }
+    }
+}
+#endif
+
+/**
+ * Decode one compact block back into records.
+ *
+ * @param block the start of the block
+ * @param avail the number of bytes available from block onward
+ * @param out the buffer to decode into, with room for
+ *            TRACE_COMPACT_BLOCK_RECS records
+ * @param num_recs set to the number of records decoded
+ * @return the size of the block in bytes, or 0 if it is truncated or corrupt
+ */
+size_t trace_compact_decode(const uint8_t *block, size_t avail, PtrRec *out,
+                            size_t *num_recs)
+{
+    if (avail < TRACE_COMPACT_BLOCK_HEADER)
+    {
+        return 0;
+    }
+
+    uint32_t header[2];
+    memcpy(header, block, sizeof(header));
+    size_t count = header[0];
+    size_t block_size = header[1];
+    if (count == 0 || count > TRACE_COMPACT_BLOCK_RECS ||
+        block_size > avail ||
+        block_size < TRACE_COMPACT_BLOCK_HEADER + 4 * count)
+    {
+        return 0;
+    }
+
+    const uint8_t *ops = block + TRACE_COMPACT_BLOCK_HEADER;
+    const uint8_t *flags = ops + count;
+    const uint8_t *regs = flags + count;
+    const uint8_t *deltas = regs + 2 * count;
+    const uint8_t *end = block + block_size;
+
+    // The variable-length fields depend on the previous record, so they are
+    // decoded in order.
+    uint64_t pc = 0;
+    uint64_t mem = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t v;
+        if (ops[i] >= TRACE_NUM_OP_TYPES || !varint_get(&deltas, end, &v))
+        {
+            return 0;
+        }
+        pc += zigzag_decode(v);
+        out[i].inst_addr = pc;
+
+        out[i].mem_addr = 0;
+        if (flags[i] & (TRACE_COMPACT_F_MEM_READ | TRACE_COMPACT_F_MEM_WRITE))
+        {
+            if (!varint_get(&deltas, end, &v))
+            {
+                return 0;
+            }
+            mem += zigzag_decode(v);
+            out[i].mem_addr = mem;
+        }
+
+        out[i].br_target = 0;
+        if (ops[i] == TRACE_COMPACT_OP_CBR)
+        {
+            if (!varint_get(&deltas, end, &v))
+            {
+                return 0;
+            }
+            out[i].br_target = pc + zigzag_decode(v);
+        }
+    }
+    if (deltas != end)
+    {
+        return 0;
+    }
+
+    // The fixed-width fields are independent from record to record.
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= count; i += 16)
+    {
+        decode_fixed_sse2(ops + i, flags + i, regs + 2 * i, out + i);
+    }
+#endif
+    decode_fixed_scalar(ops, flags, regs, out, i, count);
+
+    *num_recs = count;
+    return block_size;
+}
@@ -0,0 +1,93 @@
+// tracecompact.h
+// Declares the compact encoding of .ptr trace records used by packed trace
+// files with TRACE_ENC_COMPACT.
+//
+// Records are stored in self-contained blocks of up to
+// TRACE_COMPACT_BLOCK_RECS records. Within a block, the fixed-width parts of
+// the records are stored column by column so they can be expanded with SIMD
+// instructions, followed by a single stream of variable-length deltas:
+//
+//   uint32_t num_recs            number of records in the block
+//   uint32_t block_size          size of the whole block in bytes
+//   uint8_t  op_type[num_recs]
+//   uint8_t  flags[num_recs]     TRACE_COMPACT_F_* bits
+//   uint16_t regs[num_recs]      dest | src1 << 5 | src2 << 10; an unused
+//                                register is stored as 0
+//   varints, per record:         zigzag(inst_addr - previous inst_addr)
+//                                zigzag(mem_addr - previous mem_addr), if
+//                                    the record reads or writes memory
+//                                zigzag(br_target - inst_addr), if the
+//                                    record is a conditional branch
+//
+// Deltas start from 0 at the beginning of each block, so blocks can be
+// decoded independently of one another.
+
+#ifndef _TRACECOMPACT_H_
+#define _TRACECOMPACT_H_
+
+#include "tracefmt.h"
+#include "varint.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The largest number of records in one compact block. */
+#define TRACE_COMPACT_BLOCK_RECS 4096
+
+/** The size in bytes of the header at the start of each compact block. */
+#define TRACE_COMPACT_BLOCK_HEADER 8
+
+/**
+ * The largest possible size in bytes of a compact block: the header, the
+ * fixed-width columns, and three varints per record.
+ */
+#define TRACE_COMPACT_MAX_BLOCK_SIZE \
+    (TRACE_COMPACT_BLOCK_HEADER + TRACE_COMPACT_BLOCK_RECS * (4 + 3 * VARINT_MAX_SIZE))
+
+/** The op type of a conditional branch (OP_CBR in the labs' trace.h). */
+#define TRACE_COMPACT_OP_CBR 3
+
+/** Flag bits stored per record in a compact block. */
+#define TRACE_COMPACT_F_DEST_NEEDED 0x01
+#define TRACE_COMPACT_F_SRC1_NEEDED 0x02
+#define TRACE_COMPACT_F_SRC2_NEEDED 0x04
+#define TRACE_COMPACT_F_CC_READ 0x08
+#define TRACE_COMPACT_F_CC_WRITE 0x10
+#define TRACE_COMPACT_F_MEM_READ 0x20
+#define TRACE_COMPACT_F_MEM_WRITE 0x40
+#define TRACE_COMPACT_F_BR_DIR 0x80
+
+/**
+ * Encode up to TRACE_COMPACT_BLOCK_RECS records as one compact block.
+ *
+ * Only records that the encoding can reproduce are accepted: every flag must
+ * be 0 or 1, used registers must be below 32 and unused ones 255 (as in the
+ * course traces), and mem_addr, br_dir and br_target must be 0 when they
+ * don't apply. Padding bytes are not preserved.
+ *
+ * @param recs the records to encode
+ * @param count the number of records, at most TRACE_COMPACT_BLOCK_RECS
+ * @param out the buffer to write the block to, with room for
+ *            TRACE_COMPACT_MAX_BLOCK_SIZE bytes
+ * @param bad_rec set to the index of the offending record on failure
+ * @return the size of the block in bytes, or 0 if a record can't be encoded
+ */
+size_t trace_compact_encode(const PtrRec *recs, size_t count, uint8_t *out,
+                            size_t *bad_rec);
+
+/**
+ * Decode one compact block back into records.
+ *
+ * Uses SSE2 to expand the fixed-width columns 16 records at a time when the
+ * compiler targets it, and plain C++ otherwise.
+ *
+ * @param block the start of the block
+ * @param avail the number of bytes available from block onward
+ * @param out the buffer to decode into, with room for
+ *            TRACE_COMPACT_BLOCK_RECS records
+ * @param num_recs set to the number of records decoded
+ * @return the size of the block in bytes, or 0 if it is truncated or corrupt
+ */
+size_t trace_compact_decode(const uint8_t *block, size_t avail, PtrRec *out,
+                            size_t *num_recs);
+
+#endif
@@ -0,0 +1,246 @@
+// tracedict.cpp
+// Implements the dictionary encoding of .ptr trace records.
+
+#include "tracedict.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+/** [Internal] The lookup structure behind a TraceDict. */
+struct TraceDictMapStruct
+{
+    /** [Internal] The first entry for each instruction address. */
+    std::unordered_map<uint64_t, uint32_t> first;
+    /**
+     * [Internal] For each entry, the next entry with the same address, or
+     * UINT32_MAX. Addresses are almost always enough to tell static
+     * instructions apart, so these chains are rarely more than one long.
+     */
+    std::vector<uint32_t> next;
+};
+
+/**
+ * [Internal] Get the static part of a record, as stored in the table.
+ *
+ * @param rec the record
+ * @param entry set to the record with br_dir, mem_addr and padding zeroed
+ */
+static void trace_dict_static(const PtrRec *rec, PtrRec *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+    entry->inst_addr = rec->inst_addr;
+    entry->op_type = rec->op_type;
+    entry->dest_reg = rec->dest_reg;
+    entry->dest_needed = rec->dest_needed;
+    entry->src1_reg = rec->src1_reg;
+    entry->src2_reg = rec->src2_reg;
+    entry->src1_needed = rec->src1_needed;
+    entry->src2_needed = rec->src2_needed;
+    entry->cc_read = rec->cc_read;
+    entry->cc_write = rec->cc_write;
+    entry->mem_write = rec->mem_write;
+    entry->mem_read = rec->mem_read;
+    entry->br_target = rec->br_target;
+}
+
+/**
+ * [Internal] Find the table entry of a static instruction, adding it if it
+ * is new.
+ *
+ * @param dict the static instruction table
+ * @param entry the static instruction, as made by trace_dict_static()
+ * @return the index of the entry, or UINT32_MAX if the table is full
+ */
+static uint32_t trace_dict_lookup(TraceDict *dict, const PtrRec *entry)
+{
+    TraceDictMapStruct *map = dict->map;
+    auto found = map->first.find(entry->inst_addr);
+    uint32_t index = found == map->first.end() ? UINT32_MAX : found->second;
+    uint32_t last = UINT32_MAX;
+    while (index != UINT32_MAX)
+    {
+        if (memcmp(&dict->entries[index], entry, sizeof(*entry)) == 0)
+        {
+            return index;
+        }
+        last = index;
+        index = map->next[index];
+    }
+
+    if (dict->num_entries == TRACE_DICT_MAX_ENTRIES)
+    {
+        return UINT32_MAX;
+    }
+    if (dict->num_entries == dict->max_entries)
+    {
+        dict->max_entries *= 2;
+        dict->entries = (PtrRec *)realloc(dict->entries,
+                                          dict->max_entries * sizeof(PtrRec));
+    }
+
+    index = (uint32_t)dict->num_entries++;
+    dict->entries[index] = *entry;
+    map->next.push_back(UINT32_MAX);
+    if (last == UINT32_MAX)
+    {
+        map->first[entry->inst_addr] = index;
+    }
+    else
+    {
+        map->next[last] = index;
+    }
+    return index;
+}
+
+/**
+ * Create an empty static instruction table.
+ *
+ * @return a pointer to a newly allocated TraceDict
+ */
+TraceDict *trace_dict_new()
+{
+    TraceDict *dict = (TraceDict *)calloc(1, sizeof(TraceDict));
+    dict->max_entries = 1024;
+    dict->entries = (PtrRec *)malloc(dict->max_entries * sizeof(PtrRec));
+    dict->map = new TraceDictMapStruct();
+    return dict;
+}
+
+/**
+ * Encode up to TRACE_DICT_BLOCK_RECS records as one dictionary block, adding
+ * any new static instructions to the table.
+ *
+ * @param dict the static instruction table
+ * @param recs the records to encode
+ * @param count the number of records, at most TRACE_DICT_BLOCK_RECS
+ * @param out the buffer to write the block to, with room for
+ *            TRACE_DICT_MAX_BLOCK_SIZE bytes
+ * @param bad_rec set to the index of the offending record on failure
+ * @return the size of the block in bytes, or 0 if a record can't be encoded
+ */
+size_t trace_dict_encode(TraceDict *dict, const PtrRec *recs, size_t count,
+                         uint8_t *out, size_t *bad_rec)
+{
+    uint8_t *pos = out + TRACE_DICT_BLOCK_HEADER;
+    int64_t prev_index = -1;
+    uint64_t prev_mem = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const PtrRec *r = &recs[i];
+        bool is_mem = r->mem_read || r->mem_write;
+        PtrRec entry;
+        trace_dict_static(r, &entry);
+        uint32_t index = trace_dict_lookup(dict, &entry);
+
+        if (r->br_dir > 1 || (!is_mem && r->mem_addr != 0) ||
+            index == UINT32_MAX)
+        {
+            *bad_rec = i;
+            return 0;
+        }
+
+        uint64_t delta = zigzag_encode((int64_t)index - (prev_index + 1));
+        pos = varint_put(pos, delta << 1 | r->br_dir);
+        prev_index = index;
+        if (is_mem)
+        {
+            pos = varint_put(pos, zigzag_encode((int64_t)(r->mem_addr - prev_mem)));
+            prev_mem = r->mem_addr;
+        }
+    }
+
+    uint32_t header[2] = {(uint32_t)count, (uint32_t)(pos - out)};
+    memcpy(out, header, sizeof(header));
+    return pos - out;
+}
+
+/**
+ * Free a static instruction table.
+ *
+ * @param dict the table to free (may be NULL)
+ */
+void trace_dict_free(TraceDict *dict)
+{
+    if (dict == NULL)
+    {
+        return;
+    }
+
+    delete dict->map;
+    free(dict->entries);
+    free(dict);
+}
+
+/**
+ * Decode one dictionary block back into records.
+ *
+ * @param entries the static instruction table
+ * @param num_entries the number of entries in the table
+ * @param block the start of the block
+ * @param avail the number of bytes available from block onward
+ * @param out the buffer to decode into, with room for TRACE_DICT_BLOCK_RECS
+ *            records
+ * @param num_recs set to the number of records decoded
+ * @return the size of the block in bytes, or 0 if it is truncated or corrupt
+ */
+size_t trace_dict_decode(const PtrRec *entries, size_t num_entries,
+                         const uint8_t *block, size_t avail, PtrRec *out,
+                         size_t *num_recs)
+{
+    if (avail < TRACE_DICT_BLOCK_HEADER)
+    {
+        return 0;
+    }
+
+    uint32_t header[2];
+    memcpy(header, block, sizeof(header));
+    size_t count = header[0];
+    size_t block_size = header[1];
+    if (count == 0 || count > TRACE_DICT_BLOCK_RECS || block_size > avail ||
+        block_size < TRACE_DICT_BLOCK_HEADER + count)
+    {
+        return 0;
+    }
+
+    const uint8_t *pos = block + TRACE_DICT_BLOCK_HEADER;
+    const uint8_t *end = block + block_size;
+    int64_t index = -1;
+    uint64_t mem = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint64_t v;
+        if (!varint_get(&pos, end, &v))
+        {
+            return 0;
+        }
+        index += 1 + zigzag_decode(v >> 1);
+        if ((uint64_t)index >= num_entries)
+        {
+            return 0;
+        }
+
+        // The entry supplies everything else, with br_dir and mem_addr 0.
+        const PtrRec *entry = &entries[index];
+        out[i] = *entry;
+        out[i].br_dir = (uint8_t)(v & 1);
+        if (entry->mem_read || entry->mem_write)
+        {
+            if (!varint_get(&pos, end, &v))
+            {
+                return 0;
+            }
+            mem += zigzag_decode(v);
+            out[i].mem_addr = mem;
+        }
+    }
+    if (pos != end)
+    {
+        return 0;
+    }
+
+    *num_recs = count;
+    return block_size;
+}
@@ -0,0 +1,112 @@
+// tracedict.h
+// Declares the dictionary encoding of .ptr trace records used by packed trace
+// files with TRACE_ENC_DICT.
+//
+// Everything in a record except br_dir and mem_addr is a property of the
+// static instruction, and a trace executes only a few thousand of those. The
+// file stores each distinct static instruction once, as a PtrRec with br_dir
+// and mem_addr set to 0, in a table at header.dict_offset. The records
+// themselves are a stream of blocks of up to TRACE_DICT_BLOCK_RECS records,
+// each carrying only what changes from one execution to the next:
+//
+//   uint32_t num_recs            number of records in the block
+//   uint32_t block_size          size of the whole block in bytes
+//   varints, per record:         zigzag(index - (previous index + 1)) << 1
+//                                    | br_dir
+//                                zigzag(mem_addr - previous mem_addr), if
+//                                    the instruction reads or writes memory
+//
+// Straight-line code then costs a single byte per record. The previous index
+// and mem_addr start at -1 and 0 in each block, so blocks can be decoded
+// independently of one another, given the table.
+
+#ifndef _TRACEDICT_H_
+#define _TRACEDICT_H_
+
+#include "tracefmt.h"
+#include "varint.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The largest number of records in one dictionary block. */
+#define TRACE_DICT_BLOCK_RECS 4096
+
+/** The size in bytes of the header at the start of each dictionary block. */
+#define TRACE_DICT_BLOCK_HEADER 8
+
+/**
+ * The largest possible size in bytes of a dictionary block: the header and
+ * two varints per record.
+ */
+#define TRACE_DICT_MAX_BLOCK_SIZE \
+    (TRACE_DICT_BLOCK_HEADER + TRACE_DICT_BLOCK_RECS * 2 * VARINT_MAX_SIZE)
+
+/** The largest number of entries in a static instruction table. */
+#define TRACE_DICT_MAX_ENTRIES (1u << 30)
+
+/** [Internal] The lookup structure behind a TraceDict. */
+struct TraceDictMapStruct;
+
+/** A static instruction table being built while encoding a trace. */
+typedef struct TraceDictStruct
+{
+    /** The table so far, in the order entries were added. */
+    PtrRec *entries;
+    /** The number of entries in the table. */
+    size_t num_entries;
+    /** [Internal] The number of entries there is room for. */
+    size_t max_entries;
+    /** [Internal] Finds the entry of a static instruction. */
+    struct TraceDictMapStruct *map;
+} TraceDict;
+
+/**
+ * Create an empty static instruction table.
+ *
+ * @return a pointer to a newly allocated TraceDict
+ */
+TraceDict *trace_dict_new();
+
+/**
+ * Encode up to TRACE_DICT_BLOCK_RECS records as one dictionary block, adding
+ * any new static instructions to the table.
+ *
+ * Only records that the encoding can reproduce are accepted: br_dir must be
+ * 0 or 1, and mem_addr must be 0 unless the record reads or writes memory.
+ * Padding bytes are not preserved.
+ *
+ * @param dict the static instruction table
+ * @param recs the records to encode
+ * @param count the number of records, at most TRACE_DICT_BLOCK_RECS
+ * @param out the buffer to write the block to, with room for
+ *            TRACE_DICT_MAX_BLOCK_SIZE bytes
+ * @param bad_rec set to the index of the offending record on failure
+ * @return the size of the block in bytes, or 0 if a record can't be encoded
+ */
+size_t trace_dict_encode(TraceDict *dict, const PtrRec *recs, size_t count,
+                         uint8_t *out, size_t *bad_rec);
+
+/**
+ * Free a static instruction table.
+ *
+ * @param dict the table to free (may be NULL)
+ */
+void trace_dict_free(TraceDict *dict);
+
+/**
+ * Decode one dictionary block back into records.
+ *
+ * @param entries the static instruction table
+ * @param num_entries the number of entries in the table
+ * @param block the start of the block
+ * @param avail the number of bytes available from block onward
+ * @param out the buffer to decode into, with room for TRACE_DICT_BLOCK_RECS
+ *            records
+ * @param num_recs set to the number of records decoded
+ * @return the size of the block in bytes, or 0 if it is truncated or corrupt
+ */
+size_t trace_dict_decode(const PtrRec *entries, size_t num_entries,
+                         const uint8_t *block, size_t avail, PtrRec *out,
+                         size_t *num_recs);
+
+#endif
@@ -0,0 +1,167 @@
+// tracefmt.h
+// Declares the on-disk layout of packed trace files: an uncompressed container
+// with a fixed header followed by the trace records, laid out so the records
+// can be used in place after mapping the file into memory.
+//
+// Also declares the two record layouts found in the course traces, for tools
+// that handle traces without being part of a particular lab.
+
+#ifndef _TRACEFMT_H_
+#define _TRACEFMT_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The first eight bytes of every packed trace file. */
+#define TRACE_PACK_MAGIC "ECETRACE"
+
+/** The current version of the packed trace format. */
+#define TRACE_PACK_VERSION 1
+
+/**
+ * The offset of the first record in a packed trace file. This is a multiple
+ * of the page size, so mapped records are as aligned as the mapping itself.
+ */
+#define TRACE_PACK_DATA_OFFSET 4096
+
+/** The number of op type counters kept in a packed trace header. */
+#define TRACE_PACK_MAX_OP_TYPES 8
+
+/**
+ * The number of op types defined by OpType in the labs' trace.h files
+ * (OP_ALU, OP_LD, OP_ST, OP_CBR and OP_OTHER). Records with a larger op type
+ * are invalid.
+ */
+#define TRACE_NUM_OP_TYPES 5
+
+/**
+ * The byte offset of the op type field within a record. This is the same for
+ * both record layouts, so tools can classify records without knowing which
+ * layout they hold.
+ */
+#define TRACE_OP_TYPE_OFFSET 8
+
+/** The record layouts a trace file can hold. */
+typedef enum TraceLayoutEnum
+{
+    TRACE_LAYOUT_OTR = 1, // Lab 1 records: address and op type (.otr)
+    TRACE_LAYOUT_PTR = 2  // Lab 2/3 records: full pipeline info (.ptr)
+} TraceLayout;
+
+/** How the records in a packed trace file are stored. */
+typedef enum TraceEncodingEnum
+{
+    TRACE_ENC_RAW = 0,     // Records exactly as in memory; mapped in place
+    TRACE_ENC_COMPACT = 1, // Bit-packed blocks of .ptr records; see tracecompact.h
+    TRACE_ENC_DICT = 2,    // Static instruction table plus a dynamic stream of
+                           // .ptr records; see tracedict.h
+    TRACE_ENC_FRAMES = 3   // Independently compressed frames of records of
+                           // either layout; see traceframe.h
+} TraceEncoding;
+
+/** A Lab 1 record, as stored in .otr traces. */
+typedef struct OtrRecStruct
+{
+    /** The address (PC) of the instruction. */
+    uint64_t inst_addr;
+    /** The type of operation performed by this instruction. */
+    uint8_t optype;
+} OtrRec;
+
+/** A Lab 2/3 record, as stored in .ptr traces. */
+typedef struct PtrRecStruct
+{
+    /** The address (PC) of the instruction. */
+    uint64_t inst_addr;
+    /** The type of operation performed by this instruction. */
+    uint8_t op_type;
+    /** If dest_needed, this instruction's destination register. */
+    uint8_t dest_reg;
+    /** Whether this instruction has a valid dest_reg. */
+    uint8_t dest_needed;
+    /** If src1_needed, this instruction's 1st source register. */
+    uint8_t src1_reg;
+    /** If src2_needed, this instruction's 2nd source register. */
+    uint8_t src2_reg;
+    /** Whether this instruction has a valid src1_reg. */
+    uint8_t src1_needed;
+    /** Whether this instruction has a valid src2_reg. */
+    uint8_t src2_needed;
+    /** Whether this instruction reads the condition code. */
+    uint8_t cc_read;
+    /** Whether this instruction writes the condition code. */
+    uint8_t cc_write;
+    /** If mem_read/mem_write, the memory address to read/write. */
+    uint64_t mem_addr;
+    /** Whether this instruction writes the memory at mem_addr. */
+    uint8_t mem_write;
+    /** Whether this instruction reads the memory at mem_addr. */
+    uint8_t mem_read;
+    /** If op_type is a conditional branch, whether it is taken. */
+    uint8_t br_dir;
+    /** If op_type is a conditional branch, the target address. */
+    uint64_t br_target;
+} PtrRec;
+
+/**
+ * The header at the start of every packed trace file.
+ *
+ * All fields are stored little-endian, as written by the x86 machines the
+ * traces are used on. The records start at data_offset and there are exactly
+ * num_recs of them. With TRACE_ENC_RAW each is stored as rec_size bytes; with
+ * other encodings rec_size is the size of a record once decoded.
+ */
+typedef struct TracePackHeaderStruct
+{
+    /** TRACE_PACK_MAGIC, not NUL-terminated. */
+    char magic[8];
+    /** TRACE_PACK_VERSION at the time the file was written. */
+    uint32_t version;
+    /** The record layout, as a TraceLayout value. */
+    uint32_t layout;
+    /** The size in bytes of one record. */
+    uint32_t rec_size;
+    /** How the records are stored, as a TraceEncoding value. */
+    uint32_t encoding;
+    /** The offset in bytes of the first record from the start of the file. */
+    uint64_t data_offset;
+    /** The number of records in the file. */
+    uint64_t num_recs;
+    /** The number of records of each op type, indexed by op type. */
+    uint64_t op_type_counts[TRACE_PACK_MAX_OP_TYPES];
+    /**
+     * With TRACE_ENC_DICT, the offset in bytes of the static instruction
+     * table, which follows the dynamic stream; otherwise 0.
+     */
+    uint64_t dict_offset;
+    /** With TRACE_ENC_DICT, the number of entries in the table; otherwise 0. */
+    uint64_t dict_entries;
+    /**
+     * With TRACE_ENC_FRAMES, the offset in bytes of the frame index, which
+     * follows the frames; otherwise 0.
+     */
+    uint64_t frame_index_offset;
+    /** With TRACE_ENC_FRAMES, the number of frames; otherwise 0. */
+    uint64_t num_frames;
+} TracePackHeader;
+
+/**
+ * Get the size in bytes of one record in the given layout.
+ *
+ * @param layout the record layout, as a TraceLayout value
+ * @return the record size, or 0 if the layout is unknown
+ */
+static inline size_t trace_layout_rec_size(uint32_t layout)
+{
+    switch (layout)
+    {
+    case TRACE_LAYOUT_OTR:
+        return sizeof(OtrRec);
+    case TRACE_LAYOUT_PTR:
+        return sizeof(PtrRec);
+    default:
+        return 0;
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+// traceframe.cpp
+// Implements the framed encoding of trace records.
+
+#include "traceframe.h"
+#include <string.h>
+#include <zlib.h>
+
+/**
+ * Get the largest possible size in bytes of a frame.
+ *
+ * @return the size of a frame holding TRACE_FRAME_MAX_SIZE bytes of records
+ *         that didn't compress at all
+ */
+size_t trace_frame_max_encoded_size()
+{
+    return TRACE_FRAME_HEADER + compressBound(TRACE_FRAME_MAX_SIZE);
+}
+
+/**
+ * Compress records into one frame.
+ *
+ * @param recs the records to compress
+ * @param count the number of records
+ * @param rec_size the size in bytes of one record; count * rec_size must be
+ *                 at most TRACE_FRAME_MAX_SIZE
+ * @param out the buffer to write the frame to, with room for
+ *            trace_frame_max_encoded_size() bytes
+ * @return the size of the frame in bytes, or 0 on error
+ */
+size_t trace_frame_encode(const void *recs, size_t count, size_t rec_size,
+                          uint8_t *out)
+{
+    uLongf out_len = compressBound(TRACE_FRAME_MAX_SIZE);
+    if (count * rec_size > TRACE_FRAME_MAX_SIZE ||
+        compress2(out + TRACE_FRAME_HEADER, &out_len, (const Bytef *)recs,
+                  count * rec_size, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        return 0;
+    }
+
+    uint32_t header[2] = {(uint32_t)count,
+                          (uint32_t)(TRACE_FRAME_HEADER + out_len)};
+    memcpy(out, header, sizeof(header));
+    return header[1];
+}
+
+/**
+ * Inflate one frame back into records.
+ *
+ * @param frame the start of the frame
+ * @param avail the number of bytes available from frame onward
+ * @param rec_size the size in bytes of one record
+ * @param out the buffer to inflate into
+ * @param cap the number of bytes available at out
+ * @param num_recs set to the number of records inflated
+ * @return the size of the frame in bytes, or 0 if it is truncated, corrupt,
+ *         or too big for out
+ */
+size_t trace_frame_decode(const uint8_t *frame, size_t avail, size_t rec_size,
+                          uint8_t *out, size_t cap, size_t *num_recs)
+{
+    if (avail < TRACE_FRAME_HEADER)
+    {
+        return 0;
+    }
+
+    uint32_t header[2];
+    memcpy(header, frame, sizeof(header));
+    size_t count = header[0];
+    size_t frame_size = header[1];
+    if (count == 0 || count * rec_size > cap || frame_size > avail ||
+        frame_size <= TRACE_FRAME_HEADER)
+    {
+        return 0;
+    }
+
+    // The zlib trailer's checksum catches corruption inside the frame.
+    uLongf out_len = count * rec_size;
+    if (uncompress(out, &out_len, frame + TRACE_FRAME_HEADER,
+                   frame_size - TRACE_FRAME_HEADER) != Z_OK ||
+        out_len != count * rec_size)
+    {
+        return 0;
+    }
+
+    *num_recs = count;
+    return frame_size;
+}
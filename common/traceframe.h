@@ -0,0 +1,79 @@
+// traceframe.h
+// Declares the framed encoding of trace records used by packed trace files
+// with TRACE_ENC_FRAMES.
+//
+// A gzip trace is one long deflate stream, so it can only be inflated from
+// the front, by one thread. A framed trace cuts the records into frames of up
+// to TRACE_FRAME_MAX_SIZE bytes and compresses each with zlib on its own, so
+// any frame can be inflated without the others, and several at once. Each
+// frame holds whole raw records, in either layout:
+//
+//   uint32_t num_recs            number of records in the frame
+//   uint32_t frame_size          size of the whole frame in bytes
+//   zlib stream                  the records, exactly as in memory
+//
+// The frames are followed by a frame index at header.frame_index_offset,
+// giving where each frame starts and the first record it holds, so readers
+// can hand frames to worker threads, or start partway into the trace,
+// without walking the frames before.
+
+#ifndef _TRACEFRAME_H_
+#define _TRACEFRAME_H_
+
+#include "tracefmt.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The largest number of bytes of records in one frame, once inflated. */
+#define TRACE_FRAME_MAX_SIZE (256 * 1024)
+
+/** The size in bytes of the header at the start of each frame. */
+#define TRACE_FRAME_HEADER 8
+
+/** One entry of the frame index of a framed packed trace. */
+typedef struct TraceFrameIndexEntryStruct
+{
+    /** The offset in bytes of the frame from the start of the file. */
+    uint64_t offset;
+    /** The index in the trace of the first record in the frame. */
+    uint64_t first_rec;
+} TraceFrameIndexEntry;
+
+/**
+ * Get the largest possible size in bytes of a frame.
+ *
+ * @return the size of a frame holding TRACE_FRAME_MAX_SIZE bytes of records
+ *         that didn't compress at all
+ */
+size_t trace_frame_max_encoded_size();
+
+/**
+ * Compress records into one frame.
+ *
+ * @param recs the records to compress
+ * @param count the number of records
+ * @param rec_size the size in bytes of one record; count * rec_size must be
+ *                 at most TRACE_FRAME_MAX_SIZE
+ * @param out the buffer to write the frame to, with room for
+ *            trace_frame_max_encoded_size() bytes
+ * @return the size of the frame in bytes, or 0 on error
+ */
+size_t trace_frame_encode(const void *recs, size_t count, size_t rec_size,
+                          uint8_t *out);
+
+/**
+ * Inflate one frame back into records.
+ *
+ * @param frame the start of the frame
+ * @param avail the number of bytes available from frame onward
+ * @param rec_size the size in bytes of one record
+ * @param out the buffer to inflate into
+ * @param cap the number of bytes available at out
+ * @param num_recs set to the number of records inflated
+ * @return the size of the frame in bytes, or 0 if it is truncated, corrupt,
+ *         or too big for out
+ */
+size_t trace_frame_decode(const uint8_t *frame, size_t avail, size_t rec_size,
+                          uint8_t *out, size_t cap, size_t *num_recs);
+
+#endif
@@ -0,0 +1,1278 @@
+// tracereader.cpp
+// Implements the block trace reader shared by all three simulators.
+
+#include "tracereader.h"
+#include "gzindex.h"
+#include "spscring.h"
+#include "tracecompact.h"
+#include "tracedict.h"
+#include "traceframe.h"
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/** [Internal] One buffer of whole records passed through the ring. */
+typedef struct TraceSlotStruct
+{
+    /** [Internal] The aligned buffer holding the records. */
+    uint8_t *buf;
+    /** [Internal] The number of valid bytes in buf; a multiple of rec_size. */
+    size_t len;
+    /** [Internal] Whether this is the last buffer of the trace. */
+    bool last;
+    /** [Internal] Whether the trace ended in an error after this buffer. */
+    bool error;
+} TraceSlot;
+
+/** [Internal] State shared with a background decompression thread. */
+struct TraceRingStruct
+{
+    /** [Internal] Buffers decompressed but not yet fully read. */
+    SpscRing<TraceSlot, TRACE_RING_SLOTS> slots;
+    /** [Internal] The background decompression thread. */
+    std::thread producer;
+    /** [Internal] Set by trace_close() to stop the producer early. */
+    std::atomic<bool> stop;
+    /** [Internal] The slot the reader is currently reading, if any. */
+    TraceSlot *held;
+};
+
+/** [Internal] One frame passed from a worker thread to the reader. */
+typedef struct TraceFrameSlotStruct
+{
+    /** [Internal] The aligned buffer holding the frame's records. */
+    uint8_t *buf;
+    /** [Internal] The number of valid bytes in buf. */
+    size_t len;
+    /** [Internal] Whether the frame failed to inflate. */
+    bool error;
+    /**
+     * [Internal] 2 * k while the slot is free for frame k, and 2 * k + 1
+     * once frame k is in buf. Frame k always goes in slot k % SLOTS, so the
+     * workers can inflate frames in any order while the reader still takes
+     * them in order.
+     */
+    std::atomic<uint64_t> seq;
+    /** [Internal] Keeps neighbouring slots' seq off one cache line. */
+    char pad[SPSC_CACHE_LINE];
+} TraceFrameSlot;
+
+/** [Internal] State shared with the worker threads of a framed trace. */
+struct TraceFramePoolStruct
+{
+    /** [Internal] Frames inflated or being inflated ahead of the reader. */
+    TraceFrameSlot slots[TRACE_FRAME_SLOTS];
+    /** [Internal] The next frame for a worker to claim. */
+    std::atomic<uint64_t> claim;
+    char pad_claim[SPSC_CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+    /** [Internal] Set by trace_close() to stop the workers early. */
+    std::atomic<bool> stop;
+    /** [Internal] The worker threads. */
+    std::vector<std::thread> workers;
+    /** [Internal] The next frame for the reader to take. */
+    uint64_t read_frame;
+    /** [Internal] Whether the reader is reading the frame before read_frame. */
+    bool held;
+};
+
+// An encoded block is always decoded whole, so one must fit in the space a
+// refill has left after carrying over a partial record.
+static_assert(TRACE_COMPACT_BLOCK_RECS * sizeof(PtrRec) * 2 <= TRACE_BUF_SIZE,
+              "TRACE_BUF_SIZE is too small for a compact trace block");
+static_assert(TRACE_DICT_BLOCK_RECS * sizeof(PtrRec) * 2 <= TRACE_BUF_SIZE,
+              "TRACE_BUF_SIZE is too small for a dictionary trace block");
+static_assert(TRACE_FRAME_MAX_SIZE * 2 <= TRACE_BUF_SIZE,
+              "TRACE_BUF_SIZE is too small for a trace frame");
+// All three encodings start each block with its record count and size, so
+// the same code can walk the blocks of any of them.
+static_assert(TRACE_COMPACT_BLOCK_HEADER == TRACE_DICT_BLOCK_HEADER &&
+                  TRACE_COMPACT_BLOCK_HEADER == TRACE_FRAME_HEADER,
+              "compact, dictionary and frame headers differ");
+
+/**
+ * [Internal] Decode whole blocks of a mapped compact, dictionary or framed
+ * packed trace into dst for as long as they fit.
+ *
+ * @param tr the trace reader
+ * @param dst where to decode the records to
+ * @param cap the number of bytes available at dst
+ * @return the number of bytes decoded, 0 at the end of the trace, or -1 on
+ *         error (already reported)
+ */
+static ssize_t trace_decode_blocks(TraceReader *tr, uint8_t *dst, size_t cap)
+{
+    uint32_t encoding = tr->header->encoding;
+    size_t len = 0;
+    // Blocks may be followed by padding, so stop at the last record.
+    while (tr->pack_recs_left > 0 && tr->pack_pos < tr->pack_end)
+    {
+        uint32_t block_recs;
+        memcpy(&block_recs, tr->pack_pos, sizeof(block_recs));
+        if (cap - len < (size_t)block_recs * tr->rec_size)
+        {
+            break;
+        }
+
+        size_t num_recs = 0;
+        size_t avail = tr->pack_end - tr->pack_pos;
+        size_t block_size;
+        const char *kind;
+        if (encoding == TRACE_ENC_FRAMES)
+        {
+            block_size = trace_frame_decode(tr->pack_pos, avail, tr->rec_size,
+                                            dst + len, cap - len, &num_recs);
+            kind = "frame";
+            tr->next_frame++;
+        }
+        else if (encoding == TRACE_ENC_DICT)
+        {
+            block_size = trace_dict_decode(tr->dict, tr->dict_entries,
+                                           tr->pack_pos, avail,
+                                           (PtrRec *)(dst + len), &num_recs);
+            kind = "dictionary block";
+        }
+        else
+        {
+            block_size = trace_compact_decode(tr->pack_pos, avail,
+                                              (PtrRec *)(dst + len), &num_recs);
+            kind = "compact block";
+        }
+        if (block_size == 0 || num_recs > tr->pack_recs_left)
+        {
+            fprintf(stderr, "\n");
+            fprintf(stderr, "Error: %s: corrupt %s at byte %lu\n",
+                    tr->filename, kind,
+                    (unsigned long)(tr->pack_pos - tr->map));
+            return -1;
+        }
+
+        tr->pack_pos += block_size;
+        tr->pack_recs_left -= num_recs;
+        len += num_recs * tr->rec_size;
+    }
+
+    if (len == 0 && tr->pack_recs_left > 0)
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Error: %s: truncated packed trace, %lu records "
+                        "missing\n",
+                tr->filename, (unsigned long)tr->pack_recs_left);
+        return -1;
+    }
+    return len;
+}
+
+/**
+ * [Internal] Read the next bytes of records from wherever the trace comes
+ * from: the gzip stream, or the encoded blocks of a packed trace.
+ *
+ * @param tr the trace reader
+ * @param dst where to read the records to
+ * @param cap the number of bytes available at dst
+ * @return the number of bytes read, 0 at the end of the trace, or -1 on
+ *         error (already reported)
+ */
+static ssize_t trace_source_read(TraceReader *tr, uint8_t *dst, size_t cap)
+{
+    if (tr->gz != NULL)
+    {
+        return gzs_read(tr->gz, dst, cap);
+    }
+    return trace_decode_blocks(tr, dst, cap);
+}
+
+/**
+ * [Internal] Wait a little longer before polling the ring again.
+ *
+ * Spins briefly first, since the other side is usually only moments away,
+ * then yields the CPU, and finally sleeps so that a stalled side does not
+ * burn a core.
+ *
+ * @param spins the number of times this wait has polled so far
+ */
+static void trace_backoff(unsigned int *spins)
+{
+    unsigned int n = (*spins)++;
+    if (n < 64)
+    {
+        return;
+    }
+    if (n < 1024)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+/**
+ * [Internal] Fill ring slots with whole records until the trace ends, an
+ * error occurs, or the reader is closed.
+ *
+ * A record split across two buffers is carried over to the start of the
+ * next slot, so the reader never sees a partial record.
+ *
+ * @param tr the trace reader whose ring to fill
+ */
+static void trace_produce(TraceReader *tr)
+{
+    TraceRingStruct *ring = tr->ring;
+    uint8_t *carry = (uint8_t *)malloc(tr->rec_size);
+    size_t carry_len = 0;
+
+    while (true)
+    {
+        TraceSlot *slot;
+        unsigned int spins = 0;
+        while ((slot = ring->slots.back()) == NULL)
+        {
+            if (ring->stop.load(std::memory_order_relaxed))
+            {
+                free(carry);
+                return;
+            }
+            trace_backoff(&spins);
+        }
+
+        memcpy(slot->buf, carry, carry_len);
+        size_t want = TRACE_BUF_SIZE - carry_len;
+        ssize_t bytes_read = trace_source_read(tr, slot->buf + carry_len, want);
+
+        slot->last = false;
+        slot->error = false;
+        if (bytes_read == -1)
+        {
+            // trace_source_read() has already reported the error.
+            slot->len = 0;
+            slot->last = true;
+            slot->error = true;
+        }
+        else
+        {
+            size_t total = carry_len + bytes_read;
+            slot->len = total - total % tr->rec_size;
+            carry_len = total - slot->len;
+            memcpy(carry, slot->buf + slot->len, carry_len);
+
+            if (bytes_read == 0)
+            {
+                slot->last = true;
+                if (carry_len > 0)
+                {
+                    // The last record was cut short.
+                    fprintf(stderr, "\n");
+                    fprintf(stderr, "Error: Invalid trace file: %s ends with "
+                                    "a partial record\n",
+                            tr->filename);
+                    slot->error = true;
+                }
+            }
+        }
+
+        bool last = slot->last;
+        ring->slots.push();
+        if (last)
+        {
+            break;
+        }
+    }
+
+    free(carry);
+}
+
+/**
+ * [Internal] Refill the reader's buffer from the background thread's ring.
+ *
+ * @param tr the trace reader
+ * @return the number of whole records now available in the buffer
+ */
+static size_t trace_refill_async(TraceReader *tr)
+{
+    TraceRingStruct *ring = tr->ring;
+
+    while (!tr->eof && !tr->error)
+    {
+        if (ring->held != NULL)
+        {
+            // The held slot has been read to the end.
+            if (ring->held->last)
+            {
+                tr->eof = true;
+                tr->error = ring->held->error;
+                break;
+            }
+            ring->slots.pop();
+            ring->held = NULL;
+        }
+
+        TraceSlot *slot;
+        unsigned int spins = 0;
+        while ((slot = ring->slots.front()) == NULL)
+        {
+            trace_backoff(&spins);
+        }
+
+        ring->held = slot;
+        tr->buf = slot->buf;
+        tr->buf_len = slot->len;
+        tr->buf_pos = 0;
+        if (slot->len > 0)
+        {
+            return slot->len / tr->rec_size;
+        }
+    }
+
+    tr->buf_pos = tr->buf_len;
+    return 0;
+}
+
+/**
+ * [Internal] Refill the reader's buffer with the next block of a raw packed
+ * trace read through io_uring.
+ *
+ * @param tr the trace reader
+ * @return the number of whole records now available in the buffer
+ */
+static size_t trace_refill_uring(TraceReader *tr)
+{
+    if (tr->eof || tr->error)
+    {
+        tr->buf_pos = tr->buf_len;
+        return 0;
+    }
+
+    const uint8_t *data;
+    ssize_t len = uring_reader_next(tr->uring, &data);
+    if (len <= 0)
+    {
+        // uring_reader_next() has already reported any error.
+        tr->eof = len == 0;
+        tr->error = len == -1;
+        tr->buf_pos = tr->buf_len;
+        return 0;
+    }
+
+    // Blocks are whole records, so a record never straddles two of them.
+    tr->buf = (uint8_t *)data;
+    tr->buf_len = (size_t)len;
+    tr->buf_pos = tr->uring_skip;
+    tr->uring_skip = 0;
+    return (tr->buf_len - tr->buf_pos) / tr->rec_size;
+}
+
+/**
+ * [Internal] Start reading a raw packed trace through io_uring, from the
+ * record trace_seek() moved to.
+ *
+ * @param tr the trace reader
+ * @param flags TRACE_OPEN_URING or TRACE_OPEN_DIRECT, or both
+ * @return 0 on success, or -1 on error (already reported)
+ */
+static int trace_start_uring(TraceReader *tr, int flags)
+{
+    // Blocks hold whole records and stay aligned for O_DIRECT.
+    size_t unit = URING_READER_ALIGN;
+    while (unit % tr->rec_size != 0)
+    {
+        unit += URING_READER_ALIGN;
+    }
+    size_t block_size = unit * (TRACE_BUF_SIZE / unit > 0 ? TRACE_BUF_SIZE / unit : 1);
+
+    // buf_pos is where trace_seek() left the first record to read.
+    uint64_t data_offset = tr->header->data_offset;
+    uint64_t first_block = tr->buf_pos / block_size;
+    tr->uring = uring_reader_open(tr->filename,
+                                  data_offset + first_block * block_size,
+                                  data_offset + tr->buf_len, block_size,
+                                  (flags & TRACE_OPEN_DIRECT) != 0);
+    if (tr->uring == NULL)
+    {
+        return -1;
+    }
+
+    tr->uring_skip = tr->buf_pos - first_block * block_size;
+    tr->buf = NULL;
+    tr->buf_len = 0;
+    tr->buf_pos = 0;
+    tr->eof = false;
+    return 0;
+}
+
+/**
+ * [Internal] Allocate one aligned buffer.
+ *
+ * @param size the size of the buffer in bytes
+ * @return the buffer; exits the program if memory is exhausted
+ */
+static uint8_t *trace_alloc_buf(size_t size)
+{
+    void *buf = NULL;
+    if (posix_memalign(&buf, TRACE_BUF_ALIGN, size) != 0)
+    {
+        fprintf(stderr, "Error: couldn't allocate trace buffer\n");
+        exit(1);
+    }
+    return (uint8_t *)buf;
+}
+
+/**
+ * [Internal] Get the number of records in a frame of a framed packed trace,
+ * according to its frame index.
+ *
+ * @param tr the trace reader
+ * @param frame the index of the frame
+ * @return the number of records in the frame
+ */
+static uint64_t trace_frame_recs(TraceReader *tr, uint64_t frame)
+{
+    uint64_t end = frame + 1 < tr->num_frames ? tr->frames[frame + 1].first_rec
+                                              : tr->header->num_recs;
+    return end - tr->frames[frame].first_rec;
+}
+
+/**
+ * [Internal] Claim frames of a framed packed trace one at a time and inflate
+ * each into its slot, until there are none left or the reader is closed.
+ *
+ * Several workers run this at once. Each waits for its frame's slot to be
+ * handed back by the reader before inflating into it, so no worker gets more
+ * than TRACE_FRAME_SLOTS frames ahead of the reader.
+ *
+ * @param tr the trace reader whose frames to inflate
+ */
+static void trace_frame_work(TraceReader *tr)
+{
+    TraceFramePoolStruct *pool = tr->pool;
+
+    while (true)
+    {
+        uint64_t frame = pool->claim.fetch_add(1, std::memory_order_relaxed);
+        if (frame >= tr->num_frames)
+        {
+            return;
+        }
+
+        TraceFrameSlot *slot = &pool->slots[frame % TRACE_FRAME_SLOTS];
+        unsigned int spins = 0;
+        while (slot->seq.load(std::memory_order_acquire) != 2 * frame)
+        {
+            if (pool->stop.load(std::memory_order_relaxed))
+            {
+                return;
+            }
+            trace_backoff(&spins);
+        }
+
+        // The index was checked when the trace was opened, so the frame
+        // starts inside the frames; its contents are checked here.
+        const uint8_t *start = tr->map + tr->frames[frame].offset;
+        size_t num_recs = 0;
+        size_t frame_size =
+            trace_frame_decode(start, tr->pack_end - start, tr->rec_size,
+                               slot->buf, TRACE_FRAME_MAX_SIZE, &num_recs);
+        slot->error = frame_size == 0 ||
+                      num_recs != trace_frame_recs(tr, frame);
+        slot->len = slot->error ? 0 : num_recs * tr->rec_size;
+        slot->seq.store(2 * frame + 1, std::memory_order_release);
+    }
+}
+
+/**
+ * [Internal] Refill the reader's buffer with the next frame inflated by the
+ * worker threads, handing the previous one back to them.
+ *
+ * @param tr the trace reader
+ * @return the number of whole records now available in the buffer
+ */
+static size_t trace_refill_frames(TraceReader *tr)
+{
+    TraceFramePoolStruct *pool = tr->pool;
+
+    if (pool->held)
+    {
+        uint64_t done = pool->read_frame - 1;
+        pool->slots[done % TRACE_FRAME_SLOTS].seq.store(
+            2 * (done + TRACE_FRAME_SLOTS), std::memory_order_release);
+        pool->held = false;
+    }
+    if (!tr->error && pool->read_frame == tr->num_frames)
+    {
+        tr->eof = true;
+    }
+    if (tr->eof || tr->error)
+    {
+        tr->buf_pos = tr->buf_len;
+        return 0;
+    }
+
+    uint64_t frame = pool->read_frame;
+    TraceFrameSlot *slot = &pool->slots[frame % TRACE_FRAME_SLOTS];
+    unsigned int spins = 0;
+    while (slot->seq.load(std::memory_order_acquire) != 2 * frame + 1)
+    {
+        trace_backoff(&spins);
+    }
+
+    if (slot->error)
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Error: %s: corrupt frame at byte %lu\n",
+                tr->filename, (unsigned long)tr->frames[frame].offset);
+        tr->error = true;
+        tr->buf_pos = tr->buf_len;
+        return 0;
+    }
+
+    pool->read_frame++;
+    pool->held = true;
+    tr->buf = slot->buf;
+    tr->buf_len = slot->len;
+    tr->buf_pos = 0;
+    return slot->len / tr->rec_size;
+}
+
+/**
+ * [Internal] Start the worker threads of a framed packed trace, beginning at
+ * the frame at pack_pos.
+ *
+ * @param tr the trace reader
+ */
+static void trace_start_frames(TraceReader *tr)
+{
+    TraceFramePoolStruct *pool = new TraceFramePoolStruct();
+    uint64_t first = tr->next_frame;
+    for (unsigned int i = 0; i < TRACE_FRAME_SLOTS; i++)
+    {
+        // Slot i first holds the first frame from first onward that maps
+        // to it.
+        uint64_t frame = first + (i + TRACE_FRAME_SLOTS - first % TRACE_FRAME_SLOTS) %
+                                     TRACE_FRAME_SLOTS;
+        pool->slots[i].buf = trace_alloc_buf(TRACE_FRAME_MAX_SIZE);
+        pool->slots[i].seq = 2 * frame;
+    }
+    pool->claim = first;
+    pool->stop = false;
+    pool->read_frame = first;
+    pool->held = false;
+    tr->pool = pool;
+
+    // Leave a core for the simulator itself.
+    unsigned int num_workers = std::thread::hardware_concurrency();
+    num_workers = num_workers > 1 ? num_workers - 1 : 1;
+    if (num_workers > TRACE_FRAME_MAX_WORKERS)
+    {
+        num_workers = TRACE_FRAME_MAX_WORKERS;
+    }
+    if (num_workers > tr->num_frames - first)
+    {
+        num_workers = (unsigned int)(tr->num_frames - first);
+    }
+    for (unsigned int i = 0; i < num_workers; i++)
+    {
+        pool->workers.push_back(std::thread(trace_frame_work, tr));
+    }
+}
+
+/**
+ * [Internal] Set up the buffers records are decompressed or decoded into,
+ * starting the background thread if asked to.
+ *
+ * @param tr the trace reader
+ * @param flags 0, or TRACE_OPEN_ASYNC
+ */
+static void trace_start(TraceReader *tr, int flags)
+{
+    if ((flags & TRACE_OPEN_ASYNC) && tr->frames != NULL)
+    {
+        trace_start_frames(tr);
+    }
+    else if (flags & TRACE_OPEN_ASYNC)
+    {
+        tr->ring = new TraceRingStruct();
+        for (unsigned int i = 0; i < TRACE_RING_SLOTS; i++)
+        {
+            tr->ring->slots.slot(i).buf = trace_alloc_buf(TRACE_BUF_SIZE);
+        }
+        tr->ring->stop = false;
+        tr->ring->held = NULL;
+        tr->ring->producer = std::thread(trace_produce, tr);
+    }
+    else
+    {
+        tr->buf = trace_alloc_buf(TRACE_BUF_SIZE);
+    }
+}
+
+/**
+ * [Internal] Check that the frame index of a framed packed trace lies within
+ * the file and describes frames in order, each holding at least one record.
+ *
+ * @param header the header of the mapped file
+ * @param map_len the size of the file in bytes
+ * @return whether the index is sound
+ */
+static bool trace_frame_index_ok(const TracePackHeader *header, size_t map_len)
+{
+    uint64_t index_offset = header->frame_index_offset;
+    if (index_offset < header->data_offset ||
+        index_offset % sizeof(uint64_t) != 0 || index_offset > map_len ||
+        header->num_frames > (map_len - index_offset) / sizeof(TraceFrameIndexEntry) ||
+        (header->num_frames == 0) != (header->num_recs == 0))
+    {
+        return false;
+    }
+
+    const TraceFrameIndexEntry *frames =
+        (const TraceFrameIndexEntry *)((const uint8_t *)header + index_offset);
+    for (uint64_t i = 0; i < header->num_frames; i++)
+    {
+        uint64_t prev_offset = i == 0 ? header->data_offset : frames[i - 1].offset;
+        if (frames[i].offset < prev_offset ||
+            frames[i].offset + TRACE_FRAME_HEADER > index_offset ||
+            (i == 0 ? frames[i].first_rec != 0
+                    : frames[i].first_rec <= frames[i - 1].first_rec) ||
+            frames[i].first_rec >= header->num_recs)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * [Internal] Map a packed trace file into memory and check its header.
+ *
+ * @param filename the path of the trace file
+ * @param fd an open file descriptor for the file; always closed
+ * @param rec_size the record size the caller expects
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+static TraceReader *trace_open_packed(const char *filename, int fd,
+                                      size_t rec_size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Couldn't stat trace file %s: ", filename);
+        perror(NULL);
+        close(fd);
+        return NULL;
+    }
+
+    size_t map_len = (size_t)st.st_size;
+    if (map_len < sizeof(TracePackHeader))
+    {
+        fprintf(stderr, "Error: %s: truncated packed trace header\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Couldn't map trace file %s: ", filename);
+        perror(NULL);
+        return NULL;
+    }
+
+    const TracePackHeader *header = (const TracePackHeader *)map;
+    const char *problem = NULL;
+    if (header->version != TRACE_PACK_VERSION)
+    {
+        problem = "unsupported packed trace version";
+    }
+    else if (header->rec_size != rec_size)
+    {
+        problem = "packed trace holds records of the wrong size for this "
+                  "simulator (is it an .otr trace used with a .ptr simulator, "
+                  "or vice versa?)";
+    }
+    else if (header->encoding != TRACE_ENC_RAW &&
+             header->encoding != TRACE_ENC_COMPACT &&
+             header->encoding != TRACE_ENC_DICT &&
+             header->encoding != TRACE_ENC_FRAMES)
+    {
+        problem = "unsupported packed trace encoding";
+    }
+    else if ((header->encoding == TRACE_ENC_COMPACT ||
+              header->encoding == TRACE_ENC_DICT) &&
+             (header->layout != TRACE_LAYOUT_PTR || rec_size != sizeof(PtrRec)))
+    {
+        problem = "compact and dictionary encodings are only supported for "
+                  ".ptr traces";
+    }
+    else if (header->data_offset < sizeof(TracePackHeader) ||
+             header->data_offset % TRACE_BUF_ALIGN != 0 ||
+             header->data_offset > map_len ||
+             (header->encoding == TRACE_ENC_RAW &&
+              header->num_recs > (map_len - header->data_offset) / rec_size))
+    {
+        problem = "truncated or corrupt packed trace";
+    }
+    else if (header->encoding == TRACE_ENC_DICT &&
+             (header->dict_offset < header->data_offset ||
+              header->dict_offset % sizeof(uint64_t) != 0 ||
+              header->dict_offset > map_len ||
+              header->dict_entries > (map_len - header->dict_offset) / sizeof(PtrRec)))
+    {
+        problem = "truncated or corrupt static instruction table";
+    }
+    else if (header->encoding == TRACE_ENC_FRAMES &&
+             !trace_frame_index_ok(header, map_len))
+    {
+        problem = "truncated or corrupt frame index";
+    }
+
+    if (problem != NULL)
+    {
+        fprintf(stderr, "Error: %s: %s\n", filename, problem);
+        munmap(map, map_len);
+        return NULL;
+    }
+
+    // The records are read front to back exactly once.
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    TraceReader *tr = (TraceReader *)calloc(1, sizeof(TraceReader));
+    tr->filename = filename;
+    tr->rec_size = rec_size;
+    tr->map = (uint8_t *)map;
+    tr->map_len = map_len;
+    tr->header = header;
+    tr->total_recs = header->num_recs;
+
+    if (header->encoding == TRACE_ENC_COMPACT)
+    {
+        tr->pack_pos = tr->map + header->data_offset;
+        tr->pack_end = tr->map + map_len;
+        tr->pack_recs_left = header->num_recs;
+        return tr;
+    }
+    if (header->encoding == TRACE_ENC_DICT)
+    {
+        // The table is small and used throughout, so it stays in cache while
+        // the dynamic stream streams past it.
+        tr->pack_pos = tr->map + header->data_offset;
+        tr->pack_end = tr->map + header->dict_offset;
+        tr->pack_recs_left = header->num_recs;
+        tr->dict = (const PtrRec *)(tr->map + header->dict_offset);
+        tr->dict_entries = header->dict_entries;
+        return tr;
+    }
+    if (header->encoding == TRACE_ENC_FRAMES)
+    {
+        tr->pack_pos = tr->map + header->data_offset;
+        tr->pack_end = tr->map + header->frame_index_offset;
+        tr->pack_recs_left = header->num_recs;
+        tr->frames = (const TraceFrameIndexEntry *)(tr->map +
+                                                    header->frame_index_offset);
+        tr->num_frames = header->num_frames;
+        return tr;
+    }
+
+    tr->buf = tr->map + header->data_offset;
+    tr->buf_len = header->num_recs * rec_size;
+    tr->eof = true;
+    return tr;
+}
+
+/**
+ * [Internal] Open a gzip-compressed trace, using its index (if it has one)
+ * to learn how many records it holds.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param gzi set to the trace's index, or NULL if it has none
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+static TraceReader *trace_open_gzip(const char *filename, size_t rec_size,
+                                    GzIndex **gzi)
+{
+    GzStream *gz = gzs_open(filename);
+    if (gz == NULL)
+    {
+        return NULL;
+    }
+
+    TraceReader *tr = (TraceReader *)calloc(1, sizeof(TraceReader));
+    tr->gz = gz;
+    tr->filename = filename;
+    tr->rec_size = rec_size;
+
+    *gzi = gzi_load(filename);
+    if (*gzi != NULL)
+    {
+        tr->total_recs = (*gzi)->header.total_out / rec_size;
+    }
+    return tr;
+}
+
+/**
+ * [Internal] Open the shared decoded copy of a trace, creating it if no
+ * other process has.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param error set to whether the trace couldn't be read; already reported
+ * @return a pointer to a newly allocated TraceReader over the copy, or NULL
+ *         if there is none
+ */
+static TraceReader *trace_open_cached(const char *filename, size_t rec_size,
+                                      bool *error)
+{
+    TraceCache *cache = trace_cache_open(filename, rec_size, error);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    // The copy is a raw packed trace. Its descriptor stays with the cache,
+    // which holds the lock marking this process as a user.
+    TraceReader *tr = trace_open_packed(filename, dup(cache->fd), rec_size);
+    if (tr == NULL)
+    {
+        trace_cache_close(cache);
+        *error = true;
+        return NULL;
+    }
+    tr->cache = cache;
+    return tr;
+}
+
+/**
+ * [Internal] Move a trace that hasn't been read yet as close to a record as
+ * can be done without reading the records before it.
+ *
+ * Raw packed traces move straight to the record. Framed packed traces look
+ * up the frame holding it in their frame index. Compact and dictionary
+ * packed traces skip whole blocks. Gzip traces move to the nearest
+ * checkpoint of their index, if they have one, and inflate and discard the
+ * rest of the way.
+ *
+ * @param tr the trace reader
+ * @param gzi the index of a gzip trace, or NULL
+ * @param first_rec the index of the record to move to
+ * @return the number of records still to be read and discarded, or
+ *         (uint64_t)-1 on error (already reported)
+ */
+static uint64_t trace_seek(TraceReader *tr, GzIndex *gzi, uint64_t first_rec)
+{
+    if (tr->map != NULL && tr->pack_end == NULL)
+    {
+        tr->buf_pos = first_rec * tr->rec_size;
+        return 0;
+    }
+
+    if (tr->frames != NULL)
+    {
+        // Find the last frame starting at or before the record.
+        uint64_t lo = 0;
+        uint64_t hi = tr->num_frames;
+        while (hi - lo > 1)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (tr->frames[mid].first_rec <= first_rec)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        tr->next_frame = lo;
+        tr->pack_pos = tr->map + tr->frames[lo].offset;
+        tr->pack_recs_left = tr->header->num_recs - tr->frames[lo].first_rec;
+        return first_rec - tr->frames[lo].first_rec;
+    }
+
+    if (tr->map != NULL)
+    {
+        while (tr->pack_end - tr->pack_pos >= TRACE_COMPACT_BLOCK_HEADER)
+        {
+            uint32_t block_header[2];
+            memcpy(block_header, tr->pack_pos, sizeof(block_header));
+            if (block_header[0] > first_rec ||
+                block_header[0] > tr->pack_recs_left ||
+                block_header[1] > (size_t)(tr->pack_end - tr->pack_pos) ||
+                block_header[1] < TRACE_COMPACT_BLOCK_HEADER)
+            {
+                // Decode the rest; a corrupt block is reported then.
+                break;
+            }
+            first_rec -= block_header[0];
+            tr->pack_recs_left -= block_header[0];
+            tr->pack_pos += block_header[1];
+        }
+        return first_rec;
+    }
+
+    uint64_t target = first_rec * tr->rec_size;
+    uint64_t pos = 0;
+    if (gzi != NULL)
+    {
+        pos = gzi_seek(gzi, tr->gz, target);
+        if (pos == (uint64_t)-1)
+        {
+            return (uint64_t)-1;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Note: %s has no index; inflating %lu records to "
+                        "skip them (build one with tools/traceindex)\n",
+                tr->filename, (unsigned long)first_rec);
+    }
+
+    // Records don't line up with checkpoints, so inflate up to the exact
+    // record before handing the stream over.
+    uint8_t *scratch = trace_alloc_buf(TRACE_BUF_SIZE);
+    while (pos < target)
+    {
+        uint64_t want = target - pos;
+        if (want > TRACE_BUF_SIZE)
+        {
+            want = TRACE_BUF_SIZE;
+        }
+        ssize_t bytes_read = gzs_read(tr->gz, scratch, (size_t)want);
+        if (bytes_read <= 0)
+        {
+            break;
+        }
+        pos += bytes_read;
+    }
+    free(scratch);
+
+    if (tr->gz->error)
+    {
+        return (uint64_t)-1;
+    }
+    // Any shortfall is reported by the caller.
+    return (target - pos) / tr->rec_size + ((target - pos) % tr->rec_size != 0);
+}
+
+/**
+ * Open a trace file of fixed-size records.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param flags 0, or any of TRACE_OPEN_ASYNC, TRACE_OPEN_URING,
+ *              TRACE_OPEN_DIRECT and TRACE_OPEN_SHARED
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+TraceReader *trace_open(const char *filename, size_t rec_size, int flags)
+{
+    return trace_open_range(filename, rec_size, flags, 0, 0);
+}
+
+/**
+ * Open a trace file of fixed-size records, to read only some of them.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param flags as for trace_open()
+ * @param first_rec the index of the first record to read
+ * @param max_recs the largest number of records to read, or 0 for all of
+ *                 them up to the end of the trace
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+TraceReader *trace_open_range(const char *filename, size_t rec_size,
+                              int flags, uint64_t first_rec, uint64_t max_recs)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Couldn't open trace file %s: ", filename);
+        perror(NULL);
+        return NULL;
+    }
+
+    // Packed traces are recognized by their magic number; anything else is
+    // handed to the gzip decoder, which rejects what it can't decode.
+    TraceReader *tr = NULL;
+    GzIndex *gzi = NULL;
+    TracePackHeader header;
+    bool is_packed =
+        pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        memcmp(header.magic, TRACE_PACK_MAGIC, sizeof(header.magic)) == 0;
+
+    // Raw packed traces are shared through the page cache already.
+    if ((flags & TRACE_OPEN_SHARED) &&
+        !(is_packed && header.encoding == TRACE_ENC_RAW))
+    {
+        bool error;
+        tr = trace_open_cached(filename, rec_size, &error);
+        if (tr == NULL && error)
+        {
+            close(fd);
+            return NULL;
+        }
+    }
+
+    if (tr != NULL)
+    {
+        close(fd);
+    }
+    else if (is_packed)
+    {
+        tr = trace_open_packed(filename, fd, rec_size);
+    }
+    else
+    {
+        close(fd);
+        tr = trace_open_gzip(filename, rec_size, &gzi);
+    }
+    if (tr == NULL)
+    {
+        return NULL;
+    }
+    tr->end_rec = (uint64_t)-1;
+
+    // Don't bother reading through a trace known to be too short.
+    bool too_short = tr->total_recs > 0 && first_rec >= tr->total_recs;
+    uint64_t skip_left = 0;
+    if (first_rec > 0 && !too_short)
+    {
+        skip_left = trace_seek(tr, gzi, first_rec);
+    }
+    gzi_free(gzi);
+    if (skip_left == (uint64_t)-1)
+    {
+        trace_close(tr);
+        return NULL;
+    }
+
+    // Raw packed records are used in place and need no buffers, unless they
+    // are to be read rather than mapped.
+    bool is_raw = tr->map != NULL && tr->pack_end == NULL;
+    if (!too_short && is_raw && tr->cache == NULL &&
+        (flags & (TRACE_OPEN_URING | TRACE_OPEN_DIRECT)))
+    {
+        if (trace_start_uring(tr, flags) != 0)
+        {
+            trace_close(tr);
+            return NULL;
+        }
+    }
+    else if (!too_short && !is_raw)
+    {
+        trace_start(tr, flags);
+    }
+
+    while (skip_left > 0 && !tr->error)
+    {
+        TraceBlock block = trace_next_block(tr, skip_left);
+        if (block.count == 0)
+        {
+            too_short = !tr->error;
+            break;
+        }
+        skip_left -= block.count;
+    }
+
+    // A gzip trace of unknown length may end exactly at the record; make
+    // sure there is one to start at, without consuming it.
+    if (first_rec > 0 && !too_short && !tr->error && tr->total_recs == 0 &&
+        tr->buf_len - tr->buf_pos < tr->rec_size && trace_refill(tr) == 0)
+    {
+        too_short = !tr->error;
+    }
+    if (too_short)
+    {
+        fprintf(stderr, "Error: %s: can't start at record %lu; the trace is "
+                        "shorter than that\n",
+                filename, (unsigned long)first_rec);
+    }
+    if (too_short || tr->error)
+    {
+        trace_close(tr);
+        return NULL;
+    }
+
+    tr->num_recs = 0;
+    if (tr->total_recs > 0)
+    {
+        tr->total_recs -= first_rec;
+    }
+    if (max_recs > 0)
+    {
+        tr->end_rec = max_recs;
+        if (tr->total_recs == 0 || tr->total_recs > max_recs)
+        {
+            tr->total_recs = max_recs;
+        }
+    }
+    return tr;
+}
+
+/**
+ * [Internal] Refill the reader's buffer, keeping any record that straddles
+ * the end of the previous buffer.
+ *
+ * The partial record is moved to the start of the buffer and the rest of the
+ * buffer is filled behind it, so every record handed out is contiguous and
+ * aligned as well as the record size allows.
+ *
+ * @param tr the trace reader
+ * @return the number of whole records now available in the buffer
+ */
+size_t trace_refill(TraceReader *tr)
+{
+    if (tr->ring != NULL)
+    {
+        return trace_refill_async(tr);
+    }
+    if (tr->pool != NULL)
+    {
+        return trace_refill_frames(tr);
+    }
+    if (tr->uring != NULL)
+    {
+        return trace_refill_uring(tr);
+    }
+
+    size_t leftover = tr->buf_len - tr->buf_pos;
+
+    if (tr->eof || tr->error)
+    {
+        if (leftover > 0 && !tr->error)
+        {
+            // The last record was cut short.
+            fprintf(stderr, "\n");
+            fprintf(stderr, "Error: Invalid trace file: %s ends with a "
+                            "partial record\n",
+                    tr->filename);
+            tr->error = true;
+        }
+        tr->buf_pos = tr->buf_len;
+        return 0;
+    }
+
+    memmove(tr->buf, tr->buf + tr->buf_pos, leftover);
+    tr->buf_pos = 0;
+    tr->buf_len = leftover;
+
+    size_t want = TRACE_BUF_SIZE - leftover;
+    ssize_t bytes_read = trace_source_read(tr, tr->buf + leftover, want);
+    if (bytes_read == -1)
+    {
+        // trace_source_read() has already reported the error.
+        tr->error = true;
+        tr->buf_len = 0;
+        return 0;
+    }
+
+    tr->buf_len += bytes_read;
+    if (bytes_read == 0)
+    {
+        tr->eof = true;
+    }
+
+    size_t num_recs = tr->buf_len / tr->rec_size;
+    if (num_recs == 0)
+    {
+        // Read on until a whole record arrives, or report a trailing
+        // partial record at the end of the trace.
+        return trace_refill(tr);
+    }
+    return num_recs;
+}
+
+/**
+ * Get the next block of up to max_recs records without copying them.
+ *
+ * @param tr the trace reader
+ * @param max_recs the largest number of records to return
+ * @return a view of the records; its count is 0 at the end of the trace or
+ *         on error (check tr->error to tell the two apart)
+ */
+TraceBlock trace_next_block(TraceReader *tr, size_t max_recs)
+{
+    TraceBlock block = {NULL, 0};
+    if (tr->end_rec - tr->num_recs < max_recs)
+    {
+        max_recs = (size_t)(tr->end_rec - tr->num_recs);
+        if (max_recs == 0)
+        {
+            return block;
+        }
+    }
+
+    size_t avail = (tr->buf_len - tr->buf_pos) / tr->rec_size;
+    if (avail == 0)
+    {
+        avail = trace_refill(tr);
+        if (avail == 0)
+        {
+            return block;
+        }
+    }
+
+    block.recs = tr->buf + tr->buf_pos;
+    block.count = avail < max_recs ? avail : max_recs;
+    tr->buf_pos += block.count * tr->rec_size;
+    tr->num_recs += block.count;
+    return block;
+}
+
+/**
+ * Close the trace file and free all memory associated with the reader.
+ *
+ * @param tr the trace reader to close (may be NULL)
+ */
+void trace_close(TraceReader *tr)
+{
+    if (tr == NULL)
+    {
+        return;
+    }
+
+    if (tr->ring != NULL)
+    {
+        tr->ring->stop = true;
+        tr->ring->producer.join();
+        for (unsigned int i = 0; i < TRACE_RING_SLOTS; i++)
+        {
+            free(tr->ring->slots.slot(i).buf);
+        }
+        delete tr->ring;
+    }
+    else if (tr->pool != NULL)
+    {
+        tr->pool->stop = true;
+        for (size_t i = 0; i < tr->pool->workers.size(); i++)
+        {
+            tr->pool->workers[i].join();
+        }
+        for (unsigned int i = 0; i < TRACE_FRAME_SLOTS; i++)
+        {
+            free(tr->pool->slots[i].buf);
+        }
+        delete tr->pool;
+    }
+    else if (tr->uring != NULL)
+    {
+        uring_reader_close(tr->uring);
+    }
+    else if (tr->map == NULL || tr->pack_end != NULL)
+    {
+        free(tr->buf);
+    }
+
+    if (tr->map != NULL)
+    {
+        munmap(tr->map, tr->map_len);
+    }
+    trace_cache_close(tr->cache);
+    gzs_close(tr->gz);
+    free(tr);
+}
@@ -0,0 +1,306 @@
+// tracereader.h
+// Declares the block trace reader shared by all three simulators. The reader
+// decompresses a trace file into large aligned buffers, or maps a packed trace
+// file straight into memory, and hands out views of the fixed-size records in
+// them, so callers can iterate over records in place instead of issuing one
+// read per record. Encoded packed traces are decoded into the same buffers.
+
+#ifndef _TRACEREADER_H_
+#define _TRACEREADER_H_
+
+#include "gzstream.h"
+#include "tracefmt.h"
+#include "tracecache.h"
+#include "traceframe.h"
+#include "uringreader.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The size in bytes of the buffer a TraceReader decompresses into. */
+#define TRACE_BUF_SIZE (1024 * 1024)
+
+/** The alignment of the buffer a TraceReader decompresses into. */
+#define TRACE_BUF_ALIGN 4096
+
+/**
+ * The number of TRACE_BUF_SIZE buffers a background decompression thread may
+ * fill ahead of the simulator before it has to wait. Must be a power of two.
+ */
+#define TRACE_RING_SLOTS 8
+
+/**
+ * The number of frames of a framed packed trace that worker threads may
+ * inflate ahead of the simulator before they have to wait.
+ */
+#define TRACE_FRAME_SLOTS 16
+
+/** The largest number of worker threads inflating a framed packed trace. */
+#define TRACE_FRAME_MAX_WORKERS 4
+
+/**
+ * Flag for trace_open(): decompress the trace on a background thread, which
+ * hands whole buffers of records to the reader through a lock-free ring.
+ */
+#define TRACE_OPEN_ASYNC 0x1
+
+/**
+ * Flag for trace_open(): read a raw packed trace in large blocks queued ahead
+ * with io_uring (see uringreader.h) instead of mapping it into memory, so the
+ * simulator isn't stalled on page faults while the disk catches up.
+ */
+#define TRACE_OPEN_URING 0x2
+
+/**
+ * Flag for trace_open(): like TRACE_OPEN_URING, and also bypass the page
+ * cache with O_DIRECT.
+ */
+#define TRACE_OPEN_DIRECT 0x4
+
+/**
+ * Flag for trace_open(): share one decoded copy of a compressed or encoded
+ * trace with other processes reading the same trace (see tracecache.h),
+ * instead of decoding it privately.
+ */
+#define TRACE_OPEN_SHARED 0x8
+
+/** [Internal] State shared with a background decompression thread. */
+struct TraceRingStruct;
+
+/** [Internal] State shared with the worker threads of a framed trace. */
+struct TraceFramePoolStruct;
+
+/**
+ * A trace file opened for reading fixed-size records.
+ *
+ * The record size is given when the trace is opened, so the same reader
+ * serves the 16-byte Lab 1 records and the larger Lab 2/3 records alike.
+ */
+typedef struct TraceReaderStruct
+{
+    /** [Internal] The decompressed stream the records are read from. */
+    GzStream *gz;
+    /** [Internal] If not NULL, gz is read by a background thread instead. */
+    struct TraceRingStruct *ring;
+    /** [Internal] If not NULL, frames are inflated by worker threads. */
+    struct TraceFramePoolStruct *pool;
+    /** [Internal] If not NULL, raw packed records are read through this. */
+    UringReader *uring;
+    /** [Internal] The bytes to skip at the start of uring's first block. */
+    size_t uring_skip;
+    /** [Internal] If not NULL, map is a shared decoded copy of the trace. */
+    TraceCache *cache;
+    /** [Internal] If not NULL, the packed trace file mapped into memory. */
+    uint8_t *map;
+    /** [Internal] The length in bytes of map. */
+    size_t map_len;
+    /** [Internal] For an encoded packed trace, the next block to decode. */
+    const uint8_t *pack_pos;
+    /** [Internal] For an encoded packed trace, the end of the last block. */
+    const uint8_t *pack_end;
+    /** [Internal] For an encoded packed trace, the records not yet decoded. */
+    uint64_t pack_recs_left;
+    /** [Internal] For a dictionary packed trace, its static instructions. */
+    const PtrRec *dict;
+    /** [Internal] The number of entries in dict. */
+    size_t dict_entries;
+    /** [Internal] For a framed packed trace, its frame index. */
+    const TraceFrameIndexEntry *frames;
+    /** [Internal] The number of entries in frames. */
+    uint64_t num_frames;
+    /** [Internal] For a framed packed trace, the frame at pack_pos. */
+    uint64_t next_frame;
+    /** [Internal] The name of the trace file, for error messages. */
+    const char *filename;
+    /** [Internal] The size in bytes of a single record. */
+    size_t rec_size;
+    /** [Internal] The aligned buffer holding decompressed records. */
+    uint8_t *buf;
+    /** [Internal] The number of valid bytes in buf. */
+    size_t buf_len;
+    /** [Internal] The offset in buf of the next record to hand out. */
+    size_t buf_pos;
+    /** Whether the end of the trace has been reached. */
+    bool eof;
+    /** Whether the trace could not be read; already reported on stderr. */
+    bool error;
+    /** The number of records handed out so far. */
+    uint64_t num_recs;
+    /**
+     * The total number of records that will be handed out, or 0 if not known
+     * up front.
+     */
+    uint64_t total_recs;
+    /** [Internal] The value of num_recs at which to stop handing out records. */
+    uint64_t end_rec;
+    /** The header of a packed trace file, or NULL for a gzip trace. */
+    const TracePackHeader *header;
+} TraceReader;
+
+/**
+ * A view of consecutive records inside a TraceReader's buffer.
+ *
+ * The records are not copied; the view stays valid only until the next call
+ * that reads from the same TraceReader.
+ */
+typedef struct TraceBlockStruct
+{
+    /** The first record in the block. */
+    const void *recs;
+    /** The number of records in the block; 0 at the end of the trace. */
+    size_t count;
+} TraceBlock;
+
+/**
+ * A typed view of consecutive records, usable in a range-based for loop.
+ *
+ * Like TraceBlock, this points into the reader's buffer and stays valid only
+ * until the next call that reads from the same TraceReader.
+ */
+template <typename T>
+struct TraceSpan
+{
+    /** The first record in the span. */
+    const T *data;
+    /** The number of records in the span. */
+    size_t count;
+
+    const T *begin() const { return data; }
+    const T *end() const { return data + count; }
+    size_t size() const { return count; }
+    const T &operator[](size_t i) const { return data[i]; }
+};
+
+/**
+ * Open a trace file of fixed-size records.
+ *
+ * The file may be gzip-compressed or a packed trace file (see tracefmt.h);
+ * the two are told apart by their first bytes. A packed trace is mapped into
+ * memory, with total_recs and header filled in from the file's header; a
+ * gzip trace with an index (see gzindex.h) also has total_recs filled in. Raw
+ * packed records are handed out in place; compact, dictionary and framed
+ * ones (see tracecompact.h, tracedict.h and traceframe.h) are decoded a block
+ * at a time, like a gzip trace is decompressed.
+ *
+ * With TRACE_OPEN_ASYNC, decompression or decoding runs on a background
+ * thread that stays up to TRACE_RING_SLOTS buffers ahead of the caller. The
+ * frames of a framed trace are instead inflated by a pool of up to
+ * TRACE_FRAME_MAX_WORKERS threads, several at once, up to TRACE_FRAME_SLOTS
+ * frames ahead, and handed out in order. The reading functions below behave
+ * identically either way and are never blocked by a lock; they only wait
+ * when the background threads have fallen behind. The flag has no effect on
+ * raw packed traces, which need no decoding.
+ *
+ * With TRACE_OPEN_URING or TRACE_OPEN_DIRECT, a raw packed trace is read
+ * into buffers with io_uring instead of being mapped. The flags have no
+ * effect on other traces.
+ *
+ * With TRACE_OPEN_SHARED, any other trace is decoded in full into shared
+ * memory by the first process to open it, and then read by every process in
+ * place, as if it were a raw packed trace; header describes that copy. If
+ * shared memory is unavailable, the trace is read as without the flag.
+ *
+ * Prints an error message and returns NULL if the file cannot be opened.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param flags 0, or any of TRACE_OPEN_ASYNC, TRACE_OPEN_URING,
+ *              TRACE_OPEN_DIRECT and TRACE_OPEN_SHARED
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+TraceReader *trace_open(const char *filename, size_t rec_size, int flags);
+
+/**
+ * Open a trace file of fixed-size records, to read only some of them.
+ *
+ * Reading starts at record first_rec (counting from 0) and stops after
+ * max_recs records, as if the trace held only those; num_recs and total_recs
+ * count records within the range. Getting to first_rec is quick for packed
+ * traces, and for gzip traces with an index built by tools/traceindex (see
+ * gzindex.h). Other gzip traces are inflated up to first_rec.
+ *
+ * Prints an error message and returns NULL if the file cannot be opened or
+ * holds no more than first_rec records.
+ *
+ * @param filename the path of the trace file
+ * @param rec_size the size in bytes of one trace record
+ * @param flags as for trace_open()
+ * @param first_rec the index of the first record to read
+ * @param max_recs the largest number of records to read, or 0 for all of
+ *                 them up to the end of the trace
+ * @return a pointer to a newly allocated TraceReader, or NULL on error
+ */
+TraceReader *trace_open_range(const char *filename, size_t rec_size,
+                              int flags, uint64_t first_rec, uint64_t max_recs);
+
+/**
+ * [Internal] Refill the reader's buffer, keeping any record that straddles
+ * the end of the previous buffer.
+ *
+ * Use trace_next_block() or trace_next_rec() instead.
+ *
+ * @param tr the trace reader
+ * @return the number of whole records now available in the buffer
+ */
+size_t trace_refill(TraceReader *tr);
+
+/**
+ * Get the next block of up to max_recs records without copying them.
+ *
+ * @param tr the trace reader
+ * @param max_recs the largest number of records to return
+ * @return a view of the records; its count is 0 at the end of the trace or
+ *         on error (check tr->error to tell the two apart)
+ */
+TraceBlock trace_next_block(TraceReader *tr, size_t max_recs);
+
+/**
+ * Get the next record without copying it.
+ *
+ * @param tr the trace reader
+ * @return a pointer to the record, valid until the next read from tr, or
+ *         NULL at the end of the trace or on error
+ */
+static inline const void *trace_next_rec(TraceReader *tr)
+{
+    if (tr->num_recs == tr->end_rec)
+    {
+        return NULL;
+    }
+    if (tr->buf_len - tr->buf_pos < tr->rec_size && trace_refill(tr) == 0)
+    {
+        return NULL;
+    }
+
+    const void *rec = tr->buf + tr->buf_pos;
+    tr->buf_pos += tr->rec_size;
+    tr->num_recs++;
+    return rec;
+}
+
+/**
+ * Get the next block of up to max_recs records of type T without copying
+ * them.
+ *
+ * @param tr the trace reader, opened with a rec_size of sizeof(T)
+ * @param max_recs the largest number of records to return
+ * @return a typed view of the records; empty at the end of the trace or on
+ *         error
+ */
+template <typename T>
+static inline TraceSpan<T> trace_next_span(TraceReader *tr,
+                                           size_t max_recs = (size_t)-1)
+{
+    TraceBlock block = trace_next_block(tr, max_recs);
+    TraceSpan<T> span = {(const T *)block.recs, block.count};
+    return span;
+}
+
+/**
+ * Close the trace file and free all memory associated with the reader,
+ * stopping its background threads if it has any.
+ *
+ * @param tr the trace reader to close (may be NULL)
+ */
+void trace_close(TraceReader *tr);
+
+#endif
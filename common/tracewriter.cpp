@@ -0,0 +1,345 @@
+// tracewriter.cpp
+// Implements a writer for packed trace files.
+
+#include "tracewriter.h"
+#include "tracecompact.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * [Internal] Write len bytes at the given file offset, retrying short writes.
+ *
+ * @param tw the trace writer, marked as failed on error
+ * @param data the bytes to write
+ * @param len the number of bytes to write
+ * @param offset the file offset to write at
+ * @return 0 on success, or -1 on error
+ */
+static int trace_writer_pwrite(TraceWriter *tw, const void *data, size_t len,
+                               uint64_t offset)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (len > 0)
+    {
+        ssize_t written = pwrite(tw->fd, p, len, (off_t)offset);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            fprintf(stderr, "Couldn't write %s: ", tw->tmp_filename);
+            perror(NULL);
+            tw->error = true;
+            return -1;
+        }
+        p += written;
+        len -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+/**
+ * [Internal] Compress all buffered records into one frame and add it to the
+ * frame index.
+ *
+ * @param tw the trace writer
+ * @return the size of the frame in bytes, or 0 on error
+ */
+static size_t trace_writer_frame(TraceWriter *tw)
+{
+    size_t count = tw->buf_len / tw->header.rec_size;
+    size_t len = trace_frame_encode(tw->buf, count, tw->header.rec_size,
+                                    tw->block);
+    if (len == 0)
+    {
+        fprintf(stderr, "Error: couldn't compress frame %lu\n",
+                (unsigned long)tw->header.num_frames);
+        tw->error = true;
+        return 0;
+    }
+
+    if (tw->header.num_frames == tw->max_frames)
+    {
+        tw->max_frames = tw->max_frames == 0 ? 1024 : tw->max_frames * 2;
+        tw->frames = (TraceFrameIndexEntry *)realloc(
+            tw->frames, tw->max_frames * sizeof(TraceFrameIndexEntry));
+    }
+    TraceFrameIndexEntry *entry = &tw->frames[tw->header.num_frames++];
+    entry->offset = tw->header.data_offset + tw->data_len;
+    entry->first_rec = tw->header.num_recs - count;
+    return len;
+}
+
+/**
+ * [Internal] Write out all buffered records, encoding them first if the file
+ * is compact, a dictionary file or a framed file.
+ *
+ * @param tw the trace writer
+ * @return 0 on success, or -1 on error
+ */
+static int trace_writer_flush(TraceWriter *tw)
+{
+    const uint8_t *data = tw->buf;
+    size_t len = tw->buf_len;
+    if (tw->header.encoding == TRACE_ENC_FRAMES && len > 0)
+    {
+        len = trace_writer_frame(tw);
+        if (len == 0)
+        {
+            return -1;
+        }
+        data = tw->block;
+    }
+    else if (tw->header.encoding != TRACE_ENC_RAW && len > 0)
+    {
+        size_t count = len / sizeof(PtrRec);
+        size_t bad_rec = 0;
+        const PtrRec *recs = (const PtrRec *)tw->buf;
+        len = tw->dict != NULL
+                  ? trace_dict_encode(tw->dict, recs, count, tw->block, &bad_rec)
+                  : trace_compact_encode(recs, count, tw->block, &bad_rec);
+        if (len == 0)
+        {
+            fprintf(stderr, "Error: record %lu can't be stored in the %s "
+                            "encoding\n",
+                    (unsigned long)(tw->header.num_recs - count + bad_rec),
+                    tw->dict != NULL ? "dictionary" : "compact");
+            tw->error = true;
+            return -1;
+        }
+        data = tw->block;
+    }
+
+    uint64_t offset = tw->header.data_offset + tw->data_len;
+    if (trace_writer_pwrite(tw, data, len, offset) != 0)
+    {
+        return -1;
+    }
+    tw->data_len += len;
+    tw->buf_len = 0;
+    return 0;
+}
+
+/**
+ * Create a packed trace file.
+ *
+ * @param filename the path of the file to create
+ * @param layout the record layout the file will hold
+ * @param encoding how to store the records
+ * @return a pointer to a newly allocated TraceWriter, or NULL on error
+ */
+TraceWriter *trace_writer_open(const char *filename, TraceLayout layout,
+                               TraceEncoding encoding)
+{
+    size_t rec_size = trace_layout_rec_size(layout);
+    if (rec_size == 0)
+    {
+        fprintf(stderr, "Error: unknown trace layout %d\n", (int)layout);
+        return NULL;
+    }
+    if ((encoding == TRACE_ENC_COMPACT || encoding == TRACE_ENC_DICT) &&
+        layout != TRACE_LAYOUT_PTR)
+    {
+        fprintf(stderr, "Error: the compact and dictionary encodings are only "
+                        "supported for .ptr traces\n");
+        return NULL;
+    }
+
+    size_t name_len = strlen(filename);
+    char *tmp_filename = (char *)malloc(name_len + 5);
+    snprintf(tmp_filename, name_len + 5, "%s.tmp", filename);
+
+    int fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        fprintf(stderr, "Couldn't create %s: ", tmp_filename);
+        perror(NULL);
+        free(tmp_filename);
+        return NULL;
+    }
+
+    TraceWriter *tw = (TraceWriter *)calloc(1, sizeof(TraceWriter));
+    tw->fd = fd;
+    tw->filename = strdup(filename);
+    tw->tmp_filename = tmp_filename;
+    tw->buf = (uint8_t *)malloc(TRACE_WRITER_BUF_SIZE);
+    if (encoding == TRACE_ENC_COMPACT)
+    {
+        tw->block = (uint8_t *)malloc(TRACE_COMPACT_MAX_BLOCK_SIZE);
+    }
+    else if (encoding == TRACE_ENC_DICT)
+    {
+        tw->block = (uint8_t *)malloc(TRACE_DICT_MAX_BLOCK_SIZE);
+        tw->dict = trace_dict_new();
+    }
+    else if (encoding == TRACE_ENC_FRAMES)
+    {
+        tw->block = (uint8_t *)malloc(trace_frame_max_encoded_size());
+    }
+
+    memcpy(tw->header.magic, TRACE_PACK_MAGIC, sizeof(tw->header.magic));
+    tw->header.version = TRACE_PACK_VERSION;
+    tw->header.layout = layout;
+    tw->header.rec_size = (uint32_t)rec_size;
+    tw->header.encoding = encoding;
+    tw->header.data_offset = TRACE_PACK_DATA_OFFSET;
+
+    return tw;
+}
+
+/**
+ * Append records to a packed trace file.
+ *
+ * @param tw the trace writer
+ * @param recs the records to append, in the writer's layout
+ * @param count the number of records to append
+ * @return 0 on success, or -1 on error
+ */
+int trace_writer_write(TraceWriter *tw, const void *recs, size_t count)
+{
+    if (tw->error)
+    {
+        return -1;
+    }
+
+    const uint8_t *rec = (const uint8_t *)recs;
+    size_t rec_size = tw->header.rec_size;
+    // Encoded files are encoded one block of records at a time.
+    size_t buf_size = TRACE_WRITER_BUF_SIZE;
+    if (tw->header.encoding == TRACE_ENC_COMPACT)
+    {
+        buf_size = TRACE_COMPACT_BLOCK_RECS * rec_size;
+    }
+    else if (tw->header.encoding == TRACE_ENC_DICT)
+    {
+        buf_size = TRACE_DICT_BLOCK_RECS * rec_size;
+    }
+    else if (tw->header.encoding == TRACE_ENC_FRAMES)
+    {
+        buf_size = TRACE_FRAME_MAX_SIZE / rec_size * rec_size;
+    }
+    for (size_t i = 0; i < count; i++, rec += rec_size)
+    {
+        uint8_t op_type = rec[TRACE_OP_TYPE_OFFSET];
+        if (op_type >= TRACE_NUM_OP_TYPES)
+        {
+            fprintf(stderr, "Error: record %lu has invalid op type %u\n",
+                    (unsigned long)tw->header.num_recs, op_type);
+            tw->error = true;
+            return -1;
+        }
+
+        if (tw->buf_len + rec_size > buf_size &&
+            trace_writer_flush(tw) != 0)
+        {
+            return -1;
+        }
+
+        memcpy(tw->buf + tw->buf_len, rec, rec_size);
+        tw->buf_len += rec_size;
+        tw->header.num_recs++;
+        tw->header.op_type_counts[op_type]++;
+    }
+
+    return 0;
+}
+
+/**
+ * Discard the file being written, removing it from disk.
+ *
+ * @param tw the trace writer (freed by this call)
+ */
+void trace_writer_abort(TraceWriter *tw)
+{
+    close(tw->fd);
+    unlink(tw->tmp_filename);
+    free(tw->filename);
+    free(tw->tmp_filename);
+    free(tw->buf);
+    free(tw->block);
+    trace_dict_free(tw->dict);
+    free(tw->frames);
+    free(tw);
+}
+
+/**
+ * Finish the file: write out buffered records, the static instruction table
+ * of a dictionary file or the frame index of a framed file, and the header,
+ * and move the file to its final name. If any write failed, the partial file
+ * is removed instead.
+ *
+ * @param tw the trace writer (freed by this call)
+ * @return 0 if the file was written successfully, or -1 on error
+ */
+int trace_writer_close(TraceWriter *tw)
+{
+    if (!tw->error)
+    {
+        trace_writer_flush(tw);
+    }
+    if (!tw->error && tw->dict != NULL)
+    {
+        // The table goes after the dynamic stream, aligned for use in place.
+        uint64_t offset = tw->header.data_offset + tw->data_len;
+        offset = (offset + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+        tw->header.dict_offset = offset;
+        tw->header.dict_entries = tw->dict->num_entries;
+        trace_writer_pwrite(tw, tw->dict->entries,
+                            tw->dict->num_entries * sizeof(PtrRec), offset);
+    }
+    if (!tw->error && tw->header.encoding == TRACE_ENC_FRAMES)
+    {
+        // Likewise the frame index goes after the frames.
+        uint64_t offset = tw->header.data_offset + tw->data_len;
+        offset = (offset + sizeof(uint64_t) - 1) & ~(uint64_t)(sizeof(uint64_t) - 1);
+        tw->header.frame_index_offset = offset;
+        trace_writer_pwrite(tw, tw->frames,
+                            tw->header.num_frames * sizeof(TraceFrameIndexEntry),
+                            offset);
+    }
+    if (!tw->error)
+    {
+        // Pad the header out to data_offset so the file has no hole.
+        uint8_t header_block[TRACE_PACK_DATA_OFFSET] = {0};
+        memcpy(header_block, &tw->header, sizeof(tw->header));
+        trace_writer_pwrite(tw, header_block, sizeof(header_block), 0);
+    }
+    if (!tw->error && close(tw->fd) != 0)
+    {
+        fprintf(stderr, "Couldn't write %s: ", tw->tmp_filename);
+        perror(NULL);
+        tw->error = true;
+        tw->fd = -1;
+    }
+
+    if (tw->error)
+    {
+        trace_writer_abort(tw);
+        return -1;
+    }
+
+    int status = 0;
+    if (rename(tw->tmp_filename, tw->filename) != 0)
+    {
+        fprintf(stderr, "Couldn't rename %s to %s: ", tw->tmp_filename,
+                tw->filename);
+        perror(NULL);
+        unlink(tw->tmp_filename);
+        status = -1;
+    }
+
+    free(tw->filename);
+    free(tw->tmp_filename);
+    free(tw->buf);
+    free(tw->block);
+    trace_dict_free(tw->dict);
+    free(tw->frames);
+    free(tw);
+    return status;
+}
@@ -0,0 +1,98 @@
+// tracewriter.h
+// Declares a writer for packed trace files, used by the trace conversion
+// tools.
+
+#ifndef _TRACEWRITER_H_
+#define _TRACEWRITER_H_
+
+#include "tracedict.h"
+#include "tracefmt.h"
+#include "traceframe.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+/** [Internal] The size in bytes of a TraceWriter's output buffer. */
+#define TRACE_WRITER_BUF_SIZE (1024 * 1024)
+
+/**
+ * A packed trace file being written.
+ *
+ * The file is written under a temporary name and only renamed into place by
+ * trace_writer_close() once it is complete, so an interrupted conversion
+ * never leaves a plausible-looking but truncated trace behind.
+ */
+typedef struct TraceWriterStruct
+{
+    /** [Internal] The file descriptor of the temporary output file. */
+    int fd;
+    /** [Internal] The final name of the output file. */
+    char *filename;
+    /** [Internal] The temporary name the file is written under. */
+    char *tmp_filename;
+    /** [Internal] The header, completed as records are written. */
+    TracePackHeader header;
+    /** [Internal] Records buffered but not yet written. */
+    uint8_t *buf;
+    /** [Internal] The number of valid bytes in buf. */
+    size_t buf_len;
+    /** [Internal] For encoded files, the block being encoded. */
+    uint8_t *block;
+    /** [Internal] For TRACE_ENC_DICT, the static instructions seen so far. */
+    TraceDict *dict;
+    /** [Internal] For TRACE_ENC_FRAMES, the frame index so far. */
+    TraceFrameIndexEntry *frames;
+    /** [Internal] The number of entries there is room for in frames. */
+    size_t max_frames;
+    /** [Internal] The number of bytes written after data_offset so far. */
+    uint64_t data_len;
+    /** Whether a write has failed; already reported on stderr. */
+    bool error;
+} TraceWriter;
+
+/**
+ * Create a packed trace file.
+ *
+ * TRACE_ENC_COMPACT and TRACE_ENC_DICT are only available for
+ * TRACE_LAYOUT_PTR; TRACE_ENC_FRAMES is available for both layouts. Prints an
+ * error message and returns NULL if the file cannot be created.
+ *
+ * @param filename the path of the file to create
+ * @param layout the record layout the file will hold
+ * @param encoding how to store the records
+ * @return a pointer to a newly allocated TraceWriter, or NULL on error
+ */
+TraceWriter *trace_writer_open(const char *filename, TraceLayout layout,
+                               TraceEncoding encoding);
+
+/**
+ * Append records to a packed trace file.
+ *
+ * Records with an invalid op type, or that the file's encoding can't
+ * reproduce, are rejected, and the writer is marked as failed.
+ *
+ * @param tw the trace writer
+ * @param recs the records to append, in the writer's layout
+ * @param count the number of records to append
+ * @return 0 on success, or -1 on error
+ */
+int trace_writer_write(TraceWriter *tw, const void *recs, size_t count);
+
+/**
+ * Finish the file: write out buffered records, the static instruction table
+ * of a dictionary file or the frame index of a framed file, and the header,
+ * and move the file to its final name. If any write failed, the partial file
+ * is removed instead.
+ *
+ * @param tw the trace writer (freed by this call)
+ * @return 0 if the file was written successfully, or -1 on error
+ */
+int trace_writer_close(TraceWriter *tw);
+
+/**
+ * Discard the file being written, removing it from disk.
+ *
+ * @param tw the trace writer (freed by this call)
+ */
+void trace_writer_abort(TraceWriter *tw);
+
+#endif
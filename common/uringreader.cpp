@@ -0,0 +1,469 @@
+// uringreader.cpp
+// Implements a sequential reader for uncompressed files on top of io_uring.
+//
+// liburing isn't available on the course machines, so the ring is driven
+// through the raw system calls and the structures in <linux/io_uring.h>.
+
+#include "uringreader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** [Internal] The io_uring instance behind a UringReader. */
+struct UringReaderRingStruct
+{
+    /** [Internal] The file descriptor of the ring. */
+    int fd;
+    /** [Internal] The mapped submission queue ring. */
+    void *sq_map;
+    /** [Internal] The length in bytes of sq_map. */
+    size_t sq_map_len;
+    /** [Internal] The mapped completion queue ring; may be sq_map. */
+    void *cq_map;
+    /** [Internal] The length in bytes of cq_map. */
+    size_t cq_map_len;
+    /** [Internal] The mapped submission queue entries. */
+    struct io_uring_sqe *sqes;
+    /** [Internal] The length in bytes of sqes. */
+    size_t sqes_len;
+    /** [Internal] Pointers into sq_map. */
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    /** [Internal] Pointers into cq_map. */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /** [Internal] Whether the read into each buffer has completed. */
+    bool done[URING_READER_DEPTH];
+    /** [Internal] The result of the completed read into each buffer. */
+    int res[URING_READER_DEPTH];
+    /** [Internal] The number of reads queued but not yet completed. */
+    unsigned in_flight;
+    /** [Internal] The number of reads queued but not yet submitted. */
+    unsigned unsubmitted;
+};
+
+/**
+ * [Internal] Submit queued reads to the kernel and optionally wait for one
+ * to complete.
+ *
+ * @param ring the ring
+ * @param wait whether to wait for a completion
+ */
+static void uring_reader_enter(UringReaderRingStruct *ring, bool wait)
+{
+    long submitted = syscall(__NR_io_uring_enter, ring->fd, ring->unsubmitted,
+                             wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                             NULL, 0);
+    // On failure (e.g. EINTR or EAGAIN) the reads stay queued, and the next
+    // call tries again.
+    if (submitted > 0)
+    {
+        ring->unsubmitted -= (unsigned)submitted;
+    }
+}
+
+/**
+ * [Internal] Get the offset and size of a block of the file.
+ *
+ * @param ur the reader
+ * @param block the index of the block
+ * @param offset set to the offset of the block in the file
+ * @return the number of bytes of the file in the block
+ */
+static size_t uring_reader_block(UringReader *ur, uint64_t block,
+                                 uint64_t *offset)
+{
+    *offset = ur->start + block * ur->block_size;
+    uint64_t left = ur->end - *offset;
+    return left < ur->block_size ? (size_t)left : ur->block_size;
+}
+
+/**
+ * [Internal] Get the number of bytes to ask the kernel for to read len bytes.
+ *
+ * @param ur the reader
+ * @param len the number of bytes wanted
+ * @return len, rounded up to URING_READER_ALIGN for O_DIRECT
+ */
+static size_t uring_reader_read_size(UringReader *ur, size_t len)
+{
+    if (!ur->direct)
+    {
+        return len;
+    }
+    return (len + URING_READER_ALIGN - 1) & ~(size_t)(URING_READER_ALIGN - 1);
+}
+
+/**
+ * [Internal] Set up an io_uring instance with room for URING_READER_DEPTH
+ * reads.
+ *
+ * @return a pointer to a newly allocated ring, or NULL (with errno set) if
+ *         io_uring is unavailable
+ */
+static UringReaderRingStruct *uring_reader_ring_new()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_READER_DEPTH, &params);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    UringReaderRingStruct *ring =
+        (UringReaderRingStruct *)calloc(1, sizeof(UringReaderRingStruct));
+    ring->fd = fd;
+    ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_len = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels share one mapping between both rings.
+    bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map && ring->cq_map_len > ring->sq_map_len)
+    {
+        ring->sq_map_len = ring->cq_map_len;
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    ring->cq_map = single_map ? ring->sq_map
+                              : mmap(NULL, ring->cq_map_len,
+                                     PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_POPULATE, fd,
+                                     IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+        sqes == MAP_FAILED)
+    {
+        int saved_errno = errno;
+        if (ring->sq_map != MAP_FAILED)
+        {
+            munmap(ring->sq_map, ring->sq_map_len);
+        }
+        if (!single_map && ring->cq_map != MAP_FAILED)
+        {
+            munmap(ring->cq_map, ring->cq_map_len);
+        }
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, ring->sqes_len);
+        }
+        close(fd);
+        free(ring);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    uint8_t *sq = (uint8_t *)ring->sq_map;
+    uint8_t *cq = (uint8_t *)ring->cq_map;
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+/**
+ * [Internal] Tear down an io_uring instance. No reads may be in flight.
+ *
+ * @param ring the ring to free
+ */
+static void uring_reader_ring_free(UringReaderRingStruct *ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_map != ring->sq_map)
+    {
+        munmap(ring->cq_map, ring->cq_map_len);
+    }
+    munmap(ring->sq_map, ring->sq_map_len);
+    close(ring->fd);
+    free(ring);
+}
+
+/**
+ * [Internal] Queue the read of the next block not yet queued, if any, into
+ * the buffer it maps to.
+ *
+ * @param ur the reader, which must have a ring
+ */
+static void uring_reader_queue(UringReader *ur)
+{
+    UringReaderRingStruct *ring = ur->ring;
+    uint64_t offset;
+    size_t len = uring_reader_block(ur, ur->num_queued, &offset);
+    if (offset >= ur->end)
+    {
+        return;
+    }
+
+    unsigned buf_index = ur->num_queued % URING_READER_DEPTH;
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = ur->fd;
+    sqe->addr = (uint64_t)(uintptr_t)ur->bufs[buf_index];
+    sqe->len = (uint32_t)uring_reader_read_size(ur, len);
+    sqe->off = offset;
+    sqe->user_data = buf_index;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->done[buf_index] = false;
+    ring->in_flight++;
+    ring->unsubmitted++;
+    ur->num_queued++;
+    uring_reader_enter(ring, false);
+}
+
+/**
+ * [Internal] Collect completed reads, waiting for at least one if none have
+ * completed yet.
+ *
+ * @param ring the ring
+ */
+static void uring_reader_reap(UringReaderRingStruct *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        uring_reader_enter(ring, true);
+    }
+
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        ring->done[cqe->user_data] = true;
+        ring->res[cqe->user_data] = cqe->res;
+        ring->in_flight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * [Internal] Read bytes of the file with plain pread() calls, retrying short
+ * reads.
+ *
+ * @param ur the reader
+ * @param buf where to read to
+ * @param len the number of bytes wanted
+ * @param offset the offset in the file to read from
+ * @param done the number of bytes at buf already read
+ * @return 0 on success, or -1 on error (already reported)
+ */
+static int uring_reader_pread(UringReader *ur, uint8_t *buf, size_t len,
+                              uint64_t offset, size_t done)
+{
+    while (done < len)
+    {
+        // O_DIRECT reads must stay aligned, so redo a partial one whole.
+        size_t from = ur->direct ? 0 : done;
+        size_t want = uring_reader_read_size(ur, len - from);
+        ssize_t bytes_read = pread(ur->fd, buf + from, want,
+                                   (off_t)(offset + from));
+        if (bytes_read == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_read <= 0 || from + bytes_read <= done)
+        {
+            fprintf(stderr, "\n");
+            if (bytes_read == -1)
+            {
+                fprintf(stderr, "Couldn't read trace file %s: ", ur->filename);
+                perror(NULL);
+            }
+            else
+            {
+                fprintf(stderr, "Error: %s: file ends early\n", ur->filename);
+            }
+            ur->error = true;
+            return -1;
+        }
+        done = from + bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * Open a file to read the bytes between two offsets, and queue the first
+ * reads.
+ *
+ * @param filename the path of the file
+ * @param start the offset of the first byte to read
+ * @param end the offset at which to stop reading
+ * @param block_size the size in bytes of each block handed out
+ * @param direct whether to bypass the page cache with O_DIRECT
+ * @return a pointer to a newly allocated UringReader, or NULL on error
+ */
+UringReader *uring_reader_open(const char *filename, uint64_t start,
+                               uint64_t end, size_t block_size, bool direct)
+{
+    int fd = -1;
+    if (direct)
+    {
+        fd = open(filename, O_RDONLY | O_DIRECT);
+        if (fd == -1 && errno == EINVAL)
+        {
+            fprintf(stderr, "Note: %s's file system doesn't support direct "
+                            "I/O; reading it through the page cache\n",
+                    filename);
+            direct = false;
+        }
+    }
+    if (fd == -1)
+    {
+        fd = open(filename, O_RDONLY);
+    }
+    if (fd == -1)
+    {
+        fprintf(stderr, "Couldn't open trace file %s: ", filename);
+        perror(NULL);
+        return NULL;
+    }
+
+    UringReader *ur = (UringReader *)calloc(1, sizeof(UringReader));
+    ur->fd = fd;
+    ur->filename = filename;
+    ur->block_size = block_size;
+    ur->start = start;
+    ur->end = end;
+    ur->direct = direct;
+
+    // Without a ring, only one block is ever read at a time.
+    ur->ring = uring_reader_ring_new();
+    unsigned num_bufs = URING_READER_DEPTH;
+    if (ur->ring == NULL)
+    {
+        fprintf(stderr, "Note: io_uring is unavailable (%s); reading %s with "
+                        "plain reads\n",
+                strerror(errno), filename);
+        num_bufs = 1;
+    }
+    for (unsigned int i = 0; i < num_bufs; i++)
+    {
+        void *buf = NULL;
+        if (posix_memalign(&buf, URING_READER_ALIGN,
+                           uring_reader_read_size(ur, block_size)) != 0)
+        {
+            fprintf(stderr, "Error: couldn't allocate trace buffer\n");
+            exit(1);
+        }
+        ur->bufs[i] = (uint8_t *)buf;
+    }
+
+    if (ur->ring != NULL)
+    {
+        for (unsigned int i = 0; i < URING_READER_DEPTH; i++)
+        {
+            uring_reader_queue(ur);
+        }
+    }
+    return ur;
+}
+
+/**
+ * Get the next block of the file, waiting for its read to complete.
+ *
+ * @param ur the reader
+ * @param data set to the start of the block
+ * @return the size of the block in bytes, 0 once end is reached, or -1 on
+ *         error (already reported)
+ */
+ssize_t uring_reader_next(UringReader *ur, const uint8_t **data)
+{
+    if (ur->error)
+    {
+        return -1;
+    }
+
+    UringReaderRingStruct *ring = ur->ring;
+    if (ring != NULL && ur->num_taken > 0)
+    {
+        // The caller is done with the previous block; reuse its buffer.
+        uring_reader_queue(ur);
+    }
+
+    uint64_t offset;
+    size_t len = uring_reader_block(ur, ur->num_taken, &offset);
+    if (offset >= ur->end)
+    {
+        return 0;
+    }
+
+    uint8_t *buf;
+    size_t done = 0;
+    if (ring != NULL)
+    {
+        unsigned buf_index = ur->num_taken % URING_READER_DEPTH;
+        while (!ring->done[buf_index])
+        {
+            uring_reader_reap(ring);
+        }
+        buf = ur->bufs[buf_index];
+        // Finish short or failed reads (e.g. on kernels without
+        // IORING_OP_READ) synchronously; a real error shows up again there.
+        done = ring->res[buf_index] > 0 ? (size_t)ring->res[buf_index] : 0;
+    }
+    else
+    {
+        buf = ur->bufs[0];
+    }
+
+    if (done < len && uring_reader_pread(ur, buf, len, offset, done) != 0)
+    {
+        return -1;
+    }
+
+    ur->num_taken++;
+    *data = buf;
+    return len;
+}
+
+/**
+ * Close the file and free all memory associated with the reader, waiting for
+ * any reads still in flight.
+ *
+ * @param ur the reader to close (may be NULL)
+ */
+void uring_reader_close(UringReader *ur)
+{
+    if (ur == NULL)
+    {
+        return;
+    }
+
+    if (ur->ring != NULL)
+    {
+        // The kernel may still be writing into the buffers.
+        while (ur->ring->in_flight > 0)
+        {
+            uring_reader_reap(ur->ring);
+        }
+        uring_reader_ring_free(ur->ring);
+    }
+    for (unsigned int i = 0; i < URING_READER_DEPTH; i++)
+    {
+        free(ur->bufs[i]);
+    }
+    close(ur->fd);
+    free(ur);
+}
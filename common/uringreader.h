@@ -0,0 +1,94 @@
+// uringreader.h
+// Declares a sequential reader for uncompressed files that keeps several
+// large reads queued with io_uring, so the kernel fetches the next blocks of
+// a trace while the simulator works through the current one.
+//
+// Where io_uring is unavailable (old kernels, or containers that forbid it),
+// the reader falls back to plain pread() calls, one block at a time. The file
+// may also be opened with O_DIRECT, so a trace streamed by many simulations
+// at once doesn't push everything else out of the page cache.
+
+#ifndef _URINGREADER_H_
+#define _URINGREADER_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/** The number of blocks a UringReader keeps queued ahead of the caller. */
+#define URING_READER_DEPTH 8
+
+/** The alignment of offsets, sizes and buffers for O_DIRECT reads. */
+#define URING_READER_ALIGN 4096
+
+/** [Internal] The io_uring instance behind a UringReader. */
+struct UringReaderRingStruct;
+
+/** An uncompressed file being read front to back in large blocks. */
+typedef struct UringReaderStruct
+{
+    /** [Internal] The file descriptor of the file. */
+    int fd;
+    /** [Internal] The name of the file, for error messages. */
+    const char *filename;
+    /** [Internal] If not NULL, the ring the reads are queued on. */
+    struct UringReaderRingStruct *ring;
+    /** [Internal] One aligned buffer per queued block. */
+    uint8_t *bufs[URING_READER_DEPTH];
+    /** [Internal] The size in bytes of each block but the last. */
+    size_t block_size;
+    /** [Internal] The offset in the file of the first block. */
+    uint64_t start;
+    /** [Internal] The offset in the file at which to stop reading. */
+    uint64_t end;
+    /** [Internal] The number of blocks queued so far. */
+    uint64_t num_queued;
+    /** [Internal] The number of blocks handed to the caller so far. */
+    uint64_t num_taken;
+    /** [Internal] Whether the file was opened with O_DIRECT. */
+    bool direct;
+    /** Whether a read has failed; already reported on stderr. */
+    bool error;
+} UringReader;
+
+/**
+ * Open a file to read the bytes between two offsets, and queue the first
+ * reads.
+ *
+ * With direct set, start and block_size must be multiples of
+ * URING_READER_ALIGN. If the file can't be opened with O_DIRECT, or io_uring
+ * is unavailable, a note is printed and the reader carries on without it.
+ * Prints an error message and returns NULL if the file cannot be opened.
+ *
+ * @param filename the path of the file
+ * @param start the offset of the first byte to read
+ * @param end the offset at which to stop reading
+ * @param block_size the size in bytes of each block handed out
+ * @param direct whether to bypass the page cache with O_DIRECT
+ * @return a pointer to a newly allocated UringReader, or NULL on error
+ */
+UringReader *uring_reader_open(const char *filename, uint64_t start,
+                               uint64_t end, size_t block_size, bool direct);
+
+/**
+ * Get the next block of the file, waiting for its read to complete.
+ *
+ * Every block but the last holds exactly block_size bytes. The block stays
+ * valid until the next call, which queues its buffer for a later block.
+ *
+ * @param ur the reader
+ * @param data set to the start of the block
+ * @return the size of the block in bytes, 0 once end is reached, or -1 on
+ *         error (already reported)
+ */
+ssize_t uring_reader_next(UringReader *ur, const uint8_t **data);
+
+/**
+ * Close the file and free all memory associated with the reader, waiting for
+ * any reads still in flight.
+ *
+ * @param ur the reader to close (may be NULL)
+ */
+void uring_reader_close(UringReader *ur);
+
+#endif
@@ -0,0 +1,87 @@
+// varint.h
+// Declares the variable-length integer helpers shared by the packed trace
+// encodings: LEB128 varints, and zigzag mapping so small negative deltas
+// also take few bytes.
+
+#ifndef _VARINT_H_
+#define _VARINT_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/** The largest number of bytes a 64-bit varint takes. */
+#define VARINT_MAX_SIZE 10
+
+/**
+ * Map a signed delta to an unsigned value so that small negative deltas also
+ * encode to few bytes.
+ */
+static inline uint64_t zigzag_encode(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+/** Undo zigzag_encode(). */
+static inline int64_t zigzag_decode(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * Append a LEB128 varint.
+ *
+ * @param out where to write the varint
+ * @param v the value to write
+ * @return the position just past the varint
+ */
+static inline uint8_t *varint_put(uint8_t *out, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *out++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *out++ = (uint8_t)v;
+    return out;
+}
+
+/**
+ * Read a LEB128 varint.
+ *
+ * @param in the position of the varint; advanced past it
+ * @param end the end of the readable bytes
+ * @param v set to the value read
+ * @return true on success, false if the varint is truncated or too long
+ */
+static inline bool varint_get(const uint8_t **in, const uint8_t *end,
+                              uint64_t *v)
+{
+    const uint8_t *p = *in;
+    if (p < end && *p < 0x80)
+    {
+        // Fast path: most deltas fit in one byte.
+        *v = *p;
+        *in = p + 1;
+        return true;
+    }
+
+    uint64_t result = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        if (p == end)
+        {
+            return false;
+        }
+        uint8_t byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            *v = result;
+            *in = p;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
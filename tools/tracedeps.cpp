@@ -0,0 +1,682 @@
+// tracedeps.cpp
+// Measures the register dataflow of a .ptr trace in one pass: how far each
+// source operand is from the instruction that produced it, how soon the
+// values each op type produces are first used, how long values stay in their
+// registers, and how many values are live at once. These set how often a
+// pipeline stalls on a dependence (Lab 2) and how many ROB entries and
+// physical registers an out-of-order core needs (Lab 3).
+//
+// A table indexed by register holds the last writer of each register, and one
+// more entry the last writer of the condition code, so each record takes a
+// few table lookups whatever the length of the trace. Distances are in
+// instructions: an instruction reading the result of the one just before it
+// is at distance 1.
+//
+// A value is live from the instruction producing it until the last one
+// reading it, and so is counted as live at each instruction in between. Its
+// live range is known only at that last read, and the count at each
+// instruction only once every value live across it has been read, so the
+// counts are kept in a ring of the last -horizon instructions. A value not
+// read for longer than that is counted as live only over the -horizon
+// instructions before its next read.
+
+#include "tracereader.h"
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** The number of registers a record can name. */
+#define DEPS_NUM_REGS 256
+
+/** The index in the last-writer table of the condition code. */
+#define DEPS_CC DEPS_NUM_REGS
+
+/** Distances below this have a histogram bucket each. */
+#define DEPS_EXACT 16
+
+/** The number of buckets of distances: exact, then by their log2. */
+#define DEPS_HIST_BUCKETS (DEPS_EXACT + 64 - 4)
+
+/** The default number of instructions over which live values are counted. */
+#define DEPS_DEFAULT_HORIZON 1000000
+
+/** The source operands, with RAW distance histograms of their own. */
+enum
+{
+    DEPS_SRC1,
+    DEPS_SRC2,
+    DEPS_CC_READ,
+    DEPS_NUM_SLOTS
+};
+
+/** The names of the source operands, as printed. */
+static const char *slot_names[DEPS_NUM_SLOTS] = {"SRC1", "SRC2", "CC"};
+
+/** The names of the op types of a .ptr trace, as printed. */
+static const char *op_names[TRACE_NUM_OP_TYPES] = {"ALU", "LD", "ST", "CBR",
+                                                   "OTHER"};
+
+/** The settings of the analysis. */
+typedef struct DepsParamsStruct
+{
+    /** The path of the trace file. */
+    const char *trace_filename;
+    /** The number of records to skip at the start of the trace. */
+    uint64_t skip;
+    /** The largest number of records to analyze, or 0 for all of them. */
+    uint64_t window;
+    /** The number of instructions over which live values are counted. */
+    uint64_t horizon;
+} DepsParams;
+
+/** The value last written to a register. */
+typedef struct DepsValueStruct
+{
+    /** The index of the instruction writing it, plus one, or 0 for none. */
+    uint64_t written;
+    /** The index of the last instruction reading it so far, if read. */
+    uint64_t last_read;
+    /** The op type of the instruction writing it. */
+    uint8_t op_type;
+    /** Whether it has been read. */
+    bool read;
+} DepsValue;
+
+/** A histogram of distances, and their count and sum for the mean. */
+typedef struct DepsHistStruct
+{
+    /** The number of distances in each bucket. */
+    uint64_t buckets[DEPS_HIST_BUCKETS];
+    /** The number of distances. */
+    uint64_t count;
+    /** The sum of the distances. */
+    uint64_t sum;
+} DepsHist;
+
+/** The state of a register dataflow analysis. */
+typedef struct DepsStruct
+{
+    /** The last value written to each register, and to the condition code. */
+    DepsValue values[DEPS_NUM_REGS + 1];
+    /** The distances from each source operand back to its producer. */
+    DepsHist raw[DEPS_NUM_SLOTS];
+    /** The source operands read before any instruction wrote them. */
+    uint64_t no_producer[DEPS_NUM_SLOTS];
+    /** The distances from each value to its first read, by producer op type. */
+    DepsHist first_use[TRACE_NUM_OP_TYPES];
+    /** The values produced by each op type. */
+    uint64_t produced[TRACE_NUM_OP_TYPES];
+    /** The values overwritten unread, by producer op type. */
+    uint64_t dead[TRACE_NUM_OP_TYPES];
+    /** The distances from each value read to its last read. */
+    DepsHist live_range;
+    /** The distances from each value to the write replacing it. */
+    DepsHist held;
+    /** The number of instructions over which live values are counted. */
+    uint64_t horizon;
+    /**
+     * The changes in the number of live values at each of the last horizon
+     * instructions, indexed by instruction modulo horizon + 1.
+     */
+    std::vector<int32_t> live_deltas;
+    /** The index of the next instruction whose live values are counted. */
+    uint64_t next_counted;
+    /** The number of values live at that instruction. */
+    int64_t live;
+    /** The most values live at any instruction counted. */
+    int64_t peak_live;
+    /** The index of the first instruction with that many. */
+    uint64_t peak_at;
+    /** The sum of the live values at every instruction counted. */
+    uint64_t live_sum;
+} Deps;
+
+int parse_args(int argc, char *argv[], DepsParams *params);
+int parse_num(const char *option, const char *arg, uint64_t *num);
+void print_usage(char *program_name);
+
+/**
+ * Find the histogram bucket of a distance.
+ *
+ * @param distance the distance, at least 1
+ * @return its bucket: the distance itself below DEPS_EXACT, or for larger
+ *         ones DEPS_EXACT plus the log2 of the distance over DEPS_EXACT
+ */
+static inline int deps_bucket(uint64_t distance)
+{
+    if (distance < DEPS_EXACT)
+    {
+        return (int)distance;
+    }
+    return DEPS_EXACT + (63 - __builtin_clzll(distance)) -
+           __builtin_ctz(DEPS_EXACT);
+}
+
+/**
+ * Find the smallest distance in a histogram bucket.
+ *
+ * @param bucket the bucket
+ * @return the smallest distance in it
+ */
+static inline uint64_t deps_bucket_low(int bucket)
+{
+    if (bucket < DEPS_EXACT)
+    {
+        return (uint64_t)bucket;
+    }
+    return (uint64_t)DEPS_EXACT << (bucket - DEPS_EXACT);
+}
+
+/**
+ * Add a distance to a histogram.
+ *
+ * @param h the histogram
+ * @param distance the distance, at least 1
+ */
+static inline void deps_hist_add(DepsHist *h, uint64_t distance)
+{
+    h->buckets[deps_bucket(distance)]++;
+    h->count++;
+    h->sum += distance;
+}
+
+/**
+ * Start an analysis.
+ *
+ * @param d the analysis
+ * @param params the settings of the analysis
+ */
+void deps_init(Deps *d, const DepsParams *params)
+{
+    memset(d->values, 0, sizeof(d->values));
+    memset(d->raw, 0, sizeof(d->raw));
+    memset(d->no_producer, 0, sizeof(d->no_producer));
+    memset(d->first_use, 0, sizeof(d->first_use));
+    memset(d->produced, 0, sizeof(d->produced));
+    memset(d->dead, 0, sizeof(d->dead));
+    memset(&d->live_range, 0, sizeof(d->live_range));
+    memset(&d->held, 0, sizeof(d->held));
+    d->horizon = params->horizon;
+    d->live_deltas.assign(params->horizon + 1, 0);
+    d->next_counted = 0;
+    d->live = 0;
+    d->peak_live = 0;
+    d->peak_at = 0;
+    d->live_sum = 0;
+}
+
+/**
+ * Count the live values at the next instruction not yet counted, whose count
+ * no read can change any more.
+ *
+ * @param d the analysis
+ */
+static inline void deps_count_live(Deps *d)
+{
+    int32_t *delta = &d->live_deltas[d->next_counted % (d->horizon + 1)];
+    d->live += *delta;
+    *delta = 0;
+    if (d->live > d->peak_live)
+    {
+        d->peak_live = d->live;
+        d->peak_at = d->next_counted;
+    }
+    d->live_sum += (uint64_t)d->live;
+    d->next_counted++;
+}
+
+/**
+ * Analyze a read of a register or the condition code.
+ *
+ * @param d the analysis
+ * @param reg the register, or DEPS_CC
+ * @param slot the source operand reading it
+ * @param now the index of the instruction reading it
+ */
+static inline void deps_read(Deps *d, int reg, int slot, uint64_t now)
+{
+    DepsValue *v = &d->values[reg];
+    if (v->written == 0)
+    {
+        d->no_producer[slot]++;
+        return;
+    }
+
+    uint64_t producer = v->written - 1;
+    deps_hist_add(&d->raw[slot], now - producer);
+
+    // The value was live since it was written, or last read, and is until
+    // now, but no earlier than the ring of counts goes back.
+    uint64_t live_from = v->read ? v->last_read : producer;
+    if (!v->read)
+    {
+        deps_hist_add(&d->first_use[v->op_type], now - producer);
+        v->read = true;
+    }
+    live_from = std::max(live_from, now - std::min(now, d->horizon));
+    if (live_from < now)
+    {
+        d->live_deltas[live_from % (d->horizon + 1)]++;
+        d->live_deltas[now % (d->horizon + 1)]--;
+    }
+    v->last_read = now;
+}
+
+/**
+ * Note how long the value in a register lasted, as it is replaced.
+ *
+ * @param d the analysis
+ * @param v the value
+ * @param now the index of the instruction replacing it
+ */
+static inline void deps_retire(Deps *d, const DepsValue *v, uint64_t now)
+{
+    if (v->written == 0)
+    {
+        return;
+    }
+
+    uint64_t producer = v->written - 1;
+    deps_hist_add(&d->held, now - producer);
+    if (v->read)
+    {
+        deps_hist_add(&d->live_range, v->last_read - producer);
+    }
+    else
+    {
+        d->dead[v->op_type]++;
+    }
+}
+
+/**
+ * Analyze a write of a register or the condition code.
+ *
+ * @param d the analysis
+ * @param reg the register, or DEPS_CC
+ * @param op_type the op type of the instruction writing it
+ * @param now the index of the instruction writing it
+ */
+static inline void deps_write(Deps *d, int reg, uint8_t op_type, uint64_t now)
+{
+    DepsValue *v = &d->values[reg];
+    deps_retire(d, v, now);
+    v->written = now + 1;
+    v->op_type = op_type;
+    v->read = false;
+    d->produced[op_type]++;
+}
+
+/**
+ * Analyze the next record. Its sources are read before its destinations are
+ * written, so an instruction reading and writing a register reads the value
+ * before it.
+ *
+ * @param d the analysis
+ * @param rec the record
+ * @param now the index of the record among those analyzed
+ */
+static inline void deps_add(Deps *d, const PtrRec *rec, uint64_t now)
+{
+    // No read from here on can reach back past the horizon.
+    if (now > d->horizon)
+    {
+        deps_count_live(d);
+    }
+
+    if (rec->src1_needed)
+    {
+        deps_read(d, rec->src1_reg, DEPS_SRC1, now);
+    }
+    if (rec->src2_needed)
+    {
+        deps_read(d, rec->src2_reg, DEPS_SRC2, now);
+    }
+    if (rec->cc_read)
+    {
+        deps_read(d, DEPS_CC, DEPS_CC_READ, now);
+    }
+    if (rec->dest_needed)
+    {
+        deps_write(d, rec->dest_reg, rec->op_type, now);
+    }
+    if (rec->cc_write)
+    {
+        deps_write(d, DEPS_CC, rec->op_type, now);
+    }
+}
+
+/**
+ * Finish an analysis, counting the live values at the instructions not yet
+ * counted. The values still in registers are left out of the lifetimes, as
+ * how long they last is not known.
+ *
+ * @param d the analysis
+ * @param num_recs the number of records analyzed
+ */
+void deps_finish(Deps *d, uint64_t num_recs)
+{
+    while (d->next_counted < num_recs)
+    {
+        deps_count_live(d);
+    }
+}
+
+/**
+ * Print a distance bucket's range.
+ *
+ * @param bucket the bucket
+ */
+void print_bucket(int bucket)
+{
+    uint64_t low = deps_bucket_low(bucket);
+    if (bucket < DEPS_EXACT)
+    {
+        printf("%15lu", (unsigned long)low);
+    }
+    else
+    {
+        char range[32];
+        snprintf(range, sizeof(range), "%lu-%lu", (unsigned long)low,
+                 (unsigned long)(2 * low - 1));
+        printf("%15s", range);
+    }
+}
+
+/**
+ * Print histograms side by side, one row per bucket up to the last bucket any
+ * of them uses, with the count in each bucket and the percentage of each
+ * histogram's distances in it or below.
+ *
+ * @param hists the histograms
+ * @param names their names
+ * @param n the number of histograms
+ */
+void print_hists(const DepsHist *const *hists, const char *const *names,
+                 int n)
+{
+    int last = 0;
+    for (int i = 0; i < n; i++)
+    {
+        for (int b = 0; b < DEPS_HIST_BUCKETS; b++)
+        {
+            last = hists[i]->buckets[b] != 0 ? std::max(last, b) : last;
+        }
+    }
+
+    printf("%15s", "DISTANCE");
+    for (int i = 0; i < n; i++)
+    {
+        printf("  %12s  %7s", names[i], "CUM%");
+    }
+    printf("\n");
+    std::vector<uint64_t> below(n, 0);
+    for (int b = 1; b <= last; b++)
+    {
+        print_bucket(b);
+        for (int i = 0; i < n; i++)
+        {
+            below[i] += hists[i]->buckets[b];
+            double total = hists[i]->count != 0 ? (double)hists[i]->count : 1;
+            printf("  %12lu  %7.3f", (unsigned long)hists[i]->buckets[b],
+                   100.0 * (double)below[i] / total);
+        }
+        printf("\n");
+    }
+    printf("%15s", "MEAN");
+    for (int i = 0; i < n; i++)
+    {
+        double total = hists[i]->count != 0 ? (double)hists[i]->count : 1;
+        printf("  %12.2f  %7s", (double)hists[i]->sum / total, "");
+    }
+    printf("\n");
+}
+
+/**
+ * Print the distances from each source operand back to its producer.
+ *
+ * @param d the finished analysis
+ */
+void print_raw(const Deps *d)
+{
+    printf("\nSource operands:\n");
+    printf("%-6s  %12s  %12s\n", "SOURCE", "READS", "NO PRODUCER");
+    const DepsHist *hists[DEPS_NUM_SLOTS];
+    for (int slot = 0; slot < DEPS_NUM_SLOTS; slot++)
+    {
+        hists[slot] = &d->raw[slot];
+        printf("%-6s  %12lu  %12lu\n", slot_names[slot],
+               (unsigned long)(d->raw[slot].count + d->no_producer[slot]),
+               (unsigned long)d->no_producer[slot]);
+    }
+
+    printf("\nRead-after-write distances, in instructions back to the "
+           "producer:\n");
+    print_hists(hists, slot_names, DEPS_NUM_SLOTS);
+}
+
+/**
+ * Print the distances from the values each op type produces to their first
+ * reads.
+ *
+ * @param d the finished analysis
+ */
+void print_producers(const Deps *d)
+{
+    printf("\nValues produced, by op type:\n");
+    printf("%-6s  %12s  %12s  %8s\n", "OP", "PRODUCED", "DEAD", "%DEAD");
+    const DepsHist *hists[TRACE_NUM_OP_TYPES];
+    for (int op = 0; op < TRACE_NUM_OP_TYPES; op++)
+    {
+        hists[op] = &d->first_use[op];
+        double produced = d->produced[op] != 0 ? (double)d->produced[op] : 1;
+        printf("%-6s  %12lu  %12lu  %8.3f\n", op_names[op],
+               (unsigned long)d->produced[op], (unsigned long)d->dead[op],
+               100.0 * (double)d->dead[op] / produced);
+    }
+
+    printf("\nDistances from each value to its first read, by producer op "
+           "type:\n");
+    print_hists(hists, op_names, TRACE_NUM_OP_TYPES);
+}
+
+/**
+ * Print how long values last and how many are live at once.
+ *
+ * @param d the finished analysis
+ */
+void print_lifetimes(const Deps *d)
+{
+    printf("\nRegister lifetimes, in instructions from the write to the last "
+           "read (LIVE)\nand to the write replacing it (HELD):\n");
+    const DepsHist *hists[2] = {&d->live_range, &d->held};
+    const char *names[2] = {"LIVE", "HELD"};
+    print_hists(hists, names, 2);
+
+    double counted = d->next_counted != 0 ? (double)d->next_counted : 1;
+    printf("\nLive values: peak %ld at instruction %lu, mean %.2f\n",
+           (long)d->peak_live, (unsigned long)d->peak_at,
+           (double)d->live_sum / counted);
+}
+
+int main(int argc, char *argv[])
+{
+    DepsParams params;
+    int status = parse_args(argc, argv, &params);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    TraceReader *trace = trace_open_range(params.trace_filename,
+                                          sizeof(PtrRec), TRACE_OPEN_ASYNC,
+                                          params.skip, params.window);
+    if (trace == NULL)
+    {
+        return 1;
+    }
+
+    printf("Analyzing %s\n", params.trace_filename);
+    Deps *d = new Deps();
+    deps_init(d, &params);
+    uint64_t num_recs = 0;
+    bool invalid = false;
+    TraceSpan<PtrRec> block;
+    while (!invalid && (block = trace_next_span<PtrRec>(trace)).size() > 0)
+    {
+        for (const PtrRec &rec : block)
+        {
+            if (rec.op_type >= TRACE_NUM_OP_TYPES)
+            {
+                fprintf(stderr, "Error: Invalid trace file: %s\n",
+                        params.trace_filename);
+                invalid = true;
+                break;
+            }
+            deps_add(d, &rec, num_recs++);
+        }
+    }
+    bool failed = invalid || trace->error;
+    trace_close(trace);
+    if (failed)
+    {
+        delete d;
+        return 1;
+    }
+
+    deps_finish(d, num_recs);
+    printf("Records:   %12lu\n", (unsigned long)num_recs);
+    print_raw(d);
+    print_producers(d);
+    print_lifetimes(d);
+    delete d;
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], DepsParams *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->horizon = DEPS_DEFAULT_HORIZON;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (params->trace_filename != NULL)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            params->trace_filename = argv[i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+
+        // The rest take an argument.
+        const char *option = argv[i];
+        if (++i >= argc)
+        {
+            fprintf(stderr, "Error: missing argument to %s\n", option);
+            return 2;
+        }
+        const char *arg = argv[i];
+        int bad = 0;
+        if (strcmp(option, "-skip") == 0)
+        {
+            bad = parse_num(option, arg, &params->skip);
+        }
+        else if (strcmp(option, "-window") == 0)
+        {
+            bad = parse_num(option, arg, &params->window);
+        }
+        else if (strcmp(option, "-horizon") == 0)
+        {
+            bad = parse_num(option, arg, &params->horizon);
+            if (!bad && (params->horizon == 0 || params->horizon > (1u << 28)))
+            {
+                fprintf(stderr, "Error: -horizon must be from 1 to %u\n",
+                        1u << 28);
+                return 2;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", option);
+            return 2;
+        }
+        if (bad)
+        {
+            return 2;
+        }
+    }
+
+    if (params->trace_filename == NULL)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (strstr(params->trace_filename, ".otr") != NULL)
+    {
+        fprintf(stderr, "Error: %s is a Lab 1 trace, which has no registers; "
+                        "use a .ptr trace\n",
+                params->trace_filename);
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * Parse a non-negative number given to an option, optionally followed by K,
+ * M, G or T for a power of 1000.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param num set to the number
+ * @return 0 on success, or 2 if arg is not a valid number
+ */
+int parse_num(const char *option, const char *arg, uint64_t *num)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    const char *suffixes = "KMGT";
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL && end[1] == '\0')
+    {
+        for (const char *s = suffixes; s <= suffix; s++)
+        {
+            errno = value > ~0ull / 1000 ? ERANGE : errno;
+            value *= 1000;
+        }
+        end++;
+    }
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number\n", option);
+        return 2;
+    }
+
+    *num = value;
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file>\n\n", program_name);
+    fprintf(stderr, "Measure the register dataflow of a .ptr trace in one pass: read-after-write\n");
+    fprintf(stderr, "distances, how soon each op type's results are used, register lifetimes and\n");
+    fprintf(stderr, "the number of values live at once.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -skip <num>         Start <num> records into the trace\n");
+    fprintf(stderr, "    -window <num>       Analyze at most <num> records\n");
+    fprintf(stderr, "    -horizon <num>      Count a value as live for at most <num> instructions\n");
+    fprintf(stderr, "                        before each read (default: 1M)\n\n");
+    fprintf(stderr, "Numbers may end in K, M, G or T for powers of 1000.\n");
+}
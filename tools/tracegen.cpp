@@ -0,0 +1,779 @@
+// tracegen.cpp
+// Generates a synthetic trace (.ptr layout for Labs 2 and 3, or .otr for Lab
+// 1) as a packed trace file, to drive the simulators with a controlled,
+// reproducible load: a given op mix, register dependency distances, branch
+// behavior and memory locality, at any length up to billions of records.
+//
+// The trace is the execution of a made-up static program. Its instructions
+// are drawn from the op mix and split into basic blocks at each conditional
+// branch. Each branch leans towards one direction, and goes that way with a
+// given probability; taken branches jump to the start of a random block.
+// Each static load and store walks its own stream of addresses through a
+// shared data footprint, mostly by a fixed stride and otherwise at random.
+//
+// Registers are written round-robin, so a value stays in its register for
+// GEN_NUM_REGS writes; each source register is then picked as the
+// destination of the instruction a sampled distance back. Stores and branches
+// write no register, so when that instruction is one of them the source is
+// taken from the nearest writer before it instead. Dependency distances
+// therefore follow the chosen distribution only as far as the op mix allows:
+// each is the sampled distance when it lands on an ALU, LD or OTHER record,
+// and longer otherwise. With the default mix, fixed:1 gives distance 1 for
+// about 78% of sources. tools/tracedeps measures the distances a trace
+// actually has. The same arguments and seed always give the same trace.
+
+#include "tracereader.h"
+#include "tracewriter.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** The op types of the labs' trace.h files. */
+enum
+{
+    GEN_OP_ALU,
+    GEN_OP_LD,
+    GEN_OP_ST,
+    GEN_OP_CBR,
+    GEN_OP_OTHER
+};
+
+/** The number of architectural registers written by generated records. */
+#define GEN_NUM_REGS 32
+
+/** The value of an unused register field, as in the course traces. */
+#define GEN_NO_REG 255
+
+/**
+ * The number of most recent records whose destinations are remembered for
+ * picking sources, which bounds the dependency distance. A power of two.
+ */
+#define GEN_HISTORY 256
+
+/** The address of the first static instruction. */
+#define GEN_CODE_BASE 0x400000
+
+/** The size in bytes of each static instruction. */
+#define GEN_INST_SIZE 4
+
+/** The address of the start of the data footprint. */
+#define GEN_DATA_BASE 0x10000000
+
+/** The number of records generated per call to trace_writer_write(). */
+#define GEN_BATCH 4096
+
+/** How far back the sources of a record are produced. */
+typedef enum GenDepKindEnum
+{
+    GEN_DEP_NONE,    // No sources at all
+    GEN_DEP_FIXED,   // Always the same distance
+    GEN_DEP_UNIFORM, // Uniform between two distances
+    GEN_DEP_GEOM     // Geometric with a given mean
+} GenDepKind;
+
+/** The settings of a generated trace. */
+typedef struct GenParamsStruct
+{
+    /** The number of records to generate. */
+    uint64_t num_recs;
+    /** The relative weight of each op type. */
+    double mix[TRACE_NUM_OP_TYPES];
+    /** The dependency distance distribution. */
+    GenDepKind dep_kind;
+    /** The parameters of the distribution: distance, bounds, or mean. */
+    double dep_a, dep_b;
+    /** The probability that an instruction has a 2nd source register. */
+    double src2_prob;
+    /** The fraction of static branches that lean towards taken. */
+    double taken_bias;
+    /** The probability that a branch goes the way it leans. */
+    double predictability;
+    /** The number of static instructions. */
+    uint32_t num_static;
+    /** The size in bytes of the data footprint. */
+    uint64_t footprint;
+    /** The distance in bytes between sequential accesses. */
+    uint64_t stride;
+    /** The probability that an access follows on from the last by stride. */
+    double seq_prob;
+    /** The seed of the random number generator. */
+    uint64_t seed;
+} GenParams;
+
+/** One instruction of the made-up static program. */
+typedef struct GenStaticStruct
+{
+    /** The op type of the instruction. */
+    uint8_t op_type;
+    /** Whether the instruction writes a register. */
+    bool dest_needed;
+    /** Whether the instruction reads one or two registers. */
+    bool src1_needed, src2_needed;
+    /** For a branch, whether it leans towards taken. */
+    bool taken_bias;
+    /** For a branch, the index of the instruction it jumps to if taken. */
+    uint32_t target;
+    /** For a load or store, the offset in the footprint of its last access. */
+    uint64_t cursor;
+} GenStatic;
+
+/** The state of a xoshiro256** random number generator. */
+typedef struct GenRngStruct
+{
+    uint64_t s[4];
+} GenRng;
+
+int parse_args(int argc, char *argv[], char **out_filename,
+               TraceLayout *layout, TraceEncoding *encoding,
+               GenParams *params);
+int parse_num(const char *option, const char *arg, uint64_t *num);
+int parse_prob(const char *option, const char *arg, double *prob);
+int parse_dep(const char *arg, GenParams *params);
+void print_usage(char *program_name);
+
+/**
+ * Seed a random number generator, expanding the seed with splitmix64.
+ *
+ * @param rng the generator
+ * @param seed the seed
+ */
+void rng_seed(GenRng *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        rng->s[i] = z ^ (z >> 31);
+    }
+}
+
+/**
+ * Get the next 64 random bits.
+ *
+ * @param rng the generator
+ * @return the bits
+ */
+static inline uint64_t rng_next(GenRng *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t x = s[1] * 5;
+    uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/**
+ * Get a random number in [0, 1).
+ *
+ * @param rng the generator
+ * @return the number
+ */
+static inline double rng_unit(GenRng *rng)
+{
+    return (double)(rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Get a random integer in [0, n).
+ *
+ * @param rng the generator
+ * @param n the bound; must not be 0
+ * @return the integer
+ */
+static inline uint64_t rng_below(GenRng *rng, uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)rng_next(rng) * n) >> 64);
+}
+
+/**
+ * Draw a dependency distance.
+ *
+ * @param params the settings of the trace
+ * @param rng the generator
+ * @return a distance between 1 and GEN_HISTORY - 1
+ */
+static uint32_t draw_distance(const GenParams *params, GenRng *rng)
+{
+    double d;
+    switch (params->dep_kind)
+    {
+    case GEN_DEP_FIXED:
+        d = params->dep_a;
+        break;
+    case GEN_DEP_UNIFORM:
+        d = params->dep_a +
+            (double)rng_below(rng, (uint64_t)(params->dep_b - params->dep_a) + 1);
+        break;
+    default:
+        // Geometric on 1, 2, ... with mean dep_a.
+        d = params->dep_a <= 1
+                ? 1
+                : ceil(log(1 - rng_unit(rng)) / log(1 - 1 / params->dep_a));
+        break;
+    }
+    return d < 1 ? 1 : d >= GEN_HISTORY ? GEN_HISTORY - 1 : (uint32_t)d;
+}
+
+/**
+ * Make up the static program the trace executes.
+ *
+ * @param params the settings of the trace
+ * @param rng the generator
+ * @return an array of params->num_static instructions; free it with free()
+ */
+GenStatic *make_program(const GenParams *params, GenRng *rng)
+{
+    double total = 0;
+    for (int op = 0; op < TRACE_NUM_OP_TYPES; op++)
+    {
+        total += params->mix[op];
+    }
+
+    uint32_t n = params->num_static;
+    GenStatic *prog = (GenStatic *)calloc(n, sizeof(GenStatic));
+    std::vector<uint32_t> block_starts(1, 0);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        GenStatic *inst = &prog[i];
+        double pick = rng_unit(rng) * total;
+        int op = 0;
+        while (op < TRACE_NUM_OP_TYPES - 1 && pick >= params->mix[op])
+        {
+            pick -= params->mix[op];
+            op++;
+        }
+        inst->op_type = (uint8_t)op;
+
+        // Shape the operands like the course traces: loads and ALU ops
+        // write a register, stores read the data and the base address, and
+        // branches read only the condition code.
+        bool has_srcs = params->dep_kind != GEN_DEP_NONE;
+        inst->dest_needed = op == GEN_OP_ALU || op == GEN_OP_LD || op == GEN_OP_OTHER;
+        inst->src1_needed = has_srcs && op != GEN_OP_CBR;
+        inst->src2_needed = has_srcs && op != GEN_OP_CBR &&
+                            (op == GEN_OP_ST || rng_unit(rng) < params->src2_prob);
+        inst->cursor = rng_below(rng, params->footprint / params->stride) *
+                       params->stride;
+
+        if (op == GEN_OP_CBR)
+        {
+            inst->taken_bias = rng_unit(rng) < params->taken_bias;
+            if (i + 1 < n)
+            {
+                block_starts.push_back(i + 1);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (prog[i].op_type == GEN_OP_CBR)
+        {
+            prog[i].target = block_starts[rng_below(rng, block_starts.size())];
+        }
+    }
+    return prog;
+}
+
+/**
+ * Generate the trace, writing it out in batches.
+ *
+ * @param params the settings of the trace
+ * @param out the writer of the output file
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int generate(const GenParams *params, TraceWriter *out)
+{
+    GenRng rng;
+    rng_seed(&rng, params->seed);
+    GenStatic *prog = make_program(params, &rng);
+
+    bool is_ptr = out->header.layout == TRACE_LAYOUT_PTR;
+    size_t rec_size = trace_layout_rec_size(out->header.layout);
+    uint8_t *batch = (uint8_t *)malloc(GEN_BATCH * rec_size);
+
+    // The destination register of each recent record, or GEN_NO_REG.
+    uint8_t history[GEN_HISTORY];
+    memset(history, GEN_NO_REG, sizeof(history));
+    uint64_t seq = 0;
+    uint8_t next_reg = 0;
+    uint32_t pc = 0;
+
+    uint64_t left = params->num_recs;
+    int status = 0;
+    while (left > 0 && status == 0)
+    {
+        size_t count = left < GEN_BATCH ? (size_t)left : GEN_BATCH;
+        memset(batch, 0, count * rec_size);
+        for (size_t i = 0; i < count; i++, seq++)
+        {
+            GenStatic *inst = &prog[pc];
+            uint64_t inst_addr = GEN_CODE_BASE + (uint64_t)pc * GEN_INST_SIZE;
+            uint32_t next_pc = pc + 1 == params->num_static ? 0 : pc + 1;
+            bool taken = false;
+            if (inst->op_type == GEN_OP_CBR)
+            {
+                taken = (rng_unit(&rng) < params->predictability) ==
+                        inst->taken_bias;
+                if (taken)
+                {
+                    next_pc = inst->target;
+                }
+            }
+
+            if (!is_ptr)
+            {
+                OtrRec *r = (OtrRec *)(batch + i * rec_size);
+                r->inst_addr = inst_addr;
+                r->optype = inst->op_type;
+                pc = next_pc;
+                continue;
+            }
+
+            PtrRec *r = (PtrRec *)(batch + i * rec_size);
+            r->inst_addr = inst_addr;
+            r->op_type = inst->op_type;
+            r->dest_reg = r->src1_reg = r->src2_reg = GEN_NO_REG;
+
+            // Pick each source as the register written the sampled distance
+            // back, or failing that, by the nearest writer before it.
+            uint8_t *srcs[2] = {&r->src1_reg, &r->src2_reg};
+            bool needed[2] = {inst->src1_needed, inst->src2_needed};
+            for (int s = 0; s < 2; s++)
+            {
+                if (!needed[s])
+                {
+                    continue;
+                }
+                uint32_t d = draw_distance(params, &rng);
+                uint8_t reg = GEN_NO_REG;
+                for (; d < GEN_HISTORY && d <= seq && reg == GEN_NO_REG; d++)
+                {
+                    reg = history[(seq - d) & (GEN_HISTORY - 1)];
+                }
+                *srcs[s] = reg != GEN_NO_REG
+                               ? reg
+                               : (uint8_t)rng_below(&rng, GEN_NUM_REGS);
+            }
+            r->src1_needed = inst->src1_needed;
+            r->src2_needed = inst->src2_needed;
+
+            if (inst->dest_needed)
+            {
+                r->dest_needed = 1;
+                r->dest_reg = next_reg;
+                next_reg = (next_reg + 1) % GEN_NUM_REGS;
+            }
+            history[seq & (GEN_HISTORY - 1)] = r->dest_reg;
+
+            r->cc_write = inst->op_type == GEN_OP_ALU;
+            r->cc_read = inst->op_type == GEN_OP_CBR;
+            if (inst->op_type == GEN_OP_LD || inst->op_type == GEN_OP_ST)
+            {
+                inst->cursor = rng_unit(&rng) < params->seq_prob
+                                   ? (inst->cursor + params->stride) % params->footprint
+                                   : rng_below(&rng, params->footprint / params->stride) *
+                                         params->stride;
+                r->mem_addr = GEN_DATA_BASE + inst->cursor;
+                r->mem_read = inst->op_type == GEN_OP_LD;
+                r->mem_write = inst->op_type == GEN_OP_ST;
+            }
+            if (inst->op_type == GEN_OP_CBR)
+            {
+                r->br_dir = taken;
+                r->br_target = GEN_CODE_BASE + (uint64_t)inst->target * GEN_INST_SIZE;
+            }
+            pc = next_pc;
+        }
+
+        status = trace_writer_write(out, batch, count);
+        left -= count;
+    }
+
+    free(batch);
+    free(prog);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    char *out_filename;
+    TraceLayout layout;
+    TraceEncoding encoding;
+    GenParams params;
+    int status = parse_args(argc, argv, &out_filename, &layout, &encoding,
+                            &params);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    TraceWriter *out = trace_writer_open(out_filename, layout, encoding);
+    if (out == NULL)
+    {
+        return 1;
+    }
+
+    printf("Generating %lu records into %s\n", (unsigned long)params.num_recs,
+           out_filename);
+    if (generate(&params, out) != 0 || out->error)
+    {
+        trace_writer_abort(out);
+        return 1;
+    }
+    if (trace_writer_close(out) != 0)
+    {
+        return 1;
+    }
+
+    // Report the mix actually generated from the finished file's header,
+    // which also checks that it reads back.
+    TraceReader *packed = trace_open(out_filename,
+                                     trace_layout_rec_size(layout), 0);
+    if (packed == NULL)
+    {
+        return 1;
+    }
+    TracePackHeader header = *packed->header;
+    trace_close(packed);
+
+    printf("Records:   %12lu\n", (unsigned long)header.num_recs);
+    const char *names[TRACE_NUM_OP_TYPES] = {"ALU", "LD", "ST", "CBR", "OTHER"};
+    for (int i = 0; i < TRACE_NUM_OP_TYPES; i++)
+    {
+        printf("  %-6s   %12lu  %6.2f%%\n", names[i],
+               (unsigned long)header.op_type_counts[i],
+               header.num_recs > 0
+                   ? 100.0 * header.op_type_counts[i] / header.num_recs
+                   : 0.0);
+    }
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], char **out_filename,
+               TraceLayout *layout, TraceEncoding *encoding,
+               GenParams *params)
+{
+    *out_filename = NULL;
+    *layout = TRACE_LAYOUT_PTR;
+    *encoding = TRACE_ENC_RAW;
+
+    // Defaults roughly like the course traces.
+    memset(params, 0, sizeof(*params));
+    params->num_recs = 10000000;
+    double mix[TRACE_NUM_OP_TYPES] = {40, 25, 10, 12, 13};
+    memcpy(params->mix, mix, sizeof(mix));
+    params->dep_kind = GEN_DEP_GEOM;
+    params->dep_a = 4;
+    params->src2_prob = 0.3;
+    params->taken_bias = 0.6;
+    params->predictability = 0.9;
+    params->num_static = 4096;
+    params->footprint = 1024 * 1024;
+    params->stride = 8;
+    params->seq_prob = 0.8;
+    params->seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (*out_filename != NULL)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            *out_filename = argv[i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-compact") == 0)
+        {
+            *encoding = TRACE_ENC_COMPACT;
+            continue;
+        }
+        else if (strcmp(argv[i], "-dict") == 0)
+        {
+            *encoding = TRACE_ENC_DICT;
+            continue;
+        }
+        else if (strcmp(argv[i], "-frames") == 0)
+        {
+            *encoding = TRACE_ENC_FRAMES;
+            continue;
+        }
+
+        // The rest take an argument.
+        const char *option = argv[i];
+        if (++i >= argc)
+        {
+            fprintf(stderr, "Error: missing argument to %s\n", option);
+            return 2;
+        }
+        const char *arg = argv[i];
+        uint64_t num = 0;
+        int bad = 0;
+        if (strcmp(option, "-layout") == 0)
+        {
+            if (strcmp(arg, "otr") == 0)
+            {
+                *layout = TRACE_LAYOUT_OTR;
+            }
+            else if (strcmp(arg, "ptr") == 0)
+            {
+                *layout = TRACE_LAYOUT_PTR;
+            }
+            else
+            {
+                fprintf(stderr, "Error: layout must be otr or ptr\n");
+                return 2;
+            }
+        }
+        else if (strcmp(option, "-n") == 0)
+        {
+            bad = parse_num(option, arg, &params->num_recs);
+        }
+        else if (strcmp(option, "-mix") == 0)
+        {
+            double total = 0;
+            int n = sscanf(arg, "%lf,%lf,%lf,%lf,%lf", &params->mix[0],
+                           &params->mix[1], &params->mix[2], &params->mix[3],
+                           &params->mix[4]);
+            for (int op = 0; op < n; op++)
+            {
+                bad |= params->mix[op] < 0;
+                total += params->mix[op];
+            }
+            if (n != TRACE_NUM_OP_TYPES || bad || total <= 0)
+            {
+                fprintf(stderr, "Error: -mix takes five non-negative weights, "
+                                "for ALU,LD,ST,CBR,OTHER\n");
+                return 2;
+            }
+        }
+        else if (strcmp(option, "-dep") == 0)
+        {
+            bad = parse_dep(arg, params);
+        }
+        else if (strcmp(option, "-src2") == 0)
+        {
+            bad = parse_prob(option, arg, &params->src2_prob);
+        }
+        else if (strcmp(option, "-taken") == 0)
+        {
+            bad = parse_prob(option, arg, &params->taken_bias);
+        }
+        else if (strcmp(option, "-predict") == 0)
+        {
+            bad = parse_prob(option, arg, &params->predictability);
+        }
+        else if (strcmp(option, "-static") == 0)
+        {
+            bad = parse_num(option, arg, &num);
+            if (!bad && (num == 0 || num > (1u << 30)))
+            {
+                fprintf(stderr, "Error: -static must be between 1 and 2^30\n");
+                return 2;
+            }
+            params->num_static = (uint32_t)num;
+        }
+        else if (strcmp(option, "-footprint") == 0)
+        {
+            bad = parse_num(option, arg, &params->footprint);
+        }
+        else if (strcmp(option, "-stride") == 0)
+        {
+            bad = parse_num(option, arg, &params->stride);
+        }
+        else if (strcmp(option, "-seq") == 0)
+        {
+            bad = parse_prob(option, arg, &params->seq_prob);
+        }
+        else if (strcmp(option, "-seed") == 0)
+        {
+            bad = parse_num(option, arg, &params->seed);
+        }
+        else
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", option);
+            return 2;
+        }
+        if (bad)
+        {
+            return 2;
+        }
+    }
+
+    if (*out_filename == NULL)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (params->stride == 0 || params->footprint < params->stride)
+    {
+        fprintf(stderr, "Error: -stride must be at least 1 and no more than "
+                        "-footprint\n");
+        return 2;
+    }
+    if ((*encoding == TRACE_ENC_COMPACT || *encoding == TRACE_ENC_DICT) &&
+        *layout != TRACE_LAYOUT_PTR)
+    {
+        fprintf(stderr, "Error: -compact and -dict are only supported for "
+                        ".ptr traces\n");
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * Parse a non-negative number given to an option, optionally followed by K,
+ * M, G or T for a power of 1000.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param num set to the number
+ * @return 0 on success, or 2 if arg is not a valid number
+ */
+int parse_num(const char *option, const char *arg, uint64_t *num)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    const char *suffixes = "KMGT";
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL && end[1] == '\0')
+    {
+        for (const char *s = suffixes; s <= suffix; s++)
+        {
+            errno = value > ~0ull / 1000 ? ERANGE : errno;
+            value *= 1000;
+        }
+        end++;
+    }
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number\n", option);
+        return 2;
+    }
+
+    *num = value;
+    return 0;
+}
+
+/**
+ * Parse a probability given to an option.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param prob set to the probability
+ * @return 0 on success, or 2 if arg is not between 0 and 1
+ */
+int parse_prob(const char *option, const char *arg, double *prob)
+{
+    char *end;
+    double value = strtod(arg, &end);
+    if (end == arg || *end != '\0' || !(value >= 0 && value <= 1))
+    {
+        fprintf(stderr, "Error: argument to %s must be between 0 and 1\n",
+                option);
+        return 2;
+    }
+
+    *prob = value;
+    return 0;
+}
+
+/**
+ * Parse the dependency distance distribution given to -dep.
+ *
+ * @param arg the argument: none, fixed:D, uniform:A:B or geom:MEAN
+ * @param params the settings to fill in
+ * @return 0 on success, or 2 if arg is not a valid distribution
+ */
+int parse_dep(const char *arg, GenParams *params)
+{
+    double a = 0, b = 0;
+    char end;
+    if (strcmp(arg, "none") == 0)
+    {
+        params->dep_kind = GEN_DEP_NONE;
+        return 0;
+    }
+    if (sscanf(arg, "fixed:%lf%c", &a, &end) == 1 && a >= 1)
+    {
+        params->dep_kind = GEN_DEP_FIXED;
+    }
+    else if (sscanf(arg, "uniform:%lf:%lf%c", &a, &b, &end) == 2 && a >= 1 &&
+             b >= a)
+    {
+        params->dep_kind = GEN_DEP_UNIFORM;
+    }
+    else if (sscanf(arg, "geom:%lf%c", &a, &end) == 1 && a >= 1)
+    {
+        params->dep_kind = GEN_DEP_GEOM;
+    }
+    else
+    {
+        fprintf(stderr, "Error: -dep must be none, fixed:D, uniform:A:B or "
+                        "geom:MEAN, with distances of at least 1\n");
+        return 2;
+    }
+
+    params->dep_a = floor(a);
+    params->dep_b = floor(b);
+    if (params->dep_kind == GEN_DEP_GEOM)
+    {
+        params->dep_a = a;
+    }
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <output file>\n\n", program_name);
+    fprintf(stderr, "Generate a synthetic packed trace with a controlled op mix, dependency\n");
+    fprintf(stderr, "distances, branch behavior and memory locality.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -n <num>            Number of records, optionally with a K, M, G or T\n");
+    fprintf(stderr, "                        suffix (default: 10M)\n");
+    fprintf(stderr, "    -layout <otr|ptr>   otr for Lab 1 records, ptr for Lab 2/3 records\n");
+    fprintf(stderr, "                        (default: ptr)\n");
+    fprintf(stderr, "    -mix <weights>      Relative weights of ALU,LD,ST,CBR,OTHER ops\n");
+    fprintf(stderr, "                        (default: 40,25,10,12,13)\n");
+    fprintf(stderr, "    -dep <dist>         Distance back to the producer of each source\n");
+    fprintf(stderr, "                        register: none, fixed:D, uniform:A:B or geom:MEAN\n");
+    fprintf(stderr, "                        (default: geom:4; at most %d). A distance landing\n", GEN_HISTORY - 1);
+    fprintf(stderr, "                        on a store or branch, which write no register,\n");
+    fprintf(stderr, "                        moves back to the nearest earlier writer, so\n");
+    fprintf(stderr, "                        distances run longer than asked for by the ST\n");
+    fprintf(stderr, "                        and CBR share of the mix\n");
+    fprintf(stderr, "    -src2 <p>           Probability of a 2nd source register (default: 0.3)\n");
+    fprintf(stderr, "    -taken <p>          Fraction of branches that lean towards taken\n");
+    fprintf(stderr, "                        (default: 0.6)\n");
+    fprintf(stderr, "    -predict <p>        Probability that a branch goes the way it leans\n");
+    fprintf(stderr, "                        (default: 0.9)\n");
+    fprintf(stderr, "    -static <num>       Number of static instructions (default: 4096)\n");
+    fprintf(stderr, "    -footprint <bytes>  Size of the data touched by loads and stores\n");
+    fprintf(stderr, "                        (default: 1048576)\n");
+    fprintf(stderr, "    -stride <bytes>     Distance between sequential accesses (default: 8)\n");
+    fprintf(stderr, "    -seq <p>            Probability that an access is sequential rather\n");
+    fprintf(stderr, "                        than random (default: 0.8)\n");
+    fprintf(stderr, "    -seed <num>         Seed of the random number generator (default: 1)\n");
+    fprintf(stderr, "    -compact, -dict, -frames\n");
+    fprintf(stderr, "                        Encode the records as tools/tracepack does\n");
+}
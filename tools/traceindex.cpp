@@ -0,0 +1,84 @@
+// traceindex.cpp
+// Builds a random-access index (see gzindex.h) beside each gzip-compressed
+// trace given, so the simulators' -skip option can start deep inside the
+// trace without inflating everything before it.
+
+#include "gzindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    uint64_t span = GZ_INDEX_DEFAULT_SPAN;
+    int num_traces = 0;
+    int status = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-span") == 0)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to -span\n");
+                return 2;
+            }
+
+            int span_mb = atoi(argv[i]);
+            if (span_mb < 1)
+            {
+                fprintf(stderr, "Error: span must be a positive number of MB\n");
+                return 2;
+            }
+            span = (uint64_t)span_mb * 1024 * 1024;
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+        else
+        {
+            size_t len = strlen(argv[i]) + sizeof(GZ_INDEX_SUFFIX);
+            char *index_filename = (char *)malloc(len);
+            snprintf(index_filename, len, "%s%s", argv[i], GZ_INDEX_SUFFIX);
+
+            int num_points = gzi_build(argv[i], index_filename, span);
+            if (num_points < 0)
+            {
+                status = 1;
+            }
+            else
+            {
+                printf("%s: %d checkpoints\n", index_filename, num_points);
+            }
+
+            free(index_filename);
+            num_traces++;
+        }
+    }
+
+    if (num_traces == 0)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    return status;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace.gz>...\n\n", program_name);
+    fprintf(stderr, "Write an index beside each gzip-compressed trace (as <trace.gz>%s)\n", GZ_INDEX_SUFFIX);
+    fprintf(stderr, "so the simulators can start partway into it quickly with -skip.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -span <MB>          Decompressed distance between checkpoints\n");
+    fprintf(stderr, "                        (default: %d)\n", GZ_INDEX_DEFAULT_SPAN / (1024 * 1024));
+}
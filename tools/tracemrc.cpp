@@ -0,0 +1,580 @@
+// tracemrc.cpp
+// Estimates the miss ratio curves of fully associative LRU data caches from
+// the memory accesses of a .ptr trace: the fraction of reads and of writes
+// that would miss a cache of each size, found in one pass.
+//
+// Accesses are sampled by block with SHARDS (Waldspurger et al., "Efficient
+// MRC Construction with SHARDS"): a block is sampled if a hash of its address
+// falls below a threshold, so every access to it is, and the stack distances
+// among sampled blocks, divided by the sampling rate, estimate those among
+// all blocks. To bound memory whatever the footprint, at most -samples blocks
+// are kept; when there would be more, the threshold is lowered to drop the
+// blocks with the highest hashes. Each sampled access counts as one over the
+// rate at the time, and the difference between the accesses seen and those
+// the samples stand for is added to distance 0 (SHARDS_adj).
+//
+// Reads and writes share one LRU stack, as they share a cache, but have
+// separate curves. A record that both reads and writes its address counts as
+// a read followed by a write.
+
+#include "stackdist.h"
+#include "tracereader.h"
+#include <algorithm>
+#include <errno.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** The hashes of blocks are taken modulo this; a power of two. */
+#define MRC_HASH_MOD (1u << 24)
+
+/** The number of buckets of distances, by their log2. */
+#define MRC_HIST_BUCKETS 66
+
+/** The smallest cache size in bytes given a miss ratio. */
+#define MRC_MIN_CACHE 1024
+
+/** The largest cache size in bytes given a miss ratio. */
+#define MRC_MAX_CACHE (1ull << 40)
+
+/** The kinds of access, with curves of their own. */
+enum
+{
+    MRC_READ,
+    MRC_WRITE,
+    MRC_NUM_KINDS
+};
+
+/** The settings of the analysis. */
+typedef struct MrcParamsStruct
+{
+    /** The path of the trace file. */
+    const char *trace_filename;
+    /** The number of records to skip at the start of the trace. */
+    uint64_t skip;
+    /** The largest number of records to analyze, or 0 for all of them. */
+    uint64_t window;
+    /** The log2 of the size in bytes of a cache line. */
+    int line_bits;
+    /** The fraction of blocks sampled to start with. */
+    double rate;
+    /** The most blocks kept at once, or 0 for no limit. */
+    uint64_t max_samples;
+    /** The number of instructions to list by their misses, or 0 for none. */
+    size_t num_hot_pcs;
+    /** The size in bytes of the cache whose misses they are listed by. */
+    uint64_t hot_cache_size;
+} MrcParams;
+
+/** The estimated accesses and misses of one static instruction. */
+typedef struct MrcPcStruct
+{
+    /** The estimated number of accesses. */
+    double accesses;
+    /** The estimated number of those missing the cache. */
+    double misses;
+} MrcPc;
+
+/** The state of a sampled miss ratio curve analysis. */
+typedef struct ShardsStruct
+{
+    /** The stack distances among the sampled blocks. */
+    StackDist stack;
+    /** A block is sampled if its hash is below this. */
+    uint64_t threshold;
+    /** The most blocks kept at once, or 0 for no limit. */
+    uint64_t max_samples;
+    /** The blocks kept, by hash, highest first. */
+    std::priority_queue<std::pair<uint64_t, uint64_t>> samples;
+    /** The number of accesses of each kind, sampled or not. */
+    uint64_t num_accesses[MRC_NUM_KINDS];
+    /**
+     * The estimated accesses of each kind by the log2 of their distance:
+     * bucket 0 holds distance 0, and bucket k > 0 distances from 2^(k-1) to
+     * 2^k - 1 blocks.
+     */
+    double hist[MRC_NUM_KINDS][MRC_HIST_BUCKETS];
+    /** The estimated first accesses to a block of each kind. */
+    double cold[MRC_NUM_KINDS];
+    /** If not 0, the size in blocks of the cache to count misses per PC in. */
+    uint64_t hot_cache_blocks;
+    /** The estimated accesses and misses of each PC, if hot_cache_blocks. */
+    std::unordered_map<uint64_t, MrcPc> pcs;
+} Shards;
+
+int parse_args(int argc, char *argv[], MrcParams *params);
+int parse_num(const char *option, const char *arg, uint64_t *num);
+void print_usage(char *program_name);
+
+/**
+ * Hash a block number for sampling.
+ *
+ * @param block the block number
+ * @return the hash, from 0 to MRC_HASH_MOD - 1
+ */
+static inline uint64_t shards_hash(uint64_t block)
+{
+    block ^= block >> 33;
+    block *= 0xff51afd7ed558ccdull;
+    block ^= block >> 33;
+    block *= 0xc4ceb9fe1a85ec53ull;
+    block ^= block >> 33;
+    return block & (MRC_HASH_MOD - 1);
+}
+
+/**
+ * Start an analysis.
+ *
+ * @param s the analysis
+ * @param params the settings of the analysis
+ */
+void shards_init(Shards *s, const MrcParams *params)
+{
+    stack_dist_init(&s->stack, params->line_bits);
+    s->threshold = (uint64_t)(params->rate * MRC_HASH_MOD + 0.5);
+    if (s->threshold == 0)
+    {
+        s->threshold = 1;
+    }
+    s->max_samples = params->max_samples;
+    memset(s->num_accesses, 0, sizeof(s->num_accesses));
+    memset(s->hist, 0, sizeof(s->hist));
+    memset(s->cold, 0, sizeof(s->cold));
+    s->hot_cache_blocks = params->num_hot_pcs != 0
+                              ? params->hot_cache_size >> params->line_bits
+                              : 0;
+}
+
+/**
+ * Lower the sampling threshold to that of the kept block with the highest
+ * hash, dropping every block with that hash.
+ *
+ * @param s the analysis
+ */
+void shards_shrink(Shards *s)
+{
+    uint64_t highest = s->samples.top().first;
+    s->threshold = highest;
+    while (!s->samples.empty() && s->samples.top().first == highest)
+    {
+        stack_dist_remove(&s->stack, s->samples.top().second);
+        s->samples.pop();
+    }
+}
+
+/**
+ * Analyze an access to memory.
+ *
+ * @param s the analysis
+ * @param pc the address of the instruction making the access
+ * @param addr the address accessed
+ * @param kind MRC_READ or MRC_WRITE
+ */
+void shards_access(Shards *s, uint64_t pc, uint64_t addr, int kind)
+{
+    s->num_accesses[kind]++;
+    uint64_t block = addr >> s->stack.block_bits;
+    uint64_t hash = shards_hash(block);
+    if (hash >= s->threshold)
+    {
+        return;
+    }
+
+    // Each sample stands for one over the sampling rate accesses, and its
+    // distance for that many times more blocks.
+    double weight = (double)MRC_HASH_MOD / (double)s->threshold;
+    uint64_t distance = stack_dist_add(&s->stack, addr);
+    bool miss = true;
+    if (distance == STACK_DIST_COLD)
+    {
+        s->cold[kind] += weight;
+        s->samples.push(std::make_pair(hash, block));
+        if (s->max_samples != 0 && s->samples.size() > s->max_samples)
+        {
+            shards_shrink(s);
+        }
+    }
+    else
+    {
+        uint64_t scaled = (uint64_t)((double)distance * weight);
+        int bucket = scaled != 0 ? 64 - __builtin_clzll(scaled) : 0;
+        s->hist[kind][bucket] += weight;
+        miss = scaled >= s->hot_cache_blocks;
+    }
+
+    if (s->hot_cache_blocks != 0)
+    {
+        MrcPc *p = &s->pcs[pc];
+        p->accesses += weight;
+        p->misses += miss ? weight : 0;
+    }
+}
+
+/**
+ * Finish an analysis, correcting for the difference between the number of
+ * accesses of each kind and the number the samples stand for.
+ *
+ * @param s the analysis
+ */
+void shards_finish(Shards *s)
+{
+    for (int kind = 0; kind < MRC_NUM_KINDS; kind++)
+    {
+        double sampled = s->cold[kind];
+        for (int b = 0; b < MRC_HIST_BUCKETS; b++)
+        {
+            sampled += s->hist[kind][b];
+        }
+        s->hist[kind][0] += (double)s->num_accesses[kind] - sampled;
+    }
+}
+
+/**
+ * Estimate the number of accesses of a kind that would miss a fully
+ * associative LRU cache.
+ *
+ * @param s the analysis
+ * @param kind MRC_READ or MRC_WRITE
+ * @param log2_blocks the log2 of the number of blocks the cache holds
+ * @return the estimated number of misses
+ */
+double shards_misses(const Shards *s, int kind, int log2_blocks)
+{
+    double misses = s->cold[kind];
+    for (int b = log2_blocks + 1; b < MRC_HIST_BUCKETS; b++)
+    {
+        misses += s->hist[kind][b];
+    }
+    return misses;
+}
+
+/**
+ * Print a miss ratio as a percentage of accesses, capped at 100.
+ *
+ * @param misses the number of misses
+ * @param accesses the number of accesses
+ */
+void print_ratio(double misses, uint64_t accesses)
+{
+    double ratio = accesses != 0 ? 100.0 * misses / (double)accesses : 0.0;
+    printf("  %8.3f", std::min(std::max(ratio, 0.0), 100.0));
+}
+
+/**
+ * Print the miss ratio curves, from MRC_MIN_CACHE bytes up to twice the
+ * estimated footprint.
+ *
+ * @param s the finished analysis
+ * @param params the settings of the analysis
+ */
+void print_curves(const Shards *s, const MrcParams *params)
+{
+    double footprint = s->cold[MRC_READ] + s->cold[MRC_WRITE];
+    uint64_t line_size = 1ull << params->line_bits;
+    printf("Lines:     %12.0f (estimated footprint)\n", footprint);
+    printf("Sampled:   %12lu lines, at a rate of %.6f\n\n",
+           (unsigned long)s->samples.size(),
+           (double)s->threshold / MRC_HASH_MOD);
+
+    printf("%% of accesses missing a fully associative LRU cache of %lu-byte "
+           "lines:\n",
+           (unsigned long)line_size);
+    printf("%8s  %8s  %8s  %8s\n", "SIZE", "ALL", "READS", "WRITES");
+    uint64_t total = s->num_accesses[MRC_READ] + s->num_accesses[MRC_WRITE];
+    for (uint64_t size = std::max((uint64_t)MRC_MIN_CACHE, line_size);
+         size <= MRC_MAX_CACHE; size *= 2)
+    {
+        int log2_blocks = __builtin_ctzll(size) - params->line_bits;
+        double reads = shards_misses(s, MRC_READ, log2_blocks);
+        double writes = shards_misses(s, MRC_WRITE, log2_blocks);
+        if (size < 1024 * 1024)
+        {
+            printf("%6luKB", (unsigned long)(size >> 10));
+        }
+        else if (size < 1024 * 1024 * 1024)
+        {
+            printf("%6luMB", (unsigned long)(size >> 20));
+        }
+        else
+        {
+            printf("%6luGB", (unsigned long)(size >> 30));
+        }
+        print_ratio(reads + writes, total);
+        print_ratio(reads, s->num_accesses[MRC_READ]);
+        print_ratio(writes, s->num_accesses[MRC_WRITE]);
+        printf("\n");
+        if ((double)(size >> params->line_bits) >= 2 * footprint)
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Print the instructions with the most estimated misses in the cache of
+ * params->hot_cache_size bytes.
+ *
+ * @param s the finished analysis
+ * @param params the settings of the analysis
+ */
+void print_hot_pcs(const Shards *s, const MrcParams *params)
+{
+    std::vector<std::pair<double, uint64_t>> order;
+    double total = 0;
+    for (const std::pair<const uint64_t, MrcPc> &entry : s->pcs)
+    {
+        order.push_back(std::make_pair(-entry.second.misses, entry.first));
+        total += entry.second.misses;
+    }
+    size_t k = std::min(params->num_hot_pcs, order.size());
+    std::partial_sort(order.begin(), order.begin() + k, order.end());
+
+    printf("\nInstructions with the most misses in a %luKB cache:\n",
+           (unsigned long)(params->hot_cache_size >> 10));
+    printf("%4s  %-18s  %12s  %8s  %12s  %8s\n", "RANK", "PC", "MISSES",
+           "%MISSES", "ACCESSES", "%MISS");
+    for (size_t i = 0; i < k; i++)
+    {
+        const MrcPc &p = s->pcs.at(order[i].second);
+        printf("%4lu  0x%016lx  %12.0f  %8.3f  %12.0f  %8.3f\n",
+               (unsigned long)(i + 1), (unsigned long)order[i].second,
+               p.misses, total > 0 ? 100.0 * p.misses / total : 0.0,
+               p.accesses,
+               p.accesses > 0 ? 100.0 * p.misses / p.accesses : 0.0);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    MrcParams params;
+    int status = parse_args(argc, argv, &params);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    TraceReader *trace = trace_open_range(params.trace_filename,
+                                          sizeof(PtrRec), TRACE_OPEN_ASYNC,
+                                          params.skip, params.window);
+    if (trace == NULL)
+    {
+        return 1;
+    }
+
+    printf("Analyzing %s\n", params.trace_filename);
+    Shards *s = new Shards();
+    shards_init(s, &params);
+    uint64_t num_recs = 0;
+    TraceSpan<PtrRec> block;
+    while ((block = trace_next_span<PtrRec>(trace)).size() > 0)
+    {
+        for (const PtrRec &rec : block)
+        {
+            if (rec.mem_read)
+            {
+                shards_access(s, rec.inst_addr, rec.mem_addr, MRC_READ);
+            }
+            if (rec.mem_write)
+            {
+                shards_access(s, rec.inst_addr, rec.mem_addr, MRC_WRITE);
+            }
+        }
+        num_recs += block.count;
+    }
+    bool failed = trace->error;
+    trace_close(trace);
+    if (failed)
+    {
+        delete s;
+        return 1;
+    }
+
+    shards_finish(s);
+    printf("Records:   %12lu\n", (unsigned long)num_recs);
+    printf("Reads:     %12lu\n", (unsigned long)s->num_accesses[MRC_READ]);
+    printf("Writes:    %12lu\n", (unsigned long)s->num_accesses[MRC_WRITE]);
+    print_curves(s, &params);
+    if (params.num_hot_pcs != 0)
+    {
+        print_hot_pcs(s, &params);
+    }
+    delete s;
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], MrcParams *params)
+{
+    memset(params, 0, sizeof(*params));
+    params->line_bits = 6;
+    params->rate = 0.1;
+    params->max_samples = 8192;
+    params->hot_cache_size = 32 * 1024;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (params->trace_filename != NULL)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            params->trace_filename = argv[i];
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+
+        // The rest take an argument.
+        const char *option = argv[i];
+        if (++i >= argc)
+        {
+            fprintf(stderr, "Error: missing argument to %s\n", option);
+            return 2;
+        }
+        const char *arg = argv[i];
+        uint64_t num = 0;
+        int bad = 0;
+        if (strcmp(option, "-skip") == 0)
+        {
+            bad = parse_num(option, arg, &params->skip);
+        }
+        else if (strcmp(option, "-window") == 0)
+        {
+            bad = parse_num(option, arg, &params->window);
+        }
+        else if (strcmp(option, "-line") == 0)
+        {
+            bad = parse_num(option, arg, &num);
+            if (!bad && (num < 4 || num > 4096 || (num & (num - 1)) != 0))
+            {
+                fprintf(stderr, "Error: -line must be a power of two from 4 "
+                                "to 4096\n");
+                return 2;
+            }
+            params->line_bits = __builtin_ctzll(num);
+        }
+        else if (strcmp(option, "-rate") == 0)
+        {
+            char *end;
+            params->rate = strtod(arg, &end);
+            if (end == arg || *end != '\0' ||
+                !(params->rate > 0 && params->rate <= 1))
+            {
+                fprintf(stderr, "Error: -rate must be above 0 and at most "
+                                "1\n");
+                return 2;
+            }
+        }
+        else if (strcmp(option, "-samples") == 0)
+        {
+            bad = parse_num(option, arg, &params->max_samples);
+        }
+        else if (strcmp(option, "-hotpcs") == 0)
+        {
+            bad = parse_num(option, arg, &num);
+            params->num_hot_pcs = (size_t)num;
+        }
+        else if (strcmp(option, "-cache") == 0)
+        {
+            bad = parse_num(option, arg, &num);
+            if (!bad && (num == 0 || num > (MRC_MAX_CACHE >> 10)))
+            {
+                fprintf(stderr, "Error: -cache must be a size in KB from 1 "
+                                "to %lu\n",
+                        (unsigned long)(MRC_MAX_CACHE >> 10));
+                return 2;
+            }
+            params->hot_cache_size = num << 10;
+        }
+        else
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", option);
+            return 2;
+        }
+        if (bad)
+        {
+            return 2;
+        }
+    }
+
+    if (params->trace_filename == NULL)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (strstr(params->trace_filename, ".otr") != NULL)
+    {
+        fprintf(stderr, "Error: %s is a Lab 1 trace, which has no memory "
+                        "addresses; use a .ptr trace\n",
+                params->trace_filename);
+        return 2;
+    }
+    if ((params->hot_cache_size >> params->line_bits) == 0)
+    {
+        fprintf(stderr, "Error: -cache must hold at least one line\n");
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * Parse a non-negative number given to an option, optionally followed by K,
+ * M, G or T for a power of 1000.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param num set to the number
+ * @return 0 on success, or 2 if arg is not a valid number
+ */
+int parse_num(const char *option, const char *arg, uint64_t *num)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    const char *suffixes = "KMGT";
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL && end[1] == '\0')
+    {
+        for (const char *s = suffixes; s <= suffix; s++)
+        {
+            errno = value > ~0ull / 1000 ? ERANGE : errno;
+            value *= 1000;
+        }
+        end++;
+    }
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number\n", option);
+        return 2;
+    }
+
+    *num = value;
+    return 0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <trace file>\n\n", program_name);
+    fprintf(stderr, "Estimate the miss ratios of LRU data caches of every size from the memory\n");
+    fprintf(stderr, "accesses of a .ptr trace, in one pass over a sample of its lines.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -skip <num>         Start <num> records into the trace\n");
+    fprintf(stderr, "    -window <num>       Analyze at most <num> records\n");
+    fprintf(stderr, "    -line <bytes>       Size of a cache line (default: 64)\n");
+    fprintf(stderr, "    -rate <p>           Fraction of lines sampled to start with (default: 0.1)\n");
+    fprintf(stderr, "    -samples <num>      Most lines kept at once, lowering the rate as needed,\n");
+    fprintf(stderr, "                        or 0 for no limit (default: 8192); -rate 1\n");
+    fprintf(stderr, "                        -samples 0 gives exact curves\n");
+    fprintf(stderr, "    -hotpcs <num>       Also list the <num> instructions with the most misses\n");
+    fprintf(stderr, "    -cache <KB>         Size of the cache they are counted in (default: 32)\n\n");
+    fprintf(stderr, "Numbers may end in K, M, G or T for powers of 1000.\n");
+}
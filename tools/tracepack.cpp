@@ -0,0 +1,245 @@
+// tracepack.cpp
+// Converts a gzip-compressed trace (.otr.gz for Lab 1, .ptr.gz for Labs 2 and
+// 3) into a packed trace file that the simulators map directly into memory
+// instead of decompressing on every run. With -compact, .ptr records are
+// stored bit-packed (see tracecompact.h), trading a cheap decode for a file
+// several times smaller. With -dict, they are stored as a table of static
+// instructions plus a stream of what changes per execution (see tracedict.h),
+// which is smaller still. With -frames, records of either layout are stored
+// in independently compressed frames (see traceframe.h), which the
+// simulators inflate on several threads at once.
+
+#include "tracereader.h"
+#include "tracewriter.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int parse_args(int argc, char *argv[], char **in_filename,
+               char **out_filename, TraceLayout *layout,
+               TraceEncoding *encoding);
+TraceLayout guess_layout(const char *filename);
+void print_usage(char *program_name);
+
+int main(int argc, char *argv[])
+{
+    char *in_filename;
+    char *out_filename;
+    TraceLayout layout;
+    TraceEncoding encoding;
+    int status = parse_args(argc, argv, &in_filename, &out_filename, &layout,
+                            &encoding);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    size_t rec_size = trace_layout_rec_size(layout);
+    TraceReader *trace = trace_open(in_filename, rec_size, TRACE_OPEN_ASYNC);
+    if (trace == NULL)
+    {
+        return 1;
+    }
+
+    TraceWriter *out = trace_writer_open(out_filename, layout, encoding);
+    if (out == NULL)
+    {
+        trace_close(trace);
+        return 1;
+    }
+
+    printf("Packing %s into %s\n", in_filename, out_filename);
+
+    TraceBlock block;
+    while ((block = trace_next_block(trace, (size_t)-1)).count > 0)
+    {
+        if (trace_writer_write(out, block.recs, block.count) != 0)
+        {
+            break;
+        }
+    }
+
+    if (trace->error || out->error)
+    {
+        trace_close(trace);
+        trace_writer_abort(out);
+        return 1;
+    }
+
+    trace_close(trace);
+    if (trace_writer_close(out) != 0)
+    {
+        return 1;
+    }
+
+    // Report from the finished file's own header, which also checks that it
+    // reads back.
+    TraceReader *packed = trace_open(out_filename, rec_size, 0);
+    if (packed == NULL)
+    {
+        return 1;
+    }
+    TracePackHeader header = *packed->header;
+    size_t file_size = packed->map_len;
+    trace_close(packed);
+
+    printf("Records:   %12lu\n", (unsigned long)header.num_recs);
+    if (encoding == TRACE_ENC_DICT)
+    {
+        printf("Static:    %12lu\n", (unsigned long)header.dict_entries);
+    }
+    if (encoding == TRACE_ENC_FRAMES)
+    {
+        printf("Frames:    %12lu\n", (unsigned long)header.num_frames);
+    }
+    if (header.num_recs > 0)
+    {
+        printf("Bytes/rec: %12.2f\n",
+               (double)(file_size - header.data_offset) / header.num_recs);
+    }
+    const char *names[TRACE_NUM_OP_TYPES] = {"ALU", "LD", "ST", "CBR", "OTHER"};
+    for (int i = 0; i < TRACE_NUM_OP_TYPES; i++)
+    {
+        printf("  %-6s   %12lu\n", names[i],
+               (unsigned long)header.op_type_counts[i]);
+    }
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], char **in_filename,
+               char **out_filename, TraceLayout *layout,
+               TraceEncoding *encoding)
+{
+    *in_filename = NULL;
+    *out_filename = NULL;
+    *layout = (TraceLayout)0;
+    *encoding = TRACE_ENC_RAW;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+        {
+            if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+            {
+                print_usage(argv[0]);
+                return 2;
+            }
+            else if (strcmp(argv[i], "-layout") == 0)
+            {
+                if (++i >= argc)
+                {
+                    fprintf(stderr, "Error: missing argument to -layout\n");
+                    return 2;
+                }
+
+                if (strcmp(argv[i], "otr") == 0)
+                {
+                    *layout = TRACE_LAYOUT_OTR;
+                }
+                else if (strcmp(argv[i], "ptr") == 0)
+                {
+                    *layout = TRACE_LAYOUT_PTR;
+                }
+                else
+                {
+                    fprintf(stderr, "Error: layout must be otr or ptr\n");
+                    return 2;
+                }
+            }
+            else if (strcmp(argv[i], "-compact") == 0)
+            {
+                *encoding = TRACE_ENC_COMPACT;
+            }
+            else if (strcmp(argv[i], "-dict") == 0)
+            {
+                *encoding = TRACE_ENC_DICT;
+            }
+            else if (strcmp(argv[i], "-frames") == 0)
+            {
+                *encoding = TRACE_ENC_FRAMES;
+            }
+            else
+            {
+                fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+                return 2;
+            }
+        }
+        else if (*in_filename == NULL)
+        {
+            *in_filename = argv[i];
+        }
+        else if (*out_filename == NULL)
+        {
+            *out_filename = argv[i];
+        }
+        else
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (*in_filename == NULL || *out_filename == NULL)
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    if (*layout == 0)
+    {
+        *layout = guess_layout(*in_filename);
+        if (*layout == 0)
+        {
+            fprintf(stderr, "Error: can't tell the record layout of %s; "
+                            "use -layout\n",
+                    *in_filename);
+            return 2;
+        }
+    }
+
+    if ((*encoding == TRACE_ENC_COMPACT || *encoding == TRACE_ENC_DICT) &&
+        *layout != TRACE_LAYOUT_PTR)
+    {
+        fprintf(stderr, "Error: -compact and -dict are only supported for "
+                        ".ptr traces\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * Guess the record layout of a trace from its file name.
+ *
+ * @param filename the name of the trace file
+ * @return the layout, or 0 if the name doesn't say
+ */
+TraceLayout guess_layout(const char *filename)
+{
+    if (strstr(filename, ".otr") != NULL)
+    {
+        return TRACE_LAYOUT_OTR;
+    }
+    if (strstr(filename, ".ptr") != NULL)
+    {
+        return TRACE_LAYOUT_PTR;
+    }
+    return (TraceLayout)0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <input trace> <output file>\n\n", program_name);
+    fprintf(stderr, "Convert a gzip-compressed trace into a packed trace that the\n");
+    fprintf(stderr, "simulators can map into memory without decompressing it.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -layout <otr|ptr>   Record layout of the input: otr for Lab 1 traces,\n");
+    fprintf(stderr, "                        ptr for Lab 2/3 traces (default: guessed from the\n");
+    fprintf(stderr, "                        input file name)\n");
+    fprintf(stderr, "    -compact            Store .ptr records bit-packed instead of as-is;\n");
+    fprintf(stderr, "                        smaller, but decoded while the trace is read\n");
+    fprintf(stderr, "    -dict               Store .ptr records as a table of static instructions\n");
+    fprintf(stderr, "                        plus a stream of per-execution fields; smallest\n");
+    fprintf(stderr, "    -frames             Store records in independently compressed frames,\n");
+    fprintf(stderr, "                        inflated on several threads while the trace is read\n");
+}
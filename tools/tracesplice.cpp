@@ -0,0 +1,513 @@
+// tracesplice.cpp
+// Cuts and joins traces into a new packed trace file: extracts a range of
+// records from a trace, concatenates several traces (or ranges of them) one
+// after another, or interleaves them a fixed number of records at a time, as
+// if a core were switching between programs.
+//
+// The inputs are streamed through trace readers and the output through a
+// trace writer, so memory use doesn't depend on the length of the traces,
+// and getting to the start of a range is as quick as -skip is in the
+// simulators.
+
+#include "tracereader.h"
+#include "tracewriter.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/** The number of architectural registers in .ptr records. */
+#define SPLICE_NUM_REGS 32
+
+/** The value of an unused register field in .ptr records. */
+#define SPLICE_NO_REG 255
+
+/** One input trace, or a range of it. */
+typedef struct SpliceInputStruct
+{
+    /** The path of the trace file. */
+    const char *filename;
+    /** The number of records to skip at the start of the trace. */
+    uint64_t skip;
+    /** The largest number of records to take, or 0 for all of them. */
+    uint64_t window;
+    /** The reader of the trace, while it is open. */
+    TraceReader *trace;
+    /** The number of records taken from the trace so far. */
+    uint64_t num_recs;
+} SpliceInput;
+
+/** The settings of the output. */
+typedef struct SpliceParamsStruct
+{
+    /** The path of the output file. */
+    const char *out_filename;
+    /** The record layout of every trace. */
+    TraceLayout layout;
+    /** How to store the output records. */
+    TraceEncoding encoding;
+    /**
+     * The number of records to take from each input in turn, or 0 to
+     * concatenate the inputs instead.
+     */
+    uint64_t interleave;
+    /** Whether to give each input its own registers. */
+    bool renumber;
+} SpliceParams;
+
+int parse_args(int argc, char *argv[], SpliceParams *params,
+               std::vector<SpliceInput> *inputs);
+int parse_count(const char *option, const char *arg, uint64_t *count);
+TraceLayout guess_layout(const char *filename);
+void print_usage(char *program_name);
+
+/**
+ * Open an input trace at the start of its range.
+ *
+ * @param in the input
+ * @param rec_size the size in bytes of one record
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int open_input(SpliceInput *in, size_t rec_size)
+{
+    in->trace = trace_open_range(in->filename, rec_size, TRACE_OPEN_ASYNC,
+                                 in->skip, in->window);
+    return in->trace != NULL ? 0 : -1;
+}
+
+/**
+ * Move the registers of .ptr records into the share of the register file
+ * given to their input, so that inputs never appear to depend on each other.
+ *
+ * Each of n inputs gets SPLICE_NUM_REGS / n registers, and register r of
+ * input k becomes register k * (SPLICE_NUM_REGS / n) + r mod that; registers
+ * of the same input may end up merged.
+ *
+ * @param recs the records to change
+ * @param count the number of records
+ * @param index the index of their input
+ * @param num_inputs the number of inputs
+ */
+void renumber_regs(PtrRec *recs, size_t count, size_t index,
+                   size_t num_inputs)
+{
+    uint8_t share = (uint8_t)(SPLICE_NUM_REGS / num_inputs);
+    uint8_t base = (uint8_t)(index * share);
+    for (size_t i = 0; i < count; i++)
+    {
+        PtrRec *r = &recs[i];
+        uint8_t *regs[3] = {&r->dest_reg, &r->src1_reg, &r->src2_reg};
+        uint8_t needed[3] = {r->dest_needed, r->src1_needed, r->src2_needed};
+        for (int j = 0; j < 3; j++)
+        {
+            if (needed[j] && *regs[j] != SPLICE_NO_REG)
+            {
+                *regs[j] = base + *regs[j] % share;
+            }
+        }
+    }
+}
+
+/**
+ * Copy up to max_recs records from an input to the output.
+ *
+ * @param params the settings of the output
+ * @param inputs all the inputs
+ * @param index the index of the input to copy from
+ * @param max_recs the largest number of records to copy
+ * @param out the writer of the output file
+ * @param scratch a TRACE_BUF_SIZE buffer to renumber records in
+ * @return the number of records copied, which is less than max_recs only at
+ *         the end of the input, or -1 on error (already reported)
+ */
+int64_t copy_recs(const SpliceParams *params,
+                  std::vector<SpliceInput> *inputs, size_t index,
+                  uint64_t max_recs, TraceWriter *out, uint8_t *scratch)
+{
+    SpliceInput *in = &(*inputs)[index];
+    size_t rec_size = in->trace->rec_size;
+    uint64_t copied = 0;
+    while (copied < max_recs)
+    {
+        uint64_t want = max_recs - copied;
+        size_t limit = params->renumber ? TRACE_BUF_SIZE / rec_size
+                                        : (size_t)-1;
+        TraceBlock block = trace_next_block(in->trace,
+                                            want < limit ? (size_t)want : limit);
+        if (block.count == 0)
+        {
+            break;
+        }
+
+        const void *recs = block.recs;
+        if (params->renumber)
+        {
+            memcpy(scratch, block.recs, block.count * rec_size);
+            renumber_regs((PtrRec *)scratch, block.count, index,
+                          inputs->size());
+            recs = scratch;
+        }
+        if (trace_writer_write(out, recs, block.count) != 0)
+        {
+            return -1;
+        }
+        copied += block.count;
+    }
+
+    in->num_recs += copied;
+    return in->trace->error ? -1 : (int64_t)copied;
+}
+
+/**
+ * Write the inputs one after another.
+ *
+ * Only one input is open at a time.
+ *
+ * @param params the settings of the output
+ * @param inputs the inputs
+ * @param out the writer of the output file
+ * @param scratch a TRACE_BUF_SIZE buffer to renumber records in
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int concatenate(const SpliceParams *params, std::vector<SpliceInput> *inputs,
+                TraceWriter *out, uint8_t *scratch)
+{
+    size_t rec_size = trace_layout_rec_size(params->layout);
+    for (size_t i = 0; i < inputs->size(); i++)
+    {
+        SpliceInput *in = &(*inputs)[i];
+        if (open_input(in, rec_size) != 0)
+        {
+            return -1;
+        }
+        int64_t copied = copy_recs(params, inputs, i, (uint64_t)-1, out,
+                                   scratch);
+        trace_close(in->trace);
+        in->trace = NULL;
+        if (copied < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write params->interleave records from each input in turn, dropping each
+ * input from the rotation when it runs out, until all have.
+ *
+ * @param params the settings of the output
+ * @param inputs the inputs
+ * @param out the writer of the output file
+ * @param scratch a TRACE_BUF_SIZE buffer to renumber records in
+ * @return 0 on success, or -1 on error (already reported)
+ */
+int interleave(const SpliceParams *params, std::vector<SpliceInput> *inputs,
+               TraceWriter *out, uint8_t *scratch)
+{
+    size_t rec_size = trace_layout_rec_size(params->layout);
+    int status = 0;
+    for (size_t i = 0; i < inputs->size() && status == 0; i++)
+    {
+        status = open_input(&(*inputs)[i], rec_size);
+    }
+
+    size_t num_open = inputs->size();
+    while (status == 0 && num_open > 0)
+    {
+        for (size_t i = 0; i < inputs->size() && status == 0; i++)
+        {
+            SpliceInput *in = &(*inputs)[i];
+            if (in->trace == NULL)
+            {
+                continue;
+            }
+
+            int64_t copied = copy_recs(params, inputs, i, params->interleave,
+                                       out, scratch);
+            if (copied < 0)
+            {
+                status = -1;
+            }
+            else if ((uint64_t)copied < params->interleave)
+            {
+                trace_close(in->trace);
+                in->trace = NULL;
+                num_open--;
+            }
+        }
+    }
+
+    for (SpliceInput &in : *inputs)
+    {
+        trace_close(in.trace);
+        in.trace = NULL;
+    }
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    SpliceParams params;
+    std::vector<SpliceInput> inputs;
+    int status = parse_args(argc, argv, &params, &inputs);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    TraceWriter *out = trace_writer_open(params.out_filename, params.layout,
+                                         params.encoding);
+    if (out == NULL)
+    {
+        return 1;
+    }
+
+    printf("Writing %s\n", params.out_filename);
+    uint8_t *scratch = (uint8_t *)malloc(TRACE_BUF_SIZE);
+    status = params.interleave > 0
+                 ? interleave(&params, &inputs, out, scratch)
+                 : concatenate(&params, &inputs, out, scratch);
+    free(scratch);
+    if (status != 0 || out->error)
+    {
+        trace_writer_abort(out);
+        return 1;
+    }
+    if (trace_writer_close(out) != 0)
+    {
+        return 1;
+    }
+
+    uint64_t total = 0;
+    for (const SpliceInput &in : inputs)
+    {
+        printf("  %12lu  %s\n", (unsigned long)in.num_recs, in.filename);
+        total += in.num_recs;
+    }
+    printf("Records:   %12lu\n", (unsigned long)total);
+    return 0;
+}
+
+int parse_args(int argc, char *argv[], SpliceParams *params,
+               std::vector<SpliceInput> *inputs)
+{
+    memset(params, 0, sizeof(*params));
+    params->encoding = TRACE_ENC_RAW;
+
+    // -skip and -window apply to the next input named.
+    SpliceInput next;
+    memset(&next, 0, sizeof(next));
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            if (params->out_filename == NULL)
+            {
+                params->out_filename = argv[i];
+                continue;
+            }
+            next.filename = argv[i];
+            inputs->push_back(next);
+            memset(&next, 0, sizeof(next));
+            continue;
+        }
+
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0)
+        {
+            print_usage(argv[0]);
+            return 2;
+        }
+        else if (strcmp(argv[i], "-renumber") == 0)
+        {
+            params->renumber = true;
+        }
+        else if (strcmp(argv[i], "-compact") == 0)
+        {
+            params->encoding = TRACE_ENC_COMPACT;
+        }
+        else if (strcmp(argv[i], "-dict") == 0)
+        {
+            params->encoding = TRACE_ENC_DICT;
+        }
+        else if (strcmp(argv[i], "-frames") == 0)
+        {
+            params->encoding = TRACE_ENC_FRAMES;
+        }
+        else if (strcmp(argv[i], "-layout") == 0)
+        {
+            if (++i >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to -layout\n");
+                return 2;
+            }
+
+            if (strcmp(argv[i], "otr") == 0)
+            {
+                params->layout = TRACE_LAYOUT_OTR;
+            }
+            else if (strcmp(argv[i], "ptr") == 0)
+            {
+                params->layout = TRACE_LAYOUT_PTR;
+            }
+            else
+            {
+                fprintf(stderr, "Error: layout must be otr or ptr\n");
+                return 2;
+            }
+        }
+        else if (strcmp(argv[i], "-skip") == 0 ||
+                 strcmp(argv[i], "-window") == 0 ||
+                 strcmp(argv[i], "-interleave") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                fprintf(stderr, "Error: missing argument to %s\n", argv[i]);
+                return 2;
+            }
+
+            uint64_t *count = argv[i][1] == 's'   ? &next.skip
+                              : argv[i][1] == 'w' ? &next.window
+                                                  : &params->interleave;
+            if (parse_count(argv[i], argv[i + 1], count) != 0)
+            {
+                return 2;
+            }
+            i++;
+        }
+        else
+        {
+            fprintf(stderr, "Error: unrecognized option: %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (params->out_filename == NULL || inputs->empty())
+    {
+        print_usage(argv[0]);
+        return 2;
+    }
+    if (next.skip != 0 || next.window != 0)
+    {
+        fprintf(stderr, "Error: -skip and -window must come before the input "
+                        "they apply to\n");
+        return 2;
+    }
+
+    for (const SpliceInput &in : *inputs)
+    {
+        TraceLayout layout = guess_layout(in.filename);
+        if (params->layout == 0)
+        {
+            params->layout = layout;
+        }
+        else if (layout != 0 && layout != params->layout)
+        {
+            fprintf(stderr, "Error: %s doesn't hold the same kind of records "
+                            "as the other traces\n",
+                    in.filename);
+            return 2;
+        }
+    }
+    if (params->layout == 0)
+    {
+        fprintf(stderr, "Error: can't tell the record layout of the inputs; "
+                        "use -layout\n");
+        return 2;
+    }
+
+    if (params->renumber &&
+        (params->layout != TRACE_LAYOUT_PTR || inputs->size() > SPLICE_NUM_REGS))
+    {
+        fprintf(stderr, "Error: -renumber needs .ptr traces, and at most %d "
+                        "of them\n",
+                SPLICE_NUM_REGS);
+        return 2;
+    }
+    if ((params->encoding == TRACE_ENC_COMPACT ||
+         params->encoding == TRACE_ENC_DICT) &&
+        params->layout != TRACE_LAYOUT_PTR)
+    {
+        fprintf(stderr, "Error: -compact and -dict are only supported for "
+                        ".ptr traces\n");
+        return 2;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse a non-negative record count given to an option, optionally followed
+ * by K, M or G for a power of 1000.
+ *
+ * @param option the name of the option, for error messages
+ * @param arg the argument given to the option
+ * @param count set to the count
+ * @return 0 on success, or 2 if arg is not a valid count
+ */
+int parse_count(const char *option, const char *arg, uint64_t *count)
+{
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    const char *suffixes = "KMG";
+    const char *suffix = *end != '\0' ? strchr(suffixes, *end) : NULL;
+    if (suffix != NULL && end[1] == '\0')
+    {
+        for (const char *s = suffixes; s <= suffix; s++)
+        {
+            errno = value > ~0ull / 1000 ? ERANGE : errno;
+            value *= 1000;
+        }
+        end++;
+    }
+    if (arg[0] < '0' || arg[0] > '9' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, "Error: argument to %s must be a number of records\n",
+                option);
+        return 2;
+    }
+
+    *count = value;
+    return 0;
+}
+
+/**
+ * Guess the record layout of a trace from its file name.
+ *
+ * @param filename the name of the trace file
+ * @return the layout, or 0 if the name doesn't say
+ */
+TraceLayout guess_layout(const char *filename)
+{
+    if (strstr(filename, ".otr") != NULL)
+    {
+        return TRACE_LAYOUT_OTR;
+    }
+    if (strstr(filename, ".ptr") != NULL)
+    {
+        return TRACE_LAYOUT_PTR;
+    }
+    return (TraceLayout)0;
+}
+
+void print_usage(char *program_name)
+{
+    fprintf(stderr, "Usage: %s [options] <output file> [input options] <input trace>...\n\n", program_name);
+    fprintf(stderr, "Extract, concatenate or interleave traces into a packed trace.\n\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "    -interleave <num>   Take <num> records from each input in turn, instead\n");
+    fprintf(stderr, "                        of taking the inputs one after another\n");
+    fprintf(stderr, "    -renumber           Give each .ptr input its own share of the registers,\n");
+    fprintf(stderr, "                        so inputs never depend on each other\n");
+    fprintf(stderr, "    -layout <otr|ptr>   Record layout of the inputs (default: guessed from\n");
+    fprintf(stderr, "                        their file names)\n");
+    fprintf(stderr, "    -compact, -dict, -frames\n");
+    fprintf(stderr, "                        Encode the output as tools/tracepack does\n\n");
+    fprintf(stderr, "Input options, applying to the input that follows:\n");
+    fprintf(stderr, "    -skip <num>         Start <num> records into the trace\n");
+    fprintf(stderr, "    -window <num>       Take at most <num> records\n\n");
+    fprintf(stderr, "Counts may end in K, M or G for thousands, millions or billions.\n");
+}